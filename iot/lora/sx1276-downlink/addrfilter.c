@@ -0,0 +1,404 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : DevAddr white and black lists
+        Lists compiled into a hash table with prefix bitmaps and a Bloom
+        filter, looked up without lock for every uplink
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* fopen, fgets */
+#include <stdlib.h>         /* malloc, calloc, strtoul */
+#include <string.h>         /* memset, strlen */
+#include <ctype.h>          /* isspace */
+
+#include "trace.h"
+#include "rcu.h"
+#include "protocol.h"
+#include "addrfilter.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* Every rule is in an open addressing table keyed by (address, length). An
+ * uplink matching no rule, the common case with large lists, is answered
+ * without touching that table: single addresses are first checked in a
+ * Bloom filter, prefixes in a bitmap of the 16 top bits of the address
+ * covered by at least one prefix rule. The compiled table is never modified
+ * once published, only the hit counters are, with atomic increments. A
+ * reload publishes a new table and frees the old one after a grace period. */
+
+#define BLOOM_BITS_PER_RULE     10      /* about 1% false positives with 3 hashes */
+#define BLOOM_HASH_NB           3
+#define PREFIX_MAP_BITS         16
+
+struct rule_s {
+    uint32_t addr;          /* masked to its prefix length */
+    uint8_t len;
+    uint8_t list;           /* enum addrfilter_list_e */
+    uint32_t hits;
+};
+
+struct table_s {
+    struct rule_s *rules;
+    uint32_t nb_rule;
+    uint32_t nb_white;
+    uint32_t nb_exact;      /* rules of length 32 */
+    uint32_t *slot;         /* rule index + 1, 0 for an empty slot */
+    uint32_t slot_mask;
+    uint64_t *bloom;
+    uint32_t bloom_mask;    /* number of bits - 1 */
+    uint32_t prefix_len;    /* bit n set if there are prefix rules of length n */
+    uint64_t prefix_map[(1 << PREFIX_MAP_BITS) / 64];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static struct table_s *table = NULL; /* published once compiled, read without lock under RCU */
+
+static uint32_t nb_pass;
+static uint32_t nb_drop;
+static uint32_t nb_unlisted;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint32_t prefix_mask(unsigned len) {
+    return (len == 0) ? 0 : (0xFFFFFFFFU << (32 - len));
+}
+
+static uint32_t mix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t rule_hash(uint32_t addr, unsigned len) {
+    return mix32(addr ^ (len * 0x9E3779B9U));
+}
+
+static bool bloom_maybe(const struct table_s *t, uint32_t addr) {
+    uint32_t h1 = mix32(addr);
+    uint32_t h2 = mix32(h1 ^ 0x5BD1E995U) | 1;
+    uint32_t bit;
+    int i;
+
+    for (i = 0; i < BLOOM_HASH_NB; i++) {
+        bit = (h1 + i * h2) & t->bloom_mask;
+        if ((t->bloom[bit / 64] & (1ULL << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bloom_add(struct table_s *t, uint32_t addr) {
+    uint32_t h1 = mix32(addr);
+    uint32_t h2 = mix32(h1 ^ 0x5BD1E995U) | 1;
+    uint32_t bit;
+    int i;
+
+    for (i = 0; i < BLOOM_HASH_NB; i++) {
+        bit = (h1 + i * h2) & t->bloom_mask;
+        t->bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static void prefix_map_add(struct table_s *t, uint32_t addr, unsigned len) {
+    uint32_t first = addr >> (32 - PREFIX_MAP_BITS);
+    uint32_t last = first;
+    uint32_t i;
+
+    if (len < PREFIX_MAP_BITS) {
+        last = first | ((1U << (PREFIX_MAP_BITS - len)) - 1);
+    }
+    for (i = first; i <= last; i++) {
+        t->prefix_map[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+/* slot holding the rule, or the empty slot where it goes */
+static uint32_t *find_slot(const struct table_s *t, uint32_t addr, unsigned len) {
+    uint32_t i = rule_hash(addr, len) & t->slot_mask;
+    const struct rule_s *r;
+
+    while (t->slot[i] != 0) {
+        r = &t->rules[t->slot[i] - 1];
+        if ((r->addr == addr) && (r->len == len)) {
+            break;
+        }
+        i = (i + 1) & t->slot_mask;
+    }
+    return &t->slot[i];
+}
+
+static struct rule_s *lookup(const struct table_s *t, uint32_t addr) {
+    uint32_t *slot;
+    uint32_t top;
+    int len;
+
+    if ((t->nb_exact > 0) && bloom_maybe(t, addr)) {
+        slot = find_slot(t, addr, 32);
+        if (*slot != 0) {
+            return &t->rules[*slot - 1];
+        }
+    }
+    top = addr >> (32 - PREFIX_MAP_BITS);
+    if ((t->prefix_len == 0) || ((t->prefix_map[top / 64] & (1ULL << (top % 64))) == 0)) {
+        return NULL;
+    }
+    for (len = 31; len >= 0; len--) {
+        if ((t->prefix_len & (1U << len)) == 0) {
+            continue;
+        }
+        slot = find_slot(t, addr & prefix_mask(len), len);
+        if (*slot != 0) {
+            return &t->rules[*slot - 1];
+        }
+    }
+    return NULL;
+}
+
+/* append the rules of a list file to a growing array */
+static int read_list(const char *path, enum addrfilter_list_e list, struct rule_s **rules, uint32_t *nb, uint32_t *size) {
+    FILE *fp;
+    char line[128];
+    char *p, *end;
+    unsigned long addr, len;
+    struct rule_s *grown;
+    int line_nb = 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        MSG(LOG_ERR, "ERROR: [addrfilter] failed to open %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof line, fp) != NULL) {
+        line_nb += 1;
+        for (p = line; isspace((unsigned char)*p); p++);
+        if ((*p == '\0') || (*p == '#')) {
+            continue;
+        }
+        addr = strtoul(p, &end, 16);
+        len = 32;
+        if ((end != p) && (*end == '/')) {
+            p = end + 1;
+            len = strtoul(p, &end, 10);
+            if (end == p) {
+                len = 33; /* invalid */
+            }
+        }
+        for (; isspace((unsigned char)*end); end++);
+        if ((end == p) || (*end != '\0') || (addr > 0xFFFFFFFFUL) || (len > 32)) {
+            MSG(LOG_ERR, "ERROR: [addrfilter] %s:%d: invalid rule\n", path, line_nb);
+            fclose(fp);
+            return -1;
+        }
+        if (*nb >= ADDRFILTER_RULES_MAX) {
+            MSG(LOG_ERR, "ERROR: [addrfilter] more than %d rules\n", ADDRFILTER_RULES_MAX);
+            fclose(fp);
+            return -1;
+        }
+        if (*nb == *size) {
+            *size = (*size == 0) ? 1024 : (2 * *size);
+            grown = realloc(*rules, *size * sizeof **rules);
+            if (grown == NULL) {
+                MSG(LOG_ERR, "ERROR: [addrfilter] out of memory\n");
+                fclose(fp);
+                return -1;
+            }
+            *rules = grown;
+        }
+        (*rules)[*nb].addr = (uint32_t)addr & prefix_mask(len);
+        (*rules)[*nb].len = len;
+        (*rules)[*nb].list = list;
+        (*rules)[*nb].hits = 0;
+        *nb += 1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void table_free(struct table_s *t) {
+    if (t == NULL) {
+        return;
+    }
+    free(t->rules);
+    free(t->slot);
+    free(t->bloom);
+    free(t);
+}
+
+/* compile the rules, duplicates are merged and the array is taken over */
+static struct table_s *table_build(struct rule_s *rules, uint32_t nb) {
+    struct table_s *t;
+    struct rule_s *r;
+    uint32_t *slot;
+    uint32_t slots = 2;
+    uint32_t bits = 64;
+    uint32_t i;
+
+    t = calloc(1, sizeof *t);
+    if (t == NULL) {
+        free(rules);
+        return NULL;
+    }
+    t->rules = rules;
+    while (slots < 2 * nb) {
+        slots *= 2;
+    }
+    for (i = 0; i < nb; i++) {
+        if (rules[i].len == 32) {
+            t->nb_exact += 1;
+        }
+    }
+    while (bits < BLOOM_BITS_PER_RULE * t->nb_exact) {
+        bits *= 2;
+    }
+    t->slot = calloc(slots, sizeof *t->slot);
+    t->bloom = calloc(bits / 64, sizeof *t->bloom);
+    if ((t->slot == NULL) || (t->bloom == NULL)) {
+        table_free(t);
+        return NULL;
+    }
+    t->slot_mask = slots - 1;
+    t->bloom_mask = bits - 1;
+
+    /* rules are compacted in place, a duplicate only turns its first occurrence black */
+    for (i = 0; i < nb; i++) {
+        r = &rules[i];
+        slot = find_slot(t, r->addr, r->len);
+        if (*slot != 0) {
+            if (r->list == ADDRFILTER_BLACK) {
+                t->rules[*slot - 1].list = ADDRFILTER_BLACK;
+            }
+            continue;
+        }
+        t->rules[t->nb_rule] = *r;
+        *slot = t->nb_rule + 1;
+        t->nb_rule += 1;
+        if (r->len == 32) {
+            bloom_add(t, r->addr);
+        } else {
+            t->prefix_len |= 1U << r->len;
+            prefix_map_add(t, r->addr, r->len);
+        }
+    }
+    for (i = 0; i < t->nb_rule; i++) {
+        if (t->rules[i].list == ADDRFILTER_WHITE) {
+            t->nb_white += 1;
+        }
+    }
+    return t;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int addrfilter_load(const char *white_path, const char *black_path) {
+    struct rule_s *rules = NULL;
+    struct table_s *t, *old;
+    uint32_t nb = 0;
+    uint32_t size = 0;
+
+    if (((white_path != NULL) && (read_list(white_path, ADDRFILTER_WHITE, &rules, &nb, &size) != 0)) ||
+        ((black_path != NULL) && (read_list(black_path, ADDRFILTER_BLACK, &rules, &nb, &size) != 0))) {
+        free(rules);
+        return -1;
+    }
+    t = table_build(rules, nb);
+    if (t == NULL) {
+        MSG(LOG_ERR, "ERROR: [addrfilter] out of memory\n");
+        return -1;
+    }
+    MSG(LOG_INFO, "INFO: [addrfilter] %u rules loaded (%u white, %u black), %u KiB\n", t->nb_rule, t->nb_white, t->nb_rule - t->nb_white,
+        (unsigned)((nb * sizeof(struct rule_s) + (t->slot_mask + 1) * sizeof(uint32_t) + (t->bloom_mask + 1) / 8 + sizeof *t) / 1024));
+
+    old = __atomic_exchange_n(&table, t, __ATOMIC_SEQ_CST);
+    if (old != NULL) {
+        rcu_synchronize();
+        table_free(old);
+    }
+    return 0;
+}
+
+int addrfilter_up(const uint8_t *payload, uint16_t size) {
+    const struct table_s *t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+    struct rule_s *r;
+    uint32_t devaddr;
+    bool keep;
+
+    if ((t == NULL) || !LORAWAN_DATA_UP(payload, size)) {
+        return 1;
+    }
+    devaddr = LORAWAN_DEVADDR(payload);
+
+    r = lookup(t, devaddr);
+    if (r != NULL) {
+        __atomic_fetch_add(&r->hits, 1, __ATOMIC_RELAXED);
+        keep = (r->list == ADDRFILTER_WHITE);
+    } else {
+        __atomic_fetch_add(&nb_unlisted, 1, __ATOMIC_RELAXED);
+        keep = (t->nb_white == 0);
+    }
+    if (keep == true) {
+        __atomic_fetch_add(&nb_pass, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    __atomic_fetch_add(&nb_drop, 1, __ATOMIC_RELAXED);
+    MSG_DEBUG(DEBUG_PKT_FWD, "INFO: [addrfilter] uplink from %08X dropped\n", devaddr);
+    return 0;
+}
+
+void addrfilter_stat(struct addrfilter_stat_s *st) {
+    struct table_s *t = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+    struct addrfilter_rule_stat_s rs;
+    uint32_t i;
+    int j;
+
+    memset(st, 0, sizeof *st);
+    st->nb_pass = __atomic_exchange_n(&nb_pass, 0, __ATOMIC_RELAXED);
+    st->nb_drop = __atomic_exchange_n(&nb_drop, 0, __ATOMIC_RELAXED);
+    st->nb_unlisted = __atomic_exchange_n(&nb_unlisted, 0, __ATOMIC_RELAXED);
+    if (t == NULL) {
+        return;
+    }
+    st->nb_rule = t->nb_rule;
+
+    /* keep the rules with the most hits, sorted by insertion */
+    for (i = 0; i < t->nb_rule; i++) {
+        rs.hits = __atomic_exchange_n(&t->rules[i].hits, 0, __ATOMIC_RELAXED);
+        if ((rs.hits == 0) || ((st->nb_top == ADDRFILTER_TOP_NB) && (rs.hits <= st->top[ADDRFILTER_TOP_NB - 1].hits))) {
+            continue;
+        }
+        rs.addr = t->rules[i].addr;
+        rs.len = t->rules[i].len;
+        rs.list = t->rules[i].list;
+        if (st->nb_top < ADDRFILTER_TOP_NB) {
+            st->nb_top += 1;
+        }
+        for (j = st->nb_top - 1; (j > 0) && (st->top[j - 1].hits < rs.hits); j--) {
+            st->top[j] = st->top[j - 1];
+        }
+        st->top[j] = rs;
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,96 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : DevAddr white and black lists
+        Lists compiled into a hash table with prefix bitmaps and a Bloom
+        filter, looked up without lock for every uplink
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_ADDRFILTER_H
+#define _LORA_PKTFWD_ADDRFILTER_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* A list file has one rule per line: a DevAddr in hexadecimal ("26011A2B"),
+ * or a prefix followed by its length in bits ("26000000/7" for a NetID).
+ * Empty lines and lines starting with '#' are ignored. The longest matching
+ * rule decides, a blacklist rule wins over an identical whitelist one. An
+ * address matching no rule is dropped if the whitelist is not empty. */
+
+#define ADDRFILTER_RULES_MAX    1000000
+#define ADDRFILTER_TOP_NB       5       /* rules with the most hits in the statistics */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum addrfilter_list_e {
+    ADDRFILTER_WHITE,
+    ADDRFILTER_BLACK
+};
+
+struct addrfilter_rule_stat_s {
+    uint32_t addr;
+    uint8_t len;                /* prefix length in bits, 32 for a single DevAddr */
+    enum addrfilter_list_e list;
+    uint32_t hits;
+};
+
+struct addrfilter_stat_s {
+    uint32_t nb_rule;           /* rules loaded */
+    uint32_t nb_pass;           /* uplinks kept */
+    uint32_t nb_drop;           /* uplinks dropped */
+    uint32_t nb_unlisted;       /* uplinks matching no rule */
+    int nb_top;
+    struct addrfilter_rule_stat_s top[ADDRFILTER_TOP_NB];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Compile the white and black lists and start filtering with them
+@param white_path whitelist file, NULL if none
+@param black_path blacklist file, NULL if none
+@return 0 if the lists were loaded, -1 if a file cannot be read or has an invalid rule
+
+On a reload the previous lists stay in use if the new ones cannot be loaded,
+otherwise they are freed once no reader can use them anymore (see rcu.h).
+Loads and addrfilter_stat calls must come from the same thread.
+*/
+int addrfilter_load(const char *white_path, const char *black_path);
+
+/**
+@brief Check the DevAddr of an uplink against the lists
+@param payload LoRaWAN frame
+@param size size of the frame
+@return 1 if the uplink is to be forwarded, 0 if it is to be dropped
+
+Frames without DevAddr (join requests, proprietary) are always forwarded.
+The calling thread must be an RCU reader.
+*/
+int addrfilter_up(const uint8_t *payload, uint16_t size);
+
+/**
+@brief Get the filter statistics since the last call
+@param st pointer to the structure to be filled
+*/
+void addrfilter_stat(struct addrfilter_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
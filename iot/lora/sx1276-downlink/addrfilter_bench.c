@@ -0,0 +1,327 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : DevAddr white and black lists
+        Loads a large generated whitelist, checks the verdict of addrfilter_up
+        and times it on listed, prefix-covered and unlisted DevAddr
+
+    Build, next to the forwarder (libloragw headers installed in the staging
+    include directory):
+        cc -O2 -Wall -I$(STAGING_DIR)/usr/include -o addrfilter_bench \
+            addrfilter_bench.c addrfilter.c rcu.c -lpthread
+
+    Run:
+        addrfilter_bench                    100000 DevAddr and 1000 prefixes
+        addrfilter_bench -n 1000000 -p 0    largest list, no prefix
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* printf, fprintf, fdopen */
+#include <stdlib.h>         /* atoi, malloc, qsort */
+#include <string.h>         /* memset */
+#include <stdarg.h>         /* va_list */
+#include <time.h>           /* clock_gettime */
+#include <unistd.h>         /* getopt, mkstemp, unlink */
+#include <syslog.h>         /* LOG_WARNING */
+
+#include "rcu.h"
+#include "protocol.h"
+#include "addrfilter.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* The whitelist holds random DevAddr and prefixes of 16, 20 and 24 bits, so
+ * a prefix lookup walks several lengths. Each mix is a set of unconfirmed
+ * uplink frames looked up in turn: DevAddr of the list (hit), DevAddr under
+ * a prefix only (prefix), DevAddr matching no rule (miss, dropped), and the
+ * three in equal parts. Before timing, every frame of a set is checked to
+ * get the verdict the list gives it. */
+
+#define BENCH_DEFAULT_EXACT     100000
+#define BENCH_DEFAULT_PREFIX    1000
+#define BENCH_DEFAULT_LOOKUP    10000000
+#define BENCH_SET_NB            65536   /* frames in a mix, looked up in turn */
+#define BENCH_FRAME_SIZE        16      /* MHDR, FHDR, FPort, 2 bytes, MIC */
+
+static const unsigned bench_prefix_len[] = {16, 20, 24};
+
+enum bench_kind_e {
+    BENCH_HIT,
+    BENCH_PREFIX,
+    BENCH_MISS,
+    BENCH_KIND_NB
+};
+
+struct bench_mix_s {
+    const char *name;
+    int kind[BENCH_KIND_NB];    /* share of each kind of DevAddr, out of BENCH_KIND_NB */
+};
+
+static const struct bench_mix_s bench_mix[] = {
+    {"hit",    {1, 0, 0}},
+    {"prefix", {0, 1, 0}},
+    {"miss",   {0, 0, 1}},
+    {"mixed",  {1, 1, 1}}
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static uint32_t *exact;         /* listed DevAddr, sorted */
+static uint32_t *prefix;        /* listed prefixes, masked */
+static uint8_t *prefix_len;
+static int nb_exact = BENCH_DEFAULT_EXACT;
+static int nb_prefix = BENCH_DEFAULT_PREFIX;
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static volatile int sink; /* keeps the measured calls */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* addrfilter.c logs through the forwarder */
+void _debug(int level, char *format, ...) {
+    va_list vlist;
+
+    if (level <= LOG_WARNING) {
+        va_start(vlist, format);
+        vfprintf(stderr, format, vlist);
+        va_end(vlist);
+    }
+}
+
+static double mono_s(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1E9;
+}
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+static uint32_t len_mask(unsigned len) {
+    return (len == 0) ? 0 : (0xFFFFFFFFU << (32 - len));
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static bool is_exact(uint32_t addr) {
+    return bsearch(&addr, exact, nb_exact, sizeof *exact, cmp_u32) != NULL;
+}
+
+static bool is_prefixed(uint32_t addr) {
+    int i;
+
+    for (i = 0; i < nb_prefix; i++) {
+        if ((addr & len_mask(prefix_len[i])) == prefix[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* the rules, and the whitelist file holding them */
+static int make_list(char *path) {
+    FILE *fp;
+    int fd;
+    int i;
+
+    exact = malloc(nb_exact * sizeof *exact);
+    prefix = malloc((nb_prefix + 1) * sizeof *prefix);
+    prefix_len = malloc(nb_prefix + 1);
+    if ((exact == NULL) || (prefix == NULL) || (prefix_len == NULL)) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return -1;
+    }
+    for (i = 0; i < nb_prefix; i++) {
+        prefix_len[i] = bench_prefix_len[i % (sizeof bench_prefix_len / sizeof bench_prefix_len[0])];
+        prefix[i] = rng() & len_mask(prefix_len[i]);
+    }
+    for (i = 0; i < nb_exact; i++) {
+        exact[i] = rng();
+    }
+
+    fd = mkstemp(path);
+    fp = (fd < 0) ? NULL : fdopen(fd, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: failed to create %s\n", path);
+        return -1;
+    }
+    fprintf(fp, "# addrfilter_bench, %d DevAddr and %d prefixes\n", nb_exact, nb_prefix);
+    for (i = 0; i < nb_exact; i++) {
+        fprintf(fp, "%08X\n", exact[i]);
+    }
+    for (i = 0; i < nb_prefix; i++) {
+        fprintf(fp, "%08X/%u\n", prefix[i], prefix_len[i]);
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: failed to write %s\n", path);
+        return -1;
+    }
+    qsort(exact, nb_exact, sizeof *exact, cmp_u32);
+    return 0;
+}
+
+static uint32_t pick_addr(enum bench_kind_e kind) {
+    uint32_t addr;
+    int i;
+
+    switch (kind) {
+        case BENCH_HIT:
+            return exact[rng() % nb_exact];
+        case BENCH_PREFIX:
+            do {
+                i = rng() % nb_prefix;
+                addr = prefix[i] | (rng() & ~len_mask(prefix_len[i]));
+            } while (is_exact(addr));
+            return addr;
+        default:
+            do {
+                addr = rng();
+            } while (is_exact(addr) || is_prefixed(addr));
+            return addr;
+    }
+}
+
+/* frames of a mix, with the verdict expected for each */
+static void make_set(const struct bench_mix_s *mix, uint8_t (*frame)[BENCH_FRAME_SIZE], uint8_t *expect) {
+    enum bench_kind_e kind[BENCH_KIND_NB];
+    int nb_kind = 0;
+    uint32_t addr;
+    int i, k, j;
+
+    for (k = 0; k < BENCH_KIND_NB; k++) {
+        for (j = 0; j < mix->kind[k]; j++) {
+            kind[nb_kind++] = k;
+        }
+    }
+    for (i = 0; i < BENCH_SET_NB; i++) {
+        k = kind[rng() % nb_kind];
+        addr = pick_addr(k);
+        memset(frame[i], 0, BENCH_FRAME_SIZE);
+        frame[i][0] = MTYPE_UNCONFIRM_DATA_UP << 5;
+        frame[i][1] = addr;
+        frame[i][2] = addr >> 8;
+        frame[i][3] = addr >> 16;
+        frame[i][4] = addr >> 24;
+        frame[i][6] = i;    /* FCnt */
+        frame[i][8] = 1;    /* FPort */
+        expect[i] = (k == BENCH_MISS) ? 0 : 1;
+    }
+}
+
+static void usage(void) {
+    printf("Usage: addrfilter_bench [-n devaddr] [-p prefixes] [-l lookups]\n");
+    printf("  -n  DevAddr in the whitelist, default %d\n", BENCH_DEFAULT_EXACT);
+    printf("  -p  prefixes of %u, %u and %u bits in the whitelist, default %d\n",
+        bench_prefix_len[0], bench_prefix_len[1], bench_prefix_len[2], BENCH_DEFAULT_PREFIX);
+    printf("  -l  lookups timed for each mix, default %d\n", BENCH_DEFAULT_LOOKUP);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    static uint8_t frame[BENCH_SET_NB][BENCH_FRAME_SIZE];
+    static uint8_t expect[BENCH_SET_NB];
+    char path[] = "/tmp/addrfilter_bench.XXXXXX";
+    struct addrfilter_stat_s st;
+    int nb_lookup = BENCH_DEFAULT_LOOKUP;
+    int nb_fail = 0;
+    int nb_wrong, acc;
+    double start, elapsed;
+    int rcu_id;
+    int m, i;
+
+    while ((i = getopt(argc, argv, "hn:p:l:")) != -1) {
+        switch (i) {
+            case 'n':
+                nb_exact = atoi(optarg);
+                break;
+            case 'p':
+                nb_prefix = atoi(optarg);
+                break;
+            case 'l':
+                nb_lookup = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if ((nb_exact < 1) || (nb_prefix < 0) || (nb_exact + nb_prefix > ADDRFILTER_RULES_MAX) || (nb_lookup < 1)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (make_list(path) != 0) {
+        return EXIT_FAILURE;
+    }
+    start = mono_s();
+    i = addrfilter_load(path, NULL);
+    elapsed = mono_s() - start;
+    unlink(path);
+    if (i != 0) {
+        fprintf(stderr, "ERROR: failed to load the generated list\n");
+        return EXIT_FAILURE;
+    }
+    addrfilter_stat(&st);
+    printf("%u rules loaded in %.1f ms\n", st.nb_rule, elapsed * 1E3);
+    rcu_id = rcu_register();
+
+    printf("\n  mix      ns per lookup   wrong verdicts\n");
+    for (m = 0; m < (int)(sizeof bench_mix / sizeof bench_mix[0]); m++) {
+        if ((nb_prefix == 0) && (bench_mix[m].kind[BENCH_PREFIX] > 0)) {
+            continue;
+        }
+        make_set(&bench_mix[m], frame, expect);
+        nb_wrong = 0;
+        for (i = 0; i < BENCH_SET_NB; i++) {
+            if (addrfilter_up(frame[i], BENCH_FRAME_SIZE) != expect[i]) {
+                nb_wrong += 1;
+            }
+        }
+
+        acc = 0;
+        start = mono_s();
+        for (i = 0; i < nb_lookup; i++) {
+            acc += addrfilter_up(frame[i & (BENCH_SET_NB - 1)], BENCH_FRAME_SIZE);
+        }
+        elapsed = mono_s() - start;
+        sink = acc;
+        rcu_quiescent(rcu_id);
+
+        printf("  %-8s %13.1f %16d\n", bench_mix[m].name, elapsed * 1E9 / nb_lookup, nb_wrong);
+        fflush(stdout);
+        nb_fail += (nb_wrong > 0) ? 1 : 0;
+    }
+    rcu_unregister(rcu_id);
+
+    return (nb_fail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
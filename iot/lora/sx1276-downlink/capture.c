@@ -0,0 +1,182 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : binary capture of radio and network traffic
+        Records what the concentrators, the servers and the MCU exchanged,
+        for replay.c
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* fopen, fwrite */
+#include <string.h>         /* memset, strerror */
+#include <errno.h>          /* errno */
+#include <time.h>           /* clock_gettime */
+#include <pthread.h>
+
+#include "trace.h"
+#include "capture.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* Records come from several threads, they are serialized by the mutex and
+ * buffered by stdio; main_loop flushes them at each statistics interval. */
+
+#define CAPTURE_BUFF_SIZE       65536
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_capture = PTHREAD_MUTEX_INITIALIZER; /* control access to the capture file */
+
+static int active = 0;              /* read without lock, a record may be missed when it changes */
+static FILE *file = NULL;
+static char buff[CAPTURE_BUFF_SIZE];
+static struct timespec start_time;
+static uint64_t size_max;
+static uint64_t size_used;
+static uint32_t nb_rec;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* append one record, mx_capture taken */
+static void write_rec(enum capture_type_e type, int src, const void *meta, uint32_t meta_size, const void *data, uint32_t size) {
+    static const uint8_t pad[8] = {0};
+    struct capture_rec_s rec;
+    struct timespec now;
+    uint32_t pad_size;
+
+    if (file == NULL) {
+        return;
+    }
+    rec.size = meta_size + size;
+    pad_size = CAPTURE_PAD(rec.size) - rec.size;
+    if ((size_max > 0) && (size_used + sizeof rec + rec.size + pad_size > size_max)) {
+        MSG(LOG_WARNING, "WARNING: [capture] size limit of %llu bytes reached, capture stopped\n", (unsigned long long)size_max);
+        __atomic_store_n(&active, 0, __ATOMIC_RELAXED);
+        fflush(file);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rec.time_ns = (uint64_t)(now.tv_sec - start_time.tv_sec) * 1000000000 + now.tv_nsec - start_time.tv_nsec;
+    rec.type = (uint8_t)type;
+    rec.src = (uint8_t)src;
+    rec.reserved = 0;
+
+    if ((fwrite(&rec, sizeof rec, 1, file) != 1) || ((meta_size > 0) && (fwrite(meta, meta_size, 1, file) != 1))
+        || ((size > 0) && (fwrite(data, size, 1, file) != 1)) || ((pad_size > 0) && (fwrite(pad, pad_size, 1, file) != 1))) {
+        MSG(LOG_ERR, "ERROR: [capture] write failed, capture stopped: %s\n", strerror(errno));
+        __atomic_store_n(&active, 0, __ATOMIC_RELAXED);
+        return;
+    }
+    size_used += sizeof rec + rec.size + pad_size;
+    nb_rec += 1;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int capture_open(const char *path, uint64_t max_size) {
+    struct capture_head_s head;
+    struct timespec utc;
+
+    pthread_mutex_lock(&mx_capture);
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        MSG(LOG_ERR, "ERROR: [capture] failed to create %s: %s\n", path, strerror(errno));
+        pthread_mutex_unlock(&mx_capture);
+        return -1;
+    }
+    setvbuf(file, buff, _IOFBF, sizeof buff);
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    clock_gettime(CLOCK_REALTIME, &utc);
+    memset(&head, 0, sizeof head);
+    head.magic = CAPTURE_MAGIC;
+    head.version = CAPTURE_VERSION;
+    head.meta_size = CAPTURE_META_SIZE;
+    head.start_utc_ns = (uint64_t)utc.tv_sec * 1000000000 + utc.tv_nsec;
+    if (fwrite(&head, sizeof head, 1, file) != 1) {
+        MSG(LOG_ERR, "ERROR: [capture] failed to write %s: %s\n", path, strerror(errno));
+        fclose(file);
+        file = NULL;
+        pthread_mutex_unlock(&mx_capture);
+        return -1;
+    }
+    size_max = max_size;
+    size_used = sizeof head;
+    nb_rec = 0;
+    __atomic_store_n(&active, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mx_capture);
+
+    MSG(LOG_INFO, "INFO: [capture] recording to %s\n", path);
+    return 0;
+}
+
+void capture_close(void) {
+    pthread_mutex_lock(&mx_capture);
+    __atomic_store_n(&active, 0, __ATOMIC_RELAXED);
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+    pthread_mutex_unlock(&mx_capture);
+}
+
+void capture_rx(int board, const struct lgw_pkt_rx_s *pkt, int nb_pkt) {
+    int i;
+
+    if ((__atomic_load_n(&active, __ATOMIC_RELAXED) == 0) || (nb_pkt <= 0)) {
+        return;
+    }
+    pthread_mutex_lock(&mx_capture);
+    for (i = 0; (i < nb_pkt) && (active != 0); i++) {
+        write_rec(CAPTURE_RX, board, &pkt[i], CAPTURE_META_SIZE, pkt[i].payload, pkt[i].size);
+    }
+    pthread_mutex_unlock(&mx_capture);
+}
+
+void capture_data(enum capture_type_e type, int src, const uint8_t *data, int size) {
+    if ((__atomic_load_n(&active, __ATOMIC_RELAXED) == 0) || (size <= 0)) {
+        return;
+    }
+    pthread_mutex_lock(&mx_capture);
+    if (active != 0) {
+        write_rec(type, src, NULL, 0, data, (uint32_t)size);
+    }
+    pthread_mutex_unlock(&mx_capture);
+}
+
+void capture_flush(void) {
+    pthread_mutex_lock(&mx_capture);
+    if (file != NULL) {
+        fflush(file);
+    }
+    pthread_mutex_unlock(&mx_capture);
+}
+
+void capture_stat(struct capture_stat_s *st) {
+    pthread_mutex_lock(&mx_capture);
+    st->nb_rec = nb_rec;
+    st->nb_byte = size_used;
+    st->active = active;
+    nb_rec = 0;
+    pthread_mutex_unlock(&mx_capture);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,121 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : binary capture of radio and network traffic
+        Records what the concentrators, the servers and the MCU exchanged,
+        for replay.c
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_CAPTURE_H
+#define _LORA_PKTFWD_CAPTURE_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stddef.h>         /* offsetof */
+
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* A capture is a file header followed by records in time order. A record is
+ * a header and size bytes of data, padded to 8 bytes: for CAPTURE_RX the
+ * lgw_pkt_rx_s fields before the payload then the payload, as lgw_receive
+ * returned it; for the other types the bytes as sent or received. Integers are
+ * in host order, a capture is replayed on the architecture it was made on. */
+
+#define CAPTURE_MAGIC           0x4350464C  /* "LFPC" */
+#define CAPTURE_VERSION         1
+#define CAPTURE_META_SIZE       offsetof(struct lgw_pkt_rx_s, payload)
+#define CAPTURE_PAD(size)       (((size) + 7) & ~(uint32_t)7)
+
+enum capture_type_e {
+    CAPTURE_RX = 1,         /* packet from a concentrator, src is the board */
+    CAPTURE_UP,             /* PUSH_DATA or TX_ACK sent, src is the server */
+    CAPTURE_DOWN,           /* datagram received from a server, src is the server */
+    CAPTURE_UART_OUT,       /* bytes written to an MCU, src is the SX1276 */
+    CAPTURE_UART_IN         /* bytes read from an MCU, src is the SX1276 */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct capture_head_s {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t meta_size;     /* CAPTURE_META_SIZE of the writer */
+    uint64_t start_utc_ns;  /* host time of the first record time, ns since the Epoch */
+};
+
+struct capture_rec_s {
+    uint64_t time_ns;       /* since the start of the capture, monotonic */
+    uint32_t size;          /* data following the header, padding excluded */
+    uint8_t type;           /* enum capture_type_e */
+    uint8_t src;
+    uint16_t reserved;
+};
+
+struct capture_stat_s {
+    uint32_t nb_rec;        /* records written since the last call */
+    uint64_t nb_byte;       /* size of the capture */
+    int active;             /* 0 once stopped by an error or the size limit */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Create a capture file and start recording
+@param path file to create, replaced if it exists
+@param max_size size at which recording stops, 0 for no limit
+@return 0 if recording, -1 else
+*/
+int capture_open(const char *path, uint64_t max_size);
+
+/**
+@brief Stop recording and close the file
+*/
+void capture_close(void);
+
+/**
+@brief Record packets returned by lgw_receive
+@param board concentrator
+@param pkt array of packets
+@param nb_pkt number of packets
+*/
+void capture_rx(int board, const struct lgw_pkt_rx_s *pkt, int nb_pkt);
+
+/**
+@brief Record a datagram or UART frame
+@param type CAPTURE_UP, CAPTURE_DOWN, CAPTURE_UART_OUT or CAPTURE_UART_IN
+@param src server or SX1276 index
+@param data bytes
+@param size number of bytes
+*/
+void capture_data(enum capture_type_e type, int src, const uint8_t *data, int size);
+
+/**
+@brief Write the buffered records to the file
+*/
+void capture_flush(void);
+
+/**
+@brief Get the capture statistics
+@param st pointer to the structure to be filled
+*/
+void capture_stat(struct capture_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
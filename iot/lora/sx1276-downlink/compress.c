@@ -0,0 +1,225 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : PUSH_DATA compression
+        LZ4 block compression of the JSON body, primed with a dictionary of
+        the rxpk and stat fields
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <string.h>         /* memcpy, memset */
+#include <pthread.h>
+
+#include "trace.h"
+#include "compress.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5       /* the block ends with at least that many literals */
+#define LZ4_MFLIMIT         12      /* no match starts closer than that to the end */
+#define LZ4_MAX_OFFSET      65535
+#define LZ4_HASH_LOG        12
+
+/* Field names and values as serialized by thread_up and thread_drain, most of
+ * an rxpk object is found here. Changing it breaks the servers using it. */
+static const char dict[] =
+    "\"stat\":{\"time\":\"2018-01-01 00:00:00 GMT\",\"lati\":0.00000,\"long\":0.00000,\"alti\":0,"
+    "\"rxnb\":0,\"rxok\":0,\"rxfw\":0,\"ackr\":100.0,\"dwnb\":0,\"txnb\":0,\"cpur\":0.0,\"memr\":0.0}}"
+    "{\"rxpk\":[{\"tmst\":0,\"rply\":true,\"chan\":0,\"rfch\":0,\"freq\":470.300000,\"stat\":-1,\"modu\":\"FSK\",\"datr\":50000"
+    ",\"rssi\":-100,\"size\":0,\"data\":\"\"}"
+    ",{\"tmst\":0,\"time\":\"2018-01-01T00:00:00.000000Z\",\"tmms\":1000000000000"
+    ",\"chan\":1,\"rfch\":1,\"freq\":471.500000,\"stat\":0,\"modu\":\"LORA\",\"datr\":\"SF12BW125\",\"codr\":\"4/8\",\"lsnr\":-10.0,\"rssi\":-110,\"size\":51,\"data\":\"gA"
+    "\"},{\"tmst\":0,\"chan\":2,\"rfch\":0,\"freq\":470.500000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF11BW125\",\"codr\":\"4/6\",\"lsnr\":-5.0,\"rssi\":-105,\"size\":23,\"data\":\"QA"
+    "\"},{\"tmst\":0,\"chan\":3,\"rfch\":1,\"freq\":471.700000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF10BW125\",\"codr\":\"4/7\",\"lsnr\":2.5,\"rssi\":-95,\"size\":13,\"data\":\"AA"
+    "\"},{\"tmst\":0,\"chan\":4,\"rfch\":0,\"freq\":470.700000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF9BW125\",\"codr\":\"4/5\",\"lsnr\":7.0,\"rssi\":-80,\"size\":33,\"data\":\"gA"
+    "\"},{\"tmst\":0,\"chan\":5,\"rfch\":1,\"freq\":471.900000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF8BW125\",\"codr\":\"4/5\",\"lsnr\":9.5,\"rssi\":-60,\"size\":19,\"data\":\"QA"
+    "\"},{\"tmst\":0,\"chan\":6,\"rfch\":0,\"freq\":470.900000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF7BW250\",\"codr\":\"OFF\",\"lsnr\":10.0,\"rssi\":-40,\"size\":18,\"data\":\"gA"
+    "\"},{\"tmst\":0,\"chan\":7,\"rfch\":1,\"freq\":472.100000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"lsnr\":11.5,\"rssi\":-50,\"size\":12,\"data\":\"QA"
+    "\"},{\"tmst\":0,\"chan\":8,\"rfch\":0,\"freq\":471.300000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF12BW500\",\"codr\":\"4/5\",\"lsnr\":-20.0,\"rssi\":-120,\"size\":";
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_compress = PTHREAD_MUTEX_INITIALIZER; /* control access to the server state and statistics */
+static bool server_ok = false;
+static struct compress_stat_s stat_acc;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static unsigned hash4(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/* LZ4 length field: 15 in the token, then bytes of 255 until the remainder */
+static uint8_t *put_len(uint8_t *op, unsigned len) {
+    len -= 15;
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+const uint8_t *compress_dict(unsigned *size) {
+    *size = sizeof dict - 1;
+    return (const uint8_t *)dict;
+}
+
+int compress_lz4(const uint8_t *in, int in_len, uint8_t *out, int out_max) {
+    uint8_t work[sizeof dict - 1 + COMPRESS_IN_MAX]; /* dictionary followed by the input, matches may point in both */
+    int32_t table[1 << LZ4_HASH_LOG];
+    const unsigned dict_len = sizeof dict - 1;
+    unsigned end, ip, ref, anchor, len, lit;
+    unsigned h;
+    int32_t cand;
+    uint8_t *op = out;
+    uint8_t *op_end = out + out_max;
+    uint8_t *token;
+
+    if ((in_len <= 0) || (in_len > COMPRESS_IN_MAX)) {
+        return -1;
+    }
+    memcpy(work, dict, dict_len);
+    memcpy(work + dict_len, in, in_len);
+    end = dict_len + in_len;
+
+    memset(table, 0xFF, sizeof table);
+    for (ip = 0; ip + LZ4_MIN_MATCH <= dict_len; ip++) {
+        table[hash4(read32(work + ip))] = ip;
+    }
+
+    anchor = dict_len;
+    ip = dict_len;
+    while (ip + LZ4_MFLIMIT <= end) {
+        h = hash4(read32(work + ip));
+        cand = table[h];
+        table[h] = ip;
+        ref = (unsigned)cand;
+        if ((cand < 0) || ((ip - ref) > LZ4_MAX_OFFSET) || (read32(work + ref) != read32(work + ip))) {
+            ip += 1;
+            continue;
+        }
+
+        /* extend the match both ways, it must leave the last literals alone */
+        while ((ip > anchor) && (ref > 0) && (work[ip - 1] == work[ref - 1])) {
+            ip -= 1;
+            ref -= 1;
+        }
+        len = LZ4_MIN_MATCH;
+        while ((ip + len < end - LZ4_LAST_LITERALS) && (work[ref + len] == work[ip + len])) {
+            len += 1;
+        }
+
+        /* sequence: token, literals, offset, match length */
+        lit = ip - anchor;
+        if ((op + 1 + lit + (lit / 255) + 2 + ((len - LZ4_MIN_MATCH) / 255) + 2) > op_end) {
+            return -1;
+        }
+        token = op++;
+        if (lit >= 15) {
+            *token = 15 << 4;
+            op = put_len(op, lit);
+        } else {
+            *token = lit << 4;
+        }
+        memcpy(op, work + anchor, lit);
+        op += lit;
+        *op++ = (uint8_t)(ip - ref);
+        *op++ = (uint8_t)((ip - ref) >> 8);
+        if ((len - LZ4_MIN_MATCH) >= 15) {
+            *token |= 15;
+            op = put_len(op, len - LZ4_MIN_MATCH);
+        } else {
+            *token |= len - LZ4_MIN_MATCH;
+        }
+
+        ip += len;
+        anchor = ip;
+        if (ip + LZ4_MFLIMIT <= end) {
+            table[hash4(read32(work + ip - 2))] = ip - 2;
+        }
+    }
+
+    /* last literals */
+    lit = end - anchor;
+    if ((op + 1 + lit + (lit / 255) + 1) > op_end) {
+        return -1;
+    }
+    token = op++;
+    if (lit >= 15) {
+        *token = 15 << 4;
+        op = put_len(op, lit);
+    } else {
+        *token = lit << 4;
+    }
+    memcpy(op, work + anchor, lit);
+    op += lit;
+
+    if ((op - out) >= in_len) {
+        return -1; /* not worth it */
+    }
+    return op - out;
+}
+
+void compress_server_set(bool ok) {
+    pthread_mutex_lock(&mx_compress);
+    if (ok != server_ok) {
+        MSG(LOG_INFO, "INFO: [compress] server %s compressed PUSH_DATA\n", ok ? "accepts" : "does not accept");
+        server_ok = ok;
+    }
+    pthread_mutex_unlock(&mx_compress);
+}
+
+bool compress_server_ok(void) {
+    bool ok;
+
+    pthread_mutex_lock(&mx_compress);
+    ok = server_ok;
+    pthread_mutex_unlock(&mx_compress);
+    return ok;
+}
+
+void compress_account(uint32_t raw_byte, uint32_t zip_byte, uint32_t cpu_us) {
+    pthread_mutex_lock(&mx_compress);
+    stat_acc.nb_dgram += 1;
+    stat_acc.raw_byte += raw_byte;
+    stat_acc.zip_byte += zip_byte;
+    stat_acc.cpu_us += cpu_us;
+    pthread_mutex_unlock(&mx_compress);
+}
+
+void compress_stat(struct compress_stat_s *st) {
+    pthread_mutex_lock(&mx_compress);
+    *st = stat_acc;
+    memset(&stat_acc, 0, sizeof stat_acc);
+    pthread_mutex_unlock(&mx_compress);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
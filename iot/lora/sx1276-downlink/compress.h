@@ -0,0 +1,100 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : PUSH_DATA compression
+        LZ4 block compression of the JSON body, primed with a dictionary of
+        the rxpk and stat fields
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_COMPRESS_H
+#define _LORA_PKTFWD_COMPRESS_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* A compressed PUSH_DATA has the usual 12-byte header with the identifier
+ * PKT_PUSH_DATA_LZ4, followed by the JSON size (2 bytes, network order) and
+ * an LZ4 block to be decoded with LZ4_decompress_safe_usingDict() and the
+ * dictionary returned by compress_dict(). A server able to decode it sets
+ * COMPRESS_ACK_FLAG_LZ4 in a 5th byte of its PUSH_ACK. */
+
+#define PKT_PUSH_DATA_LZ4       0x10
+#define COMPRESS_ACK_FLAG_LZ4   0x01
+#define COMPRESS_HEAD_SIZE      2       /* JSON size, before the LZ4 block */
+#define COMPRESS_IN_MAX         16384   /* largest JSON body that is compressed */
+#define COMPRESS_MISS_MAX       3       /* compressed PUSH_DATA without PUSH_ACK before falling back to plain JSON */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct compress_stat_s {
+    uint32_t nb_dgram;      /* datagrams compressed */
+    uint32_t raw_byte;      /* JSON bytes before compression */
+    uint32_t zip_byte;      /* bytes sent instead */
+    uint32_t cpu_us;        /* CPU time spent compressing */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Get the dictionary shared with the server
+@param size set to the dictionary size
+@return pointer to the dictionary
+*/
+const uint8_t *compress_dict(unsigned *size);
+
+/**
+@brief Compress a buffer as an LZ4 block, using the dictionary
+@param in buffer to compress, COMPRESS_IN_MAX bytes at most
+@param in_len size of the buffer
+@param out buffer for the LZ4 block
+@param out_max size of the output buffer
+@return size of the LZ4 block, -1 if it would not be smaller than the input
+*/
+int compress_lz4(const uint8_t *in, int in_len, uint8_t *out, int out_max);
+
+/**
+@brief Record whether the server decodes compressed PUSH_DATA
+@param ok true if the last PUSH_ACK carried COMPRESS_ACK_FLAG_LZ4
+*/
+void compress_server_set(bool ok);
+
+/**
+@brief Tell whether PUSH_DATA can be sent compressed
+@return true if the server announced it
+*/
+bool compress_server_ok(void);
+
+/**
+@brief Account for a compressed datagram
+@param raw_byte JSON bytes before compression
+@param zip_byte bytes sent instead
+@param cpu_us CPU time spent compressing
+*/
+void compress_account(uint32_t raw_byte, uint32_t zip_byte, uint32_t cpu_us);
+
+/**
+@brief Get the compression statistics since the last call
+@param st pointer to the structure to be filled
+*/
+void compress_stat(struct compress_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,287 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : LZ4 compression of PUSH_DATA
+        Compresses the PUSH_DATA of captures, checks that each one decodes
+        back to the JSON sent, and reports the ratio and the time spent
+
+    Build, next to the forwarder (libloragw headers installed in the staging
+    include directory):
+        cc -O2 -Wall -I$(STAGING_DIR)/usr/include -o compress_bench \
+            compress_bench.c compress.c -lpthread
+
+    Run on the corpus next to it, or on captures made with "capture_file":
+        compress_bench uplink_corpus.cap
+        compress_bench -r 1000 /tmp/site1.cap /tmp/site2.cap
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* printf, fprintf, fopen */
+#include <stdlib.h>         /* atoi, exit */
+#include <string.h>         /* memcmp, memcpy */
+#include <stdarg.h>         /* va_list */
+#include <time.h>           /* clock_gettime */
+#include <unistd.h>         /* getopt */
+#include <syslog.h>         /* LOG_WARNING */
+
+#include "compress.h"
+#include "capture.h"
+#include "protocol.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* Only the CAPTURE_UP records holding a PUSH_DATA are used, the JSON after the
+ * 12-byte header is compressed as thread_up does. Sizes compared are the
+ * datagrams as sent: 12-byte header and JSON, or 12-byte header, JSON size
+ * and LZ4 block. Each datagram is compressed bench_repeat times to time it,
+ * the decoder here is a plain LZ4 block decoder with an external dictionary,
+ * as a server would use. uplink_corpus.cap is 60 s of the simulated
+ * concentrator at 10 uplinks/s, serialized by thread_up, on a little-endian
+ * host. */
+
+#define BENCH_HEAD_SIZE         12
+#define BENCH_DGRAM_MAX         (BENCH_HEAD_SIZE + COMPRESS_IN_MAX)
+#define BENCH_DEFAULT_REPEAT    100
+#define BENCH_DEFAULT_CAPTURE   "uplink_corpus.cap"
+
+struct bench_result_s {
+    uint32_t nb_dgram;
+    uint32_t nb_plain;      /* datagrams that would be sent uncompressed */
+    uint32_t nb_bad;        /* datagrams that did not decode back */
+    uint64_t raw_byte;
+    uint64_t sent_byte;
+    double cpu_s;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static int bench_repeat = BENCH_DEFAULT_REPEAT;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* compress.c logs through the forwarder */
+void _debug(int level, char *format, ...) {
+    va_list vlist;
+
+    if (level <= LOG_WARNING) {
+        va_start(vlist, format);
+        vfprintf(stderr, format, vlist);
+        va_end(vlist);
+    }
+}
+
+static double mono_s(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1E9;
+}
+
+/* LZ4 block decoder, matches may reach back into the dictionary */
+static int lz4_decode(const uint8_t *in, int in_len, uint8_t *out, int out_max) {
+    uint8_t work[COMPRESS_IN_MAX * 2];
+    const uint8_t *dict;
+    unsigned dict_len;
+    const uint8_t *ip = in;
+    const uint8_t *ip_end = in + in_len;
+    unsigned op, len, off, i;
+    uint8_t b;
+
+    dict = compress_dict(&dict_len);
+    if (dict_len > sizeof work - (unsigned)out_max) {
+        return -1;
+    }
+    memcpy(work, dict, dict_len);
+    op = dict_len;
+    while (ip < ip_end) {
+        b = *ip++;
+        len = b >> 4;
+        if (len == 15) {
+            do {
+                if (ip >= ip_end) {
+                    return -1;
+                }
+                len += *ip;
+            } while (*ip++ == 255);
+        }
+        if ((ip + len > ip_end) || (op + len > dict_len + (unsigned)out_max)) {
+            return -1;
+        }
+        memcpy(work + op, ip, len);
+        ip += len;
+        op += len;
+        if (ip == ip_end) {
+            break; /* last sequence, literals only */
+        }
+        if (ip + 2 > ip_end) {
+            return -1;
+        }
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        len = b & 0x0F;
+        if (len == 15) {
+            do {
+                if (ip >= ip_end) {
+                    return -1;
+                }
+                len += *ip;
+            } while (*ip++ == 255);
+        }
+        len += 4;
+        if ((off == 0) || (off > op) || (op + len > dict_len + (unsigned)out_max)) {
+            return -1;
+        }
+        for (i = 0; i < len; i++, op++) {
+            work[op] = work[op - off]; /* byte by byte, the copy may overlap */
+        }
+    }
+    memcpy(out, work + dict_len, op - dict_len);
+    return (int)(op - dict_len);
+}
+
+static int run_capture(const char *path, struct bench_result_s *res) {
+    static uint8_t data[BENCH_DGRAM_MAX + 8];
+    static uint8_t zip[BENCH_DGRAM_MAX + 64];
+    static uint8_t back[COMPRESS_IN_MAX];
+    struct capture_head_s head;
+    struct capture_rec_s rec;
+    FILE *f;
+    double start;
+    int json_len, zip_len = 0, back_len;
+    int i;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: failed to open %s\n", path);
+        return -1;
+    }
+    if (fread(&head, sizeof head, 1, f) != 1) {
+        fprintf(stderr, "ERROR: %s is too short\n", path);
+        fclose(f);
+        return -1;
+    }
+    if (head.magic != CAPTURE_MAGIC) {
+        fprintf(stderr, "ERROR: %s is not a capture, or was made on a host of the other byte order\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    while (fread(&rec, sizeof rec, 1, f) == 1) {
+        if ((rec.type != CAPTURE_UP) || (rec.size <= BENCH_HEAD_SIZE) || (rec.size > BENCH_DGRAM_MAX)) {
+            if (fseek(f, CAPTURE_PAD(rec.size), SEEK_CUR) != 0) {
+                break;
+            }
+            continue;
+        }
+        if (fread(data, CAPTURE_PAD(rec.size), 1, f) != 1) {
+            break;
+        }
+        if (data[3] != PKT_PUSH_DATA) {
+            continue; /* TX_ACK */
+        }
+        json_len = (int)rec.size - BENCH_HEAD_SIZE;
+
+        start = mono_s();
+        for (i = 0; i < bench_repeat; i++) {
+            zip_len = compress_lz4(data + BENCH_HEAD_SIZE, json_len, zip, sizeof zip);
+        }
+        res->cpu_s += mono_s() - start;
+
+        res->nb_dgram += 1;
+        res->raw_byte += rec.size;
+        if (zip_len < 0) {
+            res->nb_plain += 1;
+            res->sent_byte += rec.size;
+            continue;
+        }
+        res->sent_byte += BENCH_HEAD_SIZE + COMPRESS_HEAD_SIZE + zip_len;
+        back_len = lz4_decode(zip, zip_len, back, sizeof back);
+        if ((back_len != json_len) || (memcmp(back, data + BENCH_HEAD_SIZE, json_len) != 0)) {
+            if (res->nb_bad < 10) {
+                fprintf(stderr, "FAIL: %s, datagram %u does not decode back\n", path, res->nb_dgram);
+            }
+            res->nb_bad += 1;
+        }
+    }
+    fclose(f);
+
+    return 0;
+}
+
+static void usage(void) {
+    printf("Usage: compress_bench [-r repeat] [capture ...]\n");
+    printf("  -r  times each datagram is compressed for the timing, default %d\n", BENCH_DEFAULT_REPEAT);
+    printf("  captures made with \"capture_file\", default %s\n", BENCH_DEFAULT_CAPTURE);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    struct bench_result_s res;
+    static const char *def_path[] = {BENCH_DEFAULT_CAPTURE};
+    const char **path = def_path;
+    int nb_path = 1;
+    int nb_fail = 0;
+    int i;
+
+    while ((i = getopt(argc, argv, "hr:")) != -1) {
+        switch (i) {
+            case 'r':
+                bench_repeat = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (bench_repeat < 1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (optind < argc) {
+        path = (const char **)(argv + optind);
+        nb_path = argc - optind;
+    }
+
+    for (i = 0; i < nb_path; i++) {
+        memset(&res, 0, sizeof res);
+        if (run_capture(path[i], &res) != 0) {
+            nb_fail += 1;
+            continue;
+        }
+        if (res.nb_dgram == 0) {
+            printf("%s: no PUSH_DATA\n", path[i]);
+            continue;
+        }
+        printf("%s: %u PUSH_DATA, %.0f bytes on average, %u sent uncompressed, %u not decoded back\n",
+            path[i], res.nb_dgram, (double)res.raw_byte / res.nb_dgram, res.nb_plain, res.nb_bad);
+        printf("    %llu -> %llu bytes, ratio %.2f, %.1f us per datagram, %.1f MB/s\n",
+            (unsigned long long)res.raw_byte, (unsigned long long)res.sent_byte,
+            (double)res.raw_byte / (double)res.sent_byte,
+            1E6 * res.cpu_s / ((double)res.nb_dgram * bench_repeat),
+            (double)res.raw_byte * bench_repeat / res.cpu_s / 1E6);
+        nb_fail += (res.nb_bad > 0) ? 1 : 0;
+    }
+
+    return (nb_fail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
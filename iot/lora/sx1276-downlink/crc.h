@@ -0,0 +1,46 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : CRC computation
+        Table driven CRC16 (beacons) and CRC8 (MCU UART frames)
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_CRC_H
+#define _LORA_PKTFWD_CRC_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief CRC16 CCITT (polynomial 0x1021, init 0x0000, not reflected), as used in beacons
+@param data pointer to the data, may be NULL if size is 0
+@param size number of bytes
+@return CRC of the data, 0 if data is NULL
+*/
+uint16_t crc16_ccitt(const uint8_t *data, unsigned size);
+
+/**
+@brief CRC8 (polynomial 0x07, init 0x00, not reflected), as used on the MCU UART frames
+@param data pointer to the data
+@param size number of bytes
+@return CRC of the data
+*/
+uint8_t crc8_smbus(const uint8_t *data, unsigned size);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,203 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : CRC kernels
+        Checks crc16_ccitt and crc8_smbus bit-exact against the bit-serial
+        loops they replaced, then reports their throughput at frame sizes
+
+    Build, on the target or on the host:
+        cc -O2 -Wall -o crc_bench crc_bench.c crc.c
+
+    Run:
+        crc_bench                   check 100000 random buffers, then bench
+        crc_bench -n 1000000 -t 2   more buffers, 2 s per measure
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdio.h>          /* printf */
+#include <stdlib.h>         /* atoi, rand */
+#include <time.h>           /* clock_gettime */
+#include <unistd.h>         /* getopt */
+
+#include "crc.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* The references are the bit-serial crc16 of the beacon code and crc_check of
+ * the UART code, as they were before crc.c. Buffers are checked at random
+ * offsets, so the 8 and 4-byte steps of the kernels see every alignment and
+ * every remainder. */
+
+#define BENCH_BUF_MAX           1024
+#define BENCH_DEFAULT_NB        100000  /* random buffers checked */
+#define BENCH_DEFAULT_TIME_S    1       /* per measure */
+
+static const unsigned bench_size[] = {7, 17, 64, 255, 1024}; /* beacon field, beacon, UART frames */
+
+typedef uint32_t (*bench_fn)(const uint8_t *data, unsigned size);
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static volatile uint32_t sink; /* keeps the measured calls */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint16_t ref_crc16(const uint8_t *data, unsigned size) {
+    const uint16_t crc_poly = 0x1021;
+    uint16_t x = 0x0000;
+    unsigned i, j;
+
+    for (i = 0; i < size; ++i) {
+        x ^= (uint16_t)data[i] << 8;
+        for (j = 0; j < 8; ++j) {
+            x = (x & 0x8000) ? (x << 1) ^ crc_poly : (x << 1);
+        }
+    }
+    return x;
+}
+
+static uint8_t ref_crc8(const uint8_t *data, unsigned size) {
+    uint8_t crc_byte = 0x00;
+    unsigned i, j;
+
+    for (i = 0; i < size; i++) {
+        crc_byte ^= data[i];
+        for (j = 0; j < 8; j++) {
+            if (crc_byte & 0x80) {
+                crc_byte <<= 1;
+                crc_byte ^= 0x07;
+            } else
+                crc_byte <<= 1;
+        }
+    }
+    return crc_byte;
+}
+
+/* same prototype for all the measured functions */
+static uint32_t run_ref16(const uint8_t *d, unsigned n) { return ref_crc16(d, n); }
+static uint32_t run_crc16(const uint8_t *d, unsigned n) { return crc16_ccitt(d, n); }
+static uint32_t run_ref8(const uint8_t *d, unsigned n) { return ref_crc8(d, n); }
+static uint32_t run_crc8(const uint8_t *d, unsigned n) { return crc8_smbus(d, n); }
+
+static double mono_s(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1E9;
+}
+
+/* MB/s of fn over buffers of a given size, for about duration_s */
+static double measure(bench_fn fn, const uint8_t *buf, unsigned size, int duration_s) {
+    double start, elapsed;
+    uint64_t nb = 0;
+    uint32_t acc = 0;
+    int i;
+
+    start = mono_s();
+    do {
+        for (i = 0; i < 1000; i++) {
+            acc ^= fn(buf + (i & 63), size);
+        }
+        nb += 1000;
+        elapsed = mono_s() - start;
+    } while (elapsed < duration_s);
+    sink = acc;
+
+    return (double)nb * size / elapsed / 1E6;
+}
+
+static void usage(void) {
+    printf("Usage: crc_bench [-n buffers] [-t seconds]\n");
+    printf("  -n  random buffers checked against the bit-serial CRC, default %d\n", BENCH_DEFAULT_NB);
+    printf("  -t  duration of each throughput measure, default %d s\n", BENCH_DEFAULT_TIME_S);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    static uint8_t buf[BENCH_BUF_MAX + 64];
+    const uint8_t check[] = "123456789";
+    int nb_check = BENCH_DEFAULT_NB;
+    int duration_s = BENCH_DEFAULT_TIME_S;
+    int nb_fail = 0;
+    unsigned size, s;
+    int i, k;
+
+    while ((i = getopt(argc, argv, "hn:t:")) != -1) {
+        switch (i) {
+            case 'n':
+                nb_check = atoi(optarg);
+                break;
+            case 't':
+                duration_s = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if ((nb_check < 0) || (duration_s < 1)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    /* standard check values, then random buffers at random offsets */
+    if ((crc16_ccitt(check, 9) != 0x31C3) || (crc8_smbus(check, 9) != 0xF4)) {
+        printf("FAIL: check value of \"123456789\"\n");
+        nb_fail += 1;
+    }
+    if (crc16_ccitt(NULL, 0) != 0) {
+        printf("FAIL: crc16_ccitt of NULL\n");
+        nb_fail += 1;
+    }
+    srand(1);
+    for (i = 0; i < nb_check; i++) {
+        size = (unsigned)rand() % (BENCH_BUF_MAX + 1);
+        s = (unsigned)rand() % 64;
+        for (k = 0; k < (int)size; k++) {
+            buf[s + k] = (uint8_t)rand();
+        }
+        if ((crc16_ccitt(buf + s, size) != ref_crc16(buf + s, size)) ||
+            (crc8_smbus(buf + s, size) != ref_crc8(buf + s, size))) {
+            if (nb_fail < 10) {
+                printf("FAIL: buffer %d, %u bytes at offset %u\n", i, size, s);
+            }
+            nb_fail += 1;
+        }
+    }
+    printf("%d random buffers of 0 to %d bytes checked, %d mismatch\n", nb_check, BENCH_BUF_MAX, nb_fail);
+
+    /* throughput */
+    for (k = 0; k < BENCH_BUF_MAX + 64; k++) {
+        buf[k] = (uint8_t)rand();
+    }
+    printf("\n  size   crc16 MB/s: bit-serial  crc16_ccitt    crc8 MB/s: bit-serial  crc8_smbus\n");
+    for (i = 0; i < (int)(sizeof bench_size / sizeof bench_size[0]); i++) {
+        size = bench_size[i];
+        printf("%6u %22.0f %12.0f %21.0f %11.0f\n", size,
+            measure(run_ref16, buf, size, duration_s), measure(run_crc16, buf, size, duration_s),
+            measure(run_ref8, buf, size, duration_s), measure(run_crc8, buf, size, duration_s));
+        fflush(stdout);
+    }
+
+    return (nb_fail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
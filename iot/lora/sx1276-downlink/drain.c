@@ -0,0 +1,180 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : drain of the data_recovery backlog
+        Paces the datagrams replaying the stored packets once the server is
+        reachable again, so they do not delay the live uplinks
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <string.h>         /* memset */
+#include <time.h>           /* clock_gettime */
+#include <pthread.h>
+
+#include "trace.h"
+#include "tokenbucket.h"
+#include "drain.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* Datagrams in flight, oldest first. The backlog is released in order: a
+ * PUSH_ACK received out of order is kept until the older ones arrive. When the
+ * oldest one times out the whole window is resent, the server drops the
+ * duplicates. */
+
+struct drain_dgram_s {
+    uint8_t token_h;
+    uint8_t token_l;
+    bool acked;
+    uint32_t first_seq;     /* sequence number of its first stored packet */
+    uint32_t next_seq;      /* sequence number following its last stored packet */
+    uint16_t nb_pkt;
+    struct timespec send_time;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_drain = PTHREAD_MUTEX_INITIALIZER; /* control access to the drain state */
+
+static struct tokenbucket_s bucket;
+static unsigned window_max = DRAIN_DEFAULT_WINDOW;
+
+static struct drain_dgram_s window[DRAIN_WINDOW_MAX];
+static unsigned window_head;        /* oldest datagram in flight */
+static unsigned window_nb;
+static uint32_t cursor;             /* next stored packet to send */
+
+static struct drain_stat_s stat_acc;
+static struct timespec last_stat;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static long elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void drain_init(uint32_t rate, unsigned win) {
+    pthread_mutex_lock(&mx_drain);
+    tokenbucket_init(&bucket, rate);
+    window_max = ((win > 0) && (win <= DRAIN_WINDOW_MAX)) ? win : DRAIN_DEFAULT_WINDOW;
+    window_head = 0;
+    window_nb = 0;
+    cursor = 0; /* before any sequence number, pktstore_read starts from the oldest packet */
+    memset(&stat_acc, 0, sizeof stat_acc);
+    clock_gettime(CLOCK_MONOTONIC, &last_stat);
+    pthread_mutex_unlock(&mx_drain);
+}
+
+void drain_reset(void) {
+    pthread_mutex_lock(&mx_drain);
+    if (window_nb > 0) {
+        cursor = window[window_head].first_seq;
+        window_nb = 0;
+    }
+    pthread_mutex_unlock(&mx_drain);
+}
+
+bool drain_ready(uint32_t *seq) {
+    struct timespec now;
+    struct drain_dgram_s *oldest;
+    bool ready;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&mx_drain);
+
+    /* go back to the oldest datagram not acknowledged in time */
+    oldest = &window[window_head];
+    if ((window_nb > 0) && (oldest->acked == false) && (elapsed_ms(&oldest->send_time, &now) > DRAIN_ACK_TIMEOUT_MS)) {
+        MSG(LOG_INFO, "INFO: [drain] no PUSH_ACK for %u stored packets, resending %u datagrams\n", oldest->nb_pkt, window_nb);
+        cursor = oldest->first_seq;
+        window_nb = 0;
+        stat_acc.nb_dgram_timeout += 1;
+    }
+
+    ready = (window_nb < window_max) && tokenbucket_ready(&bucket);
+    *seq = cursor;
+    pthread_mutex_unlock(&mx_drain);
+
+    return ready;
+}
+
+void drain_sent(uint8_t token_h, uint8_t token_l, uint32_t seq, int nb_pkt, int nb_byte) {
+    struct drain_dgram_s *dgram;
+
+    pthread_mutex_lock(&mx_drain);
+    if (window_nb < DRAIN_WINDOW_MAX) {
+        dgram = &window[(window_head + window_nb) % DRAIN_WINDOW_MAX];
+        dgram->token_h = token_h;
+        dgram->token_l = token_l;
+        dgram->acked = false;
+        dgram->first_seq = cursor;
+        dgram->next_seq = seq;
+        dgram->nb_pkt = nb_pkt;
+        clock_gettime(CLOCK_MONOTONIC, &dgram->send_time);
+        window_nb += 1;
+    }
+    cursor = seq;
+    tokenbucket_take(&bucket, nb_byte);
+    stat_acc.nb_dgram_sent += 1;
+    pthread_mutex_unlock(&mx_drain);
+}
+
+bool drain_ack(uint8_t token_h, uint8_t token_l, uint32_t *seq) {
+    struct drain_dgram_s *dgram;
+    bool release = false;
+    unsigned i;
+
+    pthread_mutex_lock(&mx_drain);
+    for (i = 0; i < window_nb; i++) {
+        dgram = &window[(window_head + i) % DRAIN_WINDOW_MAX];
+        if ((dgram->token_h == token_h) && (dgram->token_l == token_l)) {
+            dgram->acked = true;
+            break;
+        }
+    }
+    while ((window_nb > 0) && (window[window_head].acked == true)) {
+        *seq = window[window_head].next_seq;
+        stat_acc.nb_pkt_acked += window[window_head].nb_pkt;
+        window_head = (window_head + 1) % DRAIN_WINDOW_MAX;
+        window_nb -= 1;
+        release = true;
+    }
+    pthread_mutex_unlock(&mx_drain);
+
+    return release;
+}
+
+void drain_stat(struct drain_stat_s *st) {
+    struct timespec now;
+    long dt;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&mx_drain);
+    dt = elapsed_ms(&last_stat, &now);
+    stat_acc.pkt_rate = (dt > 0) ? (1000.0 * stat_acc.nb_pkt_acked / dt) : 0.0;
+    *st = stat_acc;
+    memset(&stat_acc, 0, sizeof stat_acc);
+    last_stat = now;
+    pthread_mutex_unlock(&mx_drain);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
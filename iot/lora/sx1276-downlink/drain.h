@@ -0,0 +1,93 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : drain of the data_recovery backlog
+        Paces the datagrams replaying the stored packets once the server is
+        reachable again, so they do not delay the live uplinks
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_DRAIN_H
+#define _LORA_PKTFWD_DRAIN_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define DRAIN_WINDOW_MAX        16      /* max datagrams waiting for their PUSH_ACK */
+#define DRAIN_ACK_TIMEOUT_MS    1000    /* the backlog is resent from the oldest unacknowledged datagram after that */
+
+#define DRAIN_DEFAULT_RATE      4096    /* bytes per second, 0 = not limited */
+#define DRAIN_DEFAULT_WINDOW    4
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct drain_stat_s {
+    uint32_t nb_pkt_acked;      /* stored packets acknowledged by the server */
+    uint32_t nb_dgram_sent;     /* datagrams sent, resent ones included */
+    uint32_t nb_dgram_timeout;  /* times the backlog was resent after a missing PUSH_ACK */
+    float pkt_rate;             /* acknowledged packets per second */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Set the drain pace
+@param rate max bytes per second, 0 for no limit
+@param window max datagrams waiting for their PUSH_ACK, DRAIN_DEFAULT_WINDOW if out of 1 to DRAIN_WINDOW_MAX
+*/
+void drain_init(uint32_t rate, unsigned window);
+
+/**
+@brief Forget the datagrams in flight, the next ones restart from the oldest unacknowledged packet
+*/
+void drain_reset(void);
+
+/**
+@brief Tell whether a datagram can be sent now
+@param seq set to the sequence number of the next stored packet to send
+@return true if the window and the byte rate allow a datagram
+*/
+bool drain_ready(uint32_t *seq);
+
+/**
+@brief Record a datagram sent
+@param token_h token_l PUSH_DATA token
+@param seq sequence number following the last packet of the datagram, as set by pktstore_read
+@param nb_pkt number of stored packets in the datagram
+@param nb_byte datagram size
+*/
+void drain_sent(uint8_t token_h, uint8_t token_l, uint32_t seq, int nb_pkt, int nb_byte);
+
+/**
+@brief Apply a PUSH_ACK
+@param token_h token_l token of the PUSH_ACK
+@param seq set to the sequence number up to which the stored packets can be released
+@return true if seq was set
+*/
+bool drain_ack(uint8_t token_h, uint8_t token_l, uint32_t *seq);
+
+/**
+@brief Get the drain statistics since the last call
+@param st pointer to the structure to be filled
+*/
+void drain_stat(struct drain_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
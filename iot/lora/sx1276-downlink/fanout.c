@@ -0,0 +1,549 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : additional network servers
+        Routes the uplinks serialized for the main server to other servers
+        by DevAddr or JoinEUI, and hands their downlinks to thread_down
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* snprintf */
+#include <stdlib.h>         /* strtoull, rand */
+#include <string.h>         /* memset, strncpy */
+#include <errno.h>          /* error messages */
+#include <time.h>           /* clock_gettime */
+#include <unistd.h>         /* close, pipe, read, write */
+#include <fcntl.h>          /* fcntl */
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>     /* socket specific definitions */
+#include <sys/uio.h>        /* iovec */
+#include <netdb.h>          /* getaddrinfo */
+
+#include "trace.h"
+#include "protocol.h"
+#include "fanout.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* The PUSH_DATA of a server is gathered with sendmsg from the rxpk objects
+ * serialized by thread_up for the main server, nothing is copied. Each server
+ * has a thread of its own receiving its ACKs and PULL_RESP; a PULL_RESP is
+ * queued for thread_down, which handles it like one from the main server and
+ * sends the TX_ACK back with fanout_send. */
+
+#define FANOUT_IOV_MAX      72      /* header, rxpk objects and separators, stat */
+#define FANOUT_QUEUE_NB     8       /* PULL_RESP waiting for thread_down */
+#define FANOUT_RETRY_S      10      /* nb of s between two connection attempts */
+#define FANOUT_POLL_MS      100     /* nb of ms between two keep-alive checks */
+
+enum route_key_e {
+    ROUTE_ALL,
+    ROUTE_DEVADDR,
+    ROUTE_JOINEUI
+};
+
+struct route_s {
+    enum route_key_e key;
+    uint64_t value;         /* masked to its prefix length */
+    uint8_t len;            /* prefix length in bits */
+};
+
+struct server_s {
+    char addr[64];
+    char port_up[8];
+    char port_down[8];
+    struct route_s route[FANOUT_ROUTE_MAX];
+    int nb_route;
+    int sock_up;            /* -1 until connected */
+    int sock_down;
+    uint8_t push_token[2];  /* token of the latest PUSH_DATA, set by fanout_push */
+    uint8_t pull_token[2];
+    pthread_t thrid;
+    pthread_mutex_t mx;     /* control access to the tokens and the statistics */
+    struct fanout_stat_s stat;
+};
+
+struct queued_s {
+    int server;
+    int size;
+    uint8_t data[FANOUT_DOWN_SIZE];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static struct server_s servers[FANOUT_SERVER_MAX];
+static int nb_server = 0;
+static uint32_t net_mac_h;
+static uint32_t net_mac_l;
+static int keepalive_time;
+
+static pthread_mutex_t mx_queue = PTHREAD_MUTEX_INITIALIZER; /* control access to the PULL_RESP queue */
+static struct queued_s queue[FANOUT_QUEUE_NB];
+static int queue_first = 0;
+static int queue_nb = 0;
+static int queue_pipe[2] = {-1, -1}; /* one byte per queued PULL_RESP */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t prefix_mask(unsigned len, unsigned bits) {
+    return (len == 0) ? 0 : (~0ULL << (bits - len)) & ((bits == 64) ? ~0ULL : ((1ULL << bits) - 1));
+}
+
+static int parse_route(const char *str, struct route_s *r) {
+    unsigned bits;
+    char *end;
+    const char *p;
+
+    if (strcmp(str, "all") == 0) {
+        r->key = ROUTE_ALL;
+        r->value = 0;
+        r->len = 0;
+        return 0;
+    }
+    if (strncmp(str, "devaddr:", 8) == 0) {
+        r->key = ROUTE_DEVADDR;
+        bits = 32;
+    } else if (strncmp(str, "joineui:", 8) == 0) {
+        r->key = ROUTE_JOINEUI;
+        bits = 64;
+    } else {
+        return -1;
+    }
+    p = str + 8;
+    errno = 0;
+    r->value = strtoull(p, &end, 16);
+    if ((end == p) || (errno != 0) || ((bits == 32) && (r->value > 0xFFFFFFFFULL))) {
+        return -1;
+    }
+    r->len = bits;
+    if (*end == '/') {
+        p = end + 1;
+        r->len = (uint8_t)strtoul(p, &end, 10);
+        if ((end == p) || (r->len > bits)) {
+            return -1;
+        }
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    r->value &= prefix_mask(r->len, bits);
+    return 0;
+}
+
+static int open_socket(const char *addr, const char *port) {
+    struct addrinfo hints;
+    struct addrinfo *result;
+    struct addrinfo *q;
+    int sock = -1;
+    int i;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET; /* as for the main server */
+    hints.ai_socktype = SOCK_DGRAM;
+    i = getaddrinfo(addr, port, &hints, &result);
+    if (i != 0) {
+        MSG(LOG_ERR, "ERROR: [fanout] getaddrinfo on address %s (port %s) returned %s\n", addr, port, gai_strerror(i));
+        return -1;
+    }
+    for (q = result; q != NULL; q = q->ai_next) {
+        sock = socket(q->ai_family, q->ai_socktype, q->ai_protocol);
+        if (sock == -1) {
+            continue;
+        }
+        if (connect(sock, q->ai_addr, q->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(result);
+    if (sock == -1) {
+        MSG(LOG_ERR, "ERROR: [fanout] failed to connect to %s (port %s)\n", addr, port);
+    }
+    return sock;
+}
+
+static void queue_down(int server, const uint8_t *data, int size) {
+    struct queued_s *q;
+
+    if (size > FANOUT_DOWN_SIZE) {
+        MSG(LOG_WARNING, "WARNING: [fanout] PULL_RESP of %d bytes from server %d dropped\n", size, server);
+        return;
+    }
+    pthread_mutex_lock(&mx_queue);
+    if (queue_nb == FANOUT_QUEUE_NB) {
+        pthread_mutex_unlock(&mx_queue);
+        MSG(LOG_WARNING, "WARNING: [fanout] downlink queue full, PULL_RESP from server %d dropped\n", server);
+        return;
+    }
+    q = &queue[(queue_first + queue_nb) % FANOUT_QUEUE_NB];
+    q->server = server;
+    q->size = size;
+    memcpy(q->data, data, size);
+    queue_nb += 1;
+    pthread_mutex_unlock(&mx_queue);
+    if (write(queue_pipe[1], "", 1) != 1) {
+        MSG(LOG_WARNING, "WARNING: [fanout] failed to wake thread_down: %s\n", strerror(errno));
+    }
+}
+
+static void *thread_server(void *arg) {
+    struct server_s *s = arg;
+    int server = (int)(s - servers) + 1;
+    uint8_t buff_req[12];
+    uint8_t buff[FANOUT_DOWN_SIZE + 1];
+    struct pollfd pfd[2];
+    struct timespec now;
+    time_t next_pull = 0;
+    int n;
+
+    buff_req[0] = PROTOCOL_VERSION;
+    buff_req[3] = PKT_PULL_DATA;
+    memcpy(buff_req + 4, &net_mac_h, 4);
+    memcpy(buff_req + 8, &net_mac_l, 4);
+
+    for (;;) {
+        /* connect, the other servers and the main one keep running meanwhile */
+        if (s->sock_up < 0) {
+            s->sock_down = open_socket(s->addr, s->port_down);
+            n = (s->sock_down < 0) ? -1 : open_socket(s->addr, s->port_up);
+            if (n < 0) {
+                if (s->sock_down >= 0) {
+                    close(s->sock_down);
+                }
+                sleep(FANOUT_RETRY_S);
+                continue;
+            }
+            __atomic_store_n(&s->sock_up, n, __ATOMIC_RELEASE);
+            MSG(LOG_NOTICE, "INFO: [fanout] connected to server %d %s\n", server, s->addr);
+        }
+
+        /* keep-alive */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec >= next_pull) {
+            pthread_mutex_lock(&s->mx);
+            s->pull_token[0] = buff_req[1] = (uint8_t)rand();
+            s->pull_token[1] = buff_req[2] = (uint8_t)rand();
+            s->stat.pull_sent += 1;
+            pthread_mutex_unlock(&s->mx);
+            send(s->sock_down, buff_req, sizeof buff_req, MSG_DONTWAIT);
+            next_pull = now.tv_sec + keepalive_time;
+        }
+
+        pfd[0].fd = s->sock_up;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = s->sock_down;
+        pfd[1].events = POLLIN;
+        if (poll(pfd, 2, FANOUT_POLL_MS) <= 0) {
+            continue;
+        }
+
+        /* PUSH_ACK */
+        if (pfd[0].revents & POLLIN) {
+            n = recv(s->sock_up, buff, sizeof buff, MSG_DONTWAIT);
+            if ((n >= 4) && (buff[0] == PROTOCOL_VERSION) && (buff[3] == PKT_PUSH_ACK)) {
+                pthread_mutex_lock(&s->mx);
+                if ((buff[1] == s->push_token[0]) && (buff[2] == s->push_token[1])) {
+                    s->stat.ack_rcv += 1;
+                }
+                pthread_mutex_unlock(&s->mx);
+            }
+        }
+
+        /* PULL_ACK and PULL_RESP */
+        if (pfd[1].revents & POLLIN) {
+            n = recv(s->sock_down, buff, sizeof buff, MSG_DONTWAIT);
+            if ((n < 4) || (buff[0] != PROTOCOL_VERSION)) {
+                continue;
+            }
+            if (buff[3] == PKT_PULL_ACK) {
+                pthread_mutex_lock(&s->mx);
+                if ((buff[1] == s->pull_token[0]) && (buff[2] == s->pull_token[1])) {
+                    s->stat.pull_ack_rcv += 1;
+                }
+                pthread_mutex_unlock(&s->mx);
+            } else if (buff[3] == PKT_PULL_RESP) {
+                pthread_mutex_lock(&s->mx);
+                s->stat.dgram_rcv += 1;
+                pthread_mutex_unlock(&s->mx);
+                queue_down(server, buff, n);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int fanout_add(const char *addr, const char *port_up, const char *port_down, const char * const *route, int nb_route) {
+    struct server_s *s;
+    int i;
+
+    if (nb_server == FANOUT_SERVER_MAX) {
+        MSG(LOG_ERR, "ERROR: [fanout] more than %d additional servers\n", FANOUT_SERVER_MAX);
+        return -1;
+    }
+    if (nb_route > FANOUT_ROUTE_MAX) {
+        MSG(LOG_ERR, "ERROR: [fanout] more than %d routes for server %s\n", FANOUT_ROUTE_MAX, addr);
+        return -1;
+    }
+    s = &servers[nb_server];
+    memset(s, 0, sizeof *s);
+    for (i = 0; i < nb_route; i++) {
+        if (parse_route(route[i], &s->route[i]) != 0) {
+            MSG(LOG_ERR, "ERROR: [fanout] invalid route \"%s\" for server %s\n", route[i], addr);
+            return -1;
+        }
+    }
+    if (nb_route == 0) {
+        s->route[0].key = ROUTE_ALL;
+        nb_route = 1;
+    }
+    s->nb_route = nb_route;
+    strncpy(s->addr, addr, sizeof s->addr - 1);
+    strncpy(s->port_up, port_up, sizeof s->port_up - 1);
+    strncpy(s->port_down, port_down, sizeof s->port_down - 1);
+    s->sock_up = -1;
+    s->sock_down = -1;
+    s->stat.addr = s->addr;
+    pthread_mutex_init(&s->mx, NULL);
+    nb_server += 1;
+    return nb_server;
+}
+
+int fanout_count(void) {
+    return nb_server;
+}
+
+int fanout_start(uint32_t mac_h, uint32_t mac_l, int keepalive_s) {
+    int i;
+
+    if (nb_server == 0) {
+        return 0;
+    }
+    net_mac_h = mac_h;
+    net_mac_l = mac_l;
+    keepalive_time = (keepalive_s > 0) ? keepalive_s : 1;
+    if ((pipe(queue_pipe) != 0) || (fcntl(queue_pipe[0], F_SETFL, O_NONBLOCK) != 0) || (fcntl(queue_pipe[1], F_SETFL, O_NONBLOCK) != 0)) {
+        MSG(LOG_ERR, "ERROR: [fanout] failed to create the downlink queue: %s\n", strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < nb_server; i++) {
+        if (pthread_create(&servers[i].thrid, NULL, thread_server, &servers[i]) != 0) {
+            MSG(LOG_ERR, "ERROR: [fanout] impossible to create the thread of server %d\n", i + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void fanout_stop(void) {
+    int i;
+
+    for (i = 0; i < nb_server; i++) {
+        pthread_cancel(servers[i].thrid);
+        pthread_join(servers[i].thrid, NULL);
+    }
+}
+
+unsigned fanout_route(const uint8_t *payload, uint16_t size) {
+    const struct server_s *s;
+    const struct route_s *r;
+    unsigned mask = 0;
+    uint64_t value = 0;
+    enum route_key_e key = ROUTE_ALL;
+    int i, j;
+
+    if (size > 0) {
+        if (LORAWAN_DATA_UP(payload, size)) {
+            key = ROUTE_DEVADDR;
+            value = LORAWAN_DEVADDR(payload);
+        } else if ((LORAWAN_MTYPE(payload) == MTYPE_JOIN_REQUEST) && (size == LORAWAN_JOIN_SIZE)) {
+            key = ROUTE_JOINEUI;
+            for (i = 8; i >= 1; i--) { /* little endian on air */
+                value = (value << 8) | payload[i];
+            }
+        }
+    }
+
+    for (i = 0; i < nb_server; i++) {
+        s = &servers[i];
+        for (j = 0; j < s->nb_route; j++) {
+            r = &s->route[j];
+            if ((r->key == ROUTE_ALL) ||
+                ((r->key == key) && ((value & prefix_mask(r->len, (key == ROUTE_DEVADDR) ? 32 : 64)) == r->value))) {
+                mask |= 1U << i;
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+void fanout_push(const struct fanout_frag_s *frag, int nb_frag, const uint8_t *stat, int stat_size) {
+    static const char rxpk_open[] = "{\"rxpk\":[";
+    struct server_s *s;
+    struct iovec iov[FANOUT_IOV_MAX];
+    struct msghdr msg;
+    const uint8_t *part_stat;
+    uint8_t hdr[12];
+    int sock;
+    int nb_iov, nb_pkt;
+    bool last;
+    int i, j;
+
+    hdr[0] = PROTOCOL_VERSION;
+    hdr[3] = PKT_PUSH_DATA;
+    memcpy(hdr + 4, &net_mac_h, 4);
+    memcpy(hdr + 8, &net_mac_l, 4);
+
+    for (i = 0; i < nb_server; i++) {
+        s = &servers[i];
+        sock = __atomic_load_n(&s->sock_up, __ATOMIC_ACQUIRE);
+        if (sock < 0) {
+            continue;
+        }
+
+        /* all the datagrams of one push share a token, each gets its own PUSH_ACK */
+        pthread_mutex_lock(&s->mx);
+        s->push_token[0] = hdr[1] = (uint8_t)rand();
+        s->push_token[1] = hdr[2] = (uint8_t)rand();
+        pthread_mutex_unlock(&s->mx);
+
+        /* more rxpk than iovecs: split them over several datagrams, the stat goes with the last one */
+        j = 0;
+        do {
+            /* header, then "{" or "{"rxpk":[" */
+            nb_iov = 1;
+            nb_pkt = 0;
+            iov[0].iov_base = hdr;
+            iov[0].iov_len = sizeof hdr;
+            iov[1].iov_base = (void *)rxpk_open;
+            iov[1].iov_len = 1;
+            nb_iov += 1;
+            for (; (j < nb_frag) && (nb_iov < FANOUT_IOV_MAX - 4); j++) {
+                if ((frag[j].mask & (1U << i)) == 0) {
+                    continue;
+                }
+                if (nb_pkt == 0) {
+                    iov[1].iov_len = sizeof rxpk_open - 1;
+                } else {
+                    iov[nb_iov].iov_base = (void *)",";
+                    iov[nb_iov].iov_len = 1;
+                    nb_iov += 1;
+                }
+                iov[nb_iov].iov_base = (void *)frag[j].data;
+                iov[nb_iov].iov_len = frag[j].size;
+                nb_iov += 1;
+                nb_pkt += 1;
+            }
+            while ((j < nb_frag) && ((frag[j].mask & (1U << i)) == 0)) {
+                j++; /* not for that server, does not need another datagram */
+            }
+            last = (j == nb_frag);
+            part_stat = (last == true) ? stat : NULL;
+            if ((nb_pkt == 0) && (part_stat == NULL)) {
+                break;
+            }
+            if (nb_pkt > 0) {
+                iov[nb_iov].iov_base = (void *)((part_stat != NULL) ? "]," : "]");
+                iov[nb_iov].iov_len = (part_stat != NULL) ? 2 : 1;
+                nb_iov += 1;
+            }
+            if (part_stat != NULL) {
+                iov[nb_iov].iov_base = (void *)part_stat;
+                iov[nb_iov].iov_len = stat_size;
+                nb_iov += 1;
+            }
+            iov[nb_iov].iov_base = (void *)"}";
+            iov[nb_iov].iov_len = 1;
+            nb_iov += 1;
+
+            pthread_mutex_lock(&s->mx);
+            s->stat.dgram_sent += 1;
+            s->stat.pkt_fwd += nb_pkt;
+            pthread_mutex_unlock(&s->mx);
+
+            memset(&msg, 0, sizeof msg);
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nb_iov;
+            sendmsg(sock, &msg, MSG_DONTWAIT);
+        } while (last == false);
+    }
+}
+
+int fanout_down_fd(void) {
+    return queue_pipe[0];
+}
+
+int fanout_down_pop(uint8_t *buff, int size, int *server) {
+    struct queued_s *q;
+    uint8_t byte;
+    int n = -1;
+
+    if (read(queue_pipe[0], &byte, 1) != 1) {
+        return -1;
+    }
+    pthread_mutex_lock(&mx_queue);
+    if (queue_nb > 0) {
+        q = &queue[queue_first];
+        n = (q->size < size) ? q->size : size;
+        memcpy(buff, q->data, n);
+        *server = q->server;
+        queue_first = (queue_first + 1) % FANOUT_QUEUE_NB;
+        queue_nb -= 1;
+    }
+    pthread_mutex_unlock(&mx_queue);
+    return n;
+}
+
+int fanout_send(int server, const uint8_t *buff, int size) {
+    struct server_s *s;
+
+    if ((server < 1) || (server > nb_server)) {
+        return -1;
+    }
+    s = &servers[server - 1];
+    if (__atomic_load_n(&s->sock_up, __ATOMIC_ACQUIRE) < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&s->mx);
+    s->stat.tx_ack_sent += 1;
+    pthread_mutex_unlock(&s->mx);
+    return send(s->sock_down, buff, size, MSG_DONTWAIT);
+}
+
+void fanout_stat(int server, struct fanout_stat_s *st) {
+    struct server_s *s;
+
+    memset(st, 0, sizeof *st);
+    if ((server < 1) || (server > nb_server)) {
+        return;
+    }
+    s = &servers[server - 1];
+    pthread_mutex_lock(&s->mx);
+    *st = s->stat;
+    memset(&s->stat, 0, sizeof s->stat);
+    s->stat.addr = s->addr;
+    pthread_mutex_unlock(&s->mx);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
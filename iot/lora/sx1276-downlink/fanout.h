@@ -0,0 +1,145 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : additional network servers
+        Routes the uplinks serialized for the main server to other servers
+        by DevAddr or JoinEUI, and hands their downlinks to thread_down
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_FANOUT_H
+#define _LORA_PKTFWD_FANOUT_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* Servers are numbered from 1, 0 being the main server. A route is "all",
+ * "devaddr:<hex>/<bits>" or "joineui:<hex>/<bits>"; an uplink goes to a server
+ * if one of its routes matches it. Data frames are matched on their DevAddr,
+ * join requests on their JoinEUI, other frames only by "all". */
+
+#define FANOUT_SERVER_MAX   4
+#define FANOUT_ROUTE_MAX    16      /* routes per server */
+#define FANOUT_DOWN_SIZE    1000    /* largest PULL_RESP handed to thread_down */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/* part of a PUSH_DATA already serialized for the main server */
+struct fanout_frag_s {
+    const uint8_t *data;    /* rxpk JSON object, braces included */
+    uint16_t size;
+    unsigned mask;          /* bit n-1 set if server n takes it, see fanout_route */
+};
+
+struct fanout_stat_s {
+    const char *addr;       /* server address, as configured */
+    uint32_t pkt_fwd;       /* rxpk sent */
+    uint32_t dgram_sent;    /* PUSH_DATA sent */
+    uint32_t ack_rcv;       /* PUSH_ACK received */
+    uint32_t pull_sent;     /* PULL_DATA sent */
+    uint32_t pull_ack_rcv;  /* PULL_ACK received */
+    uint32_t dgram_rcv;     /* PULL_RESP received */
+    uint32_t tx_ack_sent;   /* TX_ACK sent */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Declare an additional server, before fanout_start
+@param addr host name or IPv4 address
+@param port_up port for PUSH_DATA
+@param port_down port for PULL_DATA
+@param route routes of the server
+@param nb_route number of routes, 0 to send it every uplink
+@return server number, -1 if there are too many servers or a route is invalid
+*/
+int fanout_add(const char *addr, const char *port_up, const char *port_down, const char * const *route, int nb_route);
+
+/**
+@brief Number of additional servers
+*/
+int fanout_count(void);
+
+/**
+@brief Start one thread per server, they connect and keep the connection alive
+@param mac_h mac_l gateway identifier, network order
+@param keepalive_s interval between two PULL_DATA
+@return 0 if the threads were started, -1 otherwise
+*/
+int fanout_start(uint32_t mac_h, uint32_t mac_l, int keepalive_s);
+
+/**
+@brief Stop the server threads
+*/
+void fanout_stop(void);
+
+/**
+@brief Select the servers an uplink goes to
+@param payload LoRaWAN frame
+@param size size of the frame
+@return server mask for fanout_frag_s
+*/
+unsigned fanout_route(const uint8_t *payload, uint16_t size);
+
+/**
+@brief Send the uplinks and the status report to the additional servers
+@param frag rxpk objects, each sent to the servers of its mask
+@param nb_frag number of rxpk objects
+@param stat "stat" member as sent to the main server, NULL if none
+@param stat_size size of the stat member
+
+Each server gets one PUSH_DATA pointing to the given bytes, it is only sent
+if it has an rxpk or a status report. Too many rxpk for one datagram are
+split over several, with the same token, the status report in the last one.
+*/
+void fanout_push(const struct fanout_frag_s *frag, int nb_frag, const uint8_t *stat, int stat_size);
+
+/**
+@brief File descriptor readable while a PULL_RESP waits for fanout_down_pop
+@return descriptor, -1 if there is no additional server
+*/
+int fanout_down_fd(void);
+
+/**
+@brief Take the oldest PULL_RESP received from an additional server
+@param buff buffer to be filled
+@param size size of the buffer
+@param server set to the server the datagram came from
+@return size of the datagram, -1 if there is none
+*/
+int fanout_down_pop(uint8_t *buff, int size, int *server);
+
+/**
+@brief Send a TX_ACK to the server a downlink came from
+@param server server number, from 1
+@param buff datagram
+@param size size of the datagram
+@return send return value
+*/
+int fanout_send(int server, const uint8_t *buff, int size);
+
+/**
+@brief Get the statistics of a server since the last call
+@param server server number, from 1
+@param st pointer to the structure to be filled
+*/
+void fanout_stat(int server, struct fanout_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
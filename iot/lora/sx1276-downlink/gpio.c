@@ -0,0 +1,125 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : reset lines
+        Drives the concentrator reset GPIOs through sysfs, all boards being
+        pulsed together
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdio.h>          /* snprintf */
+#include <string.h>         /* strlen */
+#include <errno.h>          /* error messages */
+#include <time.h>           /* nanosleep */
+#include <fcntl.h>          /* open */
+#include <unistd.h>         /* write, close, access */
+
+#include "trace.h"
+#include "gpio.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define GPIO_PIN_MAX        8       /* lines pulsed together */
+#define GPIO_SYSFS          "/sys/class/gpio"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static void sleep_us(long us) {
+    struct timespec t = {us / 1000000, (us % 1000000) * 1000};
+
+    while ((nanosleep(&t, &t) != 0) && (errno == EINTR));
+}
+
+static int write_str(const char *path, const char *str) {
+    int fd, n;
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    n = write(fd, str, strlen(str));
+    close(fd);
+    return (n == (int)strlen(str)) ? 0 : -1;
+}
+
+/* export the line if needed and drive it high, the value file is left open for the falling edge */
+static int line_high(uint32_t pin) {
+    char path[64];
+    char num[16];
+    int i;
+
+    snprintf(path, sizeof path, GPIO_SYSFS "/gpio%u/direction", pin);
+    if (access(path, F_OK) != 0) {
+        snprintf(num, sizeof num, "%u", pin);
+        if (write_str(GPIO_SYSFS "/export", num) != 0) {
+            MSG(LOG_ERR, "ERROR: [gpio] failed to export GPIO %u: %s\n", pin, strerror(errno));
+            return -1;
+        }
+    }
+    /* "high" sets the direction and the level in one write, retried while udev sets the permissions */
+    for (i = 0; write_str(path, "high") != 0; i++) {
+        if (i >= GPIO_EXPORT_WAIT_MS) {
+            MSG(LOG_ERR, "ERROR: [gpio] failed to drive GPIO %u: %s\n", pin, strerror(errno));
+            return -1;
+        }
+        sleep_us(1000);
+    }
+    snprintf(path, sizeof path, GPIO_SYSFS "/gpio%u/value", pin);
+    return open(path, O_WRONLY);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int gpio_reset_pulse(const uint32_t *pins, int nb) {
+    int value_fd[GPIO_PIN_MAX];
+    char path[64];
+    int err = 0;
+    int i;
+
+    if (nb > GPIO_PIN_MAX) {
+        nb = GPIO_PIN_MAX;
+    }
+    for (i = 0; i < nb; i++) {
+        value_fd[i] = (pins[i] == 0) ? -1 : line_high(pins[i]);
+        if ((pins[i] != 0) && (value_fd[i] < 0)) {
+            err = -1;
+        }
+    }
+    sleep_us(GPIO_RESET_PULSE_US);
+    for (i = 0; i < nb; i++) {
+        if (value_fd[i] < 0) {
+            continue;
+        }
+        if (write(value_fd[i], "0", 1) != 1) {
+            MSG(LOG_ERR, "ERROR: [gpio] failed to release GPIO %u: %s\n", pins[i], strerror(errno));
+            err = -1;
+        }
+        close(value_fd[i]);
+    }
+    sleep_us(GPIO_RESET_SETTLE_US);
+    for (i = 0; i < nb; i++) {
+        if (pins[i] == 0) {
+            continue;
+        }
+        snprintf(path, sizeof path, GPIO_SYSFS "/gpio%u/direction", pins[i]);
+        write_str(path, "in");
+    }
+    return err;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,49 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : reset lines
+        Drives the concentrator reset GPIOs through sysfs, all boards being
+        pulsed together
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_GPIO_H
+#define _LORA_PKTFWD_GPIO_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* The line is driven high for the pulse, low for the settle time, then left
+ * as an input as the board pulls it down by itself. */
+
+#define GPIO_RESET_PULSE_US     1000    /* reset line held high */
+#define GPIO_RESET_SETTLE_US    5000    /* low before the concentrator is accessed */
+#define GPIO_EXPORT_WAIT_MS     200     /* time for udev to give access to a newly exported line */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Pulse the reset line of several concentrators at once
+@param pins sysfs GPIO numbers, 0 for a board without reset line
+@param nb number of pins
+@return 0 if every line was pulsed, -1 if one of them could not be driven
+*/
+int gpio_reset_pulse(const uint32_t *pins, int nb);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
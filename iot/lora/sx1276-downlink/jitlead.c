@@ -0,0 +1,151 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : JIT lead time tuning
+        Learns the dispatch latency of each SX1276 and shifts the time given
+        to the JIT queue so that packets are handed to the MCU just in time
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdlib.h>         /* qsort */
+#include <string.h>         /* memcpy */
+#include <pthread.h>
+
+#include "trace.h"
+#include "jitqueue.h"
+#include "jitlead.h"
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* Windows applied by jitqueue.c, relative to the time it is given. Upstream
+   keeps its delays private to jitqueue.c, the values are restated here unless
+   a jitqueue.h exports them. */
+#ifndef TX_JIT_DELAY
+#define TX_JIT_DELAY            30000   /* packets are peeked this long before TX */
+#endif
+#ifndef TX_START_DELAY
+#define TX_START_DELAY          1500
+#endif
+#ifndef TX_MARGIN_DELAY
+#define TX_MARGIN_DELAY         1000
+#endif
+
+#define JIT_TX_DISPATCH_US      TX_JIT_DELAY
+#define JIT_TX_TOO_LATE_US      (TX_START_DELAY + TX_MARGIN_DELAY + TX_JIT_DELAY)
+#define JIT_TX_TOO_EARLY_S      ((JIT_NUM_BEACON_IN_QUEUE + 1) * 128) /* TX_MAX_ADVANCE_DELAY, in seconds */
+
+#define JITLEAD_TICK_US         10000   /* thread_jit polling period */
+#define JITLEAD_SAMPLE_NB       64      /* dispatch latencies the percentile is computed on */
+#define JITLEAD_SAMPLE_MIN      8       /* no correction before that many samples */
+#define JITLEAD_MAX_US          500000  /* upper bound of the lead time */
+
+struct jitlead_radio_s {
+    uint32_t sample[JITLEAD_SAMPLE_NB];
+    int nb_sample;
+    int wr_idx;
+    uint32_t latency_us;    /* latency percentile of the recent dispatches */
+    int32_t shift_us;       /* added to the concentrator time given to the JIT queue */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_jitlead = PTHREAD_MUTEX_INITIALIZER; /* control access to the samples */
+static struct jitlead_radio_s lead[SUPPORT_SX1276_MAX];
+static double lead_percentile = JITLEAD_DEFAULT_PERCENTILE;
+static uint32_t lead_margin_us = JITLEAD_DEFAULT_MARGIN_US;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int compare_uint32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void jitlead_init(double percentile, uint32_t margin_us) {
+    if ((percentile < 50.0) || (percentile > 100.0)) {
+        MSG(LOG_WARNING, "WARNING: [jitlead] invalid percentile %.1f, using %.1f\n", percentile, JITLEAD_DEFAULT_PERCENTILE);
+        percentile = JITLEAD_DEFAULT_PERCENTILE;
+    }
+    pthread_mutex_lock(&mx_jitlead);
+    lead_percentile = percentile;
+    lead_margin_us = margin_us;
+    pthread_mutex_unlock(&mx_jitlead);
+}
+
+void jitlead_record(int radio, uint32_t latency_us) {
+    struct jitlead_radio_s *r = &lead[radio];
+    uint32_t sorted[JITLEAD_SAMPLE_NB];
+    int64_t target_us;
+    int idx;
+
+    pthread_mutex_lock(&mx_jitlead);
+    r->sample[r->wr_idx] = latency_us;
+    r->wr_idx = (r->wr_idx + 1) % JITLEAD_SAMPLE_NB;
+    if (r->nb_sample < JITLEAD_SAMPLE_NB) {
+        r->nb_sample++;
+    }
+
+    if (r->nb_sample >= JITLEAD_SAMPLE_MIN) {
+        memcpy(sorted, r->sample, r->nb_sample * sizeof(uint32_t));
+        qsort(sorted, r->nb_sample, sizeof(uint32_t), compare_uint32);
+        idx = (int)((lead_percentile / 100.0) * (double)(r->nb_sample - 1) + 0.5);
+        r->latency_us = sorted[idx];
+
+        /* the packet must be dispatched early enough to absorb the polling period and the write latency */
+        target_us = (int64_t)r->latency_us + JITLEAD_TICK_US + lead_margin_us;
+        if (target_us > JITLEAD_MAX_US) {
+            target_us = JITLEAD_MAX_US;
+        }
+        __atomic_store_n(&(r->shift_us), (int32_t)(target_us - JIT_TX_DISPATCH_US), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&mx_jitlead);
+}
+
+struct timeval jitlead_time(int radio, struct timeval concent_time) {
+    int32_t shift_us = __atomic_load_n(&(lead[radio].shift_us), __ATOMIC_RELAXED);
+    int64_t time_us = (int64_t)concent_time.tv_sec * 1000000 + concent_time.tv_usec + shift_us;
+
+    /* the JIT queue acts as if it was later by shift_us: it dispatches and rejects (TOO_LATE) earlier */
+    concent_time.tv_sec = (time_t)(time_us / 1000000);
+    concent_time.tv_usec = (suseconds_t)(time_us % 1000000);
+    if (concent_time.tv_usec < 0) {
+        --concent_time.tv_sec;
+        concent_time.tv_usec += 1000000;
+    }
+    return concent_time;
+}
+
+void jitlead_report(void) {
+    int32_t shift_us;
+    int i;
+
+    for (i = 0; i < SUPPORT_SX1276_MAX; i++) {
+        /* no need for mutex, display is not critical */
+        shift_us = lead[i].shift_us;
+        MSG(LOG_NOTICE,"# JIT sx1276 %d: dispatch latency p%.1f %u us (%d samples), TX lead %d us, TOO_LATE under %d us, TOO_EARLY over %d s\n",
+            i, lead_percentile, lead[i].latency_us, lead[i].nb_sample,
+            JIT_TX_DISPATCH_US + shift_us, JIT_TX_TOO_LATE_US + shift_us, JIT_TX_TOO_EARLY_S + shift_us / 1000000);
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,65 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : JIT lead time tuning
+        Learns the dispatch latency of each SX1276 and shifts the time given
+        to the JIT queue so that packets are handed to the MCU just in time
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_JITLEAD_H
+#define _LORA_PKTFWD_JITLEAD_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <sys/time.h>       /* timeval */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define JITLEAD_DEFAULT_PERCENTILE  99.0    /* dispatch latency percentile the lead is based on */
+#define JITLEAD_DEFAULT_MARGIN_US   2000    /* added to the measured latency */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Configure the lead time tuning
+@param percentile dispatch latency percentile to cover, between 50 and 100
+@param margin_us safety margin added to that percentile
+*/
+void jitlead_init(double percentile, uint32_t margin_us);
+
+/**
+@brief Record the latency of a packet dispatch, from JIT dequeue to UART write completion
+@param radio index of the SX1276
+@param latency_us measured latency
+*/
+void jitlead_record(int radio, uint32_t latency_us);
+
+/**
+@brief Get the concentrator time to give to jit_enqueue/jit_peek
+@param radio index of the SX1276
+@param concent_time current concentrator time of that SX1276
+@return concent_time shifted by the learned lead correction
+*/
+struct timeval jitlead_time(int radio, struct timeval concent_time);
+
+/**
+@brief Print the current lead time and admission windows of each SX1276
+*/
+void jitlead_report(void);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
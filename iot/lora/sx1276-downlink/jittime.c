@@ -0,0 +1,188 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : JIT queue time window
+        Feeds the JIT queue of each SX1276 with times taken from the 64-bit
+        concentrator timeline, rebased on a window that never wraps
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <pthread.h>
+
+#include "trace.h"
+#include "jittime.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* jitqueue.c sorts and checks collisions on the raw 32-bit count_us, so a
+ * queue holding packets on both sides of a counter wrap misorders them. The
+ * queue is given times relative to a base instead: the current time stays
+ * between JITTIME_MARGIN_US and JITTIME_REBASE_US past the base, and packets,
+ * at most TX_MAX_ADVANCE_DELAY ahead, always fit below 2^32. Once the current
+ * time reaches JITTIME_REBASE_US the queue is drained and filled again
+ * relative to a new base, about every 36 minutes. The lock of a radio covers
+ * a conversion and the queue operation it is used for. */
+
+#define JITTIME_MARGIN_US       (1ULL << 30)    /* ~18 min kept behind the current time */
+#define JITTIME_REBASE_US       (3ULL << 30)    /* current time past the base that triggers a rebase */
+#define JITTIME_WINDOW_US       (1ULL << 32)
+#define JITTIME_REINSERT_US     100000          /* earliest packet ahead of the time given at reinsertion */
+
+struct jittime_radio_s {
+    pthread_mutex_t mx;
+    bool valid;
+    uint64_t base_us;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static struct jittime_radio_s radio_base[SUPPORT_SX1276_MAX] = {[0 ... SUPPORT_SX1276_MAX-1] = {PTHREAD_MUTEX_INITIALIZER, false, 0}};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t timeval_to_us(const struct timeval *tv) {
+    return (uint64_t)tv->tv_sec * 1000000 + (uint64_t)tv->tv_usec;
+}
+
+static struct timeval window_time(uint32_t rel_us) {
+    struct timeval tv;
+
+    tv.tv_sec = rel_us / 1000000;
+    tv.tv_usec = rel_us % 1000000;
+    return tv;
+}
+
+/* Move the base so that now_us is JITTIME_MARGIN_US past it, the queued
+   packets are taken out and put back relative to the new base. */
+static void rebase(int idx, struct jit_queue_s *queue, uint64_t now_us) {
+    struct jittime_radio_s *r = &radio_base[idx];
+    struct lgw_pkt_tx_s pkt[JIT_QUEUE_MAX];
+    enum jit_pkt_type_e type[JIT_QUEUE_MAX];
+    struct timeval tv;
+    uint64_t new_base_us;
+    uint32_t delta_us;
+    uint32_t first_us = UINT32_MAX;
+    enum jit_error_e res;
+    int nb = 0;
+    int i;
+
+    new_base_us = (now_us > JITTIME_MARGIN_US) ? now_us - JITTIME_MARGIN_US : 0;
+    if (r->valid == false) {
+        r->base_us = new_base_us;
+        r->valid = true;
+        return;
+    }
+    delta_us = (uint32_t)(new_base_us - r->base_us);
+
+    while ((nb < JIT_QUEUE_MAX) && (jit_queue_is_empty(queue) == false)) {
+        if (jit_dequeue(queue, 0, &pkt[nb], &type[nb]) != JIT_ERROR_OK) {
+            break;
+        }
+        if (pkt[nb].count_us < delta_us) {
+            MSG(LOG_WARNING, "WARNING: [jit] sx1276 %d, dropped a packet stuck in the queue for more than %llu s\n", idx, (unsigned long long)(JITTIME_MARGIN_US / 1000000));
+            continue;
+        }
+        pkt[nb].count_us -= delta_us;
+        if (pkt[nb].count_us < first_us) {
+            first_us = pkt[nb].count_us;
+        }
+        nb += 1;
+    }
+    r->base_us = new_base_us;
+
+    /* the admission checks run again, against a time just before the earliest packet */
+    tv = window_time((first_us > JITTIME_REINSERT_US) ? first_us - JITTIME_REINSERT_US : 0);
+    for (i = 0; i < nb; i++) {
+        if (type[i] == JIT_PKT_TYPE_DOWNLINK_CLASS_C) {
+            /* its ASAP time was decided on the first insertion, keep it */
+            type[i] = JIT_PKT_TYPE_DOWNLINK_CLASS_A;
+            pkt[i].tx_mode = TIMESTAMPED;
+        }
+        res = jit_enqueue(queue, &tv, &pkt[i], type[i]);
+        if (res != JIT_ERROR_OK) {
+            MSG(LOG_WARNING, "WARNING: [jit] sx1276 %d, packet lost when moving the queue window (jit error=%d)\n", idx, res);
+        }
+    }
+    MSG(LOG_INFO, "INFO: [jit] sx1276 %d, queue window moved by %u us, %d packets kept\n", idx, delta_us, nb);
+}
+
+/* Get the current time relative to the base, rebasing first if needed. Called with the lock held. */
+static uint32_t window_now(int idx, struct jit_queue_s *queue, const struct timeval *jit_time) {
+    struct jittime_radio_s *r = &radio_base[idx];
+    uint64_t now_us = timeval_to_us(jit_time);
+
+    if ((r->valid == false) || (now_us < r->base_us) || (now_us - r->base_us >= JITTIME_REBASE_US)) {
+        rebase(idx, queue, now_us);
+    }
+    return (uint32_t)(now_us - r->base_us);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+enum jit_error_e jittime_enqueue(int radio, struct jit_queue_s *queue, const struct timeval *jit_time, struct lgw_pkt_tx_s *pkt, uint64_t count_us, enum jit_pkt_type_e type) {
+    struct jittime_radio_s *r = &radio_base[radio];
+    struct timeval tv;
+    enum jit_error_e res;
+
+    pthread_mutex_lock(&r->mx);
+    tv = window_time(window_now(radio, queue, jit_time));
+    if (pkt->tx_mode == IMMEDIATE) {
+        pkt->count_us = 0; /* set by jit_enqueue from the current time */
+    } else if (count_us < r->base_us) {
+        pthread_mutex_unlock(&r->mx);
+        pkt->count_us = (uint32_t)count_us;
+        return JIT_ERROR_TOO_LATE;
+    } else if (count_us - r->base_us >= JITTIME_WINDOW_US) {
+        pthread_mutex_unlock(&r->mx);
+        pkt->count_us = (uint32_t)count_us;
+        return JIT_ERROR_TOO_EARLY;
+    } else {
+        pkt->count_us = (uint32_t)(count_us - r->base_us);
+    }
+    res = jit_enqueue(queue, &tv, pkt, type);
+    pkt->count_us = (uint32_t)(r->base_us + pkt->count_us);
+    pthread_mutex_unlock(&r->mx);
+
+    return res;
+}
+
+enum jit_error_e jittime_dequeue(int radio, struct jit_queue_s *queue, const struct timeval *jit_time, struct lgw_pkt_tx_s *pkt, enum jit_pkt_type_e *type, bool *found) {
+    struct jittime_radio_s *r = &radio_base[radio];
+    struct timeval tv;
+    enum jit_error_e res;
+    int pkt_index = -1;
+
+    *found = false;
+    pthread_mutex_lock(&r->mx);
+    tv = window_time(window_now(radio, queue, jit_time));
+    res = jit_peek(queue, &tv, &pkt_index);
+    if ((res == JIT_ERROR_OK) && (pkt_index > -1)) {
+        res = jit_dequeue(queue, pkt_index, pkt, type);
+        if (res == JIT_ERROR_OK) {
+            pkt->count_us = (uint32_t)(r->base_us + pkt->count_us); /* back to the wire value */
+            *found = true;
+        }
+    }
+    pthread_mutex_unlock(&r->mx);
+
+    return res;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
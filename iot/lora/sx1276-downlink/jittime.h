@@ -0,0 +1,60 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : JIT queue time window
+        Feeds the JIT queue of each SX1276 with times taken from the 64-bit
+        concentrator timeline, rebased on a window that never wraps
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_JITTIME_H
+#define _LORA_PKTFWD_JITTIME_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <sys/time.h>       /* timeval */
+
+#include "jitqueue.h"
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Insert a packet in the JIT queue of an SX1276
+@param radio index of the SX1276
+@param queue JIT queue of that SX1276
+@param jit_time current time on the 64-bit timeline of that SX1276, as given by jitlead_time
+@param pkt packet to queue, its count_us is left to the 32-bit wire value of count_us
+@param count_us TX time on the 64-bit timeline of that SX1276
+@param type JIT packet type
+@return result of jit_enqueue, JIT_ERROR_TOO_LATE or JIT_ERROR_TOO_EARLY out of the window
+*/
+enum jit_error_e jittime_enqueue(int radio, struct jit_queue_s *queue, const struct timeval *jit_time, struct lgw_pkt_tx_s *pkt, uint64_t count_us, enum jit_pkt_type_e type);
+
+/**
+@brief Take the next packet due for TX out of the JIT queue of an SX1276
+@param radio index of the SX1276
+@param queue JIT queue of that SX1276
+@param jit_time current time on the 64-bit timeline of that SX1276, as given by jitlead_time
+@param pkt filled with the packet, count_us being the 32-bit wire value
+@param type filled with the JIT packet type
+@param found set to true if a packet was taken
+@return result of jit_peek, or of jit_dequeue when a packet is due
+*/
+enum jit_error_e jittime_dequeue(int radio, struct jit_queue_s *queue, const struct timeval *jit_time, struct lgw_pkt_tx_s *pkt, enum jit_pkt_type_e *type, bool *found);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
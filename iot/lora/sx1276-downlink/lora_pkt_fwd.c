@@ -50,6 +50,7 @@ Maintainer: Michael Coracin
 #include <arpa/inet.h>      /* IP address conversion stuff */
 #include <netdb.h>          /* gai_strerror */
 #include <fcntl.h>
+#include <poll.h>
 
 #include <pthread.h>
 #include <syslog.h>
@@ -66,6 +67,14 @@ Maintainer: Michael Coracin
 #include "trace.h"
 #include "jitqueue.h"
 #include "timersync.h"
+#include "timedomain.h"
+#include "metrics.h"
+#include "txtrace.h"
+#include "jitlead.h"
+#include "jittime.h"
+#include "txconfirm.h"
+#include "pktbuf.h"
+#include "crc.h"
 #include "parson.h"
 #include "base64.h"
 #include "logger.h"
@@ -77,7 +86,20 @@ Maintainer: Michael Coracin
 #include "rrd.h"
 
 #include "filter_node.h"
-#include "fbuffer.h"
+#include "pktstore.h"
+#include "drain.h"
+#include "compress.h"
+#include "addrfilter.h"
+#include "rcu.h"
+#include "gpio.h"
+#include "fanout.h"
+#include "uplane.h"
+#include "shmring.h"
+#include "capture.h"
+#include "replay.h"
+#include "simgw.h"
+#include "simmcu.h"
+#include "protocol.h"
 
 typedef struct _lora_led{
     int fd;
@@ -85,7 +107,7 @@ typedef struct _lora_led{
 }lora_led;
 
 lgw_context * g_ctx_arr[SUPPORT_SX1301_MAX] = {NULL};
-lgw_context * g_ctx_sx1276_arr[SUPPORT_SX1276_MAX] = {NULL};
+lgw_context_sx1276 * g_ctx_sx1276_arr[SUPPORT_SX1276_MAX] = {NULL};
 lora_led g_led_arr[SUPPORT_SX1301_MAX] = {{0}};
 
 //lgw_context * ctx_tx  = NULL; 
@@ -143,24 +165,25 @@ _debug( int level, char *format, ...)
 #define DEFAULT_PORT_DW     1782
 #define DEFAULT_KEEPALIVE   5           /* default time interval for downstream keep-alive packet */
 #define DEFAULT_STAT        30          /* default time interval for statistics */
+#define DEFAULT_DNS_REFRESH 300         /* default time interval for the resolution of the server name */
 #define PUSH_TIMEOUT_MS     100
 #define PULL_TIMEOUT_MS     200
 #define GPS_REF_MAX_AGE     30          /* maximum admitted delay in seconds of GPS loss before considering latest GPS sync unusable */
 #define FETCH_SLEEP_MS      5          /* nb of ms waited when a fetch return no packets */
+#define DRAIN_POLL_MS       10          /* nb of ms waited when no stored packet can be replayed */
+#define DRAIN_IDLE_MS       1000        /* nb of ms waited while the server is unreachable */
+#define CONNECT_RETRY_MAX_S 10          /* longest delay between two attempts to reach the server at start */
+#define WATCHDOG_RESTART_S  1           /* nb of s waited before restarting a child that exited */
+#define CONN_CHECK_MS       1000        /* nb of ms between two checks of the server connection */
+#define CONN_RETRY_MIN_S    10          /* delay between the first two reconnections while PULL_DATA stay unacknowledged */
+#define CONN_RETRY_MAX_S    60          /* longest delay between two reconnections while PULL_DATA stay unacknowledged */
+#define DNS_RETRY_S         10          /* nb of s waited after a failed resolution of the server name */
 #define BEACON_POLL_MS      50          /* time in ms between polling of beacon TX status */
-
-#define PROTOCOL_VERSION    2           /* v1.3 */
+#define GPS_BUFF_SIZE       1024        /* GPS serial ring buffer, holds several UBX/NMEA frames */
 
 #define XERR_INIT_AVG       128         /* nb of measurements the XTAL correction is averaged on as initial value */
 #define XERR_FILT_COEF      256         /* coefficient for low-pass XTAL error tracking */
 
-#define PKT_PUSH_DATA   0
-#define PKT_PUSH_ACK    1
-#define PKT_PULL_DATA   2
-#define PKT_PULL_RESP   3
-#define PKT_PULL_ACK    4
-#define PKT_TX_ACK      5
-
 #define NB_PKT_MAX      8 /* max number of packets per fetch/send cycle */
 
 #define MIN_LORA_PREAMB 6 /* minimum Lora preamble length for this application */
@@ -181,6 +204,7 @@ _debug( int level, char *format, ...)
 #define DEFAULT_BEACON_BW_HZ        125000
 #define DEFAULT_BEACON_POWER        14
 #define DEFAULT_BEACON_INFODESC     0
+#define BEACON_TIMER_MS             1000    /* period at which the beacon slots are refilled */
 
 /* Define value and TX_METADATA_NB is the same */
 #define UART_METADATA_NB    16
@@ -198,6 +222,20 @@ _debug( int level, char *format, ...)
 #define RTC_SIZE_INDEX      2
 #define RTC_FIRST_INDEX     3
 
+/* Reading MCU TX reports index */
+#define TX_REPORT_SIZE          9   /* event, count_us, MCU timer */
+#define TX_REPORT_SIZE_INDEX    2
+#define TX_REPORT_FIRST_INDEX   3
+#define TX_REPORT_RETURN_SIZE   (TX_REPORT_FIRST_INDEX + TXCONFIRM_REPORT_MAX * TX_REPORT_SIZE + 1)
+#define TX_REPORT_MISS_MAX      3   /* unanswered polls before the MCU is considered without TX reports */
+#define TX_RETRY_MAX            1   /* retries of a failed downlink on another SX1276 */
+
+/* GPS frame framing */
+#define UBX_SYNC_CHAR_2     0x62    /* second UBX sync char */
+#define UBX_HEADER_SIZE     6       /* sync chars, class, id, 16-bit payload length */
+#define UBX_FRAME_OVERHEAD  8       /* header and 2 checksum bytes */
+#define NMEA_MAX_SIZE       82      /* NMEA sentence, CR LF included */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
 
@@ -207,10 +245,19 @@ volatile bool quit_sig = false; /* 1 -> application terminates without shutting
 
 static bool exit_err = false;
 
-/* packets filtering configuration variables */
-static bool fwd_valid_pkt = true; /* packets with PAYLOAD CRC OK are forwarded */
-static bool fwd_error_pkt = false; /* packets with PAYLOAD CRC ERROR are NOT forwarded */
-static bool fwd_nocrc_pkt = false; /* packets with NO PAYLOAD CRC are NOT forwarded */
+/* packets filtering configuration variables, published as a snapshot replaced on reload */
+struct fwd_policy_s {
+    bool is_lorawan; /* LoRaWAN frames only, downlinks are dropped and DevAddr lists apply */
+    bool fwd_valid_pkt; /* packets with PAYLOAD CRC OK are forwarded */
+    bool fwd_error_pkt; /* packets with PAYLOAD CRC ERROR are NOT forwarded */
+    bool fwd_nocrc_pkt; /* packets with NO PAYLOAD CRC are NOT forwarded */
+};
+static const struct fwd_policy_s fwd_policy_default = {true, true, false, false};
+static struct fwd_policy_s *fwd_policy = NULL; /* read by thread_up without lock, see rcu.h */
+static JSON_Value *conf_applied = NULL; /* global configuration in use, compared with the file on reload */
+
+/* reload of the filter lists and forwarding policy, requested by SIGHUP or the metrics endpoint */
+static volatile sig_atomic_t reload_req = 0;
 
 /* network configuration variables */
 static uint64_t lgwm = 0; /* Lora gateway MAC address */
@@ -218,10 +265,20 @@ static char serv_addr[64] = STR(DEFAULT_SERVER); /* address of the server (host
 static char serv_port_up[8] = STR(DEFAULT_PORT_UP); /* server port for upstream traffic */
 static char serv_port_down[8] = STR(DEFAULT_PORT_DW); /* server port for downstream traffic */
 static int keepalive_time = DEFAULT_KEEPALIVE; /* send a PULL_DATA request every X seconds, negative = disabled */
+static unsigned dns_refresh_interval = DEFAULT_DNS_REFRESH; /* resolve the server name again every X seconds, 0 = disabled */
 
 /* statistics collection configuration variables */
 static unsigned stat_interval = DEFAULT_STAT; /* time interval (in sec) at which statistics are collected and displayed */
 
+/* start-up timeline */
+static struct timespec startup_time; /* process start, the phases are logged relative to it */
+struct lgw_start_job_s {
+    int board;
+    lgw_context *ctx;
+    int result; /* lgw_start return value */
+    unsigned duration_ms;
+};
+
 
 /* gateway <-> MAC protocol variables */
 uint32_t net_mac_h; /* Most Significant Nibble, network order */
@@ -237,14 +294,18 @@ static int sock_up; /* socket for upstream traffic */
 
 static int sock_down; /* socket for downstream traffic */
 
+pthread_mutex_t mx_serv = PTHREAD_MUTEX_INITIALIZER; /* control access to the server address and ports, changed on reload */
+static uint32_t serv_generation = 0; /* incremented when the server sockets are replaced */
+static pthread_mutex_t mx_reopen = PTHREAD_MUTEX_INITIALIZER; /* one replacement of the server sockets at a time */
+static uint32_t pull_unacked = 0; /* PULL_DATA sent since the latest PULL_ACK, published by thread_down */
+
 /* network protocol variables */
 static struct timeval push_timeout_half = {0, (PUSH_TIMEOUT_MS * 500)}; /* cut in half, critical for throughput */
 static struct timeval pull_timeout = {0, (PULL_TIMEOUT_MS * 1000)}; /* non critical for throughput */
 
-bool is_lorawan = true;
-
 /* hardware access control and correction */
 pthread_mutex_t mx_concent = PTHREAD_MUTEX_INITIALIZER; /* control access to the concentrator */
+static bool board_down[SUPPORT_SX1301_MAX] = {false}; /* not polled, restarting or failed to restart, under mx_concent */
 pthread_mutex_t mx_concent_sx1276 = PTHREAD_MUTEX_INITIALIZER; /* control access to the concentrator */
 static pthread_mutex_t mx_xcorr = PTHREAD_MUTEX_INITIALIZER; /* control access to the XTAL correction */
 static bool xtal_correct_ok = false; /* set true when XTAL correction is stable enough */
@@ -298,6 +359,10 @@ static uint32_t meas_dw_network_byte = 0; /* sum of UDP bytes sent for upstream
 static uint32_t meas_dw_payload_byte = 0; /* sum of radio payload bytes sent for upstream traffic */
 static uint32_t meas_nb_tx_ok = 0; /* count packets emitted successfully */
 static uint32_t meas_nb_tx_fail = 0; /* count packets were TX failed for other reasons */
+static uint32_t meas_nb_tx_confirmed = 0; /* count packets the MCU reported as transmitted */
+static uint32_t meas_nb_tx_unsent = 0; /* count packets the MCU reported as failed */
+static uint32_t meas_nb_tx_timeout = 0; /* count packets without TX report in time */
+static uint32_t meas_nb_tx_retry = 0; /* count failed packets retried on another SX1276 */
 static uint32_t meas_nb_tx_requested = 0; /* count TX request from server (downlinks) */
 static uint32_t meas_nb_tx_rejected_collision_packet = 0; /* count packets were TX request were rejected due to collision with another packet already programmed */
 static uint32_t meas_nb_tx_rejected_collision_beacon = 0; /* count packets were TX request were rejected due to collision with a beacon already programmed */
@@ -321,6 +386,9 @@ pthread_mutex_t mx_meas_gps = PTHREAD_MUTEX_INITIALIZER; /* control access to th
 bool gps_coord_valid; /* could we get valid GPS coordinates ? */
 struct coord_s meas_gps_coord; /* GPS position of the gateway */
 struct coord_s meas_gps_err; /* GPS position of the gateway */
+static uint32_t meas_gps_nb_frame = 0; /* count GPS frames parsed */
+static uint32_t meas_gps_nb_corrupt = 0; /* count GPS frames with a bad header or checksum */
+static uint32_t meas_gps_nb_lost = 0; /* count GPS data skipped to resynchronize (lost frames) */
 
 static pthread_mutex_t mx_stat_rep = PTHREAD_MUTEX_INITIALIZER; /* control access to the status report */
 static bool report_ready = false; /* true when there is a new report to send to the server */
@@ -341,10 +409,50 @@ static int8_t beacon_power = DEFAULT_BEACON_POWER; /* set beacon TX power, in dB
 static uint8_t beacon_infodesc = DEFAULT_BEACON_INFODESC; /* set beacon information descriptor */
 
 /* auto-quit function */
-static uint32_t autoquit_threshold = 30; /* enable auto-quit after a number of non-acknowledged PULL_DATA (0 = disabled)*/
+static uint32_t autoquit_threshold = 30; /* reconnect after a number of non-acknowledged PULL_DATA (0 = disabled)*/
 static uint32_t network_error_threshold = 3;
 bool data_recovery = false;
 char * data_recovery_path = NULL;
+static uint32_t data_recovery_size = PKTSTORE_DEFAULT_SIZE; /* size of the store ring, in bytes */
+static uint32_t data_recovery_max_age = PKTSTORE_DEFAULT_MAX_AGE; /* stored packets older than that (in s) are dropped */
+static uint32_t data_recovery_rate = DRAIN_DEFAULT_RATE; /* max bytes per second used to replay stored packets, 0 = not limited */
+static unsigned data_recovery_window = DRAIN_DEFAULT_WINDOW; /* max replay datagrams waiting for their PUSH_ACK */
+
+/* uplink priority lanes */
+static unsigned uplink_lane_depth = UPLANE_DEFAULT_DEPTH; /* packets waiting to be sent, lower classes are shed beyond */
+static uint32_t uplink_max_rate = 0; /* max bytes per second of PUSH_DATA to the main server, 0 = not limited */
+
+/* shared memory ring of the accepted uplinks, for local consumers */
+static bool shm_ring = false;
+static char * shm_ring_name = NULL; /* NULL for SHMRING_DEFAULT_NAME */
+static uint32_t shm_ring_slots = SHMRING_DEFAULT_SLOTS;
+
+/* capture of the radio and network traffic, and replay of a capture in place of the hardware */
+static char * capture_path = NULL; /* disabled if NULL */
+static uint64_t capture_max_size = 0; /* capture stops beyond that size in bytes, 0 = no limit */
+static char * replay_path = NULL; /* disabled if NULL */
+static double replay_speed = 1.0; /* 1.0 for the captured pace, REPLAY_SPEED_MAX for no pacing */
+
+/* simulated SX1276 MCUs on pseudo terminals, in place of the UARTs */
+static bool sim_mcu = false;
+static struct simmcu_conf_s sim_mcu_conf = {SIMMCU_DEFAULT_LATENCY_US, 0, 0.0};
+
+/* LZ4 compression of PUSH_DATA, used once the server announces it in a PUSH_ACK */
+static bool push_compression = false;
+
+/* local metrics endpoint (Unix socket path or loopback TCP port, disabled if NULL) */
+static char * metrics_endpoint = NULL;
+
+/* DevAddr white and black list files (disabled if NULL) */
+static char * devaddr_whitelist = NULL;
+static char * devaddr_blacklist = NULL;
+
+/* downlink trace dump requested by SIGUSR1 */
+static volatile sig_atomic_t txtrace_dump_req = 0;
+
+/* TX confirmation */
+static bool tx_ack_confirm = false; /* TX_ACK sent when the MCU reports the end of TX */
+static bool tx_retry = false; /* failed downlinks are retried on another SX1276 */
 
 /* auto-quit rx CRC error 100% */
 static uint32_t autoquit_error_crc = 30;
@@ -386,9 +494,12 @@ static void sig_handler(int sigio);
 
 static int parse_SX1301_configuration(const char * conf_file);
 
+static int parse_fwd_policy(JSON_Object *conf_obj);
+
 static int parse_gateway_configuration(const char * conf_file);
 
-static uint16_t crc16(const uint8_t * data, unsigned size);
+static void reload_configuration(void);
+
 
 static double difftimespec(struct timespec end, struct timespec beginning);
 
@@ -403,6 +514,9 @@ void thread_down(void);
 void thread_gps(void);
 void thread_valid(void);
 void thread_jit(void);
+void thread_beacon(void);
+void thread_drain(void);
+void thread_conn(void);
 void thread_timersync(void);
 void thread_rrd( void );
 void thread_led(void);
@@ -432,6 +546,436 @@ static void sig_handler(int sigio) {
     return;
 }
 
+/* -------------------------------------------------------------------------- */
+/* --- SERVER SOCKETS ------------------------------------------------------- */
+
+/* Open a UDP socket to the server, connected to it (bound to it for the
+ * downstream socket under _ALI_LINKWAN_). The address and ports are read under
+ * mx_serv, the reload may change them. */
+static int open_server_socket(bool down, const struct timeval *rcv_timeout) {
+    const char *tag = down ? "down" : "up";
+    char addr[sizeof serv_addr];
+    char port[sizeof serv_port_up];
+    struct addrinfo hints;
+    struct addrinfo *result; /* store result of getaddrinfo */
+    struct addrinfo *q; /* pointer to move into *result data */
+    char host_name[64];
+    char port_name[64];
+    int sock = -1;
+    int i;
+
+    pthread_mutex_lock(&mx_serv);
+    strncpy(addr, serv_addr, sizeof addr);
+    strncpy(port, down ? serv_port_down : serv_port_up, sizeof port);
+    pthread_mutex_unlock(&mx_serv);
+
+    /* prepare hints to open network sockets */
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET; /* WA: Forcing IPv4 as AF_UNSPEC makes connection on localhost to fail */
+    hints.ai_socktype = SOCK_DGRAM;
+
+    /* look for server address w/ the port */
+    i = getaddrinfo(addr, port, &hints, &result);
+    if (i != 0) {
+        MSG(LOG_ERR,"ERROR: [%s] getaddrinfo on address %s (port %s) returned %s\n", tag, addr, port, gai_strerror(i));
+        return -1;
+    }
+
+    /* try to open socket */
+    for (q=result; q!=NULL; q=q->ai_next) {
+        sock = socket(q->ai_family, q->ai_socktype,q->ai_protocol);
+        if (sock == -1)
+            continue; /* try next field */
+        else
+            break; /* success, get out of loop */
+    }
+    if (q == NULL) {
+        MSG(LOG_ERR,"ERROR: [%s] failed to open socket to any of server %s addresses (port %s)\n", tag, addr, port);
+        i = 1;
+        for (q=result; q!=NULL; q=q->ai_next) {
+            getnameinfo(q->ai_addr, q->ai_addrlen, host_name, sizeof host_name, port_name, sizeof port_name, NI_NUMERICHOST);
+            MSG(LOG_INFO,"INFO: [%s] result %i host:%s service:%s\n", tag, i, host_name, port_name);
+            ++i;
+        }
+        freeaddrinfo(result);
+        return -1;
+    }
+
+#ifdef _ALI_LINKWAN_
+    if (down) {
+        /* bind so we can receive packet with the server only */
+        i = bind(sock, q->ai_addr, q->ai_addrlen);
+    } else
+#endif
+    {
+        /* connect so we can send/receive packet with the server only */
+        i = connect(sock, q->ai_addr, q->ai_addrlen);
+    }
+    freeaddrinfo(result);
+    if (i != 0) {
+        MSG(LOG_ERR,"ERROR: [%s] %s returned %s\n", tag, down ? "bind/connect" : "connect", strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    /* set socket RX timeout */
+    if ((rcv_timeout != NULL) && (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (void *)rcv_timeout, sizeof *rcv_timeout) != 0)) {
+        MSG(LOG_ERR,"ERROR: [%s] setsockopt returned %s\n", tag, strerror(errno));
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Replace the server sockets under the threads using them: the descriptor
+ * numbers do not change, a thread blocked in recv returns at its time-out. */
+static int reopen_server_sockets(void) {
+    int up, down;
+
+    pthread_mutex_lock(&mx_reopen);
+    up = open_server_socket(false, &push_timeout_half);
+    if (up == -1) {
+        pthread_mutex_unlock(&mx_reopen);
+        return -1;
+    }
+    down = open_server_socket(true, &pull_timeout);
+    if (down == -1) {
+        close(up);
+        pthread_mutex_unlock(&mx_reopen);
+        return -1;
+    }
+    dup2(up, sock_up);
+    dup2(down, sock_down);
+    close(up);
+    close(down);
+    __atomic_add_fetch(&serv_generation, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&mx_reopen);
+    return 0;
+}
+
+/* Resolve the server name again: 1 if sock_up is not connected to any of its
+ * addresses anymore, 0 if it still is, -1 if the name cannot be resolved. */
+static int server_moved(void) {
+    char addr[sizeof serv_addr];
+    char port[sizeof serv_port_up];
+    struct addrinfo hints;
+    struct addrinfo *result;
+    struct addrinfo *q;
+    struct sockaddr_in peer;
+    socklen_t len = sizeof peer;
+    int moved = 1;
+
+    pthread_mutex_lock(&mx_serv);
+    strncpy(addr, serv_addr, sizeof addr);
+    strncpy(port, serv_port_up, sizeof port);
+    pthread_mutex_unlock(&mx_serv);
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET; /* same as open_server_socket */
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(addr, port, &hints, &result) != 0) {
+        return -1;
+    }
+    if (getpeername(sock_up, (struct sockaddr *)&peer, &len) == 0) {
+        for (q = result; q != NULL; q = q->ai_next) {
+            if ((peer.sin_family == AF_INET) && (((struct sockaddr_in *)q->ai_addr)->sin_addr.s_addr == peer.sin_addr.s_addr) && (((struct sockaddr_in *)q->ai_addr)->sin_port == peer.sin_port)) {
+                moved = 0;
+                break;
+            }
+        }
+    }
+    freeaddrinfo(result);
+    return moved;
+}
+
+/* Move to new server sockets, uplinks are stored by thread_up until the next PULL_ACK */
+static void reconnect_server(void) {
+    pthread_mutex_lock(&mx_network_err);
+    status_network_connect = false;
+    pthread_mutex_unlock(&mx_network_err);
+    if (reopen_server_sockets() == 0) {
+        MSG(LOG_NOTICE,"INFO: [conn] server sockets reopened\n");
+    } else {
+        MSG(LOG_ERR,"ERROR: [conn] failed to reopen the server sockets, previous ones kept\n");
+    }
+}
+
+/* parse the RF and IF chains of an SX1301_conf object, those selected by the masks are submitted to the HAL */
+static int setconf_radio(lgw_context *ctx, JSON_Object *conf_obj, unsigned rf_mask, unsigned if_mask) {
+    int i;
+    char param_name[32]; /* used to generate variable parameter names */
+    const char *str; /* used to store string value from JSON object */
+    JSON_Value *val = NULL;
+    struct lgw_conf_rxrf_s rfconf;
+    struct lgw_conf_rxif_s ifconf;
+    uint32_t sf, bw, fdev;
+
+    /* set configuration for RF chains */
+    for (i = 0; i < LGW_RF_CHAIN_NB; ++i) {
+        if ((rf_mask & (1U << i)) == 0) {
+            continue;
+        }
+        memset(&rfconf, 0, sizeof rfconf); /* initialize configuration structure */
+        snprintf(param_name, sizeof param_name, "radio_%i", i); /* compose parameter path inside JSON structure */
+        val = json_object_get_value(conf_obj, param_name); /* fetch value (if possible) */
+        if (json_value_get_type(val) != JSONObject) {
+            MSG(LOG_INFO,"INFO: no configuration for radio %i\n", i);
+            continue;
+        }
+        /* there is an object to configure that radio, let's parse it */
+        snprintf(param_name, sizeof param_name, "radio_%i.type", i);
+        str = json_object_dotget_string(conf_obj, param_name);
+        if (!strncmp(str, "SX1255", 6)) {
+            rfconf.type = LGW_RADIO_TYPE_SX1255;
+        } else if (!strncmp(str, "SX1257", 6)) {
+            rfconf.type = LGW_RADIO_TYPE_SX1257;
+        } else {
+            MSG(LOG_INFO,"WARNING: invalid radio type: %s (should be SX1255 or SX1257)\n", str);
+        }
+            
+        snprintf(param_name, sizeof param_name, "radio_%i.enable", i);
+        val = json_object_dotget_value(conf_obj, param_name);
+        if (json_value_get_type(val) == JSONBoolean) {
+            rfconf.enable = (bool)json_value_get_boolean(val);
+        } else {
+            rfconf.enable = false;
+        }
+        if (rfconf.enable == false) { /* radio disabled, nothing else to parse */
+            MSG(LOG_INFO,"INFO: radio %i disabled\n", i);
+        } else  { /* radio enabled, will parse the other parameters */
+            snprintf(param_name, sizeof param_name, "radio_%i.freq", i);
+            rfconf.freq_hz = (uint32_t)json_object_dotget_number(conf_obj, param_name);
+            snprintf(param_name, sizeof param_name, "radio_%i.rssi_offset", i);
+            rfconf.rssi_offset = (float)json_object_dotget_number(conf_obj, param_name);
+            
+            snprintf(param_name, sizeof param_name, "radio_%i.tx_enable", i);
+            val = json_object_dotget_value(conf_obj, param_name);
+            if (json_value_get_type(val) == JSONBoolean) {
+                rfconf.tx_enable = (bool)json_value_get_boolean(val);
+                if (rfconf.tx_enable == true) {
+                    /* tx is enabled on this rf chain, we need its frequency range */
+                    snprintf(param_name, sizeof param_name, "radio_%i.tx_freq_min", i);
+                    tx_freq_min[i] = (uint32_t)json_object_dotget_number(conf_obj, param_name);
+                    snprintf(param_name, sizeof param_name, "radio_%i.tx_freq_max", i);
+                    tx_freq_max[i] = (uint32_t)json_object_dotget_number(conf_obj, param_name);
+                    if ((tx_freq_min[i] == 0) || (tx_freq_max[i] == 0)) {
+                        MSG(LOG_INFO,"WARNING: no frequency range specified for TX rf chain %d\n", i);
+                    }
+                    /* ... and the notch filter frequency to be set */
+                    snprintf(param_name, sizeof param_name, "radio_%i.tx_notch_freq", i);
+                    rfconf.tx_notch_freq = (uint32_t)json_object_dotget_number(conf_obj, param_name);
+                }
+            } else {
+                rfconf.tx_enable = false;
+            }
+            MSG(LOG_INFO,"INFO: radio %i enabled (type %s), center frequency %u, RSSI offset %f, tx enabled %d, tx_notch_freq %u\n", i, str, rfconf.freq_hz, rfconf.rssi_offset, rfconf.tx_enable, rfconf.tx_notch_freq);
+        }
+        /* all parameters parsed, submitting configuration to the HAL */
+        if (lgw_rxrf_setconf(i, rfconf,ctx) != LGW_HAL_SUCCESS) {
+            MSG(LOG_INFO,"ERROR: invalid configuration for radio %i\n", i);
+            return -1;
+        }
+    }
+
+    /* set configuration for Lora multi-SF channels (bandwidth cannot be set) */
+    for (i = 0; i < LGW_MULTI_NB; ++i) {
+        if ((if_mask & (1U << i)) == 0) {
+            continue;
+        }
+        memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
+        snprintf(param_name, sizeof param_name, "chan_multiSF_%i", i); /* compose parameter path inside JSON structure */
+        val = json_object_get_value(conf_obj, param_name); /* fetch value (if possible) */
+        if (json_value_get_type(val) != JSONObject) {
+            MSG(LOG_INFO,"INFO: no configuration for Lora multi-SF channel %i\n", i);
+            continue;
+        }
+        
+        /* there is an object to configure that Lora multi-SF channel, let's parse it */
+        snprintf(param_name, sizeof param_name, "chan_multiSF_%i.enable", i);
+        val = json_object_dotget_value(conf_obj, param_name);
+        if (json_value_get_type(val) == JSONBoolean) {
+            ifconf.enable = (bool)json_value_get_boolean(val);
+        } else {
+            ifconf.enable = false;
+        }
+        
+        if (ifconf.enable == false) { /* Lora multi-SF channel disabled, nothing else to parse */
+            MSG(LOG_INFO,"INFO: Lora multi-SF channel %i disabled\n", i);
+        } else  { /* Lora multi-SF channel enabled, will parse the other parameters */
+            snprintf(param_name, sizeof param_name, "chan_multiSF_%i.radio", i);
+            ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, param_name);
+            snprintf(param_name, sizeof param_name, "chan_multiSF_%i.if", i);
+            ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, param_name);
+            // TODO: handle individual SF enabling and disabling (spread_factor)
+            MSG(LOG_INFO,"INFO: Lora multi-SF channel %i>  radio %i, IF %i Hz, 125 kHz bw, SF 7 to 12\n", i, ifconf.rf_chain, ifconf.freq_hz);
+        }
+        
+        /* all parameters parsed, submitting configuration to the HAL */
+        if (lgw_rxif_setconf(i, ifconf,ctx) != LGW_HAL_SUCCESS) {
+            MSG(LOG_INFO,"ERROR: invalid configuration for Lora multi-SF channel %i\n", i);
+            return -1;
+        }
+    }
+
+    /* set configuration for Lora standard channel */
+    memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
+    val = json_object_get_value(conf_obj, "chan_Lora_std"); /* fetch value (if possible) */
+    if ((if_mask & (1U << 8)) == 0) {
+        /* not selected */
+    } else if (json_value_get_type(val) != JSONObject) {
+        MSG(LOG_INFO,"INFO: no configuration for Lora standard channel\n");
+    } else {
+        val = json_object_dotget_value(conf_obj, "chan_Lora_std.enable");
+        if (json_value_get_type(val) == JSONBoolean) {
+            ifconf.enable = (bool)json_value_get_boolean(val);
+        } else {
+            ifconf.enable = false;
+        }
+        if (ifconf.enable == false) {
+            MSG(LOG_INFO,"INFO: Lora standard channel %i disabled\n", i);
+        } else  {
+            ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.radio");
+            ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.if");
+            bw = (uint32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.bandwidth");
+            switch(bw) {
+                case 500000: ifconf.bandwidth = BW_500KHZ; break;
+                case 250000: ifconf.bandwidth = BW_250KHZ; break;
+                case 125000: ifconf.bandwidth = BW_125KHZ; break;
+                default: ifconf.bandwidth = BW_UNDEFINED;
+            }
+            sf = (uint32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.spread_factor");
+            switch(sf) {
+                case  7: ifconf.datarate = DR_LORA_SF7;  break;
+                case  8: ifconf.datarate = DR_LORA_SF8;  break;
+                case  9: ifconf.datarate = DR_LORA_SF9;  break;
+                case 10: ifconf.datarate = DR_LORA_SF10; break;
+                case 11: ifconf.datarate = DR_LORA_SF11; break;
+                case 12: ifconf.datarate = DR_LORA_SF12; break;
+                default: ifconf.datarate = DR_UNDEFINED;
+            }
+            MSG(LOG_INFO,"INFO: Lora std channel> radio %i, IF %i Hz, %u Hz bw, SF %u\n", ifconf.rf_chain, ifconf.freq_hz, bw, sf);
+        }
+        if (lgw_rxif_setconf(8, ifconf,ctx) != LGW_HAL_SUCCESS) {
+            MSG(LOG_INFO,"ERROR: invalid configuration for Lora standard channel\n");
+            return -1;
+        }
+    }
+
+    /* set configuration for FSK channel */
+    memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
+    val = json_object_get_value(conf_obj, "chan_FSK"); /* fetch value (if possible) */
+    if ((if_mask & (1U << 9)) == 0) {
+        /* not selected */
+    } else if (json_value_get_type(val) != JSONObject) {
+        MSG(LOG_INFO,"INFO: no configuration for FSK channel\n");
+    } else {
+        val = json_object_dotget_value(conf_obj, "chan_FSK.enable");
+        if (json_value_get_type(val) == JSONBoolean) {
+            ifconf.enable = (bool)json_value_get_boolean(val);
+        } else {
+            ifconf.enable = false;
+        }
+        if (ifconf.enable == false) {
+            MSG(LOG_INFO,"INFO: FSK channel %i disabled\n", i);
+        } else  {
+            ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.radio");
+            ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, "chan_FSK.if");
+            bw = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.bandwidth");
+            fdev = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.freq_deviation");
+            ifconf.datarate = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.datarate");
+
+            /* if chan_FSK.bandwidth is set, it has priority over chan_FSK.freq_deviation */
+            if ((bw == 0) && (fdev != 0)) {
+                bw = 2 * fdev + ifconf.datarate;
+            }
+            if      (bw == 0)      ifconf.bandwidth = BW_UNDEFINED;
+            else if (bw <= 7800)   ifconf.bandwidth = BW_7K8HZ;
+            else if (bw <= 15600)  ifconf.bandwidth = BW_15K6HZ;
+            else if (bw <= 31200)  ifconf.bandwidth = BW_31K2HZ;
+            else if (bw <= 62500)  ifconf.bandwidth = BW_62K5HZ;
+            else if (bw <= 125000) ifconf.bandwidth = BW_125KHZ;
+            else if (bw <= 250000) ifconf.bandwidth = BW_250KHZ;
+            else if (bw <= 500000) ifconf.bandwidth = BW_500KHZ;
+            else ifconf.bandwidth = BW_UNDEFINED;
+
+            MSG(LOG_INFO,"INFO: FSK channel> radio %i, IF %i Hz, %u Hz bw, %u bps datarate\n", ifconf.rf_chain, ifconf.freq_hz, bw, ifconf.datarate);
+        }
+        if (lgw_rxif_setconf(9, ifconf,ctx) != LGW_HAL_SUCCESS) {
+            MSG(LOG_INFO,"ERROR: invalid configuration for FSK channel\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* traffic of a simulated concentrator, on the multi-SF channels of its SX1301_conf object */
+static int setconf_simulation(int board, JSON_Object *conf_obj) {
+    int i;
+    char param_name[32]; /* used to generate variable parameter names */
+    JSON_Value *val = NULL;
+    JSON_Array *conf_array = NULL;
+    struct simgw_conf_s simconf;
+    unsigned rf_chain;
+
+    memset(&simconf, 0, sizeof simconf);
+    simconf.rate = SIMGW_DEFAULT_RATE;
+    simconf.nb_device = SIMGW_DEFAULT_DEVICES;
+    simconf.payload_size = SIMGW_DEFAULT_SIZE;
+    simconf.sf_mix[0] = 1.0;
+
+    val = json_object_get_value(conf_obj, "sim_rate");
+    if (val != NULL) {
+        simconf.rate = json_value_get_number(val);
+    }
+    conf_array = json_object_get_array(conf_obj, "sim_sf_mix"); /* weights of SF7 to SF12 */
+    if (conf_array != NULL) {
+        for (i = 0; i < SIMGW_SF_NB; i++) {
+            simconf.sf_mix[i] = (i < (int)json_array_get_count(conf_array)) ? json_array_get_number(conf_array, i) : 0.0;
+        }
+    }
+    val = json_object_get_value(conf_obj, "sim_crc_error");
+    if (val != NULL) {
+        simconf.crc_error = json_value_get_number(val);
+    }
+    val = json_object_get_value(conf_obj, "sim_confirmed");
+    if (val != NULL) {
+        simconf.confirmed = json_value_get_number(val);
+    }
+    val = json_object_get_value(conf_obj, "sim_join");
+    if (val != NULL) {
+        simconf.join = json_value_get_number(val);
+    }
+    val = json_object_get_value(conf_obj, "sim_devices");
+    if (val != NULL) {
+        simconf.nb_device = (uint32_t)json_value_get_number(val);
+    }
+    val = json_object_get_value(conf_obj, "sim_payload_size");
+    if (val != NULL) {
+        simconf.payload_size = (uint16_t)json_value_get_number(val);
+    }
+
+    for (i = 0; (i < LGW_MULTI_NB) && (simconf.nb_chan < SIMGW_CHAN_MAX); ++i) {
+        snprintf(param_name, sizeof param_name, "chan_multiSF_%i.enable", i);
+        val = json_object_dotget_value(conf_obj, param_name);
+        if ((json_value_get_type(val) != JSONBoolean) || (json_value_get_boolean(val) == false)) {
+            continue;
+        }
+        snprintf(param_name, sizeof param_name, "chan_multiSF_%i.radio", i);
+        rf_chain = (unsigned)json_object_dotget_number(conf_obj, param_name);
+        snprintf(param_name, sizeof param_name, "radio_%u.freq", rf_chain);
+        simconf.freq_hz[simconf.nb_chan] = (uint32_t)json_object_dotget_number(conf_obj, param_name);
+        snprintf(param_name, sizeof param_name, "chan_multiSF_%i.if", i);
+        simconf.freq_hz[simconf.nb_chan] += (int32_t)json_object_dotget_number(conf_obj, param_name);
+        simconf.rf_chain[simconf.nb_chan] = (uint8_t)rf_chain;
+        simconf.if_chain[simconf.nb_chan] = (uint8_t)i;
+        simconf.nb_chan += 1;
+    }
+
+    MSG(LOG_INFO,"INFO: concentrator %d simulated, %.1f uplinks/s, CRC errors %.1f%%, joins %.1f%%, confirmed %.1f%%\n", board, simconf.rate, 100.0 * simconf.crc_error, 100.0 * simconf.join, 100.0 * simconf.confirmed);
+    return simgw_setconf(board, &simconf);
+}
+
 static int parse_SX1301_configuration(const char * conf_file ) {
     int i, idx;
     char param_name[32]; /* used to generate variable parameter names */
@@ -446,9 +990,6 @@ static int parse_SX1301_configuration(const char * conf_file ) {
     JSON_Array *conf_array = NULL;
     struct lgw_conf_board_s boardconf;
     struct lgw_conf_lbt_s lbtconf;
-    struct lgw_conf_rxrf_s rfconf;
-    struct lgw_conf_rxif_s ifconf;
-    uint32_t sf, bw, fdev;
     
     
     /* try to parse JSON */
@@ -465,6 +1006,7 @@ static int parse_SX1301_configuration(const char * conf_file ) {
     for( idx = 0; idx < (int)json_array_get_count(SX1301_array);idx++ ){
         lgw_context * ctx_one = NULL;
         LGW_SPI_TYPE spi_type = LGW_SPI_NATIVE;
+        bool sim_board = false;
         struct lgw_tx_gain_lut_s iTxlut; 
         conf_obj = json_array_get_object(SX1301_array, idx);
 
@@ -484,6 +1026,9 @@ static int parse_SX1301_configuration(const char * conf_file ) {
             else if( 0 == strcmp("usb", str) || 0 == strcmp("ftdi", str)){
                 spi_type = LGW_SPI_FTDI;
             }
+            else if( 0 == strcmp("sim", str) ){
+                sim_board = true; /* the HAL context is only configured, never started */
+            }
         }
 
         MSG(LOG_INFO,"INFO: spi type %d", spi_type);
@@ -675,190 +1220,13 @@ static int parse_SX1301_configuration(const char * conf_file ) {
             MSG(LOG_INFO,"WARNING: No TX gain LUT defined\n");
         }
 
-        /* set configuration for RF chains */
-        for (i = 0; i < LGW_RF_CHAIN_NB; ++i) {
-            memset(&rfconf, 0, sizeof rfconf); /* initialize configuration structure */
-            snprintf(param_name, sizeof param_name, "radio_%i", i); /* compose parameter path inside JSON structure */
-            val = json_object_get_value(conf_obj, param_name); /* fetch value (if possible) */
-            if (json_value_get_type(val) != JSONObject) {
-                MSG(LOG_INFO,"INFO: no configuration for radio %i\n", i);
-                continue;
-            }
-            /* there is an object to configure that radio, let's parse it */
-            snprintf(param_name, sizeof param_name, "radio_%i.type", i);
-            str = json_object_dotget_string(conf_obj, param_name);
-            if (!strncmp(str, "SX1255", 6)) {
-                rfconf.type = LGW_RADIO_TYPE_SX1255;
-            } else if (!strncmp(str, "SX1257", 6)) {
-                rfconf.type = LGW_RADIO_TYPE_SX1257;
-            } else {
-                MSG(LOG_INFO,"WARNING: invalid radio type: %s (should be SX1255 or SX1257)\n", str);
-            }
-                
-            snprintf(param_name, sizeof param_name, "radio_%i.enable", i);
-            val = json_object_dotget_value(conf_obj, param_name);
-            if (json_value_get_type(val) == JSONBoolean) {
-                rfconf.enable = (bool)json_value_get_boolean(val);
-            } else {
-                rfconf.enable = false;
-            }
-            if (rfconf.enable == false) { /* radio disabled, nothing else to parse */
-                MSG(LOG_INFO,"INFO: radio %i disabled\n", i);
-            } else  { /* radio enabled, will parse the other parameters */
-                snprintf(param_name, sizeof param_name, "radio_%i.freq", i);
-                rfconf.freq_hz = (uint32_t)json_object_dotget_number(conf_obj, param_name);
-                snprintf(param_name, sizeof param_name, "radio_%i.rssi_offset", i);
-                rfconf.rssi_offset = (float)json_object_dotget_number(conf_obj, param_name);
-                
-                snprintf(param_name, sizeof param_name, "radio_%i.tx_enable", i);
-                val = json_object_dotget_value(conf_obj, param_name);
-                if (json_value_get_type(val) == JSONBoolean) {
-                    rfconf.tx_enable = (bool)json_value_get_boolean(val);
-                    if (rfconf.tx_enable == true) {
-                        /* tx is enabled on this rf chain, we need its frequency range */
-                        snprintf(param_name, sizeof param_name, "radio_%i.tx_freq_min", i);
-                        tx_freq_min[i] = (uint32_t)json_object_dotget_number(conf_obj, param_name);
-                        snprintf(param_name, sizeof param_name, "radio_%i.tx_freq_max", i);
-                        tx_freq_max[i] = (uint32_t)json_object_dotget_number(conf_obj, param_name);
-                        if ((tx_freq_min[i] == 0) || (tx_freq_max[i] == 0)) {
-                            MSG(LOG_INFO,"WARNING: no frequency range specified for TX rf chain %d\n", i);
-                        }
-                        /* ... and the notch filter frequency to be set */
-                        snprintf(param_name, sizeof param_name, "radio_%i.tx_notch_freq", i);
-                        rfconf.tx_notch_freq = (uint32_t)json_object_dotget_number(conf_obj, param_name);
-                    }
-                } else {
-                    rfconf.tx_enable = false;
-                }
-                MSG(LOG_INFO,"INFO: radio %i enabled (type %s), center frequency %u, RSSI offset %f, tx enabled %d, tx_notch_freq %u\n", i, str, rfconf.freq_hz, rfconf.rssi_offset, rfconf.tx_enable, rfconf.tx_notch_freq);
-            }
-            /* all parameters parsed, submitting configuration to the HAL */
-            if (lgw_rxrf_setconf(i, rfconf,ctx_one) != LGW_HAL_SUCCESS) {
-                MSG(LOG_INFO,"ERROR: invalid configuration for radio %i\n", i);
-                return -1;
-            }
-        }
-
-        /* set configuration for Lora multi-SF channels (bandwidth cannot be set) */
-        for (i = 0; i < LGW_MULTI_NB; ++i) {
-            memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
-            snprintf(param_name, sizeof param_name, "chan_multiSF_%i", i); /* compose parameter path inside JSON structure */
-            val = json_object_get_value(conf_obj, param_name); /* fetch value (if possible) */
-            if (json_value_get_type(val) != JSONObject) {
-                MSG(LOG_INFO,"INFO: no configuration for Lora multi-SF channel %i\n", i);
-                continue;
-            }
-            
-            /* there is an object to configure that Lora multi-SF channel, let's parse it */
-            snprintf(param_name, sizeof param_name, "chan_multiSF_%i.enable", i);
-            val = json_object_dotget_value(conf_obj, param_name);
-            if (json_value_get_type(val) == JSONBoolean) {
-                ifconf.enable = (bool)json_value_get_boolean(val);
-            } else {
-                ifconf.enable = false;
-            }
-            
-            if (ifconf.enable == false) { /* Lora multi-SF channel disabled, nothing else to parse */
-                MSG(LOG_INFO,"INFO: Lora multi-SF channel %i disabled\n", i);
-            } else  { /* Lora multi-SF channel enabled, will parse the other parameters */
-                snprintf(param_name, sizeof param_name, "chan_multiSF_%i.radio", i);
-                ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, param_name);
-                snprintf(param_name, sizeof param_name, "chan_multiSF_%i.if", i);
-                ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, param_name);
-                // TODO: handle individual SF enabling and disabling (spread_factor)
-                MSG(LOG_INFO,"INFO: Lora multi-SF channel %i>  radio %i, IF %i Hz, 125 kHz bw, SF 7 to 12\n", i, ifconf.rf_chain, ifconf.freq_hz);
-            }
-            
-            /* all parameters parsed, submitting configuration to the HAL */
-            if (lgw_rxif_setconf(i, ifconf,ctx_one) != LGW_HAL_SUCCESS) {
-                MSG(LOG_INFO,"ERROR: invalid configuration for Lora multi-SF channel %i\n", i);
-                return -1;
-            }
-        }
-
-        /* set configuration for Lora standard channel */
-        memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
-        val = json_object_get_value(conf_obj, "chan_Lora_std"); /* fetch value (if possible) */
-        if (json_value_get_type(val) != JSONObject) {
-            MSG(LOG_INFO,"INFO: no configuration for Lora standard channel\n");
-        } else {
-            val = json_object_dotget_value(conf_obj, "chan_Lora_std.enable");
-            if (json_value_get_type(val) == JSONBoolean) {
-                ifconf.enable = (bool)json_value_get_boolean(val);
-            } else {
-                ifconf.enable = false;
-            }
-            if (ifconf.enable == false) {
-                MSG(LOG_INFO,"INFO: Lora standard channel %i disabled\n", i);
-            } else  {
-                ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.radio");
-                ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.if");
-                bw = (uint32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.bandwidth");
-                switch(bw) {
-                    case 500000: ifconf.bandwidth = BW_500KHZ; break;
-                    case 250000: ifconf.bandwidth = BW_250KHZ; break;
-                    case 125000: ifconf.bandwidth = BW_125KHZ; break;
-                    default: ifconf.bandwidth = BW_UNDEFINED;
-                }
-                sf = (uint32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.spread_factor");
-                switch(sf) {
-                    case  7: ifconf.datarate = DR_LORA_SF7;  break;
-                    case  8: ifconf.datarate = DR_LORA_SF8;  break;
-                    case  9: ifconf.datarate = DR_LORA_SF9;  break;
-                    case 10: ifconf.datarate = DR_LORA_SF10; break;
-                    case 11: ifconf.datarate = DR_LORA_SF11; break;
-                    case 12: ifconf.datarate = DR_LORA_SF12; break;
-                    default: ifconf.datarate = DR_UNDEFINED;
-                }
-                MSG(LOG_INFO,"INFO: Lora std channel> radio %i, IF %i Hz, %u Hz bw, SF %u\n", ifconf.rf_chain, ifconf.freq_hz, bw, sf);
-            }
-            if (lgw_rxif_setconf(8, ifconf,ctx_one) != LGW_HAL_SUCCESS) {
-                MSG(LOG_INFO,"ERROR: invalid configuration for Lora standard channel\n");
-                return -1;
-            }
+        /* set configuration for RF chains and IF chains */
+        if (setconf_radio(ctx_one, conf_obj, ~0U, ~0U) != 0) {
+            return -1;
         }
-
-        /* set configuration for FSK channel */
-        memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
-        val = json_object_get_value(conf_obj, "chan_FSK"); /* fetch value (if possible) */
-        if (json_value_get_type(val) != JSONObject) {
-            MSG(LOG_INFO,"INFO: no configuration for FSK channel\n");
-        } else {
-            val = json_object_dotget_value(conf_obj, "chan_FSK.enable");
-            if (json_value_get_type(val) == JSONBoolean) {
-                ifconf.enable = (bool)json_value_get_boolean(val);
-            } else {
-                ifconf.enable = false;
-            }
-            if (ifconf.enable == false) {
-                MSG(LOG_INFO,"INFO: FSK channel %i disabled\n", i);
-            } else  {
-                ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.radio");
-                ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, "chan_FSK.if");
-                bw = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.bandwidth");
-                fdev = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.freq_deviation");
-                ifconf.datarate = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.datarate");
-
-                /* if chan_FSK.bandwidth is set, it has priority over chan_FSK.freq_deviation */
-                if ((bw == 0) && (fdev != 0)) {
-                    bw = 2 * fdev + ifconf.datarate;
-                }
-                if      (bw == 0)      ifconf.bandwidth = BW_UNDEFINED;
-                else if (bw <= 7800)   ifconf.bandwidth = BW_7K8HZ;
-                else if (bw <= 15600)  ifconf.bandwidth = BW_15K6HZ;
-                else if (bw <= 31200)  ifconf.bandwidth = BW_31K2HZ;
-                else if (bw <= 62500)  ifconf.bandwidth = BW_62K5HZ;
-                else if (bw <= 125000) ifconf.bandwidth = BW_125KHZ;
-                else if (bw <= 250000) ifconf.bandwidth = BW_250KHZ;
-                else if (bw <= 500000) ifconf.bandwidth = BW_500KHZ;
-                else ifconf.bandwidth = BW_UNDEFINED;
-
-                MSG(LOG_INFO,"INFO: FSK channel> radio %i, IF %i Hz, %u Hz bw, %u bps datarate\n", ifconf.rf_chain, ifconf.freq_hz, bw, ifconf.datarate);
-            }
-            if (lgw_rxif_setconf(9, ifconf,ctx_one) != LGW_HAL_SUCCESS) {
-                MSG(LOG_INFO,"ERROR: invalid configuration for FSK channel\n");
-                return -1;
-            }
+        if ((sim_board == true) && (setconf_simulation(idx, conf_obj) != 0)) {
+            MSG(LOG_INFO,"ERROR: invalid simulation parameters for concentrator %d\n", idx);
+            return -1;
         }
         g_sx1301_nb++;
     }
@@ -867,39 +1235,12 @@ static int parse_SX1301_configuration(const char * conf_file ) {
     return 0;
 }
 
-static int parse_gateway_configuration(const char * conf_file) {
-    const char conf_obj_name[] = "gateway_conf";
-    JSON_Value *root_val;
-    JSON_Object *conf_obj = NULL;
+/* server hostname or IP address and ports (optional) */
+static void parse_server_conf(JSON_Object *conf_obj) {
     JSON_Value *val = NULL; /* needed to detect the absence of some fields */
     const char *str; /* pointer to sub-strings in the JSON data */
-    unsigned long long ull = 0;
 
-    /* try to parse JSON */
-    root_val = json_parse_file_with_comments(conf_file);
-    if (root_val == NULL) {
-        MSG(LOG_INFO,"ERROR: %s is not a valid JSON file\n", conf_file);
-        exit(EXIT_FAILURE);
-    }
-
-    /* point to the gateway configuration object */
-    conf_obj = json_object_get_object(json_value_get_object(root_val), conf_obj_name);
-    if (conf_obj == NULL) {
-        MSG(LOG_INFO,"INFO: %s does not contain a JSON object named %s\n", conf_file, conf_obj_name);
-        return -1;
-    } else {
-        MSG(LOG_INFO,"INFO: %s does contain a JSON object named %s, parsing gateway parameters\n", conf_file, conf_obj_name);
-    }
-
-    /* gateway unique identifier (aka MAC address) (optional) */
-    str = json_object_get_string(conf_obj, "gateway_ID");
-    if (str != NULL) {
-        sscanf(str, "%llx", &ull);
-        lgwm = ull;
-        MSG(LOG_INFO,"INFO: gateway MAC address is configured to %016llX\n", ull);
-    }
-
-    /* server hostname or IP address (optional) */
+    pthread_mutex_lock(&mx_serv);
     str = json_object_get_string(conf_obj, "server_address");
     if (str != NULL) {
         strncpy(serv_addr, str, sizeof serv_addr);
@@ -917,6 +1258,12 @@ static int parse_gateway_configuration(const char * conf_file) {
         snprintf(serv_port_down, sizeof serv_port_down, "%u", (uint16_t)json_value_get_number(val));
         MSG(LOG_INFO,"INFO: downstream port is configured to \"%s\"\n", serv_port_down);
     }
+    pthread_mutex_unlock(&mx_serv);
+}
+
+/* keep-alive, statistics and upstream time-out intervals (optional) */
+static void parse_gateway_timers(JSON_Object *conf_obj) {
+    JSON_Value *val = NULL; /* needed to detect the absence of some fields */
 
     /* get keep-alive interval (in seconds) for downstream (optional) */
     val = json_object_get_value(conf_obj, "keepalive_interval");
@@ -931,16 +1278,6 @@ static int parse_gateway_configuration(const char * conf_file) {
         stat_interval = (unsigned)json_value_get_number(val);
         MSG(LOG_INFO,"INFO: statistics display interval is configured to %u seconds\n", stat_interval);
     }
-#ifdef _ALI_LINKWAN_    
-    /* Begin add for reset when no ack in specify time */
-    /* get count timeout of status packets had send but no ack */
-    val = json_object_get_value(conf_obj, "stat_no_ack_timeout_cnt");
-    if (val != NULL) {
-        stat_no_ack_timeout = (unsigned)json_value_get_number(val);
-        MSG(LOG_INFO,"INFO: timeout of status packets had send but no ack is configured to %u count\n", stat_no_ack_timeout);
-    }
-    /* End */
-#endif
 
     /* get time-out value (in ms) for upstream datagrams (optional) */
     val = json_object_get_value(conf_obj, "push_timeout_ms");
@@ -949,27 +1286,450 @@ static int parse_gateway_configuration(const char * conf_file) {
         MSG(LOG_INFO,"INFO: upstream PUSH_DATA time-out is configured to %u ms\n", (unsigned)(push_timeout_half.tv_usec / 500));
     }
 
+    /* get interval (in seconds) between two resolutions of the server name (optional) */
+    val = json_object_get_value(conf_obj, "dns_refresh_interval");
+    if (val != NULL) {
+        dns_refresh_interval = (unsigned)json_value_get_number(val);
+        MSG(LOG_INFO,"INFO: server name resolved again every %u seconds\n", dns_refresh_interval);
+    }
+}
+
+static int parse_fwd_policy(JSON_Object *conf_obj) {
+    struct fwd_policy_s *pol, *old;
+    JSON_Value *val = NULL; /* needed to detect the absence of some fields */
+    const char *str; /* pointer to sub-strings in the JSON data */
+
+    pol = malloc(sizeof *pol);
+    if (pol == NULL) {
+        MSG(LOG_ERR,"ERROR: out of memory for the forwarding policy\n");
+        return -1;
+    }
+    *pol = fwd_policy_default;
+
     val = json_object_get_value(conf_obj, "lorawan");
     if( val != NULL ){
-        is_lorawan = json_value_get_number(val) == 0 ? false : true;
+        pol->is_lorawan = json_value_get_number(val) == 0 ? false : true;
     }
 
-    /* packet filtering parameters */
     val = json_object_get_value(conf_obj, "forward_crc_valid");
     if (json_value_get_type(val) == JSONBoolean) {
-        fwd_valid_pkt = (bool)json_value_get_boolean(val);
+        pol->fwd_valid_pkt = (bool)json_value_get_boolean(val);
     }
-    MSG(LOG_INFO,"INFO: packets received with a valid CRC will%s be forwarded\n", (fwd_valid_pkt ? "" : " NOT"));
+    MSG(LOG_INFO,"INFO: packets received with a valid CRC will%s be forwarded\n", (pol->fwd_valid_pkt ? "" : " NOT"));
     val = json_object_get_value(conf_obj, "forward_crc_error");
     if (json_value_get_type(val) == JSONBoolean) {
-        fwd_error_pkt = (bool)json_value_get_boolean(val);
+        pol->fwd_error_pkt = (bool)json_value_get_boolean(val);
     }
-    MSG(LOG_INFO,"INFO: packets received with a CRC error will%s be forwarded\n", (fwd_error_pkt ? "" : " NOT"));
+    MSG(LOG_INFO,"INFO: packets received with a CRC error will%s be forwarded\n", (pol->fwd_error_pkt ? "" : " NOT"));
     val = json_object_get_value(conf_obj, "forward_crc_disabled");
     if (json_value_get_type(val) == JSONBoolean) {
-        fwd_nocrc_pkt = (bool)json_value_get_boolean(val);
+        pol->fwd_nocrc_pkt = (bool)json_value_get_boolean(val);
+    }
+    MSG(LOG_INFO,"INFO: packets received with no CRC will%s be forwarded\n", (pol->fwd_nocrc_pkt ? "" : " NOT"));
+
+    /* DevAddr white and black lists (optional), loaded by the caller */
+    free(devaddr_whitelist);
+    devaddr_whitelist = NULL;
+    str = json_object_get_string(conf_obj, "devaddr_whitelist");
+    if (str != NULL) {
+        devaddr_whitelist = strdup(str);
+        MSG(LOG_INFO,"INFO: DevAddr whitelist is read from \"%s\"\n", devaddr_whitelist);
+    }
+    free(devaddr_blacklist);
+    devaddr_blacklist = NULL;
+    str = json_object_get_string(conf_obj, "devaddr_blacklist");
+    if (str != NULL) {
+        devaddr_blacklist = strdup(str);
+        MSG(LOG_INFO,"INFO: DevAddr blacklist is read from \"%s\"\n", devaddr_blacklist);
+    }
+
+    /* thread_up may still use the previous policy until its next fetch */
+    old = __atomic_exchange_n(&fwd_policy, pol, __ATOMIC_SEQ_CST);
+    if (old != NULL) {
+        rcu_synchronize();
+        free(old);
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- CONFIGURATION RELOAD ------------------------------------------------- */
+
+/* gateway_conf fields applied by a reload, any other change needs a restart */
+static const char * const reload_serv_keys[] = {"server_address", "serv_port_up", "serv_port_down", NULL};
+static const char * const reload_live_keys[] = {"keepalive_interval", "stat_interval", "push_timeout_ms", "dns_refresh_interval",
+    "lorawan", "forward_crc_valid", "forward_crc_error", "forward_crc_disabled",
+    "devaddr_whitelist", "devaddr_blacklist", NULL};
+
+#define RELOAD_DIFF_MAX     64 /* changed fields reported per object */
+#define RELOAD_LORA_STD     8  /* if_mask bit of the Lora standard channel */
+#define RELOAD_FSK          9  /* if_mask bit of the FSK channel */
+
+static bool json_equal(const JSON_Value *a, const JSON_Value *b) {
+    JSON_Object *oa, *ob;
+    JSON_Array *aa, *ab;
+    size_t i, n;
+
+    if ((a == NULL) || (b == NULL)) {
+        return a == b;
+    }
+    if (json_value_get_type(a) != json_value_get_type(b)) {
+        return false;
+    }
+    switch (json_value_get_type(a)) {
+        case JSONString:
+            return strcmp(json_value_get_string(a), json_value_get_string(b)) == 0;
+        case JSONNumber:
+            return json_value_get_number(a) == json_value_get_number(b);
+        case JSONBoolean:
+            return json_value_get_boolean(a) == json_value_get_boolean(b);
+        case JSONObject:
+            oa = json_value_get_object(a);
+            ob = json_value_get_object(b);
+            n = json_object_get_count(oa);
+            if (n != json_object_get_count(ob)) {
+                return false;
+            }
+            for (i = 0; i < n; i++) {
+                if (!json_equal(json_object_get_value(oa, json_object_get_name(oa, i)), json_object_get_value(ob, json_object_get_name(oa, i)))) {
+                    return false;
+                }
+            }
+            return true;
+        case JSONArray:
+            aa = json_value_get_array(a);
+            ab = json_value_get_array(b);
+            n = json_array_get_count(aa);
+            if (n != json_array_get_count(ab)) {
+                return false;
+            }
+            for (i = 0; i < n; i++) {
+                if (!json_equal(json_array_get_value(aa, i), json_array_get_value(ab, i))) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return true; /* null */
+    }
+}
+
+static bool key_in(const char *key, const char * const *list) {
+    for (; *list != NULL; list++) {
+        if (strcmp(key, *list) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* names of the fields that are added, changed or removed between two objects, those removed are flagged */
+static int conf_diff(JSON_Object *old_obj, JSON_Object *new_obj, const char **keys, bool *removed, int max) {
+    const char *key;
+    size_t i;
+    int n = 0;
+
+    for (i = 0; (i < json_object_get_count(new_obj)) && (n < max); i++) {
+        key = json_object_get_name(new_obj, i);
+        if (!json_equal(json_object_get_value(old_obj, key), json_object_get_value(new_obj, key))) {
+            removed[n] = false;
+            keys[n++] = key;
+        }
+    }
+    for (i = 0; (i < json_object_get_count(old_obj)) && (n < max); i++) {
+        key = json_object_get_name(old_obj, i);
+        if (json_object_get_value(new_obj, key) == NULL) {
+            removed[n] = true;
+            keys[n++] = key;
+        }
+    }
+    return n;
+}
+
+/* point to the new server, the previous one is kept if it cannot be reached */
+static void reload_server(JSON_Object *conf_obj) {
+    char addr[sizeof serv_addr];
+    char port_up[sizeof serv_port_up];
+    char port_down[sizeof serv_port_down];
+
+    pthread_mutex_lock(&mx_serv);
+    memcpy(addr, serv_addr, sizeof addr);
+    memcpy(port_up, serv_port_up, sizeof port_up);
+    memcpy(port_down, serv_port_down, sizeof port_down);
+    pthread_mutex_unlock(&mx_serv);
+
+    parse_server_conf(conf_obj);
+    if (reopen_server_sockets() != 0) {
+        pthread_mutex_lock(&mx_serv);
+        memcpy(serv_addr, addr, sizeof serv_addr);
+        memcpy(serv_port_up, port_up, sizeof serv_port_up);
+        memcpy(serv_port_down, port_down, sizeof serv_port_down);
+        pthread_mutex_unlock(&mx_serv);
+        MSG(LOG_ERR,"ERROR: [reload] cannot reach the new server, still using %s (ports %s/%s)\n", addr, port_up, port_down);
+        return;
+    }
+    MSG(LOG_NOTICE,"INFO: [reload] server sockets reopened\n");
+}
+
+/* channel changes of one concentrator, it is stopped while the HAL takes them */
+static void reload_radio(int idx, JSON_Object *old_obj, JSON_Object *new_obj) {
+    const char *keys[RELOAD_DIFF_MAX];
+    bool removed[RELOAD_DIFF_MAX];
+    unsigned rf_mask = 0, if_mask = 0;
+    unsigned chain;
+    int end;
+    int i, n, x;
+
+    n = conf_diff(old_obj, new_obj, keys, removed, RELOAD_DIFF_MAX);
+    for (i = 0; i < n; i++) {
+        end = 0;
+        if (removed[i]) {
+            /* the HAL keeps the removed chain as it is */
+        } else if ((sscanf(keys[i], "radio_%u%n", &chain, &end) == 1) && (keys[i][end] == '\0') && (chain < LGW_RF_CHAIN_NB)) {
+            rf_mask |= 1U << chain;
+            continue;
+        } else if ((sscanf(keys[i], "chan_multiSF_%u%n", &chain, &end) == 1) && (keys[i][end] == '\0') && (chain < LGW_MULTI_NB)) {
+            if_mask |= 1U << chain;
+            continue;
+        } else if (strcmp(keys[i], "chan_Lora_std") == 0) {
+            if_mask |= 1U << RELOAD_LORA_STD;
+            continue;
+        } else if (strcmp(keys[i], "chan_FSK") == 0) {
+            if_mask |= 1U << RELOAD_FSK;
+            continue;
+        }
+        MSG(LOG_WARNING,"WARNING: [reload] SX1301_conf[%d].%s changed, restart needed to apply it\n", idx, keys[i]);
+    }
+    if ((rf_mask == 0) && (if_mask == 0)) {
+        return;
+    }
+    if ((idx >= SUPPORT_SX1301_MAX) || (g_ctx_arr[idx] == NULL)) {
+        MSG(LOG_WARNING,"WARNING: [reload] concentrator %d is not running, restart needed to apply its channels\n", idx);
+        return;
+    }
+
+    MSG(LOG_NOTICE,"INFO: [reload] restarting concentrator %d with its new channels (radio mask 0x%X, channel mask 0x%X)\n", idx, rf_mask, if_mask);
+    pthread_mutex_lock(&mx_concent);
+    if (simgw_enabled(idx)) {
+        /* the traffic moves to the new channels, the counter keeps running */
+        x = setconf_radio(g_ctx_arr[idx], new_obj, rf_mask, if_mask);
+        if (setconf_simulation(idx, new_obj) != 0) {
+            x = -1;
+        }
+        pthread_mutex_unlock(&mx_concent);
+        if (x != 0) {
+            MSG(LOG_ERR,"ERROR: [reload] concentrator %d rejected part of its channels, check the configuration\n", idx);
+        }
+        return;
+    }
+    board_down[idx] = true;
+    lgw_stop(g_ctx_arr[idx]);
+    x = setconf_radio(g_ctx_arr[idx], new_obj, rf_mask, if_mask);
+    if (lgw_start(g_ctx_arr[idx]) != LGW_HAL_SUCCESS) {
+        pthread_mutex_unlock(&mx_concent);
+        MSG(LOG_CRIT,"ERROR: [reload] failed to restart concentrator %d, it is down until the next restart\n", idx);
+        return;
+    }
+    pthread_mutex_unlock(&mx_concent);
+
+    /* the restart cleared the board counter, its uplinks wait for the new offsets */
+    timedomain_update();
+    pthread_mutex_lock(&mx_concent);
+    board_down[idx] = false;
+    pthread_mutex_unlock(&mx_concent);
+    if (x != 0) {
+        MSG(LOG_ERR,"ERROR: [reload] concentrator %d rejected part of its channels, check the configuration\n", idx);
+    }
+}
+
+static void reload_configuration(void) {
+    const char conf_obj_name[] = "gateway_conf";
+    const char *keys[RELOAD_DIFF_MAX];
+    bool removed[RELOAD_DIFF_MAX];
+    JSON_Value *root_val;
+    JSON_Object *old_root, *new_root;
+    JSON_Object *conf_obj = NULL;
+    JSON_Array *old_arr, *new_arr;
+    bool serv = false, timers = false;
+    int i, n;
+
+    MSG(LOG_NOTICE,"INFO: [reload] reading %s\n", global_cfg_path);
+    root_val = json_parse_file_with_comments(global_cfg_path);
+    if (root_val == NULL) {
+        MSG(LOG_ERR,"ERROR: [reload] %s is not a valid JSON file, configuration kept\n", global_cfg_path);
+        return;
+    }
+    old_root = json_value_get_object(conf_applied);
+    new_root = json_value_get_object(root_val);
+    conf_obj = json_object_get_object(new_root, conf_obj_name);
+    if (conf_obj == NULL) {
+        MSG(LOG_ERR,"ERROR: [reload] no %s object in %s, configuration kept\n", conf_obj_name, global_cfg_path);
+        json_value_free(root_val);
+        return;
+    }
+
+    /* gateway parameters */
+    n = conf_diff(json_object_get_object(old_root, conf_obj_name), conf_obj, keys, removed, RELOAD_DIFF_MAX);
+    for (i = 0; i < n; i++) {
+        if (removed[i]) {
+            MSG(LOG_WARNING,"WARNING: [reload] %s removed, restart needed to apply its default\n", keys[i]);
+        } else if (key_in(keys[i], reload_serv_keys)) {
+            MSG(LOG_NOTICE,"INFO: [reload] %s changed\n", keys[i]);
+            serv = true;
+        } else if (key_in(keys[i], reload_live_keys)) {
+            MSG(LOG_NOTICE,"INFO: [reload] %s changed\n", keys[i]);
+            timers = true;
+        } else {
+            MSG(LOG_WARNING,"WARNING: [reload] %s changed, restart needed to apply it\n", keys[i]);
+        }
+    }
+    if (timers) {
+        parse_gateway_timers(conf_obj);
+        if (setsockopt(sock_up, SOL_SOCKET, SO_RCVTIMEO, (void *)&push_timeout_half, sizeof push_timeout_half) != 0) {
+            MSG(LOG_ERR,"ERROR: [reload] setsockopt returned %s\n", strerror(errno));
+        }
+    }
+    if (serv) {
+        reload_server(conf_obj);
+    }
+
+    /* forwarding policy and filter lists, always reloaded as the list files may have changed */
+    if (parse_fwd_policy(conf_obj) != 0) {
+        MSG(LOG_ERR,"ERROR: [reload] invalid forwarding policy, previous one kept\n");
+    }
+    if (addrfilter_load(devaddr_whitelist, devaddr_blacklist) != 0) {
+        MSG(LOG_ERR,"ERROR: [reload] failed to load the DevAddr lists, previous lists kept\n");
+    }
+
+    /* concentrators */
+    old_arr = json_object_get_array(old_root, "SX1301_conf");
+    new_arr = json_object_get_array(new_root, "SX1301_conf");
+    if (json_array_get_count(old_arr) != json_array_get_count(new_arr)) {
+        MSG(LOG_WARNING,"WARNING: [reload] number of concentrators changed, restart needed to apply it\n");
+    } else {
+        for (i = 0; i < (int)json_array_get_count(new_arr); i++) {
+            reload_radio(i, json_array_get_object(old_arr, i), json_array_get_object(new_arr, i));
+        }
+    }
+
+    /* any other section is only read at start */
+    n = conf_diff(old_root, new_root, keys, removed, RELOAD_DIFF_MAX);
+    for (i = 0; i < n; i++) {
+        if ((strcmp(keys[i], conf_obj_name) != 0) && (strcmp(keys[i], "SX1301_conf") != 0)) {
+            MSG(LOG_WARNING,"WARNING: [reload] %s changed, restart needed to apply it\n", keys[i]);
+        }
+    }
+
+    json_value_free(conf_applied);
+    conf_applied = root_val;
+}
+
+/* additional servers (optional), each one takes the uplinks matching its routes */
+static int parse_fanout_servers(JSON_Object *conf_obj) {
+    JSON_Array *serv_array;
+    JSON_Array *route_array;
+    JSON_Object *serv_obj;
+    JSON_Value *val = NULL; /* needed to detect the absence of some fields */
+    const char *addr;
+    const char *route[FANOUT_ROUTE_MAX];
+    char port_up[8];
+    char port_down[8];
+    int nb_route;
+    int i, j;
+
+    serv_array = json_object_get_array(conf_obj, "servers");
+    for (i = 0; i < (int)json_array_get_count(serv_array); i++) {
+        serv_obj = json_array_get_object(serv_array, i);
+        addr = json_object_get_string(serv_obj, "server_address");
+        if (addr == NULL) {
+            MSG(LOG_ERR,"ERROR: servers[%d] has no server_address\n", i);
+            return -1;
+        }
+        snprintf(port_up, sizeof port_up, "%s", STR(DEFAULT_PORT_UP));
+        val = json_object_get_value(serv_obj, "serv_port_up");
+        if (val != NULL) {
+            snprintf(port_up, sizeof port_up, "%u", (uint16_t)json_value_get_number(val));
+        }
+        snprintf(port_down, sizeof port_down, "%s", STR(DEFAULT_PORT_DW));
+        val = json_object_get_value(serv_obj, "serv_port_down");
+        if (val != NULL) {
+            snprintf(port_down, sizeof port_down, "%u", (uint16_t)json_value_get_number(val));
+        }
+        route_array = json_object_get_array(serv_obj, "routes");
+        nb_route = 0;
+        for (j = 0; j < (int)json_array_get_count(route_array); j++) {
+            if (nb_route == FANOUT_ROUTE_MAX) {
+                MSG(LOG_ERR,"ERROR: servers[%d] has more than %d routes\n", i, FANOUT_ROUTE_MAX);
+                return -1;
+            }
+            route[nb_route] = json_array_get_string(route_array, j);
+            if (route[nb_route] != NULL) {
+                nb_route++;
+            }
+        }
+        if (fanout_add(addr, port_up, port_down, route, nb_route) < 0) {
+            return -1;
+        }
+        MSG(LOG_INFO,"INFO: additional server %d is \"%s\" (ports %s/%s), %d route(s)\n", i + 1, addr, port_up, port_down, nb_route);
+    }
+    return 0;
+}
+
+static int parse_gateway_configuration(const char * conf_file) {
+    const char conf_obj_name[] = "gateway_conf";
+    double jit_lead_percentile = JITLEAD_DEFAULT_PERCENTILE;
+    uint32_t jit_lead_margin_us = JITLEAD_DEFAULT_MARGIN_US;
+    JSON_Value *root_val;
+    JSON_Object *conf_obj = NULL;
+    JSON_Value *val = NULL; /* needed to detect the absence of some fields */
+    const char *str; /* pointer to sub-strings in the JSON data */
+    unsigned long long ull = 0;
+
+    /* try to parse JSON */
+    root_val = json_parse_file_with_comments(conf_file);
+    if (root_val == NULL) {
+        MSG(LOG_INFO,"ERROR: %s is not a valid JSON file\n", conf_file);
+        exit(EXIT_FAILURE);
+    }
+
+    /* point to the gateway configuration object */
+    conf_obj = json_object_get_object(json_value_get_object(root_val), conf_obj_name);
+    if (conf_obj == NULL) {
+        MSG(LOG_INFO,"INFO: %s does not contain a JSON object named %s\n", conf_file, conf_obj_name);
+        return -1;
+    } else {
+        MSG(LOG_INFO,"INFO: %s does contain a JSON object named %s, parsing gateway parameters\n", conf_file, conf_obj_name);
+    }
+
+    /* gateway unique identifier (aka MAC address) (optional) */
+    str = json_object_get_string(conf_obj, "gateway_ID");
+    if (str != NULL) {
+        sscanf(str, "%llx", &ull);
+        lgwm = ull;
+        MSG(LOG_INFO,"INFO: gateway MAC address is configured to %016llX\n", ull);
+    }
+
+    /* server address and ports, keep-alive, statistics and time-out intervals */
+    parse_server_conf(conf_obj);
+    parse_gateway_timers(conf_obj);
+    if (parse_fanout_servers(conf_obj) != 0) {
+        return -1;
+    }
+#ifdef _ALI_LINKWAN_    
+    /* Begin add for reset when no ack in specify time */
+    /* get count timeout of status packets had send but no ack */
+    val = json_object_get_value(conf_obj, "stat_no_ack_timeout_cnt");
+    if (val != NULL) {
+        stat_no_ack_timeout = (unsigned)json_value_get_number(val);
+        MSG(LOG_INFO,"INFO: timeout of status packets had send but no ack is configured to %u count\n", stat_no_ack_timeout);
+    }
+    /* End */
+#endif
+
+    /* packet filtering parameters */
+    if (parse_fwd_policy(conf_obj) != 0) {
+        return -1;
     }
-    MSG(LOG_INFO,"INFO: packets received with no CRC will%s be forwarded\n", (fwd_nocrc_pkt ? "" : " NOT"));
 
     str = json_object_get_string(conf_obj, "region");
     if( str != NULL ){
@@ -1094,38 +1854,181 @@ static int parse_gateway_configuration(const char * conf_file) {
         MSG(LOG_INFO,"INFO: Beaconing information descriptor is set to %u\n", beacon_infodesc);
     }
 
+    /* JIT lead time tuning (optional) */
+    val = json_object_get_value(conf_obj, "jit_lead_percentile");
+    if (val != NULL) {
+        jit_lead_percentile = json_value_get_number(val);
+    }
+    val = json_object_get_value(conf_obj, "jit_lead_margin_us");
+    if (val != NULL) {
+        jit_lead_margin_us = (uint32_t)json_value_get_number(val);
+    }
+    jitlead_init(jit_lead_percentile, jit_lead_margin_us);
+    MSG(LOG_INFO,"INFO: JIT lead time covers p%.1f of dispatch latency + %u us\n", jit_lead_percentile, jit_lead_margin_us);
+
+    /* TX confirmation (optional) */
+    val = json_object_get_value(conf_obj, "tx_ack_confirm");
+    if (json_value_get_type(val) == JSONBoolean) {
+        tx_ack_confirm = (bool)json_value_get_boolean(val);
+    }
+    val = json_object_get_value(conf_obj, "tx_retry");
+    if (json_value_get_type(val) == JSONBoolean) {
+        tx_retry = (bool)json_value_get_boolean(val);
+    }
+    if (tx_ack_confirm == true) {
+        MSG(LOG_INFO,"INFO: TX_ACK will be sent at the end of TX, failed downlinks will%s be retried\n", (tx_retry ? "" : " NOT"));
+    } else {
+        MSG(LOG_INFO,"INFO: TX_ACK will be sent when the downlink is queued\n");
+    }
+
     /* Auto-quit threshold (optional) */
     val = json_object_get_value(conf_obj, "autoquit_threshold");
     if (val != NULL) {
         autoquit_threshold = (uint32_t)json_value_get_number(val);
-        MSG(LOG_INFO,"INFO: Auto-quit after %u non-acknowledged PULL_DATA\n", autoquit_threshold);
+        MSG(LOG_INFO,"INFO: Reconnect after %u non-acknowledged PULL_DATA\n", autoquit_threshold);
     }
 
-    val = json_object_get_value(conf_obj, "data_recovery");
+    /* Metrics endpoint (optional) */
+    str = json_object_get_string(conf_obj, "metrics_endpoint");
+    if (str != NULL) {
+        metrics_endpoint = strdup(str);
+        MSG(LOG_INFO,"INFO: metrics endpoint is configured to \"%s\"\n", metrics_endpoint);
+    }
+
+    /* uplink priority lanes (optional) */
+    val = json_object_get_value(conf_obj, "uplink_lane_depth");
+    if (val != NULL) {
+        uplink_lane_depth = (unsigned)json_value_get_number(val);
+        MSG(LOG_INFO,"INFO: uplink lanes hold up to %u packets\n", uplink_lane_depth);
+    }
+    val = json_object_get_value(conf_obj, "uplink_max_rate");
+    if (val != NULL) {
+        uplink_max_rate = (uint32_t)json_value_get_number(val);
+        MSG(LOG_INFO,"INFO: PUSH_DATA rate is limited to %u bytes/s (0 = no limit)\n", uplink_max_rate);
+    }
+
+    /* shared memory ring (optional) */
+    val = json_object_get_value(conf_obj, "shm_ring");
     if (json_value_get_type(val) == JSONBoolean) {
-        data_recovery = (bool)json_value_get_boolean(val);
-        if (data_recovery == true) {
-            MSG(LOG_INFO,"INFO: data_recovery is enabled\n");
-        } else {
-            MSG(LOG_INFO,"INFO: data_recovery is disabled\n");
+        shm_ring = (bool)json_value_get_boolean(val);
+    }
+    if (shm_ring == true) {
+        str = json_object_get_string(conf_obj, "shm_ring_name");
+        if (str != NULL) {
+            shm_ring_name = strdup(str);
+        }
+        val = json_object_get_value(conf_obj, "shm_ring_slots");
+        if (val != NULL) {
+            shm_ring_slots = (uint32_t)json_value_get_number(val);
         }
+        MSG(LOG_INFO,"INFO: accepted uplinks are published in shared memory %s (%u packets)\n", (shm_ring_name != NULL) ? shm_ring_name : SHMRING_DEFAULT_NAME, shm_ring_slots);
     }
 
-    if( data_recovery == true ){
-        val = json_object_get_value(conf_obj, "data_recovery_path");
+    /* simulated SX1276 MCUs (optional) */
+    val = json_object_get_value(conf_obj, "sim_mcu");
+    if (json_value_get_type(val) == JSONBoolean) {
+        sim_mcu = (bool)json_value_get_boolean(val);
+    }
+    if (sim_mcu == true) {
+        val = json_object_get_value(conf_obj, "sim_mcu_latency_us");
         if (val != NULL) {
-            data_recovery_path = strdup(json_value_get_string(val));
+            sim_mcu_conf.latency_us = (uint32_t)json_value_get_number(val);
         }
-
-        val = json_object_get_value(conf_obj, "network_failure_threshold");
-        if( val != NULL ){
-            network_error_threshold = (uint32_t)json_value_get_number(val);
+        val = json_object_get_value(conf_obj, "sim_mcu_jitter_us");
+        if (val != NULL) {
+            sim_mcu_conf.jitter_us = (uint32_t)json_value_get_number(val);
         }
-    }
-    
-    val = json_object_get_value(conf_obj, "reset_pin");
-    if( val != NULL ){
-        reset_pin = (uint32_t)json_value_get_number(val);
+        val = json_object_get_value(conf_obj, "sim_mcu_drift_ppm");
+        if (val != NULL) {
+            sim_mcu_conf.drift_ppm = json_value_get_number(val);
+        }
+        MSG(LOG_INFO,"INFO: SX1276 MCUs are simulated, latency %u us (+%u us), drift %.1f ppm\n", sim_mcu_conf.latency_us, sim_mcu_conf.jitter_us, sim_mcu_conf.drift_ppm);
+    }
+
+    /* traffic capture and replay (optional) */
+    str = json_object_get_string(conf_obj, "capture_file");
+    if (str != NULL) {
+        capture_path = strdup(str);
+        val = json_object_get_value(conf_obj, "capture_max_size");
+        if (val != NULL) {
+            capture_max_size = (uint64_t)json_value_get_number(val);
+        }
+        MSG(LOG_INFO,"INFO: traffic is captured to \"%s\" (%llu bytes max, 0 = no limit)\n", capture_path, (unsigned long long)capture_max_size);
+    }
+    str = json_object_get_string(conf_obj, "replay_file");
+    if (str != NULL) {
+        replay_path = strdup(str);
+        val = json_object_get_value(conf_obj, "replay_speed");
+        if (val != NULL) {
+            replay_speed = json_value_get_number(val);
+        }
+        MSG(LOG_INFO,"INFO: replaying \"%s\" at speed %.1f (0 = max) instead of running the concentrators\n", replay_path, replay_speed);
+    }
+
+    /* PUSH_DATA compression (optional) */
+    val = json_object_get_value(conf_obj, "push_compression");
+    if (json_value_get_type(val) == JSONBoolean) {
+        push_compression = (bool)json_value_get_boolean(val);
+        if (push_compression == true) {
+            MSG(LOG_INFO,"INFO: PUSH_DATA will be compressed if the server accepts it\n");
+        } else {
+            MSG(LOG_INFO,"INFO: PUSH_DATA will not be compressed\n");
+        }
+    }
+
+    val = json_object_get_value(conf_obj, "data_recovery");
+    if (json_value_get_type(val) == JSONBoolean) {
+        data_recovery = (bool)json_value_get_boolean(val);
+        if (data_recovery == true) {
+            MSG(LOG_INFO,"INFO: data_recovery is enabled\n");
+        } else {
+            MSG(LOG_INFO,"INFO: data_recovery is disabled\n");
+        }
+    }
+
+    if( data_recovery == true ){
+        val = json_object_get_value(conf_obj, "data_recovery_path");
+        if (val != NULL) {
+            data_recovery_path = strdup(json_value_get_string(val));
+        }
+
+        val = json_object_get_value(conf_obj, "data_recovery_size");
+        if (val != NULL) {
+            data_recovery_size = (uint32_t)json_value_get_number(val);
+            MSG(LOG_INFO,"INFO: data_recovery store size is configured to %u bytes\n", data_recovery_size);
+        }
+
+        val = json_object_get_value(conf_obj, "data_recovery_max_age");
+        if (val != NULL) {
+            data_recovery_max_age = (uint32_t)json_value_get_number(val);
+            MSG(LOG_INFO,"INFO: data_recovery packets are kept for %u s (0 = no limit)\n", data_recovery_max_age);
+        }
+
+        val = json_object_get_value(conf_obj, "data_recovery_rate");
+        if (val != NULL) {
+            data_recovery_rate = (uint32_t)json_value_get_number(val);
+            MSG(LOG_INFO,"INFO: data_recovery replay rate is configured to %u bytes/s (0 = no limit)\n", data_recovery_rate);
+        }
+
+        val = json_object_get_value(conf_obj, "data_recovery_window");
+        if (val != NULL) {
+            data_recovery_window = (unsigned)json_value_get_number(val);
+            if ((data_recovery_window == 0) || (data_recovery_window > DRAIN_WINDOW_MAX)) {
+                MSG(LOG_WARNING,"WARNING: data_recovery_window must be 1 to %u, using %u\n", DRAIN_WINDOW_MAX, DRAIN_DEFAULT_WINDOW);
+                data_recovery_window = DRAIN_DEFAULT_WINDOW;
+            }
+            MSG(LOG_INFO,"INFO: data_recovery replay window is configured to %u datagrams\n", data_recovery_window);
+        }
+
+        val = json_object_get_value(conf_obj, "network_failure_threshold");
+        if( val != NULL ){
+            network_error_threshold = (uint32_t)json_value_get_number(val);
+        }
+    }
+    
+    val = json_object_get_value(conf_obj, "reset_pin");
+    if( val != NULL ){
+        reset_pin = (uint32_t)json_value_get_number(val);
     }
 
     str = json_object_get_string(conf_obj, "device");
@@ -1143,67 +2046,32 @@ static int parse_gateway_configuration(const char * conf_file) {
     return 0;
 }
 
-static int
-do_command(const char *format, ...)
-{
-	va_list vlist;
-	char *fmt_cmd;
-	int rc;
-    int status;
-    
-	va_start(vlist, format);
-	vasprintf(&fmt_cmd, format, vlist);
-	va_end(vlist);
-    
-	status = system(fmt_cmd);
-    rc = WEXITSTATUS(status);
-	if (rc!=0)
-		MSG(LOG_INFO,"do command failed(%d): %s", rc, fmt_cmd);
-
-	free(fmt_cmd);
+/* start one concentrator, boards are brought up in parallel */
+static void *start_lgw(void *arg) {
+    struct lgw_start_job_s *job = arg;
+    struct timespec t0, t1;
 
-	return rc;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    job->result = simgw_enabled(job->board) ? simgw_start(job->board) : lgw_start(job->ctx);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    job->duration_ms = (unsigned)(1E3 * difftimespec(t1, t0));
+    return NULL;
 }
 
-static void reset_lgw(uint32_t pin){
-
-    char path[256];
-    if( pin <= 0 )
-        return;
-
-    snprintf(path, sizeof(path),"/sys/class/gpio/gpio%d", pin);
-    if( 0 != access(path, F_OK)){
-        do_command("echo %d > /sys/class/gpio/export", pin);
+/* stop one concentrator, simulated or not */
+static int stop_lgw(int idx) {
+    if (simgw_enabled(idx)) {
+        simgw_stop(idx);
+        return LGW_HAL_SUCCESS;
     }
-
-    do_command("echo \"out\" > /sys/class/gpio/gpio%d/direction",pin);
-    do_command("echo 1 > /sys/class/gpio/gpio%d/value",pin);
-    sleep(1);
-    do_command("echo 0 > /sys/class/gpio/gpio%d/value", pin);
-    sleep(1);
-    do_command("echo \"in\" > /sys/class/gpio/gpio%d/direction",pin);
-
-    return;
+    return lgw_stop(g_ctx_arr[idx]);
 }
 
-static uint16_t crc16(const uint8_t * data, unsigned size) {
-    const uint16_t crc_poly = 0x1021;
-    const uint16_t init_val = 0x0000;
-    uint16_t x = init_val;
-    unsigned i, j;
-
-    if (data == NULL)  {
-        return 0;
-    }
-
-    for (i=0; i<size; ++i) {
-        x ^= (uint16_t)data[i] << 8;
-        for (j=0; j<8; ++j) {
-            x = (x & 0x8000) ? (x<<1) ^ crc_poly : (x<<1);
-        }
-    }
+static unsigned startup_ms(void) {
+    struct timespec now;
 
-    return x;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned)(1E3 * difftimespec(now, startup_time));
 }
 
 static double difftimespec(struct timespec end, struct timespec beginning) {
@@ -1215,7 +2083,7 @@ static double difftimespec(struct timespec end, struct timespec beginning) {
     return x;
 }
 
-static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error) {
+static int send_tx_ack(int server, uint8_t token_h, uint8_t token_l, enum jit_error_e error) {
     uint8_t buff_ack[64]; /* buffer to give feedback to server */
     int buff_index;
 
@@ -1298,6 +2166,10 @@ static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error)
     buff_ack[buff_index] = 0; /* add string terminator, for safety */
 
     /* send datagram to server */
+    capture_data(CAPTURE_UP, server, buff_ack, buff_index);
+    if (server > 0) {
+        return fanout_send(server, buff_ack, buff_index);
+    }
 #ifdef _ALI_LINKWAN_    
     /* Begin add for adapt iot lora sdk of ali 
      *  return send(sock_down, (void *)buff_ack, buff_index, 0);
@@ -1309,8 +2181,146 @@ static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error)
 #endif
 }
 
+static int send_tx_confirm(const struct txconfirm_done_s *done) {
+    uint8_t buff_ack[96]; /* buffer to give feedback to server */
+    int buff_index;
+
+    /* MCU without TX reports, nothing more known than at enqueue time */
+    if (done->status == TXCONFIRM_UNCONFIRMED) {
+        return send_tx_ack(done->server, done->token_h, done->token_l, JIT_ERROR_OK);
+    }
+
+    /* reset buffer */
+    memset(buff_ack, 0, sizeof buff_ack);
+
+    /* Prepare downlink feedback to be sent to server */
+    buff_ack[0] = PROTOCOL_VERSION;
+    buff_ack[1] = done->token_h;
+    buff_ack[2] = done->token_l;
+    buff_ack[3] = PKT_TX_ACK;
+    *(uint32_t *)(buff_ack + 4) = net_mac_h;
+    *(uint32_t *)(buff_ack + 8) = net_mac_l;
+    buff_index = 12; /* 12-byte header */
+
+    /* TX status, and airtime in us when the TX is done */
+    switch (done->status) {
+        case TXCONFIRM_OK:
+            buff_index += snprintf((char *)(buff_ack + buff_index), sizeof buff_ack - buff_index, "{\"txpk_ack\":{\"error\":\"NONE\",\"airtime\":%u}}", done->airtime_us);
+            break;
+        case TXCONFIRM_FAILED:
+            buff_index += snprintf((char *)(buff_ack + buff_index), sizeof buff_ack - buff_index, "{\"txpk_ack\":{\"error\":\"TX_FAILED\"}}");
+            break;
+        default:
+            buff_index += snprintf((char *)(buff_ack + buff_index), sizeof buff_ack - buff_index, "{\"txpk_ack\":{\"error\":\"TX_TIMEOUT\"}}");
+            break;
+    }
+
+    /* send datagram to server */
+    capture_data(CAPTURE_UP, done->server, buff_ack, buff_index);
+    if (done->server > 0) {
+        return fanout_send(done->server, buff_ack, buff_index);
+    }
+#ifdef _ALI_LINKWAN_
+    return send(sock_up, (void *)buff_ack, buff_index, 0);
+#else
+    return send(sock_down, (void *)buff_ack, buff_index, 0);
+#endif
+}
+
+/* Insert a downlink in the JIT queue of an SX1276, count_us being its TX time on
+ * the 64-bit timeline of that SX1276, pkt->count_us is set to the wire value.
+ * When TX confirmation is enabled the downlink is registered first, thread_jit
+ * may dispatch it as soon as it is queued. confirm tells if its TX_ACK is deferred. */
+static enum jit_error_e enqueue_downlink(int radio, struct timeval *jit_time, struct lgw_pkt_tx_s *pkt, uint64_t count_us, enum jit_pkt_type_e type,
+                                         int server, uint8_t token_h, uint8_t token_l, uint8_t retry_nb, bool *confirm) {
+    enum jit_error_e jit_result;
+    uint64_t now_us = (uint64_t)jit_time->tv_sec * 1000000 + (uint64_t)jit_time->tv_usec;
+    uint64_t ahead_us = (count_us > now_us) ? count_us - now_us : 0;
+
+    pkt->count_us = (uint32_t)count_us;
+    /* the TX time of an IMMEDIATE downlink is chosen by the JIT queue, it cannot be matched to its reports */
+    *confirm = (tx_ack_confirm == true) && (pkt->tx_mode != IMMEDIATE) &&
+               (txconfirm_add(server, token_h, token_l, radio, pkt, type, retry_nb, (ahead_us < UINT32_MAX) ? (uint32_t)ahead_us : UINT32_MAX) == 0);
+    jit_result = jittime_enqueue(radio, &jit_queue[radio], jit_time, pkt, count_us, type);
+    if ((jit_result != JIT_ERROR_OK) && (*confirm == true)) {
+        txconfirm_cancel(radio, pkt->count_us);
+        *confirm = false;
+    }
+
+    return jit_result;
+}
+
+/* Queue a downlink that failed on one SX1276 on another one, at the same gateway time */
+static int retry_downlink(const struct txconfirm_done_s *done) {
+    struct lgw_pkt_tx_s pkt;
+    struct timeval host_time;
+    struct timeval concent_time;
+    struct timeval jit_time;
+    uint32_t ref_us;
+    uint32_t err_us;
+    bool confirm;
+    int i;
+
+    pktbuf_tx_get(done->pkt, &pkt);
+    ref_us = pkt.count_us + (uint32_t)timedomain_sx1276_offset(done->radio, &err_us); // sx1276[radio] --> gateway tmst
+    for (i = 0; i < SUPPORT_SX1276_MAX; i++) {
+        if (g_ctx_sx1276_arr[i] == NULL)
+            break;
+        if (i == done->radio)
+            continue;
+
+        get_host_time(&host_time);
+        get_concentrator_time(&concent_time, host_time, g_ctx_sx1276_arr[i]);
+        jit_time = jitlead_time(i, concent_time);
+        if (enqueue_downlink(i, &jit_time, &pkt, timedomain_ref_to_sx1276(i, ref_us), done->type, done->server, done->token_h, done->token_l, done->retry_nb + 1, &confirm) != JIT_ERROR_OK)
+            continue;
+
+        MSG(LOG_INFO, "INFO: [jit] TX failed on sx1276 %d, retried on sx1276 %d\n", done->radio, i);
+        pthread_mutex_lock(&mx_meas_dw);
+        meas_nb_tx_retry += 1;
+        pthread_mutex_unlock(&mx_meas_dw);
+        if (confirm == false) {
+            send_tx_ack(done->server, done->token_h, done->token_l, JIT_ERROR_OK);
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Compress a PUSH_DATA if the server accepts it, returns the size of the compressed datagram or 0 to send it as is */
+static int push_data_compress(const uint8_t *dgram, int size, uint8_t *zip, int zip_max) {
+    struct timespec cpu_start;
+    struct timespec cpu_end;
+    uint32_t cpu_us;
+    int j;
+
+    if ((push_compression == false) || (compress_server_ok() == false)) {
+        return 0;
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    j = compress_lz4(dgram + 12, size - 12, zip + 12 + COMPRESS_HEAD_SIZE, zip_max - 12 - COMPRESS_HEAD_SIZE);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    cpu_us = (uint32_t)(1E6 * difftimespec(cpu_end, cpu_start));
+    metrics_hist_record(METRICS_COMPRESS_CPU, cpu_us);
+    if (j < 0) {
+        return 0;
+    }
+
+    /* same header, JSON size in front of the LZ4 block */
+    memcpy(zip, dgram, 12);
+    zip[3] = PKT_PUSH_DATA_LZ4;
+    zip[12] = (uint8_t)((size - 12) >> 8);
+    zip[13] = (uint8_t)(size - 12);
+    compress_account(size - 12, COMPRESS_HEAD_SIZE + j, cpu_us);
+    return 12 + COMPRESS_HEAD_SIZE + j;
+}
+
 static void lora_led_on(int idx){
     //system("echo 1 > /sys/class/leds/rak:green:lora/brightness");
+    if( simgw_enabled(idx) ){
+        return;
+    }
     if( idx == 0 ){
         if( g_led_arr[idx].fd <= 0 ){
             g_led_arr[idx].fd = open("/sys/class/leds/rak:green:lora/brightness", O_RDWR);
@@ -1344,6 +2354,9 @@ static void lora_led_trigger( int idx ){
 
 static void lora_led_off(int idx){
     //system("echo 0 > /sys/class/leds/rak:green:lora/brightness");
+    if( simgw_enabled(idx) ){
+        return;
+    }
     if( idx == 0 ){
         if( g_led_arr[idx].fd <= 0 ){
             g_led_arr[idx].fd = open("/sys/class/leds/rak:green:lora/brightness", O_RDWR);
@@ -1380,6 +2393,26 @@ termination_handler(int s)
 
 }
 
+static void
+txtrace_sig_handler(int s)
+{
+    (void)s;
+    txtrace_dump_req = 1;
+}
+
+static void
+reload_sig_handler(int s)
+{
+    (void)s;
+    reload_req = 1;
+}
+
+static void
+reload_request(void)
+{
+    reload_req = 1;
+}
+
 void
 sigchld_handler(int s)
 {
@@ -1437,6 +2470,20 @@ void init_signals(void)
 		exit(1);
 	}
 
+	/* Trap SIGUSR1: dump the downlink traces */
+	sa.sa_handler = txtrace_sig_handler;
+	if (sigaction(SIGUSR1, &sa, NULL) == -1) {
+		MSG(LOG_INFO, "sigaction(): %s", strerror(errno));
+		exit(1);
+	}
+
+	/* Trap SIGHUP: reload the forwarding policy and the filter lists */
+	sa.sa_handler = reload_sig_handler;
+	if (sigaction(SIGHUP, &sa, NULL) == -1) {
+		MSG(LOG_INFO, "sigaction(): %s", strerror(errno));
+		exit(1);
+	}
+
     return;
 }
 
@@ -1456,8 +2503,10 @@ watch_child(void)
         {
         	if ((pid_main = fork()) == 0) 
             {
-                /* child */
-                sleep(3);
+                /* child, restarted after a short pause so a crash loop does not spin */
+                if (pid_exit != -1) {
+                    sleep(WATCHDOG_RESTART_S);
+                }
                 signal(SIGCHLD, SIG_DFL);
                 main_loop();
                 exit(1);
@@ -1610,27 +2659,11 @@ int get_iface_ip(const char *ifname, struct sockaddr_in * addr)
 const char *uart_dev[SUPPORT_SX1276_MAX] = {
     "/dev/ttyUSB0",
 };
-int uart_fd[SUPPORT_SX1276_MAX];
 
 /* CRC8 polynomial expression 0x07(10001110) */
 uint8_t crc_check(uint8_t *data, uint8_t len)
 {
-    uint8_t i, j;
-    uint8_t crc_byte = 0x00;
-
-    for (i = 0; i < len; i++) {
-        crc_byte ^= data[i];
-
-        for (j = 0; j < 8; j++) {
-            if (crc_byte & 0x80) {
-                crc_byte <<= 1;
-                crc_byte ^= 0x07;
-            } else
-                crc_byte <<= 1;
-        }
-    }
-
-    return crc_byte;
+    return crc8_smbus(data, len);
 }
 
 int lora_uart_open(const char *dev_name)
@@ -1733,8 +2766,21 @@ int lora_uart_set_port(const int fd, int speed, int databits, int stopbits, int
     return 0;
 }
 
+/* SX1276 index of an UART, for the capture */
+static int lora_uart_index(int fd)
+{
+    int i;
+
+    for (i = 0; i < SUPPORT_SX1276_MAX; i++) {
+        if ((g_ctx_sx1276_arr[i] != NULL) && (g_ctx_sx1276_arr[i]->uart == fd))
+            return i;
+    }
+    return 0;
+}
+
 int lora_uart_write(int fd, uint8_t *buf, int size)
 {
+    capture_data(CAPTURE_UART_OUT, lora_uart_index(fd), buf, size);
     return write(fd, buf, size);
 }
 
@@ -1755,7 +2801,9 @@ int lora_uart_read(int fd, uint8_t *buf, int size)
     if (i == retry)
         return 0;
 
-    return read(fd, buf, size);
+    bytes = read(fd, buf, size);
+    capture_data(CAPTURE_UART_IN, lora_uart_index(fd), buf, bytes);
+    return bytes;
 }
 
 void lora_uart_read_version(int fd)
@@ -1828,7 +2876,56 @@ void lora_uart_read_rtc(int fd)
     MSG(LOG_NOTICE, "MCU RTC: %d.%d\n", second, msecond);
 }
 
-int lora_uart_write_downlink(const int fd, uint8_t port, uint8_t func, struct lgw_pkt_tx_s pkt)
+/* Reading the TX reports queued by the MCU since the last call,
+ * returns the number of reports or -1 if the MCU did not answer */
+int lora_uart_read_tx_report(int fd, struct txconfirm_report_s *report, int max_nb)
+{
+    int i;
+    int bytes;
+    int size = 0;
+    int len;
+    uint8_t *data;
+    uint8_t rep_buf[TX_REPORT_RETURN_SIZE];
+    uint8_t buf[] = { 0x00, 0x05, 0x00 }; /* Reading TX reports command */
+
+    tcflush(fd, TCIFLUSH); /* drop the late answer to a previous poll */
+    lora_uart_write(fd, buf, sizeof(buf) / sizeof(uint8_t));
+
+    /* the answer length is only known once its header is read */
+    do {
+        bytes = lora_uart_read(fd, &rep_buf[size], TX_REPORT_RETURN_SIZE - size);
+        if (bytes <= 0)
+            break;
+        size += bytes;
+    } while ((size <= TX_REPORT_SIZE_INDEX) || (size < TX_REPORT_FIRST_INDEX + rep_buf[TX_REPORT_SIZE_INDEX] + 1));
+
+    if ((size <= TX_REPORT_SIZE_INDEX) || (rep_buf[1] != buf[1])) {
+        return -1;
+    }
+
+    len = rep_buf[TX_REPORT_SIZE_INDEX];
+    if ((size < TX_REPORT_FIRST_INDEX + len + 1) || ((len % TX_REPORT_SIZE) != 0) || (len / TX_REPORT_SIZE > max_nb)) {
+        MSG(LOG_NOTICE, "Reading MCU TX reports errors, reading count: %d\n", size);
+        return 0;
+    }
+
+    /* Checking datas CRC */
+    if (crc_check(&rep_buf[TX_REPORT_FIRST_INDEX], len) != rep_buf[TX_REPORT_FIRST_INDEX + len]) {
+        MSG(LOG_NOTICE, "Reading MCU TX reports CRC error.\n");
+        return 0;
+    }
+
+    for (i = 0; i < len / TX_REPORT_SIZE; i++) {
+        data = &rep_buf[TX_REPORT_FIRST_INDEX + i * TX_REPORT_SIZE];
+        report[i].event = data[0];
+        report[i].count_us = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 8) | (uint32_t)data[4];
+        report[i].timer_us = ((uint32_t)data[5] << 24) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 8) | (uint32_t)data[8];
+    }
+
+    return len / TX_REPORT_SIZE;
+}
+
+int lora_uart_write_downlink(const int fd, uint8_t port, uint8_t func, const struct lgw_pkt_tx_s *pkt)
 {
     int i;
     int size;
@@ -1841,36 +2938,36 @@ int lora_uart_write_downlink(const int fd, uint8_t port, uint8_t func, struct lg
     buff[1] = func;
 
     /* Uart datas from pkt */
-    buff[2] = (uint8_t)((pkt.freq_hz >> 24) & 0xff);
-    buff[3] = (uint8_t)((pkt.freq_hz >> 16) & 0xff);
-    buff[4] = (uint8_t)((pkt.freq_hz >> 8) & 0xff);
-    buff[5] = (uint8_t)((pkt.freq_hz >> 0) & 0xff);
-    buff[6] = pkt.tx_mode;
-    buff[7] = (uint8_t)((pkt.count_us >> 24) & 0xff);
-    buff[8] = (uint8_t)((pkt.count_us >> 16) & 0xff);
-    buff[9] = (uint8_t)((pkt.count_us >> 8) & 0xff);
-    buff[10] = (uint8_t)((pkt.count_us >> 0) & 0xff);
-    buff[11] = pkt.rf_chain;
-    buff[12] = pkt.rf_power;
-    buff[13] = pkt.modulation;
-    buff[14] = pkt.bandwidth;
-    buff[15] = (uint8_t)((pkt.datarate >> 24) & 0xff);
-    buff[16] = (uint8_t)((pkt.datarate >> 16) & 0xff);
-    buff[17] = (uint8_t)((pkt.datarate >> 8) & 0xff);
-    buff[18] = (uint8_t)((pkt.datarate >> 0) & 0xff);
-    buff[19] = pkt.coderate;
-    buff[20] = pkt.invert_pol;
-    buff[21] = pkt.f_dev;
-    buff[22] = (uint8_t)((pkt.preamble >> 8) & 0xff);
-    buff[23] = (uint8_t)((pkt.preamble >> 0) & 0xff);
-    buff[24] = pkt.no_crc;
-    buff[25] = pkt.no_header;
-    buff[26] = (uint8_t)((pkt.size >> 8) & 0xff);
-    buff[27] = (uint8_t)((pkt.size >> 0) & 0xff);
-    for (i = 0; i < pkt.size; i++)
-        buff[UART_HEADER_LEN + i] = pkt.payload[i];
-
-    size = UART_HEADER_LEN + pkt.size;
+    buff[2] = (uint8_t)((pkt->freq_hz >> 24) & 0xff);
+    buff[3] = (uint8_t)((pkt->freq_hz >> 16) & 0xff);
+    buff[4] = (uint8_t)((pkt->freq_hz >> 8) & 0xff);
+    buff[5] = (uint8_t)((pkt->freq_hz >> 0) & 0xff);
+    buff[6] = pkt->tx_mode;
+    buff[7] = (uint8_t)((pkt->count_us >> 24) & 0xff);
+    buff[8] = (uint8_t)((pkt->count_us >> 16) & 0xff);
+    buff[9] = (uint8_t)((pkt->count_us >> 8) & 0xff);
+    buff[10] = (uint8_t)((pkt->count_us >> 0) & 0xff);
+    buff[11] = pkt->rf_chain;
+    buff[12] = pkt->rf_power;
+    buff[13] = pkt->modulation;
+    buff[14] = pkt->bandwidth;
+    buff[15] = (uint8_t)((pkt->datarate >> 24) & 0xff);
+    buff[16] = (uint8_t)((pkt->datarate >> 16) & 0xff);
+    buff[17] = (uint8_t)((pkt->datarate >> 8) & 0xff);
+    buff[18] = (uint8_t)((pkt->datarate >> 0) & 0xff);
+    buff[19] = pkt->coderate;
+    buff[20] = pkt->invert_pol;
+    buff[21] = pkt->f_dev;
+    buff[22] = (uint8_t)((pkt->preamble >> 8) & 0xff);
+    buff[23] = (uint8_t)((pkt->preamble >> 0) & 0xff);
+    buff[24] = pkt->no_crc;
+    buff[25] = pkt->no_header;
+    buff[26] = (uint8_t)((pkt->size >> 8) & 0xff);
+    buff[27] = (uint8_t)((pkt->size >> 0) & 0xff);
+    for (i = 0; i < pkt->size; i++)
+        buff[UART_HEADER_LEN + i] = pkt->payload[i];
+
+    size = UART_HEADER_LEN + pkt->size;
 
     return lora_uart_write(fd, buff, size);
 }
@@ -1878,6 +2975,7 @@ int lora_uart_write_downlink(const int fd, uint8_t port, uint8_t func, struct lg
 lgw_context_sx1276 * lgw_context_sx1276_init(int index)
 {
     lgw_context_sx1276 * ctx = NULL;
+    char sim_dev[64];
 
     ctx = (lgw_context_sx1276 *)malloc(sizeof(lgw_context_sx1276));
     if( NULL == ctx ){
@@ -1887,7 +2985,20 @@ lgw_context_sx1276 * lgw_context_sx1276_init(int index)
 
     memset(ctx, 0x00, sizeof(lgw_context_sx1276));
 
-    ctx->uart = lora_uart_open(uart_dev[index]);
+    if (sim_mcu == true) {
+        /* the simulated MCU answers on a pseudo terminal, opened as the UART, replay included */
+        if (simmcu_open(index, &sim_mcu_conf, sim_dev, sizeof sim_dev) != 0) {
+            MSG(LOG_ERR, "ERROR: Simulated MCU failed, index: %d.\n", index);
+            exit(EXIT_FAILURE);
+        }
+        ctx->uart = lora_uart_open(sim_dev);
+    } else if (replay_path != NULL) {
+        /* no MCU during a replay, downlinks are accepted and never reported */
+        ctx->uart = lora_uart_open("/dev/null");
+        return ctx;
+    } else {
+        ctx->uart = lora_uart_open(uart_dev[index]);
+    }
     if (ctx->uart == -1) {
         MSG(LOG_ERR, "ERROR: Open faild, index: %d.\n", index);
         exit(EXIT_FAILURE);
@@ -1909,24 +3020,30 @@ static int main_loop()
     int idx;
     /* configuration file related */
 
+    /* concentrators bring-up */
+    uint32_t reset_pins[SUPPORT_SX1301_MAX];
+    struct lgw_start_job_s start_job[SUPPORT_SX1301_MAX];
+    pthread_t start_thrid[SUPPORT_SX1301_MAX];
+    int nb_board;
+    unsigned retry_s;
+    unsigned conf_ms, reset_ms, start_ms, net_ms;
+
     /* threads */
     pthread_t thrid_logger;
     pthread_t thrid_up;
     pthread_t thrid_down;
+    pthread_t thrid_conn;
     pthread_t thrid_gps;
     pthread_t thrid_valid;
     pthread_t thrid_jit;
     pthread_t thrid_timersync;
+    pthread_t thrid_beacon;
+    pthread_t thrid_drain;
     pthread_t thrid_rrd;
     pthread_t thrid_led;
-    /* network socket creation */
-    struct addrinfo hints;
-    struct addrinfo *result; /* store result of getaddrinfo */
-    struct addrinfo *q; /* pointer to move into *result data */
-
-    char host_name[64];
-    char port_name[64];
-
+    pthread_t thrid_metrics;
+    unsigned wait_s;
+    bool metrics_enabled = false;
     /* variables to get local copies of measurements */
     uint32_t cp_nb_rx_rcv;
     uint32_t cp_nb_rx_ok;
@@ -1944,6 +3061,10 @@ static int main_loop()
     uint32_t cp_dw_payload_byte;
     uint32_t cp_nb_tx_ok;
     uint32_t cp_nb_tx_fail;
+    uint32_t cp_nb_tx_confirmed;
+    uint32_t cp_nb_tx_unsent;
+    uint32_t cp_nb_tx_timeout;
+    uint32_t cp_nb_tx_retry;
     uint32_t cp_nb_tx_requested = 0;
     uint32_t cp_nb_tx_rejected_collision_packet = 0;
     uint32_t cp_nb_tx_rejected_collision_beacon = 0;
@@ -1960,12 +3081,36 @@ static int main_loop()
     /* End */
 #endif
 
+    /* data_recovery store and replay statistics */
+    struct pktstore_stat_s store_stat;
+    struct drain_stat_s drain_st;
+    struct compress_stat_s zip_st;
+
+    /* DevAddr filter statistics */
+    struct addrfilter_stat_s filter_st;
+    struct fanout_stat_s serv_st;
+    struct uplane_stat_s lane_st;
+    struct shmring_stat_s shm_st;
+    struct capture_stat_s cap_st;
+    struct replay_stat_s replay_st;
+    int replay_done_nb = 0; /* consecutive reports with the replay done */
+    struct simgw_stat_s sim_st;
+    struct simmcu_stat_s mcu_st;
+
+    /* pending downlinks held for TX_ACK */
+    struct pktbuf_stat_s buf_st;
+
     /* GPS coordinates variables */
     bool coord_ok = false;
     struct coord_s cp_gps_coord = {0.0, 0.0, 0};
+    uint32_t cp_gps_nb_frame = 0;
+    uint32_t cp_gps_nb_corrupt = 0;
+    uint32_t cp_gps_nb_lost = 0;
 
     /* SX1301 data variables */
     uint32_t trig_tstamp;
+    int32_t offset_us;
+    uint32_t offset_error_us;
 
     /* statistics variable */
     time_t t;
@@ -1984,6 +3129,8 @@ static int main_loop()
 
     lgw_context_sx1276 * ctx_sx1276 = NULL;
 
+    clock_gettime(CLOCK_MONOTONIC, &startup_time);
+
     /* display version informations */
     MSG(LOG_INFO,"*** Beacon Packet Forwarder for Lora Gateway ***\nVersion: " VERSION_STRING "\n");
     MSG(LOG_INFO,"*** Lora concentrator HAL library version info ***\n%s\n***\n", lgw_version_info());
@@ -2007,15 +3154,22 @@ static int main_loop()
         if (x != 0) {
             exit(EXIT_FAILURE);
         }
+        conf_applied = json_parse_file_with_comments(global_cfg_path);
     } 
 
     else {
         MSG(LOG_CRIT,"ERROR: [main] failed to find any configuration file named %s, %s OR %s\n", global_cfg_path, local_cfg_path, debug_cfg_path);
         exit(EXIT_FAILURE);
     }
+    conf_ms = startup_ms();
+
+    /* start the capture before any traffic */
+    if ((capture_path != NULL) && (capture_open(capture_path, capture_max_size) != 0)) {
+        MSG(LOG_ERR,"ERROR: [main] failed to start the capture, traffic is not captured\n");
+    }
 
     /* Start GPS a.s.a.p., to allow it to lock */
-    if (gps_tty_path[0] != '\0') { /* do not try to open GPS device if no path set */
+    if ((gps_tty_path[0] != '\0') && (replay_path == NULL)) { /* do not try to open GPS device if no path set, nor during a replay */
         i = lgw_gps_enable(gps_tty_path, "ubx7", 0, &gps_tty_fd); /* HAL only supports u-blox 7 for now */
         if (i != LGW_GPS_SUCCESS) {
             MSG(LOG_WARNING,"WARNING: [main] impossible to open %s for GPS sync (check permissions)\n", gps_tty_path);
@@ -2046,38 +3200,49 @@ static int main_loop()
     sigaction(SIGINT, &sigact, NULL); /* Ctrl-C */
     sigaction(SIGTERM, &sigact, NULL); /* default "kill" command */
 
-    /* prepare hints to open network sockets */
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_INET; /* WA: Forcing IPv4 as AF_UNSPEC makes connection on localhost to fail */
-    hints.ai_socktype = SOCK_DGRAM;
-
-    /* Init lgw */
-    for( idx=0; idx < SUPPORT_SX1301_MAX; idx++ ){
-        if( NULL == g_ctx_arr[idx])
-            break;
-
-        if( 0 == g_ctx_arr[idx]->reset_pin )
-            continue;
-        
-        reset_lgw(g_ctx_arr[idx]->reset_pin);     
+    /* reset all the concentrators together, then start them in parallel */
+    for (idx = 0; (idx < SUPPORT_SX1301_MAX) && (g_ctx_arr[idx] != NULL); idx++) {
+        reset_pins[idx] = simgw_enabled(idx) ? 0 : g_ctx_arr[idx]->reset_pin; /* 0 is not pulsed */
     }
-    /* starting the concentrator */
- 
-    for( idx = 0; idx < SUPPORT_SX1301_MAX; idx++ ){
-        if( NULL == g_ctx_arr[idx] )
-            break;
-        
-        i = lgw_start(g_ctx_arr[idx]);
-        if (i == LGW_HAL_SUCCESS) {
-            MSG(LOG_NOTICE,"INFO: [main] concentrator started, packet can now be received\n");
-            
-            lora_led_on(idx);
-            
-        } else {
-            MSG(LOG_CRIT,"ERROR: [main] failed to start the concentrator\n");
+    nb_board = idx;
+    if (replay_path != NULL) {
+        /* the capture stands in for the concentrators, a local server for the network server */
+        if ((replay_open(replay_path, replay_speed, nb_board) != 0)
+            || (replay_server_start(serv_addr, sizeof serv_addr, serv_port_up, serv_port_down, sizeof serv_port_up) != 0)) {
+            MSG(LOG_CRIT,"ERROR: [main] failed to start the replay of %s\n", replay_path);
             exit(EXIT_FAILURE);
         }
+        reset_ms = startup_ms();
+    } else {
+        if (gpio_reset_pulse(reset_pins, nb_board) != 0) {
+            MSG(LOG_WARNING,"WARNING: [main] failed to reset some concentrators, trying to start them anyway\n");
+        }
+        reset_ms = startup_ms();
+
+        for (idx = 0; idx < nb_board; idx++) {
+            start_job[idx].board = idx;
+            start_job[idx].ctx = g_ctx_arr[idx];
+            start_job[idx].result = LGW_HAL_ERROR;
+            start_job[idx].duration_ms = 0;
+            if (pthread_create(&start_thrid[idx], NULL, start_lgw, &start_job[idx]) != 0) {
+                start_lgw(&start_job[idx]); /* no thread left, start it from here */
+                start_thrid[idx] = pthread_self();
+            }
+        }
+        for (idx = 0; idx < nb_board; idx++) {
+            if (!pthread_equal(start_thrid[idx], pthread_self())) {
+                pthread_join(start_thrid[idx], NULL);
+            }
+            if (start_job[idx].result == LGW_HAL_SUCCESS) {
+                MSG(LOG_NOTICE,"INFO: [main] concentrator %d started in %u ms, packet can now be received\n", idx, start_job[idx].duration_ms);
+                lora_led_on(idx);
+            } else {
+                MSG(LOG_CRIT,"ERROR: [main] failed to start concentrator %d\n", idx);
+                exit(EXIT_FAILURE);
+            }
+        }
     }
+    start_ms = startup_ms();
     
     /* Open UsbToUart device file */
     for (i = 0; i < SUPPORT_SX1276_MAX; i++) {
@@ -2090,155 +3255,57 @@ static int main_loop()
         g_ctx_sx1276_arr[i] = ctx_sx1276;
     }
 
-    while(!exit_sig && !quit_sig )
-    {
-        sleep(10);
-        
-        /* look for server address w/ upstream port */
-        i = getaddrinfo(serv_addr, serv_port_up, &hints, &result);
-        if (i != 0) {
-            MSG(LOG_ERR,"ERROR: [up] getaddrinfo on address %s (PORT %s) returned %s\n", serv_addr, serv_port_up, gai_strerror(i));
-            if( data_recovery ){
-                continue;
-            }
-            else{
-                exit(EXIT_FAILURE);
-            }
+    /* open sockets for upstream and downstream traffic, first attempt right away */
+    for (retry_s = 0; !exit_sig && !quit_sig; retry_s = (retry_s == 0) ? 1 : ((2 * retry_s < CONNECT_RETRY_MAX_S) ? 2 * retry_s : CONNECT_RETRY_MAX_S)) {
+        if (retry_s > 0) {
+            MSG(LOG_WARNING,"WARNING: [main] server not reachable, next attempt in %u s\n", retry_s);
+            sleep(retry_s);
         }
-        /* try to open socket for upstream traffic */
-        for (q=result; q!=NULL; q=q->ai_next) {
-            sock_up = socket(q->ai_family, q->ai_socktype,q->ai_protocol);
-            if (sock_up == -1) 
-                continue; /* try next field */
-            else 
-                break; /* success, get out of loop */
-        }
-
-        if (q == NULL) {
-            MSG(LOG_ERR,"ERROR: [up] failed to open socket to any of server %s addresses (port %s)\n", serv_addr, serv_port_up);
-            i = 1;
-            for (q=result; q!=NULL; q=q->ai_next) {
-                getnameinfo(q->ai_addr, q->ai_addrlen, host_name, sizeof host_name, port_name, sizeof port_name, NI_NUMERICHOST);
-                MSG(LOG_INFO,"INFO: [up] result %i host:%s service:%s\n", i, host_name, port_name);
-                ++i;
-            }
-            freeaddrinfo(result);
+        sock_up = open_server_socket(false, &push_timeout_half);
+        if (sock_up == -1) {
+            continue;
+        }
+        sock_down = open_server_socket(true, NULL);
+        if (sock_down == -1) {
             close(sock_up);
-            if( data_recovery ){
-                continue;
-            }
-            else{
-                exit(EXIT_FAILURE);
-            }
+            sock_up = -1;
+            continue;
+        }
+        break;
+    }
+    if (exit_sig || quit_sig) {
+        for (idx = 0; exit_sig && (replay_path == NULL) && (idx < nb_board); idx++) {
+            stop_lgw(idx);
         }
-
-        /* connect so we can send/receive packet with the server only */
-        i = connect(sock_up, q->ai_addr, q->ai_addrlen);
-        if (i != 0) {
-            MSG(LOG_ERR,"ERROR: [up] connect returned %s\n", strerror(errno));
-            freeaddrinfo(result);
-            //exit(EXIT_FAILURE);
-            close(sock_up);
-            if( data_recovery ){
-                continue;
-            }
-            else{
-                exit(EXIT_FAILURE);
-            }
-        }
-        
-        /* set upstream socket RX timeout */
-        i = setsockopt(sock_up, SOL_SOCKET, SO_RCVTIMEO, (void *)&push_timeout_half, sizeof push_timeout_half);
-        if (i != 0) {
-            MSG(LOG_CRIT,"ERROR: [up] setsockopt returned %s\n", strerror(errno));
-            exit(EXIT_FAILURE);
-        }
-        
-        freeaddrinfo(result);
-        /* look for server address w/ downstream port */
-        i = getaddrinfo(serv_addr, serv_port_down, &hints, &result);
-        if (i != 0) {
-            MSG(LOG_ERR,"ERROR: [down] getaddrinfo on address %s (port %s) returned %s\n", serv_addr, serv_port_up, gai_strerror(i));
-            if( data_recovery ){
-                continue;
-            }
-            else{
-                exit(EXIT_FAILURE);
-            }
-        }
-
-        /* try to open socket for downstream traffic */
-        for (q=result; q!=NULL; q=q->ai_next) {
-            sock_down = socket(q->ai_family, q->ai_socktype,q->ai_protocol);
-            if (sock_down == -1)
-                continue; /* try next field */
-            else 
-                break; /* success, get out of loop */
-        }
-
-        if (q == NULL) {
-            MSG(LOG_ERR,"ERROR: [down] failed to open socket to any of server %s addresses (port %s)\n", serv_addr, serv_port_up);
-            i = 1;
-            for (q=result; q!=NULL; q=q->ai_next) {
-                getnameinfo(q->ai_addr, q->ai_addrlen, host_name, sizeof host_name, port_name, sizeof port_name, NI_NUMERICHOST);
-                MSG(LOG_INFO,"INFO: [down] result %i host:%s service:%s\n", i, host_name, port_name);
-                ++i;
-            }
-            //exit(EXIT_FAILURE);
-            close(sock_down);
-            freeaddrinfo(result);
-            if( data_recovery ){
-                continue;
-            }
-            else{
-                exit(EXIT_FAILURE);
-            }
-        }
-#ifdef _ALI_LINKWAN_
-         /* bind so we can receive packet with the server only */
-        i = bind(sock_down, q->ai_addr, q->ai_addrlen);
-        if (i != 0) {
-             MSG(LOG_ERR,"ERROR: [down] bind returned %s\n", strerror(errno));
-            close(sock_down);
-            freeaddrinfo(result);
-            if( data_recovery ){
-                continue;
-            }
-            else{
-                exit(EXIT_FAILURE);
-            }
-        }
-        
-        
-#else
-       /* connect so we can send/receive packet with the server only */
-        i = connect(sock_down, q->ai_addr, q->ai_addrlen);
-        if (i != 0) {
-            MSG(LOG_CRIT,"ERROR: [down] connect returned %s\n", strerror(errno));
-            //exit(EXIT_FAILURE);
-            close(sock_down);
-            freeaddrinfo(result);
-            if( data_recovery ){
-                continue;
-            }
-            else{
-                exit(EXIT_FAILURE);
-            }
-        }
-#endif
-
-        freeaddrinfo(result);
-        break;
-    }
-    
-
+        exit(EXIT_SUCCESS);
+    }
+    net_ms = startup_ms();
 
 #if defined(USE_FILTER_NODE)
     if (0 == filter_init()) {
         filter_inited = 1;
     }
 #endif
+    if ((devaddr_whitelist != NULL) || (devaddr_blacklist != NULL)) {
+        if (addrfilter_load(devaddr_whitelist, devaddr_blacklist) != 0) {
+            MSG(LOG_ERR,"ERROR: [main] failed to load the DevAddr lists, uplinks are not filtered by DevAddr\n");
+        }
+    }
     rrd_init();  
+
+    if (shm_ring == true) {
+        if (shmring_init(shm_ring_name, shm_ring_slots) != 0) {
+            MSG(LOG_ERR,"ERROR: [main] failed to create the shared memory ring, uplinks are not published\n");
+            shm_ring = false;
+        }
+    }
+
+    if (fanout_count() > 0) {
+        if (fanout_start(net_mac_h, net_mac_l, keepalive_time) != 0) {
+            MSG(LOG_CRIT,"ERROR: [main] impossible to create the additional server threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
     
     i = pthread_create( &thrid_up, NULL, (void * (*)(void *))thread_up, NULL);
     if (i != 0) {
@@ -2259,11 +3326,21 @@ static int main_loop()
         exit(EXIT_FAILURE);
     }
 
+    /* JIT queue initialization, shared by the downstream and beacon threads */
+    for (i = 0; i < SUPPORT_SX1276_MAX; i++) {
+        jit_queue_init(&jit_queue[i]);
+    }
+
     i = pthread_create( &thrid_down, NULL, (void * (*)(void *))thread_down, NULL);
     if (i != 0) {
         MSG(LOG_CRIT,"ERROR: [main] impossible to create downstream thread\n");
         exit(EXIT_FAILURE);
     }
+    i = pthread_create( &thrid_conn, NULL, (void * (*)(void *))thread_conn, NULL);
+    if (i != 0) {
+        MSG(LOG_CRIT,"ERROR: [main] impossible to create connection thread\n");
+        exit(EXIT_FAILURE);
+    }
     i = pthread_create( &thrid_jit, NULL, (void * (*)(void *))thread_jit, NULL);
     if (i != 0) {
         MSG(LOG_CRIT,"ERROR: [main] impossible to create JIT thread\n");
@@ -2274,6 +3351,20 @@ static int main_loop()
         MSG(LOG_CRIT,"ERROR: [main] impossible to create Timer Sync thread\n");
         exit(EXIT_FAILURE);
     }
+    if (beacon_period != 0) {
+        i = pthread_create( &thrid_beacon, NULL, (void * (*)(void *))thread_beacon, NULL);
+        if (i != 0) {
+            MSG(LOG_CRIT,"ERROR: [main] impossible to create beacon thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (data_recovery == true) {
+        i = pthread_create( &thrid_drain, NULL, (void * (*)(void *))thread_drain, NULL);
+        if (i != 0) {
+            MSG(LOG_CRIT,"ERROR: [main] impossible to create drain thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     
     i = pthread_create(&thrid_led, NULL, (void *(*)(void *))thread_led, NULL);
@@ -2282,6 +3373,17 @@ static int main_loop()
         exit(EXIT_FAILURE);
     }
     
+    /* spawn thread to serve metrics, it also takes reload requests */
+    metrics_set_reload(reload_request);
+    if ((metrics_endpoint != NULL) && (metrics_init(metrics_endpoint) == 0)) {
+        i = pthread_create( &thrid_metrics, NULL, (void * (*)(void *))thread_metrics, NULL);
+        if (i != 0) {
+            MSG(LOG_CRIT,"ERROR: [main] impossible to create metrics thread\n");
+            exit(EXIT_FAILURE);
+        }
+        metrics_enabled = true;
+    }
+
     /* spawn thread to manage GPS */
     if (gps_enabled == true) {
         i = pthread_create( &thrid_gps, NULL, (void * (*)(void *))thread_gps, NULL);
@@ -2297,10 +3399,23 @@ static int main_loop()
     }
     
     
+    MSG(LOG_NOTICE,"INFO: [main] start-up timeline: configuration %u ms, reset %u ms, concentrators started %u ms, server reached %u ms, threads running %u ms\n",
+        conf_ms, reset_ms, start_ms, net_ms, startup_ms());
+
     /* main loop task : statistics collection */
     while (!exit_sig && !quit_sig) {
-        /* wait for next reporting interval */
-        wait_ms(1000 * stat_interval);
+        /* wait for next reporting interval, serving trace dump and reload requests meanwhile */
+        for (wait_s = 0; (wait_s < stat_interval) && !exit_sig && !quit_sig; wait_s++) {
+            wait_ms(1000);
+            if (txtrace_dump_req) {
+                txtrace_dump_req = 0;
+                txtrace_dump();
+            }
+            if (reload_req) {
+                reload_req = 0;
+                reload_configuration();
+            }
+        }
 
         /* get timestamp for statistics */
         t = time(NULL);
@@ -2366,6 +3481,10 @@ static int main_loop()
         cp_dw_payload_byte =  meas_dw_payload_byte;
         cp_nb_tx_ok        =  meas_nb_tx_ok;
         cp_nb_tx_fail      =  meas_nb_tx_fail;
+        cp_nb_tx_confirmed =  meas_nb_tx_confirmed;
+        cp_nb_tx_unsent    =  meas_nb_tx_unsent;
+        cp_nb_tx_timeout   =  meas_nb_tx_timeout;
+        cp_nb_tx_retry     =  meas_nb_tx_retry;
         cp_nb_tx_requested                 +=  meas_nb_tx_requested;
         cp_nb_tx_rejected_collision_packet +=  meas_nb_tx_rejected_collision_packet;
         cp_nb_tx_rejected_collision_beacon +=  meas_nb_tx_rejected_collision_beacon;
@@ -2381,6 +3500,10 @@ static int main_loop()
         meas_dw_payload_byte = 0;
         meas_nb_tx_ok = 0;
         meas_nb_tx_fail = 0;
+        meas_nb_tx_confirmed = 0;
+        meas_nb_tx_unsent = 0;
+        meas_nb_tx_timeout = 0;
+        meas_nb_tx_retry = 0;
         meas_nb_tx_requested = 0;
         meas_nb_tx_rejected_collision_packet = 0;
         meas_nb_tx_rejected_collision_beacon = 0;
@@ -2390,6 +3513,18 @@ static int main_loop()
         meas_nb_beacon_sent = 0;
         meas_nb_beacon_rejected = 0;
         pthread_mutex_unlock(&mx_meas_dw);
+
+        /* metrics endpoint exposes cumulative counters */
+        metrics_counter_add(METRICS_RX_RCV, cp_nb_rx_rcv);
+        metrics_counter_add(METRICS_RX_OK, cp_nb_rx_ok);
+        metrics_counter_add(METRICS_UP_PKT_FWD, cp_up_pkt_fwd);
+        metrics_counter_add(METRICS_UP_DGRAM_SENT, cp_up_dgram_sent);
+        metrics_counter_add(METRICS_UP_ACK_RCV, cp_up_ack_rcv);
+        metrics_counter_add(METRICS_DW_PULL_SENT, cp_dw_pull_sent);
+        metrics_counter_add(METRICS_DW_ACK_RCV, cp_dw_ack_rcv);
+        metrics_counter_add(METRICS_DW_DGRAM_RCV, cp_dw_dgram_rcv);
+        metrics_counter_add(METRICS_TX_OK, cp_nb_tx_ok);
+        metrics_counter_add(METRICS_TX_FAIL, cp_nb_tx_fail);
         if (cp_dw_pull_sent > 0) {
             dw_ack_ratio = (float)cp_dw_ack_rcv / (float)cp_dw_pull_sent;
         } else {
@@ -2407,6 +3542,12 @@ static int main_loop()
             pthread_mutex_lock(&mx_meas_gps);
             coord_ok = gps_coord_valid;
             cp_gps_coord = meas_gps_coord;
+            cp_gps_nb_frame = meas_gps_nb_frame;
+            cp_gps_nb_corrupt = meas_gps_nb_corrupt;
+            cp_gps_nb_lost = meas_gps_nb_lost;
+            meas_gps_nb_frame = 0;
+            meas_gps_nb_corrupt = 0;
+            meas_gps_nb_lost = 0;
             pthread_mutex_unlock(&mx_meas_gps);
         }
 
@@ -2423,11 +3564,52 @@ static int main_loop()
         MSG(LOG_NOTICE,"# RF packets forwarded: %u (%u bytes)\n", cp_up_pkt_fwd, cp_up_payload_byte);
         MSG(LOG_NOTICE,"# PUSH_DATA datagrams sent: %u (%u bytes)\n", cp_up_dgram_sent, cp_up_network_byte);
         MSG(LOG_NOTICE,"# PUSH_DATA acknowledged: %.2f\n", 100.0 * up_ack_ratio);
+        uplane_stat(&lane_st);
+        MSG(LOG_NOTICE,"# Uplink lanes, sent/shed/queued: join %u/%u/%u, confirmed %u/%u/%u, unconfirmed %u/%u/%u, CRC error %u/%u/%u\n",
+            lane_st.nb_sent[UPLANE_JOIN], lane_st.nb_shed[UPLANE_JOIN], lane_st.nb_queued[UPLANE_JOIN],
+            lane_st.nb_sent[UPLANE_CONFIRMED], lane_st.nb_shed[UPLANE_CONFIRMED], lane_st.nb_queued[UPLANE_CONFIRMED],
+            lane_st.nb_sent[UPLANE_UNCONFIRMED], lane_st.nb_shed[UPLANE_UNCONFIRMED], lane_st.nb_queued[UPLANE_UNCONFIRMED],
+            lane_st.nb_sent[UPLANE_BAD], lane_st.nb_shed[UPLANE_BAD], lane_st.nb_queued[UPLANE_BAD]);
+        MSG(LOG_NOTICE,"# Backhaul congestion level: %u (PUSH_ACK srtt %u ms)\n", lane_st.level, lane_st.srtt_us / 1000);
+        if (shm_ring == true) {
+            shmring_stat(&shm_st);
+            MSG(LOG_NOTICE,"# Shared memory ring: %u packets published, %d readers (%d too slow), max lag %llu\n", shm_st.nb_pub, shm_st.nb_reader, shm_st.nb_slow, (unsigned long long)shm_st.max_lag);
+        }
+        if (push_compression == true) {
+            compress_stat(&zip_st);
+            if (zip_st.nb_dgram > 0) {
+                MSG(LOG_NOTICE,"# PUSH_DATA compressed: %u (%u bytes for %u, ratio %.2f), %.1f us CPU per datagram\n", zip_st.nb_dgram, zip_st.zip_byte, zip_st.raw_byte, (double)zip_st.zip_byte / zip_st.raw_byte, (double)zip_st.cpu_us / zip_st.nb_dgram);
+            } else {
+                MSG(LOG_NOTICE,"# PUSH_DATA compressed: 0\n");
+            }
+        }
+        if ((devaddr_whitelist != NULL) || (devaddr_blacklist != NULL)) {
+            addrfilter_stat(&filter_st);
+            MSG(LOG_NOTICE,"# DevAddr filter: %u rules, %u uplinks kept, %u dropped, %u unlisted\n", filter_st.nb_rule, filter_st.nb_pass, filter_st.nb_drop, filter_st.nb_unlisted);
+            for (i = 0; i < filter_st.nb_top; i++) {
+                MSG(LOG_NOTICE,"#   %08X/%u (%s): %u hits\n", filter_st.top[i].addr, filter_st.top[i].len, (filter_st.top[i].list == ADDRFILTER_BLACK) ? "black" : "white", filter_st.top[i].hits);
+            }
+        }
+        if (data_recovery == true) {
+            pktstore_stat(&store_stat);
+            MSG(LOG_NOTICE,"# Stored packets: %u (%u bytes), evicted: %u, expired: %u\n", store_stat.nb_pkt, store_stat.nb_byte, store_stat.nb_evicted, store_stat.nb_expired);
+            drain_stat(&drain_st);
+            if (drain_st.pkt_rate > 0.0) {
+                MSG(LOG_NOTICE,"# Replayed packets: %u (%u datagrams, %u timeouts), %.1f pkt/s, ETA %.0f s\n", drain_st.nb_pkt_acked, drain_st.nb_dgram_sent, drain_st.nb_dgram_timeout, drain_st.pkt_rate, store_stat.nb_pkt / drain_st.pkt_rate);
+            } else {
+                MSG(LOG_NOTICE,"# Replayed packets: %u (%u datagrams, %u timeouts), ETA unknown\n", drain_st.nb_pkt_acked, drain_st.nb_dgram_sent, drain_st.nb_dgram_timeout);
+            }
+        }
         MSG(LOG_NOTICE,"### [DOWNSTREAM] ###\n");
         MSG(LOG_NOTICE,"# PULL_DATA sent: %u (%.2f acknowledged)\n", cp_dw_pull_sent, 100.0f * dw_ack_ratio);
         MSG(LOG_NOTICE,"# PULL_RESP(onse) datagrams received: %u (%u bytes)\n", cp_dw_dgram_rcv, cp_dw_network_byte);
         MSG(LOG_NOTICE,"# RF packets sent to concentrator: %u (%u bytes)\n", (cp_nb_tx_ok+cp_nb_tx_fail), cp_dw_payload_byte);
         MSG(LOG_NOTICE,"# TX errors: %u\n", cp_nb_tx_fail);
+        if (tx_ack_confirm == true) {
+            MSG(LOG_NOTICE,"# TX confirmed: %u, failed: %u, timed out: %u, retried: %u\n", cp_nb_tx_confirmed, cp_nb_tx_unsent, cp_nb_tx_timeout, cp_nb_tx_retry);
+            pktbuf_stat(&buf_st);
+            MSG(LOG_NOTICE,"# Packet buffers: %u in use (%u bytes), %u slabs\n", buf_st.nb_used, buf_st.byte_used, buf_st.nb_slab);
+        }
         if (cp_nb_tx_requested != 0 ) {
             MSG(LOG_NOTICE,"# TX rejected (collision packet): %.2f (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_collision_packet / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_collision_packet);
             MSG(LOG_NOTICE,"# TX rejected (collision beacon): %.2f (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_collision_beacon / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_collision_beacon);
@@ -2437,22 +3619,83 @@ static int main_loop()
         MSG(LOG_NOTICE,"# BEACON queued: %u\n", cp_nb_beacon_queued);
         MSG(LOG_NOTICE,"# BEACON sent so far: %u\n", cp_nb_beacon_sent);
         MSG(LOG_NOTICE,"# BEACON rejected: %u\n", cp_nb_beacon_rejected);
+        if (fanout_count() > 0) {
+            MSG(LOG_NOTICE,"### [SERVERS] ###\n");
+            for (i = 1; i <= fanout_count(); i++) {
+                fanout_stat(i, &serv_st);
+                MSG(LOG_NOTICE,"# Server %d %s: PUSH_DATA %u (%u acknowledged), %u rxpk, PULL_DATA %u (%u acknowledged), PULL_RESP %u, TX_ACK %u\n", i, serv_st.addr, serv_st.dgram_sent, serv_st.ack_rcv, serv_st.pkt_fwd, serv_st.pull_sent, serv_st.pull_ack_rcv, serv_st.dgram_rcv, serv_st.tx_ack_sent);
+            }
+        }
+        if ((capture_path != NULL) || (replay_path != NULL)) {
+            MSG(LOG_NOTICE,"### [CAPTURE] ###\n");
+        }
+        if (capture_path != NULL) {
+            capture_flush();
+            capture_stat(&cap_st);
+            MSG(LOG_NOTICE,"# Captured: %u records, %llu bytes so far%s\n", cap_st.nb_rec, (unsigned long long)cap_st.nb_byte, (cap_st.active != 0) ? "" : " (stopped)");
+        }
+        if (replay_path != NULL) {
+            replay_stat(&replay_st);
+            MSG(LOG_NOTICE,"# Replayed: %.1f%% in %.1f s, %u packets, %u PULL_RESP\n", 100.0 * replay_st.progress, replay_st.elapsed_s, replay_st.nb_rx, replay_st.nb_pull_resp);
+            MSG(LOG_NOTICE,"# Local server: PUSH_DATA %u, %u rxpk, TX_ACK %u\n", replay_st.nb_push_data, replay_st.nb_rxpk, replay_st.nb_tx_ack);
+            /* one more interval once done, for the last uplinks and TX_ACK */
+            replay_done_nb = replay_done() ? replay_done_nb + 1 : 0;
+            if (replay_done_nb >= 2) {
+                MSG(LOG_NOTICE,"INFO: [main] replay of %s done, exiting\n", replay_path);
+                exit_sig = true;
+            }
+        }
+        for (idx = 0; (idx < SUPPORT_SX1301_MAX) && (simgw_enabled(idx) == false); idx++);
+        if ((idx < SUPPORT_SX1301_MAX) || (sim_mcu == true)) {
+            MSG(LOG_NOTICE,"### [SIMULATION] ###\n");
+        }
+        for (idx = 0; idx < SUPPORT_SX1301_MAX; idx++) {
+            if (simgw_enabled(idx) == false) {
+                continue;
+            }
+            simgw_stat(idx, &sim_st);
+            MSG(LOG_NOTICE,"# SX1301 %d: %u uplinks generated (%u CRC errors, %u joins, %u confirmed), %u lost in the FIFO\n", idx, sim_st.nb_pkt, sim_st.nb_crc_bad, sim_st.nb_join, sim_st.nb_confirmed, sim_st.nb_overflow);
+        }
+        for (idx = 0; idx < SUPPORT_SX1276_MAX; idx++) {
+            if (simmcu_enabled(idx) == false) {
+                continue;
+            }
+            simmcu_stat(idx, &mcu_st);
+            MSG(LOG_NOTICE,"# SX1276 %d MCU: %u commands (%u timer reads), %u downlinks sent, %u failed, %u bytes dropped\n", idx, mcu_st.nb_cmd, mcu_st.nb_timer, mcu_st.nb_tx, mcu_st.nb_tx_fail, mcu_st.nb_bad_frame);
+        }
         MSG(LOG_NOTICE,"### [JIT] ###\n");
         /* get timestamp captured on PPM pulse  */
 
+        /* Offsets of the other SX1301 boards to the gateway timestamp domain */
+        for( idx = 1; idx < SUPPORT_SX1301_MAX; idx++){
+            if( NULL == g_ctx_arr[idx] )
+                break;
+            offset_us = timedomain_sx1301_offset(idx, &offset_error_us);
+            if (offset_error_us == TIMEDOMAIN_ERROR_UNKNOWN) {
+                MSG(LOG_NOTICE,"# SX1301 %d offset us: unknown\n", idx);
+            } else {
+                MSG(LOG_NOTICE,"# SX1301 %d offset us: %d (+/-%u us)\n", idx, offset_us, offset_error_us);
+            }
+        }
+
         /* Downlink for SX1276 now */
         for( idx = 0; idx < SUPPORT_SX1276_MAX; idx++){
             if( NULL == g_ctx_sx1276_arr[idx] )
                 break;
-            pthread_mutex_lock(&mx_concent);
+            pthread_mutex_lock(&mx_concent_sx1276);
             trig_tstamp = lgw_uart_read_timer(g_ctx_sx1276_arr[idx]->uart);
-            pthread_mutex_unlock(&mx_concent);
-            MSG(LOG_NOTICE,"# SX1276 time (PPS): %u, offset us: %d\n", trig_tstamp, g_ctx_sx1276_arr[idx]->offset_count_us);
+            pthread_mutex_unlock(&mx_concent_sx1276);
+            offset_us = timedomain_sx1276_offset(idx, &offset_error_us);
+            MSG(LOG_NOTICE,"# SX1276 time (PPS): %u, offset us: %d (+/-%u us)\n", trig_tstamp, offset_us, offset_error_us);
+            /* no need for mutex, display is not critical */
+            MSG(LOG_NOTICE,"# SX1276 clock sync: drift %.3f ppm, accuracy +/-%u us, next sync in %u s\n", g_ctx_sx1276_arr[idx]->drift_ppm, g_ctx_sx1276_arr[idx]->sync_accuracy_us, g_ctx_sx1276_arr[idx]->sync_interval_s);
         }
 
         for( idx = 0; idx < SUPPORT_SX1276_MAX; idx++ ){
             jit_print_queue (&jit_queue[idx], false, DEBUG_LOG); 
         }
+        jitlead_report();
+        txtrace_report();
 
         MSG(LOG_NOTICE,"### [GPS] ###\n");
         if (gps_enabled == true) {
@@ -2462,6 +3705,7 @@ static int main_loop()
             } else {
                 MSG(LOG_NOTICE,"# Invalid time reference (age: %li sec)\n", (long)difftime(time(NULL), time_reference_gps.systime));
             }
+            MSG(LOG_NOTICE,"# GPS frames: %u parsed, %u corrupted, %u lost\n", cp_gps_nb_frame, cp_gps_nb_corrupt, cp_gps_nb_lost);
             if (coord_ok == true) {
                 MSG(LOG_NOTICE,"# GPS coordinates: latitude %.5f, longitude %.5f, altitude %i m\n", cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt);
             } else {
@@ -2501,8 +3745,21 @@ static int main_loop()
     /* wait for upstream thread to finish (1 fetch cycle max) */
     pthread_join(thrid_up, NULL);
     pthread_cancel(thrid_down); /* don't wait for downstream thread */
+    pthread_cancel(thrid_conn); /* don't wait for connection thread */
+    fanout_stop();
+    shmring_deinit();
+    capture_close();
     pthread_cancel(thrid_jit); /* don't wait for jit thread */
     pthread_cancel(thrid_timersync); /* don't wait for timer sync thread */
+    if (beacon_period != 0) {
+        pthread_cancel(thrid_beacon); /* don't wait for beacon thread */
+    }
+    if (data_recovery == true) {
+        pthread_cancel(thrid_drain); /* don't wait for drain thread */
+    }
+    if (metrics_enabled == true) {
+        pthread_cancel(thrid_metrics); /* don't wait for metrics thread */
+    }
     if (gps_enabled == true) {
         pthread_cancel(thrid_gps); /* don't wait for GPS thread */
         pthread_cancel(thrid_valid); /* don't wait for validation thread */
@@ -2515,16 +3772,21 @@ static int main_loop()
         }
     }
 
+    if (replay_path != NULL) {
+        replay_close();
+    }
+    simmcu_close();
+
     /* if an exit signal was received, try to quit properly */
     if (exit_sig) {
         /* shut down network sockets */
         shutdown(sock_up, SHUT_RDWR);
         shutdown(sock_down, SHUT_RDWR);
-        /* stop the hardware */
-        for(idx = 0; idx < SUPPORT_SX1301_MAX; idx++){
+        /* stop the hardware, none to stop during a replay */
+        for(idx = 0; (replay_path == NULL) && (idx < SUPPORT_SX1301_MAX); idx++){
             if( NULL == g_ctx_arr[idx])
                 break;
-            i = lgw_stop(g_ctx_arr[idx]);
+            i = stop_lgw(idx);
             lora_led_off(idx);
             if (i == LGW_HAL_SUCCESS) {
                 MSG(LOG_NOTICE,"INFO: concentrator stopped successfully\n");
@@ -2585,15 +3847,6 @@ void hex_dump( uint8_t * buff, uint16_t size){
     return;
 }
 
-#define MTYPE_JOIN_REQUEST          0
-#define MTYPE_JOIN_ACCEPT           1
-#define MTYPE_UNCONFIRM_DATA_UP     2
-#define MTYPE_UNCONFIRM_DATA_DOWN   3
-#define MTYPE_CONFIRM_DATA_UP       4
-#define MTYPE_CONFIRM_DATA_DOWN     5
-#define MTYPE_RFU                   6
-#define MTYPE_PROPRITARY            7
-
 #if 0
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 static uint32_t rx_time_on_air( struct lgw_pkt_rx_s * packet, uint8_t fsk_sync_word_size){
@@ -2696,15 +3949,256 @@ void thread_led(void){
     }
 }
 
+/* Serialize an uplink as an rxpk object of a PUSH_DATA datagram, after its
+   separator if it is not the first one. The time reference is NULL when the
+   GPS time is not known or not meaningful, replay flags the packets resent
+   from the store. Returns the index after the object. */
+static int serialize_rxpk(uint8_t *buff, int buff_index, unsigned pkt_in_dgram, const struct lgw_pkt_rx_s *p, const struct tref *ref, bool replay) {
+    int j;
+    struct tm *x; /* broken-up UTC time */
+    struct timespec pkt_utc_time;
+    struct timespec pkt_gps_time;
+    uint64_t pkt_gps_time_ms;
+
+    /* Start of packet, add inter-packet separator if necessary */
+    if (pkt_in_dgram == 0) {
+        buff[buff_index] = '{';
+        ++buff_index;
+    } else {
+        buff[buff_index] = ',';
+        buff[buff_index+1] = '{';
+        buff_index += 2;
+    }
+
+    /* RAW timestamp, 8-17 useful chars */
+    j = snprintf((char *)(buff + buff_index), TX_BUFF_SIZE-buff_index, "\"tmst\":%u", p->count_us);
+    if (j > 0) {
+        buff_index += j;
+    } else {
+        MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
+        exit(EXIT_FAILURE);
+    }
+
+    /* Replay flag, so the server can tell a stored packet from a live one, 12 useful chars */
+    if (replay == true) {
+        memcpy((void *)(buff + buff_index), (void *)",\"rply\":true", 12);
+        buff_index += 12;
+    }
+
+    /* Packet RX time (GPS based), 37 useful chars */
+    if (ref != NULL) {
+        /* convert packet timestamp to UTC absolute time */
+        j = lgw_cnt2utc(*ref, p->count_us, &pkt_utc_time);
+        if (j == LGW_GPS_SUCCESS) {
+            /* split the UNIX timestamp to its calendar components */
+            x = gmtime(&(pkt_utc_time.tv_sec));
+            j = snprintf((char *)(buff + buff_index), TX_BUFF_SIZE-buff_index, ",\"time\":\"%04i-%02i-%02iT%02i:%02i:%02i.%06liZ\"", (x->tm_year)+1900, (x->tm_mon)+1, x->tm_mday, x->tm_hour, x->tm_min, x->tm_sec, (pkt_utc_time.tv_nsec)/1000); /* ISO 8601 format */
+            if (j > 0) {
+                buff_index += j;
+            } else {
+                MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
+                exit(EXIT_FAILURE);
+            }
+        }
+        /* convert packet timestamp to GPS absolute time */
+        j = lgw_cnt2gps(*ref, p->count_us, &pkt_gps_time);
+        if (j == LGW_GPS_SUCCESS) {
+            pkt_gps_time_ms = pkt_gps_time.tv_sec * 1E3 + pkt_gps_time.tv_nsec / 1E6;
+            j = snprintf((char *)(buff + buff_index), TX_BUFF_SIZE-buff_index, ",\"tmms\":%llu",
+                            pkt_gps_time_ms); /* GPS time in milliseconds since 06.Jan.1980 */
+            if (j > 0) {
+                buff_index += j;
+            } else {
+                MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    /* Packet concentrator channel, RF chain & RX frequency, 34-36 useful chars */
+    j = snprintf((char *)(buff + buff_index), TX_BUFF_SIZE-buff_index, ",\"chan\":%1u,\"rfch\":%1u,\"freq\":%.6lf", p->if_chain, p->rf_chain, ((double)p->freq_hz / 1e6));
+    if (j > 0) {
+        buff_index += j;
+    } else {
+        MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
+        exit(EXIT_FAILURE);
+    }
+
+    
+    /* Packet status, 9-10 useful chars */
+    switch (p->status) {
+        case STAT_CRC_OK:
+            memcpy((void *)(buff + buff_index), (void *)",\"stat\":1", 9);
+            buff_index += 9;
+            break;
+        case STAT_CRC_BAD:
+            memcpy((void *)(buff + buff_index), (void *)",\"stat\":-1", 10);
+            buff_index += 10;
+            break;
+        case STAT_NO_CRC:
+            memcpy((void *)(buff + buff_index), (void *)",\"stat\":0", 9);
+            buff_index += 9;
+            break;
+        default:
+            MSG(LOG_CRIT,"ERROR: [up] received packet with unknown status\n");
+            memcpy((void *)(buff + buff_index), (void *)",\"stat\":?", 9);
+            buff_index += 9;
+            exit(EXIT_FAILURE);
+    }
+
+    /* Packet modulation, 13-14 useful chars */
+    if (p->modulation == MOD_LORA) {
+        memcpy((void *)(buff + buff_index), (void *)",\"modu\":\"LORA\"", 14);
+        buff_index += 14;
+
+        /* Lora datarate & bandwidth, 16-19 useful chars */
+        switch (p->datarate) {
+            case DR_LORA_SF7:
+                memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF7", 12);
+                buff_index += 12;
+                break;
+            case DR_LORA_SF8:
+                memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF8", 12);
+                buff_index += 12;
+                break;
+            case DR_LORA_SF9:
+                memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF9", 12);
+                buff_index += 12;
+                break;
+            case DR_LORA_SF10:
+                memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF10", 13);
+                buff_index += 13;
+                break;
+            case DR_LORA_SF11:
+                memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF11", 13);
+                buff_index += 13;
+                break;
+            case DR_LORA_SF12:
+                memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF12", 13);
+                buff_index += 13;
+                break;
+            default:
+                MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown datarate\n");
+                memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF?", 12);
+                buff_index += 12;
+                exit(EXIT_FAILURE);
+        }
+        switch (p->bandwidth) {
+            case BW_125KHZ:
+                memcpy((void *)(buff + buff_index), (void *)"BW125\"", 6);
+                buff_index += 6;
+                break;
+            case BW_250KHZ:
+                memcpy((void *)(buff + buff_index), (void *)"BW250\"", 6);
+                buff_index += 6;
+                break;
+            case BW_500KHZ:
+                memcpy((void *)(buff + buff_index), (void *)"BW500\"", 6);
+                buff_index += 6;
+                break;
+            default:
+                MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown bandwidth\n");
+                memcpy((void *)(buff + buff_index), (void *)"BW?\"", 4);
+                buff_index += 4;
+                exit(EXIT_FAILURE);
+        }
+
+        /* Packet ECC coding rate, 11-13 useful chars */
+        switch (p->coderate) {
+            case CR_LORA_4_5:
+                memcpy((void *)(buff + buff_index), (void *)",\"codr\":\"4/5\"", 13);
+                buff_index += 13;
+                break;
+            case CR_LORA_4_6:
+                memcpy((void *)(buff + buff_index), (void *)",\"codr\":\"4/6\"", 13);
+                buff_index += 13;
+                break;
+            case CR_LORA_4_7:
+                memcpy((void *)(buff + buff_index), (void *)",\"codr\":\"4/7\"", 13);
+                buff_index += 13;
+                break;
+            case CR_LORA_4_8:
+                memcpy((void *)(buff + buff_index), (void *)",\"codr\":\"4/8\"", 13);
+                buff_index += 13;
+                break;
+            case 0: /* treat the CR0 case (mostly false sync) */
+                memcpy((void *)(buff + buff_index), (void *)",\"codr\":\"OFF\"", 13);
+                buff_index += 13;
+                break;
+            default:
+                MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown coderate\n");
+                memcpy((void *)(buff + buff_index), (void *)",\"codr\":\"?\"", 11);
+                buff_index += 11;
+                exit(EXIT_FAILURE);
+        }
+
+        /* Lora SNR, 11-13 useful chars */
+        j = snprintf((char *)(buff + buff_index), TX_BUFF_SIZE-buff_index, ",\"lsnr\":%.1f", p->snr);
+        if (j > 0) {
+            buff_index += j;
+        } else {
+            MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
+            exit(EXIT_FAILURE);
+        }
+    } else if (p->modulation == MOD_FSK) {
+        memcpy((void *)(buff + buff_index), (void *)",\"modu\":\"FSK\"", 13);
+        buff_index += 13;
+
+        /* FSK datarate, 11-14 useful chars */
+        j = snprintf((char *)(buff + buff_index), TX_BUFF_SIZE-buff_index, ",\"datr\":%u", p->datarate);
+        if (j > 0) {
+            buff_index += j;
+        } else {
+            MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        MSG(LOG_CRIT,"ERROR: [up] received packet with unknown modulation\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Packet RSSI, payload size, 18-23 useful chars */
+    j = snprintf((char *)(buff + buff_index), TX_BUFF_SIZE-buff_index, ",\"rssi\":%.0f,\"size\":%u", p->rssi, p->size);
+    if (j > 0) {
+        buff_index += j;
+    } else {
+        MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
+        exit(EXIT_FAILURE);
+    }
+
+    /* Packet base64-encoded payload, 14-350 useful chars */
+    memcpy((void *)(buff + buff_index), (void *)",\"data\":\"", 9);
+    buff_index += 9;
+    j = bin_to_b64(p->payload, p->size, (char *)(buff + buff_index), 341); /* 255 bytes = 340 chars in b64 + null char */
+    if (j>=0) {
+        buff_index += j;
+    } else {
+        MSG(LOG_CRIT,"ERROR: [up] bin_to_b64 failed line %u\n", (__LINE__ - 5));
+        exit(EXIT_FAILURE);
+    }
+    buff[buff_index] = '"';
+    ++buff_index;
+
+    /* End of packet serialization */
+    buff[buff_index] = '}';
+    ++buff_index;
+
+    return buff_index;
+}
+
 void thread_up(void) {
     int i, j, n; /* loop variables */
     unsigned pkt_in_dgram; /* nb on Lora packet in the current datagram */
-    struct lgw_recev_pkts  ctx_pkts[SUPPORT_SX1301_MAX]; // add 1 for fbuffer
-    struct lgw_recev_pkts  buffer_pkts;
     uint8_t MType = 0;
     /* allocate memory for packet fetching and processing */
+    struct lgw_pkt_rx_s rxpkt[NB_PKT_MAX]; /* array containing inbound packets, one concentrator at a time */
+    struct pktbuf_s *ctx_buf[SUPPORT_SX1301_MAX][NB_PKT_MAX]; /* packets of the last fetch, held until classified */
+    int ctx_nb[SUPPORT_SX1301_MAX] = {0};
     struct lgw_pkt_rx_s *p; /* pointer on a RX packet */
     int nb_pkt;
+    struct pktbuf_s *lane_buf; /* packet taken from the priority lanes */
+    int budget; /* packets allowed in the datagram */
+    uint32_t fwd_nb, fwd_byte; /* packets serialized in the datagram */
     /* local copy of GPS time reference */
     bool ref_ok = false; /* determine if GPS time reference must be used or not */
     struct tref local_ref; /* time reference used for UTC <-> timestamp conversion */
@@ -2712,11 +4206,15 @@ void thread_up(void) {
     
     /* data buffers */
     uint8_t buff_up[TX_BUFF_SIZE]; /* buffer to compose the upstream packet */
-    
+    uint8_t buff_zip[TX_BUFF_SIZE]; /* same, compressed */
+    int zip_len;
     
     int buff_index;
 #ifndef _ALI_LINKWAN_
     uint8_t buff_ack[32]; /* buffer to receive acknowledges */
+    bool push_acked;
+    uint32_t push_rtt_us = 0;
+    unsigned zip_miss = 0; /* compressed PUSH_DATA not acknowledged in a row */
 #endif
 
     /* protocol variables */
@@ -2724,23 +4222,42 @@ void thread_up(void) {
     uint8_t token_l; /* random token for acknowledgement matching */
     /* ping measurement variables */
     struct timespec send_time;
-
-    /* GPS synchronization variables */
-    struct timespec pkt_utc_time;
-    struct tm * x; /* broken-up UTC time */
-    struct timespec pkt_gps_time;
-    uint64_t pkt_gps_time_ms;
+    struct timespec fetch_time; /* time the packets were fetched from the concentrators */
 
     /* report management variable */
     bool send_report = false;
+    bool first_fwd = true; /* start-up timeline ends with the first forwarded packet */
+
+    /* additional servers, they get the bytes serialized for the main server */
+    struct fanout_frag_s frag[NB_PKT_MAX * SUPPORT_SX1301_MAX];
+    int stat_index = 0; /* position of the status report in buff_up */
+    int stat_len = 0;
+    bool main_down; /* main server unreachable, only the additional servers get this fetch */
+
+    /* forwarding policy, may be replaced between two fetches */
+    const struct fwd_policy_s *pol;
+    int rcu_id;
 
     
 #ifndef _ALI_LINKWAN_    
     struct timespec recv_time; 
 #endif    
 
+    rcu_id = rcu_register();
+    if (rcu_id < 0) {
+        MSG(LOG_CRIT,"ERROR: [up] failed to register as RCU reader, exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (uplane_init(uplink_lane_depth, uplink_max_rate) != 0) {
+        MSG(LOG_CRIT,"ERROR: [up] failed to allocate the uplink lanes, exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
     if( data_recovery ){
-        fbuff_init(data_recovery_path);
+        if (pktstore_init(data_recovery_path, data_recovery_size, data_recovery_max_age) != 0) {
+            MSG(LOG_ERR, "ERROR: [up] failed to open the data_recovery store, packets will not be kept\n");
+        }
     }
     
     /* pre-fill the data buffer with fixed fields */
@@ -2752,6 +4269,13 @@ void thread_up(void) {
     while (!exit_sig && !quit_sig) {
         bool network_st = false;
 
+        main_down = false;
+        stat_len = 0;
+
+        /* nothing from the previous fetch is referenced anymore */
+        rcu_quiescent(rcu_id);
+        pol = __atomic_load_n(&fwd_policy, __ATOMIC_ACQUIRE);
+
         pthread_mutex_lock( &mx_network_err );
         network_st = status_network_connect;
         pthread_mutex_unlock( &mx_network_err );
@@ -2761,43 +4285,62 @@ void thread_up(void) {
         for( i = 0; i < SUPPORT_SX1301_MAX; i++){
             if( NULL == g_ctx_arr[i] )
                 break;
-            pthread_mutex_lock(&mx_concent);
-            ret = lgw_receive(NB_PKT_MAX, ctx_pkts[i].rxpkt, g_ctx_arr[i]);
-            pthread_mutex_unlock(&mx_concent);
+            /* the lanes took their own reference on the packets of the previous fetch */
+            for (j = 0; j < ctx_nb[i]; j++) {
+                pktbuf_unref(ctx_buf[i][j]);
+            }
+            ctx_nb[i] = 0;
+            if (replay_path != NULL) {
+                ret = replay_receive(i, NB_PKT_MAX, rxpkt);
+            } else if (simgw_enabled(i)) {
+                ret = simgw_receive(i, NB_PKT_MAX, rxpkt);
+            } else {
+                pthread_mutex_lock(&mx_concent);
+                ret = board_down[i] ? 0 : lgw_receive(NB_PKT_MAX, rxpkt, g_ctx_arr[i]);
+                pthread_mutex_unlock(&mx_concent);
+            }
             if( LGW_HAL_ERROR == ret ){
                 MSG(LOG_CRIT,"ERROR: [up] failed packet fetch, exiting\n");
                 exit(EXIT_FAILURE);
             }
+            capture_rx(i, rxpkt, ret);
+
+            /* translate to the gateway domain now, buffered packets keep a valid tmst */
+            for (j = 0; j < ret; j++) {
+                rxpkt[j].count_us = timedomain_sx1301_to_ref(i, rxpkt[j].count_us);
+                ctx_buf[i][ctx_nb[i]] = pktbuf_rx_new(&rxpkt[j]);
+                if (ctx_buf[i][ctx_nb[i]] != NULL) {
+                    ctx_nb[i] += 1;
+                }
+            }
 
-            ctx_pkts[i].nb_pkt = ret;
-            nb_pkt += ret;
+            nb_pkt += ctx_nb[i];
         }
 
-        if( sock_up > 0 && network_st == true ){
-            if( data_recovery){
-                buffer_pkts.nb_pkt = fbuff_dequeue(buffer_pkts.rxpkt, NB_PKT_MAX);
-                nb_pkt += buffer_pkts.nb_pkt;
-            }
-        }
-        else{
-            buffer_pkts.nb_pkt = 0;
-        }
+        clock_gettime(CLOCK_MONOTONIC, &fetch_time);
+
         /* check if there are status report to send */
         send_report = report_ready; /* copy the variable so it doesn't change mid-function */
         /* no mutex, we're only reading */
 
         
         /* wait a short time if no packets, nor status report */
-        if ((nb_pkt == 0) && (send_report == false)) {
+        if ((nb_pkt == 0) && (send_report == false) && (uplane_count() == 0)) {
             wait_ms(FETCH_SLEEP_MS);
             continue;
         }
 
+        /* stored packets are replayed by thread_drain, live ones never wait behind them */
         if(  sock_up <= 0 || network_st == false ){
             if( data_recovery ){
                 for( i = 0; i < SUPPORT_SX1301_MAX; i++){
-                    if( ctx_pkts[i].nb_pkt > 0)
-                        fbuff_enqueue(ctx_pkts[i].rxpkt, ctx_pkts[i].nb_pkt);
+                    for (j = 0; j < ctx_nb[i]; j++) {
+                        pktstore_enqueue(pktbuf_rx(ctx_buf[i][j]), 1);
+                    }
+                }
+                while ((lane_buf = uplane_pop(&n)) != NULL) {
+                    pktstore_enqueue(pktbuf_rx(lane_buf), 1);
+                    pktbuf_unref(lane_buf);
                 }
             }
 
@@ -2809,51 +4352,29 @@ void thread_up(void) {
                    
                 }
 
-                 continue;
+                if (fanout_count() == 0) {
+                    continue;
+                }
+                main_down = true;
             }
         }
         
         
-        /* get a copy of GPS time reference (avoid 1 mutex per packet) */
-        if ((nb_pkt > 0) && (gps_enabled == true)) {
-            pthread_mutex_lock(&mx_timeref);
-            ref_ok = gps_ref_valid;
-            local_ref = time_reference_gps;
-            pthread_mutex_unlock(&mx_timeref);
-        } else {
-            ref_ok = false;
-        }
-
-        /* start composing datagram with the header */
-        token_h = (uint8_t)rand(); /* random token */
-        token_l = (uint8_t)rand(); /* random token */
-        buff_up[1] = token_h;
-        buff_up[2] = token_l;
-        buff_index = 12; /* 12-byte header */
-
-        /* start of JSON structure */
-        memcpy((void *)(buff_up + buff_index), (void *)"{\"rxpk\":[", 9);
-        buff_index += 9;
-
-
-        /* End */
-        /* serialize Lora packets metadata and payload */
-        pkt_in_dgram = 0;
-
+        /* classify the packets, the lanes decide which ones are sent first */
         for( n = 0; n < SUPPORT_SX1301_MAX; n++ ){
             if( g_ctx_arr[n] == NULL )
                 break;
-            if( ctx_pkts[n].nb_pkt == 0 )
+            if( ctx_nb[n] == 0 )
                 continue;
 
             lora_led_trigger(n);
-            for (i=0; i < ctx_pkts[n].nb_pkt; ++i) {
+            for (i=0; i < ctx_nb[n]; ++i) {
                            
-                p = &(ctx_pkts[n].rxpkt[i]);
+                p = pktbuf_rx(ctx_buf[n][i]);
 
-                MType = ( p->payload[0] & 0xE0 ) >> 5;
+                MType = LORAWAN_MTYPE(p->payload);
 
-                if( is_lorawan ){
+                if( pol->is_lorawan ){
                     if( MType == MTYPE_CONFIRM_DATA_DOWN || MType == MTYPE_UNCONFIRM_DATA_DOWN || MType == MTYPE_JOIN_ACCEPT){
                         //MSG(LOG_WARNING, "[up] Receive Downlink Packet! Drop it");
                         continue;
@@ -2862,16 +4383,20 @@ void thread_up(void) {
                 
                 
 
+                /* DevAddr white and black lists */
+                if (pol->is_lorawan && (STAT_CRC_OK == p->status || STAT_NO_CRC == p->status) && (addrfilter_up(p->payload, p->size) == 0)) {
+                    if( g_packet_table.enable ){
+                        logger_packet_add_up(p, TYPE_FILTERED);
+                    }
+                    continue; /* discard packet */
+                }
+
 /* Begin add for packet filtering by whitelist and blacklist */
 #if defined(USE_FILTER_NODE)
-                if ( is_lorawan && (1 == filter_inited) && (STAT_CRC_OK == p->status  || STAT_NO_CRC == p->status)) {
+                if ( pol->is_lorawan && (1 == filter_inited) && (STAT_CRC_OK == p->status  || STAT_NO_CRC == p->status)) {
                     j = filter_up_proc(p->payload, p->size);
                     if (1 != j) {
-                        uint32_t mote_addr = 0;
-                        mote_addr  = p->payload[1];
-                        mote_addr |= p->payload[2] << 8;
-                        mote_addr |= p->payload[3] << 16;
-                        mote_addr |= p->payload[4] << 24;
+                        uint32_t mote_addr = LORAWAN_DEVADDR(p->payload);
                         MSG(LOG_INFO,"INFO: [up] the pkt from mote: %08X discard by packet filter\n", mote_addr);
                         if( g_packet_table.enable ){
                             logger_packet_add_up(p, TYPE_FILTERED);
@@ -2894,7 +4419,7 @@ void thread_up(void) {
                     case STAT_CRC_OK:
                         meas_nb_rx_ok += 1;
                         meas_g_nb_rx_ok += 1;
-                        if (!fwd_valid_pkt) {
+                        if (!pol->fwd_valid_pkt) {
                             pthread_mutex_unlock(&mx_meas_up);
                             continue; /* skip that packet */
                         }
@@ -2903,7 +4428,7 @@ void thread_up(void) {
                         MSG(LOG_INFO, "INFO: Received pkt CRC BAD\n" );
                         meas_nb_rx_bad += 1;
                         meas_g_nb_rx_bad += 1;
-                        if (!fwd_error_pkt) {
+                        if (!pol->fwd_error_pkt) {
                             pthread_mutex_unlock(&mx_meas_up);
                             continue; /* skip that packet */
                         }
@@ -2915,7 +4440,7 @@ void thread_up(void) {
                         meas_g_nb_rx_nocrc +=1;
                         MSG(LOG_INFO, "INFO: Received pkt NO CRC\n" );
                         
-                        if (!fwd_nocrc_pkt) {                            
+                        if (!pol->fwd_nocrc_pkt) {                            
                             pthread_mutex_unlock(&mx_meas_up);
                             continue; /* skip that packet */
                         }
@@ -2930,451 +4455,75 @@ void thread_up(void) {
                         continue; /* skip that packet */
                         // exit(EXIT_FAILURE);
                 }
-                meas_up_pkt_fwd += 1;
-                meas_up_payload_byte += p->size;
                 pthread_mutex_unlock(&mx_meas_up);
 
                 
                 MSG(LOG_DEBUG, "Uplink Frame : " );
                 hex_dump(p->payload, p->size);
 
-                /* Start of packet, add inter-packet separator if necessary */
-                if (pkt_in_dgram == 0) {
-                    buff_up[buff_index] = '{';
-                    
-                    ++buff_index;
-                    
-                } else {
-                    buff_up[buff_index] = ',';
-                    buff_up[buff_index+1] = '{';
-                 
-                    
-                    buff_index += 2;
-                }
-                
-                p->count_us += (g_ctx_sx1276_arr[n]->offset_count_us);
-                
-                p->rf_chain += (n * 2);
-
-                /* RAW timestamp, 8-17 useful chars */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, "\"tmst\":%u", p->count_us);
-
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-
-                /* Packet RX time (GPS based), 37 useful chars */
-                if (ref_ok == true) {
-                    /* convert packet timestamp to UTC absolute time */
-                    j = lgw_cnt2utc(local_ref, p->count_us, &pkt_utc_time);
-                    if (j == LGW_GPS_SUCCESS) {
-                        /* split the UNIX timestamp to its calendar components */
-                        x = gmtime(&(pkt_utc_time.tv_sec));
-                        j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"time\":\"%04i-%02i-%02iT%02i:%02i:%02i.%06liZ\"", (x->tm_year)+1900, (x->tm_mon)+1, x->tm_mday, x->tm_hour, x->tm_min, x->tm_sec, (pkt_utc_time.tv_nsec)/1000); /* ISO 8601 format */
-                        if (j > 0) {
-                            buff_index += j;
-                        } else {
-                            MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                    /* convert packet timestamp to GPS absolute time */
-                    j = lgw_cnt2gps(local_ref, p->count_us, &pkt_gps_time);
-                    if (j == LGW_GPS_SUCCESS) {
-                        pkt_gps_time_ms = pkt_gps_time.tv_sec * 1E3 + pkt_gps_time.tv_nsec / 1E6;
-                        j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"tmms\":%llu",
-                                        pkt_gps_time_ms); /* GPS time in milliseconds since 06.Jan.1980 */
-                        if (j > 0) {
-                            buff_index += j;
-                        } else {
-                            MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                }
-
-                /* Packet concentrator channel, RF chain & RX frequency, 34-36 useful chars */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"chan\":%1u,\"rfch\":%1u,\"freq\":%.6lf", p->if_chain, p->rf_chain, ((double)p->freq_hz / 1e6));
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-
-                
-                /* Packet status, 9-10 useful chars */
-                switch (p->status) {
-                    case STAT_CRC_OK:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":1", 9);
-                        buff_index += 9;
-                        break;
-                    case STAT_CRC_BAD:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":-1", 10);
-                        buff_index += 10;
-                        break;
-                    case STAT_NO_CRC:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":0", 9);
-                        buff_index += 9;
-                        break;
-                    default:
-                        MSG(LOG_CRIT,"ERROR: [up] received packet with unknown status\n");
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":?", 9);
-                        buff_index += 9;
-                        exit(EXIT_FAILURE);
-                }
-
-                /* Packet modulation, 13-14 useful chars */
-                if (p->modulation == MOD_LORA) {
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"modu\":\"LORA\"", 14);
-                    buff_index += 14;
-
-                    /* Lora datarate & bandwidth, 16-19 useful chars */
-                    switch (p->datarate) {
-                        case DR_LORA_SF7:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF7", 12);
-                            buff_index += 12;
-                            break;
-                        case DR_LORA_SF8:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF8", 12);
-                            buff_index += 12;
-                            break;
-                        case DR_LORA_SF9:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF9", 12);
-                            buff_index += 12;
-                            break;
-                        case DR_LORA_SF10:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF10", 13);
-                            buff_index += 13;
-                            break;
-                        case DR_LORA_SF11:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF11", 13);
-                            buff_index += 13;
-                            break;
-                        case DR_LORA_SF12:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF12", 13);
-                            buff_index += 13;
-                            break;
-                        default:
-                            MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown datarate\n");
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF?", 12);
-                            buff_index += 12;
-                            exit(EXIT_FAILURE);
-                    }
-                    switch (p->bandwidth) {
-                        case BW_125KHZ:
-                            memcpy((void *)(buff_up + buff_index), (void *)"BW125\"", 6);
-                            buff_index += 6;
-                            break;
-                        case BW_250KHZ:
-                            memcpy((void *)(buff_up + buff_index), (void *)"BW250\"", 6);
-                            buff_index += 6;
-                            break;
-                        case BW_500KHZ:
-                            memcpy((void *)(buff_up + buff_index), (void *)"BW500\"", 6);
-                            buff_index += 6;
-                            break;
-                        default:
-                            MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown bandwidth\n");
-                            memcpy((void *)(buff_up + buff_index), (void *)"BW?\"", 4);
-                            buff_index += 4;
-                            exit(EXIT_FAILURE);
-                    }
-
-                    /* Packet ECC coding rate, 11-13 useful chars */
-                    switch (p->coderate) {
-                        case CR_LORA_4_5:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/5\"", 13);
-                            buff_index += 13;
-                            break;
-                        case CR_LORA_4_6:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/6\"", 13);
-                            buff_index += 13;
-                            break;
-                        case CR_LORA_4_7:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/7\"", 13);
-                            buff_index += 13;
-                            break;
-                        case CR_LORA_4_8:
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/8\"", 13);
-                            buff_index += 13;
-                            break;
-                        case 0: /* treat the CR0 case (mostly false sync) */
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"OFF\"", 13);
-                            buff_index += 13;
-                            break;
-                        default:
-                            MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown coderate\n");
-                            memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"?\"", 11);
-                            buff_index += 11;
-                            exit(EXIT_FAILURE);
-                    }
-
-                    /* Lora SNR, 11-13 useful chars */
-                    j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"lsnr\":%.1f", p->snr);
-                    if (j > 0) {
-                        buff_index += j;
-                    } else {
-                        MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                        exit(EXIT_FAILURE);
-                    }
-                } else if (p->modulation == MOD_FSK) {
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"modu\":\"FSK\"", 13);
-                    buff_index += 13;
-
-                    /* FSK datarate, 11-14 useful chars */
-                    j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"datr\":%u", p->datarate);
-                    if (j > 0) {
-                        buff_index += j;
-                    } else {
-                        MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                        exit(EXIT_FAILURE);
-                    }
-                } else {
-                    MSG(LOG_CRIT,"ERROR: [up] received packet with unknown modulation\n");
-                    exit(EXIT_FAILURE);
-                }
-
-                /* Packet RSSI, payload size, 18-23 useful chars */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"rssi\":%.0f,\"size\":%u", p->rssi, p->size);
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-
-                /* Packet base64-encoded payload, 14-350 useful chars */
-                memcpy((void *)(buff_up + buff_index), (void *)",\"data\":\"", 9);
-                buff_index += 9;
-                j = bin_to_b64(p->payload, p->size, (char *)(buff_up + buff_index), 341); /* 255 bytes = 340 chars in b64 + null char */
-                if (j>=0) {
-                    buff_index += j;
-                } else {
-                    MSG(LOG_CRIT,"ERROR: [up] bin_to_b64 failed line %u\n", (__LINE__ - 5));
-                    exit(EXIT_FAILURE);
+                if (shm_ring == true) {
+                    shmring_publish(p, n);
                 }
-                buff_up[buff_index] = '"';
-                ++buff_index;
-
-                /* End of packet serialization */
-                buff_up[buff_index] = '}';
-                ++buff_index;
-
-                buff_up[buff_index] = 0;
-                ++pkt_in_dgram;
-
-                rrd_statistic_up(p, n);
+                uplane_push(ctx_buf[n][i], n, uplane_class(p, pol->is_lorawan));
             }
         }
-        
-        /* buffer packets */
-        for(i = 0; i < buffer_pkts.nb_pkt; i++ ){
-            p = &(buffer_pkts.rxpkt[i]);
-
-            if( g_packet_table.enable ){
-                logger_packet_add_up(p, TYPE_OUT_BUFFER);
-            }
-            /* Start of packet, add inter-packet separator if necessary */
-            if (pkt_in_dgram == 0) {
-                buff_up[buff_index] = '{';
-                
-                ++buff_index;
-                
-            } else {
-                buff_up[buff_index] = ',';
-                buff_up[buff_index+1] = '{';
-             
-                
-                buff_index += 2;
-            }
-            
-            
-            /* RAW timestamp, 8-17 useful chars */
-            j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, "\"tmst\":%u", p->count_us);
-
-            if (j > 0) {
-                buff_index += j;
-            } else {
-                MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                exit(EXIT_FAILURE);
-            }
-
-            
-
-            /* Packet concentrator channel, RF chain & RX frequency, 34-36 useful chars */
-            j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"chan\":%1u,\"rfch\":%1u,\"freq\":%.6lf", p->if_chain, p->rf_chain, ((double)p->freq_hz / 1e6));
-            if (j > 0) {
-                buff_index += j;
-            } else {
-                MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                exit(EXIT_FAILURE);
-            }
-
-            
-            /* Packet status, 9-10 useful chars */
-            switch (p->status) {
-                case STAT_CRC_OK:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":1", 9);
-                    buff_index += 9;
-                    break;
-                case STAT_CRC_BAD:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":-1", 10);
-                    buff_index += 10;
-                    break;
-                case STAT_NO_CRC:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":0", 9);
-                    buff_index += 9;
-                    break;
-                default:
-                    MSG(LOG_CRIT,"ERROR: [up] received packet with unknown status\n");
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":?", 9);
-                    buff_index += 9;
-                    exit(EXIT_FAILURE);
-            }
 
-            /* Packet modulation, 13-14 useful chars */
-            if (p->modulation == MOD_LORA) {
-                memcpy((void *)(buff_up + buff_index), (void *)",\"modu\":\"LORA\"", 14);
-                buff_index += 14;
-
-                /* Lora datarate & bandwidth, 16-19 useful chars */
-                switch (p->datarate) {
-                    case DR_LORA_SF7:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF7", 12);
-                        buff_index += 12;
-                        break;
-                    case DR_LORA_SF8:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF8", 12);
-                        buff_index += 12;
-                        break;
-                    case DR_LORA_SF9:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF9", 12);
-                        buff_index += 12;
-                        break;
-                    case DR_LORA_SF10:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF10", 13);
-                        buff_index += 13;
-                        break;
-                    case DR_LORA_SF11:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF11", 13);
-                        buff_index += 13;
-                        break;
-                    case DR_LORA_SF12:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF12", 13);
-                        buff_index += 13;
-                        break;
-                    default:
-                        MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown datarate\n");
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF?", 12);
-                        buff_index += 12;
-                        exit(EXIT_FAILURE);
-                }
-                switch (p->bandwidth) {
-                    case BW_125KHZ:
-                        memcpy((void *)(buff_up + buff_index), (void *)"BW125\"", 6);
-                        buff_index += 6;
-                        break;
-                    case BW_250KHZ:
-                        memcpy((void *)(buff_up + buff_index), (void *)"BW250\"", 6);
-                        buff_index += 6;
-                        break;
-                    case BW_500KHZ:
-                        memcpy((void *)(buff_up + buff_index), (void *)"BW500\"", 6);
-                        buff_index += 6;
-                        break;
-                    default:
-                        MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown bandwidth\n");
-                        memcpy((void *)(buff_up + buff_index), (void *)"BW?\"", 4);
-                        buff_index += 4;
-                        exit(EXIT_FAILURE);
-                }
+        /* nothing more than the status report while the byte rate is exhausted */
+        budget = uplane_budget(NB_PKT_MAX * SUPPORT_SX1301_MAX);
+        if ((budget == 0) && (send_report == false)) {
+            wait_ms(FETCH_SLEEP_MS);
+            continue;
+        }
 
-                /* Packet ECC coding rate, 11-13 useful chars */
-                switch (p->coderate) {
-                    case CR_LORA_4_5:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/5\"", 13);
-                        buff_index += 13;
-                        break;
-                    case CR_LORA_4_6:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/6\"", 13);
-                        buff_index += 13;
-                        break;
-                    case CR_LORA_4_7:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/7\"", 13);
-                        buff_index += 13;
-                        break;
-                    case CR_LORA_4_8:
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/8\"", 13);
-                        buff_index += 13;
-                        break;
-                    case 0: /* treat the CR0 case (mostly false sync) */
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"OFF\"", 13);
-                        buff_index += 13;
-                        break;
-                    default:
-                        MSG(LOG_CRIT,"ERROR: [up] lora packet with unknown coderate\n");
-                        memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"?\"", 11);
-                        buff_index += 11;
-                        exit(EXIT_FAILURE);
-                }
+        /* get a copy of GPS time reference (avoid 1 mutex per packet) */
+        if ((uplane_count() > 0) && (gps_enabled == true)) {
+            pthread_mutex_lock(&mx_timeref);
+            ref_ok = gps_ref_valid;
+            local_ref = time_reference_gps;
+            pthread_mutex_unlock(&mx_timeref);
+        } else {
+            ref_ok = false;
+        }
 
-                /* Lora SNR, 11-13 useful chars */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"lsnr\":%.1f", p->snr);
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-            } else if (p->modulation == MOD_FSK) {
-                memcpy((void *)(buff_up + buff_index), (void *)",\"modu\":\"FSK\"", 13);
-                buff_index += 13;
+        /* start composing datagram with the header */
+        token_h = (uint8_t)rand(); /* random token */
+        token_l = (uint8_t)rand(); /* random token */
+        buff_up[1] = token_h;
+        buff_up[2] = token_l;
+        buff_index = 12; /* 12-byte header */
 
-                /* FSK datarate, 11-14 useful chars */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"datr\":%u", p->datarate);
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-            } else {
-                MSG(LOG_CRIT,"ERROR: [up] received packet with unknown modulation\n");
-                exit(EXIT_FAILURE);
-            }
+        /* start of JSON structure */
+        memcpy((void *)(buff_up + buff_index), (void *)"{\"rxpk\":[", 9);
+        buff_index += 9;
 
-            /* Packet RSSI, payload size, 18-23 useful chars */
-            j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"rssi\":%.0f,\"size\":%u", p->rssi, p->size);
-            if (j > 0) {
-                buff_index += j;
-            } else {
-                MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 4));
-                exit(EXIT_FAILURE);
-            }
+        /* serialize Lora packets metadata and payload, highest class first */
+        pkt_in_dgram = 0;
+        fwd_nb = 0;
+        fwd_byte = 0;
 
-            /* Packet base64-encoded payload, 14-350 useful chars */
-            memcpy((void *)(buff_up + buff_index), (void *)",\"data\":\"", 9);
-            buff_index += 9;
-            j = bin_to_b64(p->payload, p->size, (char *)(buff_up + buff_index), 341); /* 255 bytes = 340 chars in b64 + null char */
-            if (j>=0) {
-                buff_index += j;
-            } else {
-                MSG(LOG_CRIT,"ERROR: [up] bin_to_b64 failed line %u\n", (__LINE__ - 5));
-                exit(EXIT_FAILURE);
-            }
-            buff_up[buff_index] = '"';
-            ++buff_index;
+        while ((pkt_in_dgram < (unsigned)budget) && ((lane_buf = uplane_pop(&n)) != NULL)) {
+            p = pktbuf_rx(lane_buf);
+            fwd_nb += 1;
+            fwd_byte += p->size;
 
-            /* End of packet serialization */
-            buff_up[buff_index] = '}';
-            ++buff_index;
+            /* the fragment of a packet starts at its '{', after the separator */
+            frag[pkt_in_dgram].data = buff_up + buff_index + ((pkt_in_dgram == 0) ? 0 : 1);
+            p->rf_chain += (n * 2);
+            buff_index = serialize_rxpk(buff_up, buff_index, pkt_in_dgram, p, (ref_ok == true) ? &local_ref : NULL, false);
+            frag[pkt_in_dgram].size = (uint16_t)(buff_up + buff_index - frag[pkt_in_dgram].data);
+            frag[pkt_in_dgram].mask = (fanout_count() > 0) ? fanout_route(p->payload, p->size) : 0;
 
             buff_up[buff_index] = 0;
             ++pkt_in_dgram;
+
+            rrd_statistic_up(p, n);
+            pktbuf_unref(lane_buf);
+        }
+        if (fwd_nb > 0) {
+            pthread_mutex_lock(&mx_meas_up);
+            meas_up_pkt_fwd += fwd_nb;
+            meas_up_payload_byte += fwd_byte;
+            pthread_mutex_unlock(&mx_meas_up);
         }
         
         /* restart fetch sequence without sending empty JSON if all packets have been filtered out */
@@ -3404,6 +4553,8 @@ void thread_up(void) {
             j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, "%s", status_report);
             pthread_mutex_unlock(&mx_stat_rep);
             if (j > 0) {
+                stat_index = buff_index;
+                stat_len = j;
                 buff_index += j;
             } else {
                 MSG(LOG_CRIT,"ERROR: [up] snprintf failed line %u\n", (__LINE__ - 5));
@@ -3411,10 +4562,12 @@ void thread_up(void) {
             }
 #ifdef _ALI_LINKWAN_
             /* Begin add for reset when no ack in specify time */
-            pthread_mutex_lock(&mx_stat_no_ack);
-            stat_no_ack_cnt++;
-            pthread_mutex_unlock(&mx_stat_no_ack);
-            MSG(LOG_INFO,"INFO: [up] status pkt no ack count: %u\n", stat_no_ack_cnt);
+            if (main_down == false) {
+                pthread_mutex_lock(&mx_stat_no_ack);
+                stat_no_ack_cnt++;
+                pthread_mutex_unlock(&mx_stat_no_ack);
+                MSG(LOG_INFO,"INFO: [up] status pkt no ack count: %u\n", stat_no_ack_cnt);
+            }
             /* End */
 #endif
         }
@@ -3426,15 +4579,37 @@ void thread_up(void) {
 
         
         MSG(LOG_INFO,"\nJSON up: %s\n", (char *)(buff_up + 12)); /* DEBUG: display JSON payload */
+
+        /* additional servers first, they do not wait for the main server ACK */
+        if (fanout_count() > 0) {
+            fanout_push(frag, pkt_in_dgram, (stat_len > 0) ? (buff_up + stat_index) : NULL, stat_len);
+        }
+        if (main_down == true) {
+            continue;
+        }
         
-        /* send datagram to server */
-        send(sock_up, (void *)buff_up, buff_index, 0);
+        /* send datagram to server, compressed if it accepts it */
+        capture_data(CAPTURE_UP, 0, buff_up, buff_index);
+        zip_len = push_data_compress(buff_up, buff_index, buff_zip, sizeof buff_zip);
+        if (zip_len > 0) {
+            send(sock_up, (void *)buff_zip, zip_len, 0);
+        } else {
+            send(sock_up, (void *)buff_up, buff_index, 0);
+        }
         
         clock_gettime(CLOCK_MONOTONIC, &send_time);
+        if (pkt_in_dgram > 0) {
+            metrics_hist_record(METRICS_FETCH_TO_SEND, (uint32_t)(1E6 * difftimespec(send_time, fetch_time)));
+            if (first_fwd) {
+                first_fwd = false;
+                MSG(LOG_NOTICE,"INFO: [up] first packet forwarded %u ms after start\n", startup_ms());
+            }
+        }
         pthread_mutex_lock(&mx_meas_up);
         meas_up_dgram_sent += 1;
-        meas_up_network_byte += buff_index;
+        meas_up_network_byte += (zip_len > 0) ? zip_len : buff_index;
         pthread_mutex_unlock(&mx_meas_up);
+        uplane_sent((zip_len > 0) ? zip_len : buff_index);
         
 #ifdef _ALI_LINKWAN_
         //Begin add for adapt iot lora sdk
@@ -3443,6 +4618,7 @@ void thread_up(void) {
 #else
 
         /* wait for acknowledge (in 2 times, to catch extra packets) */
+        push_acked = false;
         for (i=0; i<2; ++i) {
             j = recv(sock_up, (void *)buff_ack, sizeof buff_ack, 0);
             clock_gettime(CLOCK_MONOTONIC, &recv_time);
@@ -3464,24 +4640,44 @@ void thread_up(void) {
                 continue;
             } else {
                 MSG(LOG_INFO,"INFO: [up] PUSH_ACK received in %i ms\n", (int)(1000 * difftimespec(recv_time, send_time)));
+                push_rtt_us = (uint32_t)(1E6 * difftimespec(recv_time, send_time));
+                metrics_hist_record(METRICS_PUSH_ACK_RTT, push_rtt_us);
                 pthread_mutex_lock(&mx_meas_up);
                 meas_up_ack_rcv += 1;
                 pthread_mutex_unlock(&mx_meas_up);
-                
-                if( buffer_pkts.nb_pkt > 0 ){
-                    fbuff_drop(buffer_pkts.nb_pkt);
+                if (push_compression == true) {
+                    compress_server_set((j > 4) && (buff_ack[4] & COMPRESS_ACK_FLAG_LZ4));
                 }
+                push_acked = true;
                 break;
             }
         }
+
+        uplane_ack(push_acked, push_rtt_us);
+
+        /* a server that stopped decoding compressed PUSH_DATA does not ACK them, fall back to plain JSON */
+        if (zip_len > 0) {
+            zip_miss = (push_acked == true) ? 0 : (zip_miss + 1);
+            if (zip_miss >= COMPRESS_MISS_MAX) {
+                compress_server_set(false);
+                zip_miss = 0;
+            }
+        }
            
 #endif
 /* End */        
         
     }
     if( data_recovery ){
-        fbuff_deinit();
+        pktstore_deinit();
+    }
+    for (i = 0; i < SUPPORT_SX1301_MAX; i++) {
+        for (j = 0; j < ctx_nb[i]; j++) {
+            pktbuf_unref(ctx_buf[i][j]);
+        }
     }
+    uplane_deinit();
+    rcu_unregister(rcu_id);
     MSG(LOG_INFO,"\nINFO: End of upstream thread\n");
 }
 
@@ -3494,6 +4690,10 @@ void thread_down(void) {
     /* configuration and metadata for an outbound packet */
     struct lgw_pkt_tx_s txpkt;
     uint32_t o_count_us = 0;
+    uint64_t target_count_us = 0; /* requested TX time on the 64-bit timeline of the selected sx1276 */
+    int tx_radio = 0; /* sx1276 the downlink was queued on */
+    bool tx_confirm = false; /* TX_ACK deferred to the end of TX */
+    struct txtrace_rec_s trace; /* deadline trace of the downlink */
     bool sent_immediate = false; /* option to sent the packet immediately */
     
     /* local timekeeping variables */
@@ -3510,6 +4710,8 @@ void thread_down(void) {
 #endif
 
     int msg_len;
+    int down_server = 0; /* server the datagram came from, 0 for the main one */
+    struct pollfd pfd[2];
 
     /* protocol variables */
     uint8_t token_h; /* random token for acknowledgement matching */
@@ -3531,32 +4733,17 @@ void thread_down(void) {
     struct tref local_ref; /* time reference used for GPS <-> timestamp conversion */
     struct timespec gps_tx; /* GPS time that needs to be converted to timestamp */
 
-    /* beacon variables */
-    struct lgw_pkt_tx_s beacon_pkt;
-    uint8_t beacon_chan;
-    uint8_t beacon_loop;
-    size_t beacon_RFU1_size = 0;
-    size_t beacon_RFU2_size = 0;
-    uint8_t beacon_pyld_idx = 0;
-    time_t diff_beacon_time;
-    struct timespec next_beacon_gps_time; /* gps time of next beacon packet */
-    struct timespec last_beacon_gps_time; /* gps time of last enqueued beacon packet */
-    int retry;
-
-    /* beacon data fields, byte 0 is Least Significant Byte */
-    int32_t field_latitude; /* 3 bytes, derived from reference latitude */
-    int32_t field_longitude; /* 3 bytes, derived from reference longitude */
-    uint16_t field_crc1, field_crc2;
-
     /* auto-quit variable */
     uint32_t autoquit_cnt = 0; /* count the number of PULL_DATA sent since the latest PULL_ACK */
 
     /* Just In Time downlink */
-    struct timeval current_unix_time;
+    struct timeval current_host_time;
     struct timeval current_concentrator_time;
+    struct timeval jit_time; /* concentrator time corrected by the learned JIT lead */
     enum jit_error_e jit_result = JIT_ERROR_OK;
     enum jit_pkt_type_e downlink_type;
     uint8_t target_rf_chain = 0;
+    int ctx_id = 0;
     
     /* set downstream socket RX timeout */
     i = setsockopt(sock_down, SOL_SOCKET, SO_RCVTIMEO, (void *)&pull_timeout, sizeof pull_timeout);
@@ -3571,128 +4758,13 @@ void thread_down(void) {
     *(uint32_t *)(buff_req + 4) = net_mac_h;
     *(uint32_t *)(buff_req + 8) = net_mac_l;
 
-    /* beacon variables initialization */
-    last_beacon_gps_time.tv_sec = 0;
-    last_beacon_gps_time.tv_nsec = 0;
-
-    /* beacon packet parameters */
-    beacon_pkt.tx_mode = ON_GPS; /* send on PPS pulse */
-    beacon_pkt.rf_chain = 0; /* antenna A */
-    beacon_pkt.rf_power = beacon_power;
-    beacon_pkt.modulation = MOD_LORA;
-    switch (beacon_bw_hz) {
-        case 125000:
-            beacon_pkt.bandwidth = BW_125KHZ;
-            break;
-        case 500000:
-            beacon_pkt.bandwidth = BW_500KHZ;
-            break;
-        default:
-            /* should not happen */
-            MSG(LOG_CRIT,"ERROR: [down] unsupported bandwidth for beacon\n");
-            exit(EXIT_FAILURE);
-    }
-    switch (beacon_datarate) {
-        case 8:
-            beacon_pkt.datarate = DR_LORA_SF8;
-            beacon_RFU1_size = 1;
-            beacon_RFU2_size = 3;
-            break;
-        case 9:
-            beacon_pkt.datarate = DR_LORA_SF9;
-#if 0            
-            beacon_RFU1_size = 3;
-            beacon_RFU2_size = 1;
-#else
-            beacon_RFU1_size = 2;
-            beacon_RFU2_size = 0;
-#endif
-            break;
-        case 10:
-            beacon_pkt.datarate = DR_LORA_SF10;
-            beacon_RFU1_size = 3;
-            beacon_RFU2_size = 1;
-            break;
-        case 12:
-            beacon_pkt.datarate = DR_LORA_SF12;
-            beacon_RFU1_size = 5;
-            beacon_RFU2_size = 3;
-            break;
-        default:
-            /* should not happen */
-            MSG(LOG_CRIT,"ERROR: unsupported datarate for beacon\n");
-            exit(EXIT_FAILURE);
-    }
-    beacon_pkt.size = beacon_RFU1_size + 4 + 2 + 7 + beacon_RFU2_size + 2;
-    beacon_pkt.coderate = CR_LORA_4_5;
-    beacon_pkt.invert_pol = false;
-    beacon_pkt.preamble = 10;
-    beacon_pkt.no_crc = true;
-    beacon_pkt.no_header = true;
-
-    /* network common part beacon fields (little endian) */
-    for (i = 0; i < (int)beacon_RFU1_size; i++) {
-        beacon_pkt.payload[beacon_pyld_idx++] = 0x0;
-    }
-    
-#ifdef _ALI_LINKWAN_
-   /*delete for beacon gps info*/
-#else
-    /* network common part beacon fields (little endian) */
-    beacon_pyld_idx += 4; /* time (variable), filled later */
-    beacon_pyld_idx += 2; /* crc1 (variable), filled later */
-
-    /* calculate the latitude and longitude that must be publicly reported */
-    field_latitude = (int32_t)((reference_coord.lat / 90.0) * (double)(1<<23));
-    if (field_latitude > (int32_t)0x007FFFFF) {
-        field_latitude = (int32_t)0x007FFFFF; /* +90 N is represented as 89.99999 N */
-    } else if (field_latitude < (int32_t)0xFF800000) {
-        field_latitude = (int32_t)0xFF800000;
-    }
-    field_longitude = (int32_t)((reference_coord.lon / 180.0) * (double)(1<<23));
-    if (field_longitude > (int32_t)0x007FFFFF) {
-        field_longitude = (int32_t)0x007FFFFF; /* +180 E is represented as 179.99999 E */
-    } else if (field_longitude < (int32_t)0xFF800000) {
-        field_longitude = (int32_t)0xFF800000;
-    }
-
-    /* gateway specific beacon fields */
-    beacon_pkt.payload[beacon_pyld_idx++] = beacon_infodesc;
-    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF &  field_latitude;
-    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_latitude >>  8);
-    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_latitude >> 16);
-    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF &  field_longitude;
-    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_longitude >>  8);
-    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_longitude >> 16);
-
-    /* RFU */
-    for (i = 0; i < (int)beacon_RFU2_size; i++) {
-        beacon_pkt.payload[beacon_pyld_idx++] = 0x0;
-    }
-
-    /* CRC of the beacon gateway specific part fields */
-    field_crc2 = crc16((beacon_pkt.payload + 6 + beacon_RFU1_size), 7 + beacon_RFU2_size);
-    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF &  field_crc2;
-    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_crc2 >> 8);
-#endif
-    /* JIT queue initialization */
-    for( i = 0; i < g_sx1301_nb; i++)
-        jit_queue_init(&jit_queue[i]);
-
-    while (!exit_sig && !quit_sig) {
-        /* */
-        if( autoquit_cnt >= network_error_threshold ){
-           pthread_mutex_lock( &mx_network_err );
-           status_network_connect = false;
-           pthread_mutex_unlock( &mx_network_err );
-        }
-        /* auto-quit if the threshold is crossed */
-        if ((autoquit_threshold > 0) && (autoquit_cnt >= autoquit_threshold)) {
-            exit_err = true;
-            exit_sig = true;
-            MSG(LOG_CRIT,"INFO: [down] the last %u PULL_DATA were not ACKed, exiting application\n", autoquit_threshold);
-            break;
-        }
+    while (!exit_sig && !quit_sig) {
+        /* */
+        if( autoquit_cnt >= network_error_threshold ){
+           pthread_mutex_lock( &mx_network_err );
+           status_network_connect = false;
+           pthread_mutex_unlock( &mx_network_err );
+        }
 
         /* generate random token for request */
         token_h = (uint8_t)rand(); /* random token */
@@ -3713,180 +4785,39 @@ void thread_down(void) {
         pthread_mutex_unlock(&mx_meas_dw);
         req_ack = false;
         autoquit_cnt++;
+        __atomic_store_n(&pull_unacked, autoquit_cnt, __ATOMIC_RELAXED); /* thread_conn reconnects when it is too high */
         
         /* listen to packets and process them until a new PULL request must be sent */
         recv_time = send_time;
         while ((int)difftimespec(recv_time, send_time) < keepalive_time) {
 
-            /* try to receive a datagram */
+            /* try to receive a datagram, from the main server or an additional one */
             memset(buff_down, 0x0, sizeof(buff_down));
-            msg_len = recv(sock_down, (void *)buff_down, (sizeof buff_down)-1, 0);
-            clock_gettime(CLOCK_MONOTONIC, &recv_time);
-
-            /* Pre-allocate beacon slots in JiT queue, to check downlink collisions */
-            beacon_loop = JIT_NUM_BEACON_IN_QUEUE - jit_queue[0].num_beacon; // Send beacon on sx1301 0
-            retry = 0;
-            while (beacon_loop && (beacon_period != 0)) {
-                pthread_mutex_lock(&mx_timeref);
-                /* Wait for GPS to be ready before inserting beacons in JiT queue */
-                if ((gps_ref_valid == true) && (xtal_correct_ok == true)) {
-
-                    /* compute GPS time for next beacon to come      */
-                    /*   LoRaWAN: T = k*beacon_period + TBeaconDelay */
-                    /*            with TBeaconDelay = [1.5ms +/- 1µs]*/
-                    if (last_beacon_gps_time.tv_sec == 0) {
-                        /* if no beacon has been queued, get next slot from current GPS time */
-                        diff_beacon_time = time_reference_gps.gps.tv_sec % ((time_t)beacon_period);
-                        next_beacon_gps_time.tv_sec = time_reference_gps.gps.tv_sec +
-                                                        ((time_t)beacon_period - diff_beacon_time);
-                    } else {
-                        /* if there is already a beacon, take it as reference */
-                        next_beacon_gps_time.tv_sec = last_beacon_gps_time.tv_sec + beacon_period;
-                    }
-                    /* now we can add a beacon_period to the reference to get next beacon GPS time */
-                    next_beacon_gps_time.tv_sec += (retry * beacon_period);
-                    next_beacon_gps_time.tv_nsec = 0;
-
-#if DEBUG_BEACON
-                    {
-                        time_t time_unix;
-
-                        time_unix = time_reference_gps.gps.tv_sec + UNIX_GPS_EPOCH_OFFSET;
-                        MSG_DEBUG(DEBUG_BEACON, "GPS-now : %s", ctime(&time_unix));
-                        time_unix = last_beacon_gps_time.tv_sec + UNIX_GPS_EPOCH_OFFSET;
-                        MSG_DEBUG(DEBUG_BEACON, "GPS-last: %s", ctime(&time_unix));
-                        time_unix = next_beacon_gps_time.tv_sec + UNIX_GPS_EPOCH_OFFSET;
-                        MSG_DEBUG(DEBUG_BEACON, "GPS-next: %s", ctime(&time_unix));
-                    }
-#endif
-
-                    /* convert GPS time to concentrator time, and set packet counter for JiT trigger */
-                    lgw_gps2cnt(time_reference_gps, next_beacon_gps_time, &(beacon_pkt.count_us));
-                    pthread_mutex_unlock(&mx_timeref);
-
-                    /* apply frequency correction to beacon TX frequency */
-                    if (beacon_freq_nb > 1) {
-                        beacon_chan = (next_beacon_gps_time.tv_sec / beacon_period) % beacon_freq_nb; /* floor rounding */
-                    } else {
-                        beacon_chan = 0;
-                    }
-                    /* Compute beacon frequency */
-                    beacon_pkt.freq_hz = beacon_freq_hz + (beacon_chan * beacon_freq_step);
-
-                    /* load time in beacon payload */
-                    beacon_pyld_idx = beacon_RFU1_size;
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF &  next_beacon_gps_time.tv_sec;
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (next_beacon_gps_time.tv_sec >>  8);
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (next_beacon_gps_time.tv_sec >> 16);
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (next_beacon_gps_time.tv_sec >> 24);
-
-                    /* calculate CRC */
-                    field_crc1 = crc16(beacon_pkt.payload, 4 + beacon_RFU1_size); /* CRC for the network common part */
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & field_crc1;
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_crc1 >> 8);
-#ifdef _ALI_LINKWAN_
-                    //Begin add for beacon gps info
-                    /* GPS coordinates variables */
-                    struct coord_s cp_gps_coord = {0.0, 0.0, 0};
-
-                    /* access GPS statistics, copy them */
-                    if (gps_enabled == true) {
-                        pthread_mutex_lock(&mx_meas_gps);
-                        cp_gps_coord = meas_gps_coord;
-                        pthread_mutex_unlock(&mx_meas_gps);
-                    }
-                    
-                    /* overwrite with reference coordinates if function is enabled */
-                    if (gps_fake_enable == true) {
-                        cp_gps_coord = reference_coord;
-                    }
-                    
-                    /* calculate the latitude and longitude that must be publicly reported */
-                    field_latitude = (int32_t)((cp_gps_coord.lat / 90.0) * (double)(1<<23));
-                    if (field_latitude > (int32_t)0x007FFFFF) {
-                        field_latitude = (int32_t)0x007FFFFF; /* +90 N is represented as 89.99999 N */
-                    } else if (field_latitude < (int32_t)0xFF800000) {
-                        field_latitude = (int32_t)0xFF800000;
-                    }
-                    field_longitude = (int32_t)((cp_gps_coord.lon / 180.0) * (double)(1<<23));
-                    if (field_longitude > (int32_t)0x007FFFFF) {
-                        field_longitude = (int32_t)0x007FFFFF; /* +180 E is represented as 179.99999 E */
-                    } else if (field_longitude < (int32_t)0xFF800000) {
-                        field_longitude = (int32_t)0xFF800000;
-                    }
-                    
-                    /* gateway specific beacon fields */
-                    beacon_pkt.payload[beacon_pyld_idx++] = beacon_infodesc;
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF &  field_latitude;
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_latitude >>  8);
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_latitude >> 16);
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF &  field_longitude;
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_longitude >>  8);
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_longitude >> 16);
-                    
-                    /* RFU */
-                    for (i = 0; i < (int)beacon_RFU2_size; i++) {
-                        beacon_pkt.payload[beacon_pyld_idx++] = 0x0;
-                    }
-                    
-                    /* CRC of the beacon gateway specific part fields */
-                    field_crc2 = crc16((beacon_pkt.payload + 6 + beacon_RFU1_size), 7 + beacon_RFU2_size);
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF &  field_crc2;
-                    beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_crc2 >> 8);
-                    //End
-#endif
-
-                    /* Insert beacon packet in JiT queue */
-                    gettimeofday(&current_unix_time, NULL);
-                    /* tx beacon on sx1301 0 */
-                    get_concentrator_time(&current_concentrator_time, current_unix_time, g_ctx_arr[0]);
-                    jit_result = jit_enqueue(&jit_queue[0], &current_concentrator_time, &beacon_pkt, JIT_PKT_TYPE_BEACON);
-                    if (jit_result == JIT_ERROR_OK) {
-                        /* update stats */
-                        pthread_mutex_lock(&mx_meas_dw);
-                        meas_nb_beacon_queued += 1;
-                        pthread_mutex_unlock(&mx_meas_dw);
-
-                        /* One more beacon in the queue */
-                        beacon_loop--;
-                        retry = 0;
-                        last_beacon_gps_time.tv_sec = next_beacon_gps_time.tv_sec; /* keep this beacon time as reference for next one to be programmed */
-
-                        /* display beacon payload */
-                        MSG(LOG_DEBUG,"INFO: Beacon queued (count_us=%u, freq_hz=%u, size=%u):\n", beacon_pkt.count_us, beacon_pkt.freq_hz, beacon_pkt.size);
-                        MSG(LOG_DEBUG, "   => " );
-                        for (i = 0; i < beacon_pkt.size; ++i) {
-                            MSG(LOG_DEBUG,"%02X ", beacon_pkt.payload[i]);
-                        }
-                        MSG(LOG_DEBUG,"\n");
-                    } else {
-                        MSG_DEBUG(DEBUG_BEACON, "--> beacon queuing failed with %d\n", jit_result);
-                        /* update stats */
-                        pthread_mutex_lock(&mx_meas_dw);
-                        if (jit_result != JIT_ERROR_COLLISION_BEACON) {
-                            meas_nb_beacon_rejected += 1;
-                        }
-                        pthread_mutex_unlock(&mx_meas_dw);
-                        /* In case previous enqueue failed, we retry one period later until it succeeds */
-                        /* Note: In case the GPS has been unlocked for a while, there can be lots of retries */
-                        /*       to be done from last beacon time to a new valid one */
-                        retry++;
-                        MSG_DEBUG(DEBUG_BEACON, "--> beacon queuing retry=%d\n", retry);
-                        if( retry > 3 ){
-                            break;
-                        }
+            down_server = 0;
+            if (fanout_count() == 0) {
+                msg_len = recv(sock_down, (void *)buff_down, (sizeof buff_down)-1, 0);
+            } else {
+                pfd[0].fd = sock_down;
+                pfd[0].events = POLLIN;
+                pfd[1].fd = fanout_down_fd();
+                pfd[1].events = POLLIN;
+                msg_len = -1;
+                if (poll(pfd, 2, PULL_TIMEOUT_MS) > 0) {
+                    if (pfd[1].revents & POLLIN) {
+                        msg_len = fanout_down_pop(buff_down, (sizeof buff_down)-1, &down_server);
+                    } else if (pfd[0].revents & POLLIN) {
+                        msg_len = recv(sock_down, (void *)buff_down, (sizeof buff_down)-1, MSG_DONTWAIT);
                     }
-                } else {
-                    pthread_mutex_unlock(&mx_timeref);
-                    break;
                 }
             }
+            clock_gettime(CLOCK_MONOTONIC, &recv_time);
 
             /* if no network message was received, got back to listening sock_down socket */
             if (msg_len == -1) {
                 //MSG(LOG_INFO,"WARNING: [down] recv returned %s\n", strerror(errno)); /* too verbose */
                 continue;
             }
+            capture_data(CAPTURE_DOWN, down_server, buff_down, msg_len);
 #ifdef _ALI_LINKWAN_            
             /* Begin add for reset when no ack in specify time */
             pthread_mutex_lock(&mx_stat_no_ack);
@@ -3930,6 +4861,7 @@ void thread_down(void) {
                     } else { /* if that packet was not already acknowledged */
                         req_ack = true;
                         autoquit_cnt = 0;
+                        __atomic_store_n(&pull_unacked, 0, __ATOMIC_RELAXED);
                         
                         pthread_mutex_lock( &mx_network_err );
                         status_network_connect = true;
@@ -3939,6 +4871,7 @@ void thread_down(void) {
                         meas_dw_ack_rcv += 1;
                         pthread_mutex_unlock(&mx_meas_dw);
                         MSG(LOG_INFO,"INFO: [down] PULL_ACK received in %i ms\n", (int)(1000 * difftimespec(recv_time, send_time)));
+                        metrics_hist_record(METRICS_PULL_ACK_RTT, (uint32_t)(1E6 * difftimespec(recv_time, send_time)));
                     }
                 } else { /* out-of-sync token */
                     MSG(LOG_INFO,"INFO: [down] received out-of-sync ACK\n");
@@ -3952,6 +4885,9 @@ void thread_down(void) {
                     pthread_mutex_lock(&mx_meas_up);
                     meas_up_ack_rcv += 1;
                     pthread_mutex_unlock(&mx_meas_up);
+                    if (push_compression == true) {
+                        compress_server_set((msg_len > 4) && (buff_down[4] & COMPRESS_ACK_FLAG_LZ4));
+                    }
                 } else {
                     MSG(LOG_WARNING, "WARNING: [down] ignored out-of sync ACK packet\n");
                 }
@@ -4017,7 +4953,7 @@ void thread_down(void) {
                             json_value_free(root_val);
 
                             /* send acknoledge datagram to server */
-                            send_tx_ack(buff_down[1], buff_down[2], JIT_ERROR_GPS_UNLOCKED);
+                            send_tx_ack(down_server, buff_down[1], buff_down[2], JIT_ERROR_GPS_UNLOCKED);
                             continue;
                         }
                     } else {
@@ -4025,7 +4961,7 @@ void thread_down(void) {
                         json_value_free(root_val);
 
                         /* send acknoledge datagram to server */
-                        send_tx_ack(buff_down[1], buff_down[2], JIT_ERROR_GPS_UNLOCKED);
+                        send_tx_ack(down_server, buff_down[1], buff_down[2], JIT_ERROR_GPS_UNLOCKED);
                         continue;
                     }
 
@@ -4254,6 +5190,7 @@ void thread_down(void) {
 
             /* check TX parameter before trying to queue packet */
             jit_result = JIT_ERROR_OK;
+            tx_confirm = false;
             if ((txpkt.freq_hz < tx_freq_min[txpkt.rf_chain]) || (txpkt.freq_hz > tx_freq_max[txpkt.rf_chain])) {
                 jit_result = JIT_ERROR_TX_FREQ;
                 MSG(LOG_ERR,"ERROR: Packet REJECTED, unsupported frequency - %u (min:%u,max:%u)\n", txpkt.freq_hz, tx_freq_min[txpkt.rf_chain], tx_freq_max[txpkt.rf_chain]);
@@ -4285,27 +5222,31 @@ void thread_down(void) {
             if (jit_result == JIT_ERROR_OK) {
                 /* First try to transmit on the first sx1276 */
                 ctx_id = 0;
-                gettimeofday(&current_unix_time, NULL);
-                get_concentrator_time(&current_concentrator_time, current_unix_time, g_ctx_sx1276_arr[ctx_id]);
-                txpkt.count_us = o_count_us - g_ctx_sx1276_arr[ctx_id]->offset_count_us; // count_us sx1276[0] --> sx1276[i]
+                tx_radio = ctx_id;
+                get_host_time(&current_host_time);
+                get_concentrator_time(&current_concentrator_time, current_host_time, g_ctx_sx1276_arr[ctx_id]);
+                target_count_us = timedomain_ref_to_sx1276(ctx_id, o_count_us); // gateway tmst --> sx1276[i]
+                MSG_DEBUG(DEBUG_PKT_FWD, "INFO: [down] TX scheduled in %lld us on sx1276 %d\n", (long long)target_count_us - ((long long)current_concentrator_time.tv_sec * 1000000 + current_concentrator_time.tv_usec), ctx_id);
                 
-                jit_result = jit_enqueue(&jit_queue[ctx_id], &current_concentrator_time, &txpkt, downlink_type);
+                jit_time = jitlead_time(ctx_id, current_concentrator_time);
+                jit_result = enqueue_downlink(ctx_id, &jit_time, &txpkt, target_count_us, downlink_type, down_server, buff_down[1], buff_down[2], 0, &tx_confirm);
                 if (jit_result != JIT_ERROR_OK && jit_result != JIT_ERROR_TOO_EARLY && jit_result != JIT_ERROR_TOO_LATE) {
-                    for (i = 1; i < SUPPROT_SX1276_MAX; i++) {
+                    for (i = 1; i < SUPPORT_SX1276_MAX; i++) {
                         if (i == ctx_id)
                             continue;
                                                   
-                        gettimeofday(&current_unix_time, NULL);
-                        get_concentrator_time(&current_concentrator_time, current_unix_time, g_ctx_sx1276_arr[i]);
-                        txpkt.count_us = o_count_us - g_ctx_sx1276_arr[i]->offset_count_us; // count_us sx1276[0] --> sx1276[i]
+                        get_host_time(&current_host_time);
+                        get_concentrator_time(&current_concentrator_time, current_host_time, g_ctx_sx1276_arr[i]);
+                        target_count_us = timedomain_ref_to_sx1276(i, o_count_us); // gateway tmst --> sx1276[i]
                         
-                        jit_result = jit_enqueue(&jit_queue[i], &current_concentrator_time, &txpkt, downlink_type);
+                        jit_time = jitlead_time(i, current_concentrator_time);
+                        jit_result = enqueue_downlink(i, &jit_time, &txpkt, target_count_us, downlink_type, down_server, buff_down[1], buff_down[2], 0, &tx_confirm);
                         if (jit_result != JIT_ERROR_OK) {
                             //MSG(LOG_ERR,"ERROR: Packet REJECTED (jit error=%d) by sx1301 %d\n", jit_result, i);
                             continue;
                         }
                         MSG(LOG_INFO,"INFO: Packet ENQUENUE SUCCESS on sx1301 %d\n", i);
-                        
+                        tx_radio = i;
                         break;
                     }
                     if(jit_result != JIT_ERROR_OK)
@@ -4315,6 +5256,17 @@ void thread_down(void) {
                     MSG(LOG_INFO,"INFO: Packet ENQUENUE SUCCESS on sx1301 %d\n", ctx_id);
                 } 
 
+                /* start the deadline trace of this downlink */
+                memset(&trace, 0, sizeof trace);
+                trace.recv_time = recv_time;
+                clock_gettime(CLOCK_MONOTONIC, &trace.queued_time);
+                trace.count_us = txpkt.count_us;
+                trace.radio = tx_radio;
+                trace.jit_result = jit_result;
+                trace.slack_recv_us = (int32_t)((long long)target_count_us - ((long long)current_concentrator_time.tv_sec * 1000000 + current_concentrator_time.tv_usec)) +
+                                      (int32_t)(1E6 * difftimespec(trace.queued_time, recv_time));
+                txtrace_queued(&trace);
+
                 if( JIT_ERROR_OK == jit_result ){
                     pthread_mutex_lock(&mx_meas_dw);
                     meas_nb_tx_requested += 1;
@@ -4335,8 +5287,10 @@ void thread_down(void) {
                 }
             }
         
-            /* Send acknoledge datagram to server */
-            send_tx_ack(buff_down[1], buff_down[2], jit_result);
+            /* Send acknoledge datagram to server, thread_jit sends it at the end of TX when confirmed */
+            if (tx_confirm == false) {
+                send_tx_ack(down_server, buff_down[1], buff_down[2], jit_result);
+            }
             
         }
     }
@@ -4371,84 +5325,127 @@ void print_tx_status(uint8_t tx_status) {
 void thread_jit(void) {
     int result = LGW_HAL_SUCCESS;
     struct lgw_pkt_tx_s pkt;
-    int pkt_index = -1;
-    struct timeval current_unix_time;
+    bool pkt_found;
+    struct timeval current_host_time;
     struct timeval current_concentrator_time;
+    struct timeval jit_time; /* concentrator time corrected by the learned JIT lead */
     enum jit_error_e jit_result;
     enum jit_pkt_type_e pkt_type;
+    struct timespec dequeued_time;
+    struct timespec write_start;
+    struct timespec write_end;
+    int32_t lead_us;
+    struct txconfirm_report_s tx_report[TXCONFIRM_REPORT_MAX];
+    struct txconfirm_done_s tx_done[TXCONFIRM_PENDING_MAX];
+    int report_miss[SUPPORT_SX1276_MAX] = {0}; /* consecutive unanswered TX report polls */
+    int nb_report;
+    int nb_done;
     int i = 0;
     int j = 0;
     
     while (!exit_sig && !quit_sig) {
         wait_ms(10);
-        for( i = 0; i<g_sx1301_nb; i++){
+        for( i = 0; i < SUPPORT_SX1276_MAX; i++){
+            if( NULL == g_ctx_sx1276_arr[i] )
+                break;
             /* transfer data and metadata to the concentrator, and schedule TX */
-            gettimeofday(&current_unix_time, NULL);
-            get_concentrator_time(&current_concentrator_time, current_unix_time, g_ctx_arr[i]);
-            jit_result = jit_peek(&jit_queue[i], &current_concentrator_time, &pkt_index);
-            if (jit_result == JIT_ERROR_OK) {
-                if (pkt_index > -1) {
-                    jit_result = jit_dequeue(&jit_queue[i], pkt_index, &pkt, &pkt_type);
-                    if (jit_result == JIT_ERROR_OK) {
-                        /* update beacon stats */
-                        if (pkt_type == JIT_PKT_TYPE_BEACON) {
-                            /* Compensate breacon frequency with xtal error */
-                            pthread_mutex_lock(&mx_xcorr);
-                            pkt.freq_hz = (uint32_t)(xtal_correct * (double)pkt.freq_hz);
-                            MSG_DEBUG(DEBUG_BEACON, "beacon_pkt.freq_hz=%u (xtal_correct=%.15lf)\n", pkt.freq_hz, xtal_correct);
-                            pthread_mutex_unlock(&mx_xcorr);
-
-                            /* Update statistics */
-                            pthread_mutex_lock(&mx_meas_dw);
-                            meas_nb_beacon_sent += 1;
-                            pthread_mutex_unlock(&mx_meas_dw);
-                            MSG(LOG_INFO,"INFO: Beacon dequeued (count_us=%u)\n", pkt.count_us);
-                        }
+            get_host_time(&current_host_time);
+            get_concentrator_time(&current_concentrator_time, current_host_time, g_ctx_sx1276_arr[i]);
+            jit_time = jitlead_time(i, current_concentrator_time);
+            jit_result = jittime_dequeue(i, &jit_queue[i], &jit_time, &pkt, &pkt_type, &pkt_found);
+            if ((jit_result == JIT_ERROR_OK) && (pkt_found == true)) {
+                clock_gettime(CLOCK_MONOTONIC, &dequeued_time);
+                /* update beacon stats */
+                if (pkt_type == JIT_PKT_TYPE_BEACON) {
+                    /* Compensate breacon frequency with xtal error */
+                    pthread_mutex_lock(&mx_xcorr);
+                    pkt.freq_hz = (uint32_t)(xtal_correct * (double)pkt.freq_hz);
+                    MSG_DEBUG(DEBUG_BEACON, "beacon_pkt.freq_hz=%u (xtal_correct=%.15lf)\n", pkt.freq_hz, xtal_correct);
+                    pthread_mutex_unlock(&mx_xcorr);
+
+                    /* Update statistics */
+                    pthread_mutex_lock(&mx_meas_dw);
+                    meas_nb_beacon_sent += 1;
+                    pthread_mutex_unlock(&mx_meas_dw);
+                    MSG(LOG_INFO,"INFO: Beacon dequeued (count_us=%u)\n", pkt.count_us);
+                }
 
-                        /* Sending packet into stm32 mini-nodes by usbtouart */
-                        pthread_mutex_lock(&mx_concent); /* may have to wait for a fetch to finish */
-                        result = lora_uart_write_downlink(uart_fd[0], 0, 0x04, pkt);
-                        pthread_mutex_unlock(&mx_concent); /* free concentrator ASAP */
-
-                        printf("freq_hz: %d, 0x%x\n", pkt.freq_hz, pkt.freq_hz);
-                        printf("tx_mode: %d, 0x%x\n", pkt.tx_mode, pkt.tx_mode);
-                        printf("count_us: %d, 0x%x\n", pkt.count_us, pkt.count_us);
-                        printf("rf_chain: %d, 0x%x\n", pkt.rf_chain, pkt.rf_chain);
-                        printf("rf_power: %d, 0x%x\n", pkt.rf_power, pkt.rf_power);
-                        printf("modulation: %d, 0x%x\n", pkt.modulation, pkt.modulation);
-                        printf("bandwidth: %d, 0x%x\n", pkt.bandwidth, pkt.bandwidth);
-                        printf("datarate: %d, 0x%x\n", pkt.datarate, pkt.datarate);
-                        printf("coderate: %d, 0x%x\n", pkt.coderate, pkt.coderate);
-                        printf("invert_pol: %d, 0x%x\n", pkt.invert_pol, pkt.invert_pol);
-                        printf("f_dev: %d, 0x%x\n", pkt.f_dev, pkt.f_dev);
-                        printf("preamble: %d, 0x%x\n", pkt.preamble, pkt.preamble);
-                        printf("no_crc: %d, 0x%x\n", pkt.no_crc, pkt.no_crc);
-                        printf("no_header: %d, 0x%x\n", pkt.no_header, pkt.no_header);
-                        printf("size: %d, 0x%x\n", pkt.size, pkt.size);
-                        for (j = 0; j < pkt.size; j++)
-                            printf("payload[%d]: %d, 0x%x\n", j, pkt.payload[j], pkt.payload[j]);
-
-                        if (result == LGW_HAL_ERROR) {
-                            pthread_mutex_lock(&mx_meas_dw);
-                            meas_nb_tx_fail += 1;
-                            pthread_mutex_unlock(&mx_meas_dw);
-                            MSG(LOG_WARNING, "WARNING: [jit] lora_uart_write_downlink failed.\n");
-                            continue;
-                        } else {
-                            pthread_mutex_lock(&mx_meas_dw);
-                            meas_nb_tx_ok += 1;
-                            pthread_mutex_unlock(&mx_meas_dw);
-                            MSG_DEBUG(DEBUG_PKT_FWD, "lora_uart_write_downlink done: count_us=%u\n", pkt.count_us);
-                        }
-                    } else {
-                        MSG(LOG_ERR,"ERROR: jit_dequeue failed with %d\n", jit_result);
-                    }
+                /* time left before TX, negative if the packet is already late */
+                lead_us = (int32_t)(pkt.count_us - (uint32_t)(current_concentrator_time.tv_sec * 1000000UL + current_concentrator_time.tv_usec));
+                metrics_hist_record(METRICS_JIT_LEAD, (lead_us > 0) ? (uint32_t)lead_us : 0);
+
+                /* Sending packet into stm32 mini-nodes by usbtouart */
+                pthread_mutex_lock(&mx_concent_sx1276); /* may have to wait for a timer read to finish */
+                clock_gettime(CLOCK_MONOTONIC, &write_start);
+                result = lora_uart_write_downlink(g_ctx_sx1276_arr[i]->uart, 0, 0x04, &pkt);
+                clock_gettime(CLOCK_MONOTONIC, &write_end);
+                pthread_mutex_unlock(&mx_concent_sx1276);
+                metrics_hist_record(METRICS_UART_WRITE, (uint32_t)(1E6 * difftimespec(write_end, write_start)));
+                txtrace_dispatched(i, pkt.count_us, &dequeued_time, &write_start, &write_end, lead_us, (result != LGW_HAL_ERROR));
+                if (result != LGW_HAL_ERROR) { /* a failed write says nothing of the dispatch latency */
+                    jitlead_record(i, (uint32_t)(1E6 * difftimespec(write_end, dequeued_time)));
+                }
+                txconfirm_dispatched(i, pkt.count_us, lead_us, (result != LGW_HAL_ERROR));
+
+                if (result == LGW_HAL_ERROR) {
+                    pthread_mutex_lock(&mx_meas_dw);
+                    meas_nb_tx_fail += 1;
+                    pthread_mutex_unlock(&mx_meas_dw);
+                    MSG(LOG_WARNING, "WARNING: [jit] lora_uart_write_downlink failed.\n");
+                    continue;
+                } else {
+                    pthread_mutex_lock(&mx_meas_dw);
+                    meas_nb_tx_ok += 1;
+                    pthread_mutex_unlock(&mx_meas_dw);
+                    MSG_DEBUG(DEBUG_PKT_FWD, "lora_uart_write_downlink done: count_us=%u\n", pkt.count_us);
                 }
-            } else if (jit_result == JIT_ERROR_EMPTY) {
+            } else if ((jit_result == JIT_ERROR_OK) || (jit_result == JIT_ERROR_EMPTY)) {
                 /* Do nothing, it can happen */
             } else {
-                MSG(LOG_ERR,"ERROR: jit_peek failed with %d\n", jit_result);
+                MSG(LOG_ERR,"ERROR: JIT dequeue failed with %d\n", jit_result);
+            }
+
+            /* poll the MCU once a transmission is due to start or end */
+            if (txconfirm_poll_due(i) == true) {
+                pthread_mutex_lock(&mx_concent_sx1276);
+                nb_report = lora_uart_read_tx_report(g_ctx_sx1276_arr[i]->uart, tx_report, TXCONFIRM_REPORT_MAX);
+                pthread_mutex_unlock(&mx_concent_sx1276);
+                if (nb_report >= 0) {
+                    report_miss[i] = 0;
+                    txconfirm_report(i, tx_report, nb_report);
+                } else if (++report_miss[i] >= TX_REPORT_MISS_MAX) {
+                    txconfirm_no_report(i);
+                }
+            }
+        }
+
+        /* send the TX_ACK of the downlinks whose outcome is known */
+        nb_done = txconfirm_collect(tx_done, TXCONFIRM_PENDING_MAX);
+        for (j = 0; j < nb_done; j++) {
+            if ((tx_done[j].status == TXCONFIRM_FAILED) && (tx_retry == true) && (tx_done[j].retry_nb < TX_RETRY_MAX)) {
+                if (retry_downlink(&tx_done[j]) == 0) {
+                    pktbuf_unref(tx_done[j].pkt);
+                    continue;
+                }
+            }
+            pthread_mutex_lock(&mx_meas_dw);
+            switch (tx_done[j].status) {
+                case TXCONFIRM_OK:
+                    meas_nb_tx_confirmed += 1;
+                    break;
+                case TXCONFIRM_FAILED:
+                    meas_nb_tx_unsent += 1;
+                    break;
+                case TXCONFIRM_TIMEOUT:
+                    meas_nb_tx_timeout += 1;
+                    break;
+                default:
+                    break;
             }
+            pthread_mutex_unlock(&mx_meas_dw);
+            MSG_DEBUG(DEBUG_PKT_FWD, "INFO: [jit] TX_ACK for count_us=%u on sx1276 %d, status %d, airtime %u us\n", pktbuf_tx(tx_done[j].pkt)->count_us, tx_done[j].radio, tx_done[j].status, tx_done[j].airtime_us);
+            send_tx_confirm(&tx_done[j]);
+            pktbuf_unref(tx_done[j].pkt);
         }
     }
 
@@ -4471,7 +5468,7 @@ static void gps_process_sync(void) {
     
     /* get timestamp captured on PPM pulse  */
     pthread_mutex_lock(&mx_concent);
-    i = lgw_get_trigcnt(&trig_tstamp,&(g_ctx_arr[0]->spi));
+    i = simgw_get_trigcnt(0, &trig_tstamp);
     pthread_mutex_unlock(&mx_concent);
     if (i != LGW_HAL_SUCCESS) {
         MSG(LOG_INFO,"WARNING: [gps] failed to read concentrator timestamp\n");
@@ -4509,7 +5506,8 @@ static void gps_process_coords(void) {
 
 void thread_gps(void) {
     /* serial variables */
-    char serial_buff[128]; /* buffer to receive GPS data */
+    char serial_buff[GPS_BUFF_SIZE]; /* ring buffer to receive GPS data */
+    size_t rd_idx = 0;     /* pointer to first unprocessed char in buffer */
     size_t wr_idx = 0;     /* pointer to end of chars in buffer */
 
     /* variables for PPM pulse GPS synchronization */
@@ -4519,11 +5517,20 @@ void thread_gps(void) {
     memset(serial_buff, 0, sizeof serial_buff);
 
     while (!exit_sig && !quit_sig) {
-        size_t rd_idx = 0;
-        size_t frame_end_idx = 0;
+        uint32_t nb_frame = 0;
+        uint32_t nb_corrupt = 0;
+        uint32_t nb_lost = 0;
+
+        /* Frames are parsed in place, so the pending bytes are only moved back to the
+           start of the buffer when the free space at the end gets too small */
+        if ((sizeof(serial_buff) - wr_idx) < NMEA_MAX_SIZE) {
+            memmove(serial_buff, &serial_buff[rd_idx], wr_idx - rd_idx);
+            wr_idx -= rd_idx;
+            rd_idx = 0;
+        }
 
-        /* blocking non-canonical read on serial port */
-        ssize_t nb_char = read(gps_tty_fd, serial_buff + wr_idx, LGW_GPS_MIN_MSG_SIZE);
+        /* blocking non-canonical read on serial port, take everything available */
+        ssize_t nb_char = read(gps_tty_fd, serial_buff + wr_idx, sizeof(serial_buff) - wr_idx);
         if (nb_char <= 0) {
             MSG(LOG_INFO,"WARNING: [gps] read() returned value %d\n", nb_char);
             continue;
@@ -4534,77 +5541,115 @@ void thread_gps(void) {
          * Scan buffer for UBX/NMEA sync chars and *
          * attempt to decode frame if one is found *
          *******************************************/
-        
-        while(rd_idx < wr_idx) {
+
+        while (rd_idx < wr_idx) {
+            char *frame = &serial_buff[rd_idx];
+            size_t avail = wr_idx - rd_idx;
             size_t frame_size = 0;
+            char *sync_ptr;
+            char *end_ptr;
+
+            /* jump to the next sync char */
+            sync_ptr = memchr(frame, LGW_GPS_NMEA_SYNC_CHAR, avail);
 #ifdef GPS_UBX
-            /* Scan buffer for UBX sync char */
-            if(serial_buff[rd_idx] == (char)LGW_GPS_UBX_SYNC_CHAR) {
+            end_ptr = memchr(frame, LGW_GPS_UBX_SYNC_CHAR, (sync_ptr != NULL) ? (size_t)(sync_ptr - frame) : avail);
+            if (end_ptr != NULL) {
+                sync_ptr = end_ptr;
+            }
+#endif
+            if (sync_ptr == NULL) {
+                nb_lost += 1;
+                rd_idx = wr_idx;
+                break;
+            }
+            if (sync_ptr != frame) {
+                nb_lost += 1;
+                rd_idx += (size_t)(sync_ptr - frame);
+                frame = sync_ptr;
+                avail = wr_idx - rd_idx;
+            }
 
+#ifdef GPS_UBX
+            if (*frame == (char)LGW_GPS_UBX_SYNC_CHAR) {
                 /***********************
                  * Found UBX sync char *
                  ***********************/
-                latest_msg = lgw_parse_ubx(&serial_buff[rd_idx], (wr_idx - rd_idx), &frame_size);
-                
-                if (frame_size > 0) {
-                    if (latest_msg == INCOMPLETE) {
-                        /* UBX header found but frame appears to be missing bytes */
-                        frame_size = 0;
-                    } else if (latest_msg == INVALID) {
-                        /* message header received but message appears to be corrupted */
-                        MSG(LOG_INFO,"WARNING: [gps] could not get a valid message from GPS (no time)\n");
-                        frame_size = 0;
-                    } else if (latest_msg == UBX_NAV_TIMEGPS) {
-                        gps_process_sync();
-                    }
+                /* the frame size is in the header, wait for the whole frame before parsing it */
+                if (avail < UBX_HEADER_SIZE) {
+                    break;
                 }
-            } else 
-#endif            
-            if(serial_buff[rd_idx] == LGW_GPS_NMEA_SYNC_CHAR) {
-                /************************
-                 * Found NMEA sync char *
-                 ************************/
-                /* scan for NMEA end marker (LF = 0x0a) */
-                char* nmea_end_ptr = memchr(&serial_buff[rd_idx],(int)0x0a, (wr_idx - rd_idx));
-
-                if(nmea_end_ptr) {
-                    /* found end marker */
-                    frame_size = nmea_end_ptr - &serial_buff[rd_idx] + 1;
-                    latest_msg = lgw_parse_nmea(&serial_buff[rd_idx], frame_size);
-
-                    if(latest_msg == INVALID || latest_msg == UNKNOWN) {
-                        /* checksum failed */
-                        frame_size = 0;
-                    } else if (latest_msg == NMEA_RMC) { /* Get location from RMC frames */
-#ifndef     GPS_UBX
-                        gps_process_sync();
-#endif
-                        gps_process_coords();
-                    }
+                if ((uint8_t)frame[1] != UBX_SYNC_CHAR_2) {
+                    rd_idx++; /* not a UBX frame, resync */
+                    continue;
+                }
+                frame_size = UBX_FRAME_OVERHEAD + ((uint8_t)frame[4] | ((size_t)(uint8_t)frame[5] << 8));
+                if (frame_size > sizeof(serial_buff) - NMEA_MAX_SIZE) {
+                    nb_corrupt += 1;
+                    rd_idx++;
+                    continue;
+                }
+                if (avail < frame_size) {
+                    break;
                 }
-            }
 
-            if(frame_size > 0) {
-                /* At this point message is a checksum verified frame
-                   we're processed or ignored. Remove frame from buffer */
+                latest_msg = lgw_parse_ubx(frame, frame_size, &frame_size);
+                if ((latest_msg == INVALID) || (latest_msg == INCOMPLETE) || (frame_size == 0)) {
+                    /* message header received but message appears to be corrupted */
+                    MSG(LOG_INFO,"WARNING: [gps] could not get a valid message from GPS (no time)\n");
+                    nb_corrupt += 1;
+                    rd_idx++;
+                    continue;
+                }
+                if (latest_msg == UBX_NAV_TIMEGPS) {
+                    gps_process_sync();
+                }
+                nb_frame += 1;
                 rd_idx += frame_size;
-                frame_end_idx = rd_idx;
-            } else {
+                continue;
+            }
+#endif
+            /************************
+             * Found NMEA sync char *
+             ************************/
+            /* scan for NMEA end marker (LF = 0x0a) */
+            end_ptr = memchr(frame, (int)0x0a, (avail < NMEA_MAX_SIZE) ? avail : NMEA_MAX_SIZE);
+            if (end_ptr == NULL) {
+                if (avail < NMEA_MAX_SIZE) {
+                    break; /* wait for the end of the sentence */
+                }
+                nb_corrupt += 1;
                 rd_idx++;
+                continue;
             }
-        } /* ...for(rd_idx = 0... */
 
-        if(frame_end_idx) {
-          /* Frames have been processed. Remove bytes to end of last processed frame */
-          memcpy(serial_buff, &serial_buff[frame_end_idx], wr_idx - frame_end_idx);
-          wr_idx -= frame_end_idx;
-        } /* ...for(rd_idx = 0... */
+            frame_size = end_ptr - frame + 1;
+            latest_msg = lgw_parse_nmea(frame, frame_size);
+            if (latest_msg == INVALID || latest_msg == UNKNOWN) {
+                /* checksum failed */
+                nb_corrupt += 1;
+                rd_idx++;
+                continue;
+            } else if (latest_msg == NMEA_RMC) { /* Get location from RMC frames */
+#ifndef     GPS_UBX
+                gps_process_sync();
+#endif
+                gps_process_coords();
+            }
+            nb_frame += 1;
+            rd_idx += frame_size;
+        }
 
-        /* Prevent buffer overflow */
-        if((sizeof(serial_buff) - wr_idx) < LGW_GPS_MIN_MSG_SIZE) {
-            memcpy(serial_buff, &serial_buff[LGW_GPS_MIN_MSG_SIZE], wr_idx - LGW_GPS_MIN_MSG_SIZE);
-            wr_idx -= LGW_GPS_MIN_MSG_SIZE;
+        if (rd_idx == wr_idx) {
+            /* everything processed, restart at the beginning of the buffer */
+            rd_idx = 0;
+            wr_idx = 0;
         }
+
+        pthread_mutex_lock(&mx_meas_gps);
+        meas_gps_nb_frame += nb_frame;
+        meas_gps_nb_corrupt += nb_corrupt;
+        meas_gps_nb_lost += nb_lost;
+        pthread_mutex_unlock(&mx_meas_gps);
     }
     MSG(LOG_INFO,"\nINFO: End of GPS thread\n");
 }
@@ -4693,4 +5738,491 @@ void thread_valid(void) {
     MSG(LOG_INFO,"\nINFO: End of validation thread\n");
 }
 
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 7: KEEPING THE NEXT BEACONS IN THE JIT QUEUE ------------------ */
+
+/* Encode coordinates as publicly reported in a beacon */
+static void beacon_encode_coord(struct coord_s coord, int32_t *field_latitude, int32_t *field_longitude) {
+    *field_latitude = (int32_t)((coord.lat / 90.0) * (double)(1<<23));
+    if (*field_latitude > (int32_t)0x007FFFFF) {
+        *field_latitude = (int32_t)0x007FFFFF; /* +90 N is represented as 89.99999 N */
+    } else if (*field_latitude < (int32_t)0xFF800000) {
+        *field_latitude = (int32_t)0xFF800000;
+    }
+    *field_longitude = (int32_t)((coord.lon / 180.0) * (double)(1<<23));
+    if (*field_longitude > (int32_t)0x007FFFFF) {
+        *field_longitude = (int32_t)0x007FFFFF; /* +180 E is represented as 179.99999 E */
+    } else if (*field_longitude < (int32_t)0xFF800000) {
+        *field_longitude = (int32_t)0xFF800000;
+    }
+}
+
+/* Write the gateway specific part of a beacon and its CRC, they only change with the coordinates */
+static void beacon_set_gateway_part(struct lgw_pkt_tx_s *beacon_pkt, size_t beacon_RFU1_size, size_t beacon_RFU2_size, int32_t field_latitude, int32_t field_longitude) {
+    uint8_t beacon_pyld_idx = beacon_RFU1_size + 4 + 2; /* after time and crc1 */
+    uint16_t field_crc2;
+    int i;
+
+    /* gateway specific beacon fields */
+    beacon_pkt->payload[beacon_pyld_idx++] = beacon_infodesc;
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF &  field_latitude;
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (field_latitude >>  8);
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (field_latitude >> 16);
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF &  field_longitude;
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (field_longitude >>  8);
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (field_longitude >> 16);
+
+    /* RFU */
+    for (i = 0; i < (int)beacon_RFU2_size; i++) {
+        beacon_pkt->payload[beacon_pyld_idx++] = 0x0;
+    }
+
+    /* CRC of the beacon gateway specific part fields */
+    field_crc2 = crc16_ccitt((beacon_pkt->payload + 6 + beacon_RFU1_size), 7 + beacon_RFU2_size);
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF &  field_crc2;
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (field_crc2 >> 8);
+}
+
+/* Write the time of a beacon slot and the CRC of the network common part */
+static void beacon_set_time(struct lgw_pkt_tx_s *beacon_pkt, size_t beacon_RFU1_size, uint32_t gps_sec) {
+    uint8_t beacon_pyld_idx = beacon_RFU1_size;
+    uint16_t field_crc1;
+
+    /* load time in beacon payload */
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF &  gps_sec;
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (gps_sec >>  8);
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (gps_sec >> 16);
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (gps_sec >> 24);
+
+    /* calculate CRC */
+    field_crc1 = crc16_ccitt(beacon_pkt->payload, 4 + beacon_RFU1_size); /* CRC for the network common part */
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & field_crc1;
+    beacon_pkt->payload[beacon_pyld_idx++] = 0xFF & (field_crc1 >> 8);
+}
+
+void thread_beacon(void) {
+    int i; /* loop variables */
+
+    /* beacon variables */
+    struct lgw_pkt_tx_s beacon_tmpl; /* fixed fields and gateway specific part, built once */
+    struct lgw_pkt_tx_s beacon_pkt;
+    uint8_t beacon_chan;
+    uint8_t beacon_loop;
+    size_t beacon_RFU1_size = 0;
+    size_t beacon_RFU2_size = 0;
+    time_t diff_beacon_time;
+    struct timespec next_beacon_gps_time; /* gps time of next beacon packet */
+    struct timespec last_beacon_gps_time; /* gps time of last enqueued beacon packet */
+    struct tref local_ref; /* time reference used for GPS <-> timestamp conversion */
+    int retry;
+
+    /* beacon data fields, byte 0 is Least Significant Byte */
+    int32_t field_latitude; /* 3 bytes, derived from reference latitude */
+    int32_t field_longitude; /* 3 bytes, derived from reference longitude */
+#ifdef _ALI_LINKWAN_
+    int32_t gps_latitude;
+    int32_t gps_longitude;
+    struct coord_s cp_gps_coord;
+#endif
+
+    /* Just In Time downlink */
+    struct timeval current_host_time;
+    struct timeval current_concentrator_time;
+    struct timeval jit_time; /* concentrator time corrected by the learned JIT lead */
+    enum jit_error_e jit_result;
+
+    /* beacon variables initialization */
+    last_beacon_gps_time.tv_sec = 0;
+    last_beacon_gps_time.tv_nsec = 0;
+    memset(&beacon_tmpl, 0, sizeof beacon_tmpl);
+
+    /* beacon packet parameters */
+    beacon_tmpl.tx_mode = ON_GPS; /* send on PPS pulse */
+    beacon_tmpl.rf_chain = 0; /* antenna A */
+    beacon_tmpl.rf_power = beacon_power;
+    beacon_tmpl.modulation = MOD_LORA;
+    switch (beacon_bw_hz) {
+        case 125000:
+            beacon_tmpl.bandwidth = BW_125KHZ;
+            break;
+        case 500000:
+            beacon_tmpl.bandwidth = BW_500KHZ;
+            break;
+        default:
+            /* should not happen */
+            MSG(LOG_CRIT,"ERROR: [beacon] unsupported bandwidth for beacon\n");
+            exit(EXIT_FAILURE);
+    }
+    switch (beacon_datarate) {
+        case 8:
+            beacon_tmpl.datarate = DR_LORA_SF8;
+            beacon_RFU1_size = 1;
+            beacon_RFU2_size = 3;
+            break;
+        case 9:
+            beacon_tmpl.datarate = DR_LORA_SF9;
+#if 0            
+            beacon_RFU1_size = 3;
+            beacon_RFU2_size = 1;
+#else
+            beacon_RFU1_size = 2;
+            beacon_RFU2_size = 0;
+#endif
+            break;
+        case 10:
+            beacon_tmpl.datarate = DR_LORA_SF10;
+            beacon_RFU1_size = 3;
+            beacon_RFU2_size = 1;
+            break;
+        case 12:
+            beacon_tmpl.datarate = DR_LORA_SF12;
+            beacon_RFU1_size = 5;
+            beacon_RFU2_size = 3;
+            break;
+        default:
+            /* should not happen */
+            MSG(LOG_CRIT,"ERROR: [beacon] unsupported datarate for beacon\n");
+            exit(EXIT_FAILURE);
+    }
+    beacon_tmpl.size = beacon_RFU1_size + 4 + 2 + 7 + beacon_RFU2_size + 2;
+    beacon_tmpl.coderate = CR_LORA_4_5;
+    beacon_tmpl.invert_pol = false;
+    beacon_tmpl.preamble = 10;
+    beacon_tmpl.no_crc = true;
+    beacon_tmpl.no_header = true;
+
+    /* network common part beacon fields: RFU1 stays zero, time and crc1 are set per slot */
+
+#ifdef _ALI_LINKWAN_
+    /* coordinates come from the GPS, the gateway specific part is refreshed when they change */
+    field_latitude = 0;
+    field_longitude = 0;
+#else
+    /* calculate the latitude and longitude that must be publicly reported */
+    beacon_encode_coord(reference_coord, &field_latitude, &field_longitude);
+#endif
+    beacon_set_gateway_part(&beacon_tmpl, beacon_RFU1_size, beacon_RFU2_size, field_latitude, field_longitude);
+
+    while (!exit_sig && !quit_sig) {
+        /* Pre-allocate beacon slots in JiT queue, to check downlink collisions */
+        beacon_loop = JIT_NUM_BEACON_IN_QUEUE - jit_queue[0].num_beacon; // Send beacon on sx1276 0
+        retry = 0;
+        while (beacon_loop) {
+            /* Wait for GPS to be ready before inserting beacons in JiT queue */
+            pthread_mutex_lock(&mx_timeref);
+            if ((gps_ref_valid == false) || (xtal_correct_ok == false)) {
+                pthread_mutex_unlock(&mx_timeref);
+                break;
+            }
+            local_ref = time_reference_gps;
+            pthread_mutex_unlock(&mx_timeref);
+
+            /* compute GPS time for next beacon to come      */
+            /*   LoRaWAN: T = k*beacon_period + TBeaconDelay */
+            /*            with TBeaconDelay = [1.5ms +/- 1µs]*/
+            if (last_beacon_gps_time.tv_sec == 0) {
+                /* if no beacon has been queued, get next slot from current GPS time */
+                diff_beacon_time = local_ref.gps.tv_sec % ((time_t)beacon_period);
+                next_beacon_gps_time.tv_sec = local_ref.gps.tv_sec +
+                                                ((time_t)beacon_period - diff_beacon_time);
+            } else {
+                /* if there is already a beacon, take it as reference */
+                next_beacon_gps_time.tv_sec = last_beacon_gps_time.tv_sec + beacon_period;
+            }
+            /* now we can add a beacon_period to the reference to get next beacon GPS time */
+            next_beacon_gps_time.tv_sec += (retry * beacon_period);
+            next_beacon_gps_time.tv_nsec = 0;
+
+#if DEBUG_BEACON
+            {
+                time_t time_unix;
+
+                time_unix = local_ref.gps.tv_sec + UNIX_GPS_EPOCH_OFFSET;
+                MSG_DEBUG(DEBUG_BEACON, "GPS-now : %s", ctime(&time_unix));
+                time_unix = last_beacon_gps_time.tv_sec + UNIX_GPS_EPOCH_OFFSET;
+                MSG_DEBUG(DEBUG_BEACON, "GPS-last: %s", ctime(&time_unix));
+                time_unix = next_beacon_gps_time.tv_sec + UNIX_GPS_EPOCH_OFFSET;
+                MSG_DEBUG(DEBUG_BEACON, "GPS-next: %s", ctime(&time_unix));
+            }
+#endif
+
+#ifdef _ALI_LINKWAN_
+            /* access GPS statistics, copy them */
+            cp_gps_coord.lat = 0.0;
+            cp_gps_coord.lon = 0.0;
+            cp_gps_coord.alt = 0;
+            if (gps_enabled == true) {
+                pthread_mutex_lock(&mx_meas_gps);
+                cp_gps_coord = meas_gps_coord;
+                pthread_mutex_unlock(&mx_meas_gps);
+            }
+
+            /* overwrite with reference coordinates if function is enabled */
+            if (gps_fake_enable == true) {
+                cp_gps_coord = reference_coord;
+            }
+
+            /* rebuild the gateway specific part only if the reported position moved */
+            beacon_encode_coord(cp_gps_coord, &gps_latitude, &gps_longitude);
+            if ((gps_latitude != field_latitude) || (gps_longitude != field_longitude)) {
+                field_latitude = gps_latitude;
+                field_longitude = gps_longitude;
+                beacon_set_gateway_part(&beacon_tmpl, beacon_RFU1_size, beacon_RFU2_size, field_latitude, field_longitude);
+            }
+#endif
+
+            /* only the time, crc1, frequency and counter differ between slots */
+            beacon_pkt = beacon_tmpl;
+
+            /* convert GPS time to concentrator time, and set packet counter for JiT trigger */
+            lgw_gps2cnt(local_ref, next_beacon_gps_time, &(beacon_pkt.count_us));
+
+            /* apply frequency correction to beacon TX frequency */
+            if (beacon_freq_nb > 1) {
+                beacon_chan = (next_beacon_gps_time.tv_sec / beacon_period) % beacon_freq_nb; /* floor rounding */
+            } else {
+                beacon_chan = 0;
+            }
+            /* Compute beacon frequency */
+            beacon_pkt.freq_hz = beacon_freq_hz + (beacon_chan * beacon_freq_step);
+
+            beacon_set_time(&beacon_pkt, beacon_RFU1_size, (uint32_t)next_beacon_gps_time.tv_sec);
+
+            /* Insert beacon packet in JiT queue */
+            get_host_time(&current_host_time);
+            /* tx beacon on sx1276 0, GPS time was converted to the gateway domain */
+            get_concentrator_time(&current_concentrator_time, current_host_time, g_ctx_sx1276_arr[0]);
+            jit_time = jitlead_time(0, current_concentrator_time);
+            jit_result = jittime_enqueue(0, &jit_queue[0], &jit_time, &beacon_pkt, timedomain_ref_to_sx1276(0, beacon_pkt.count_us), JIT_PKT_TYPE_BEACON);
+            if (jit_result == JIT_ERROR_OK) {
+                /* update stats */
+                pthread_mutex_lock(&mx_meas_dw);
+                meas_nb_beacon_queued += 1;
+                pthread_mutex_unlock(&mx_meas_dw);
+
+                /* One more beacon in the queue */
+                beacon_loop--;
+                retry = 0;
+                last_beacon_gps_time.tv_sec = next_beacon_gps_time.tv_sec; /* keep this beacon time as reference for next one to be programmed */
+
+                /* display beacon payload */
+                MSG(LOG_DEBUG,"INFO: Beacon queued (count_us=%u, freq_hz=%u, size=%u):\n", beacon_pkt.count_us, beacon_pkt.freq_hz, beacon_pkt.size);
+                MSG(LOG_DEBUG, "   => " );
+                for (i = 0; i < beacon_pkt.size; ++i) {
+                    MSG(LOG_DEBUG,"%02X ", beacon_pkt.payload[i]);
+                }
+                MSG(LOG_DEBUG,"\n");
+            } else {
+                MSG_DEBUG(DEBUG_BEACON, "--> beacon queuing failed with %d\n", jit_result);
+                /* update stats */
+                pthread_mutex_lock(&mx_meas_dw);
+                if (jit_result != JIT_ERROR_COLLISION_BEACON) {
+                    meas_nb_beacon_rejected += 1;
+                }
+                pthread_mutex_unlock(&mx_meas_dw);
+                /* In case previous enqueue failed, we retry one period later until it succeeds */
+                /* Note: In case the GPS has been unlocked for a while, there can be lots of retries */
+                /*       to be done from last beacon time to a new valid one */
+                retry++;
+                MSG_DEBUG(DEBUG_BEACON, "--> beacon queuing retry=%d\n", retry);
+                if( retry > 3 ){
+                    break;
+                }
+            }
+        }
+
+        /* wait for the next refill, beacons do not depend on the downlink traffic */
+        wait_ms(BEACON_TIMER_MS);
+    }
+    MSG(LOG_INFO,"\nINFO: End of beacon thread\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 8: REPLAYING THE PACKETS STORED WHILE THE SERVER WAS AWAY ----- */
+
+void thread_drain(void) {
+    int i, j;
+    int sock = -1; /* socket of its own, so the PUSH_ACK of the replay are not read by thread_up */
+    uint32_t sock_generation = 0;
+    bool network_st;
+    struct lgw_pkt_rx_s rxpkt[NB_PKT_MAX];
+    int nb_pkt;
+    uint32_t seq;
+
+    /* data buffers */
+    uint8_t buff_up[TX_BUFF_SIZE]; /* buffer to compose the upstream packet */
+    uint8_t buff_zip[TX_BUFF_SIZE]; /* same, compressed */
+    int buff_index;
+    int zip_len;
+    uint8_t buff_ack[32]; /* buffer to receive acknowledges */
+
+    /* protocol variables */
+    uint8_t token_h; /* random token for acknowledgement matching */
+    uint8_t token_l; /* random token for acknowledgement matching */
+
+    drain_init(data_recovery_rate, data_recovery_window);
+
+    /* pre-fill the data buffer with fixed fields */
+    buff_up[0] = PROTOCOL_VERSION;
+    buff_up[3] = PKT_PUSH_DATA;
+    *(uint32_t *)(buff_up + 4) = net_mac_h;
+    *(uint32_t *)(buff_up + 8) = net_mac_l;
+
+    while (!exit_sig && !quit_sig) {
+        pthread_mutex_lock(&mx_network_err);
+        network_st = status_network_connect;
+        pthread_mutex_unlock(&mx_network_err);
+
+        /* the server changed on a reload, replay what was not acknowledged to the new one */
+        if ((sock >= 0) && (sock_generation != __atomic_load_n(&serv_generation, __ATOMIC_SEQ_CST))) {
+            close(sock);
+            sock = -1;
+            drain_reset();
+        }
+
+        /* nothing to do until thread_down gets a PULL_ACK, stored packets are resent from the oldest unacknowledged one */
+        if (network_st == false) {
+            if (sock >= 0) {
+                close(sock);
+                sock = -1;
+                drain_reset();
+            }
+            wait_ms(DRAIN_IDLE_MS);
+            continue;
+        }
+        if (sock < 0) {
+            sock_generation = __atomic_load_n(&serv_generation, __ATOMIC_SEQ_CST);
+            sock = open_server_socket(false, NULL);
+            if (sock < 0) {
+                MSG(LOG_WARNING,"WARNING: [drain] failed to open a socket to the server\n");
+                wait_ms(DRAIN_IDLE_MS);
+                continue;
+            }
+        }
+
+        /* collect the PUSH_ACK of the datagrams in flight, stored packets are released in order */
+        while ((j = recv(sock, (void *)buff_ack, sizeof buff_ack, MSG_DONTWAIT)) != -1) {
+            if ((j < 4) || (buff_ack[0] != PROTOCOL_VERSION) || (buff_ack[3] != PKT_PUSH_ACK)) {
+                MSG(LOG_INFO,"WARNING: [drain] ignored invalid non-ACK packet\n");
+                continue;
+            }
+            if (push_compression == true) {
+                compress_server_set((j > 4) && (buff_ack[4] & COMPRESS_ACK_FLAG_LZ4));
+            }
+            if (drain_ack(buff_ack[1], buff_ack[2], &seq) == true) {
+                pktstore_release(seq);
+            }
+        }
+
+        /* respect the in-flight window and the byte rate */
+        if (drain_ready(&seq) == false) {
+            wait_ms(DRAIN_POLL_MS);
+            continue;
+        }
+        nb_pkt = pktstore_read(&seq, rxpkt, NB_PKT_MAX);
+        if (nb_pkt == 0) {
+            wait_ms(DRAIN_POLL_MS);
+            continue;
+        }
+
+        /* start composing datagram with the header */
+        token_h = (uint8_t)rand(); /* random token */
+        token_l = (uint8_t)rand(); /* random token */
+        buff_up[1] = token_h;
+        buff_up[2] = token_l;
+        buff_index = 12; /* 12-byte header */
+
+        /* start of JSON structure */
+        memcpy((void *)(buff_up + buff_index), (void *)"{\"rxpk\":[", 9);
+        buff_index += 9;
+        for (i = 0; i < nb_pkt; ++i) {
+            if( g_packet_table.enable ){
+                logger_packet_add_up(&rxpkt[i], TYPE_OUT_BUFFER);
+            }
+            buff_index = serialize_rxpk(buff_up, buff_index, i, &rxpkt[i], NULL, true);
+        }
+
+        /* end of packet array and of JSON datagram payload */
+        buff_up[buff_index] = ']';
+        buff_up[buff_index+1] = '}';
+        buff_index += 2;
+        buff_up[buff_index] = 0; /* add string terminator, for safety */
+
+        MSG(LOG_INFO,"\nJSON replay: %s\n", (char *)(buff_up + 12)); /* DEBUG: display JSON payload */
+
+        zip_len = push_data_compress(buff_up, buff_index, buff_zip, sizeof buff_zip);
+        if (zip_len > 0) {
+            send(sock, (void *)buff_zip, zip_len, 0);
+        } else {
+            send(sock, (void *)buff_up, buff_index, 0);
+            zip_len = buff_index;
+        }
+        drain_sent(token_h, token_l, seq, nb_pkt, zip_len);
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+    MSG(LOG_INFO,"\nINFO: End of drain thread\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 9: KEEPING THE SERVER CONNECTION UP --------------------------- */
+
+/* The name resolution and the socket replacement may block, they are kept out
+ * of the radio threads. The sockets keep their descriptor numbers (see
+ * reopen_server_sockets), the JIT queues and the concentrators are untouched. */
+void thread_conn(void) {
+    struct timespec now;
+    struct timespec next_resolve; /* next resolution of the server name */
+    struct timespec next_retry; /* earliest reconnection after a previous one */
+    unsigned retry_s = 0;
+    uint32_t unacked;
+    int moved;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    next_resolve = now;
+    next_resolve.tv_sec += dns_refresh_interval;
+    next_retry = now;
+
+    while (!exit_sig && !quit_sig) {
+        wait_ms(CONN_CHECK_MS);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        /* sustained ACK loss, reconnect with a growing delay until the server answers again */
+        unacked = __atomic_load_n(&pull_unacked, __ATOMIC_RELAXED);
+        if ((autoquit_threshold == 0) || (unacked < autoquit_threshold)) {
+            retry_s = 0;
+        } else if (difftimespec(now, next_retry) >= 0) {
+            MSG(LOG_WARNING,"WARNING: [conn] the last %u PULL_DATA were not ACKed, reconnecting\n", unacked);
+            reconnect_server();
+            retry_s = (retry_s == 0) ? CONN_RETRY_MIN_S : retry_s * 2;
+            if (retry_s > CONN_RETRY_MAX_S) {
+                retry_s = CONN_RETRY_MAX_S;
+            }
+            next_retry = now;
+            next_retry.tv_sec += retry_s;
+            next_resolve = next_retry;
+            continue;
+        }
+
+        /* follow a change of the addresses behind the server name */
+        if ((dns_refresh_interval == 0) || (difftimespec(now, next_resolve) < 0)) {
+            continue;
+        }
+        moved = server_moved();
+        next_resolve = now;
+        if (moved < 0) {
+            MSG(LOG_WARNING,"WARNING: [conn] failed to resolve the server name, next attempt in %u s\n", DNS_RETRY_S);
+            next_resolve.tv_sec += DNS_RETRY_S;
+            continue;
+        }
+        if (moved > 0) {
+            MSG(LOG_NOTICE,"INFO: [conn] server address changed, reconnecting\n");
+            reconnect_server();
+        }
+        next_resolve.tv_sec += dns_refresh_interval;
+    }
+    MSG(LOG_INFO,"\nINFO: End of connection thread\n");
+}
+
 /* --- EOF ------------------------------------------------------------------ */
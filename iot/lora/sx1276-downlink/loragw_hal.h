@@ -391,6 +391,13 @@ typedef struct _lgw_context_sx1276 {
 
     struct timeval offset_unix_concent;
     int32_t offset_count_us;
+
+    /* clock model fitted by the timer synchronization thread, published under sync_seq */
+    uint32_t sync_seq;              /* seqlock sequence, odd while the model is being updated */
+    struct timeval sync_host_time;  /* host monotonic time at which offset_unix_concent was measured */
+    double drift_ppm;               /* offset drift, in µs per second of host time */
+    uint32_t sync_accuracy_us;      /* estimated accuracy of the model */
+    uint32_t sync_interval_s;       /* current delay between two synchronizations */
 } lgw_context_sx1276;
 
 /**************************************************************************/
@@ -513,6 +520,13 @@ int lgw_abort_tx(t_spi * spi);
 */
 int lgw_get_trigcnt(uint32_t* trig_cnt_us, t_spi * spi);
 
+/**
+@brief Read the free-running 1MHz counter of an SX1276 MCU through its UART
+@param uart file descriptor of the UART the MCU is attached to
+@return current value of the MCU counter, in microseconds
+*/
+uint32_t lgw_uart_read_timer(int uart);
+
 /**
 @brief Allow user to check the version/options of the library once compiled
 @return pointer on a human-readable null terminated string
@@ -0,0 +1,295 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Metrics
+        Latency histograms and cumulative counters, served in Prometheus text
+        format on a local endpoint
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdio.h>          /* fdopen, fprintf */
+#include <stdint.h>         /* C99 types */
+#include <stdlib.h>         /* atoi */
+#include <string.h>         /* strncpy, strncmp */
+#include <unistd.h>         /* close, unlink */
+#include <errno.h>          /* error messages */
+#include <sys/time.h>       /* timeval */
+#include <sys/stat.h>       /* lstat */
+#include <sys/socket.h>     /* socket specific definitions */
+#include <sys/un.h>         /* sockaddr_un */
+#include <netinet/in.h>     /* INET constants and stuff */
+#include <arpa/inet.h>      /* IP address conversion stuff */
+
+#include "trace.h"
+#include "metrics.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* HDR-style buckets: values below 2^SUB_BITS are exact, above that each power of two
+   is split in 2^SUB_BITS buckets, so a sample is known within 25% whatever its magnitude */
+#define HIST_SUB_BITS       2
+#define HIST_SUB_NB         (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP        26      /* samples are clipped to 2^27-1 µs (~134 s) */
+#define HIST_BUCKET_NB      ((HIST_MAX_EXP - HIST_SUB_BITS + 2) << HIST_SUB_BITS)
+#define HIST_MAX_VALUE      ((1u << (HIST_MAX_EXP + 1)) - 1)
+
+#define METRICS_BACKLOG     4
+#define METRICS_REQ_TIMEOUT 200000  /* µs waited for a request line from the client */
+
+struct metrics_hist_s {
+    uint64_t bucket[HIST_BUCKET_NB];
+    uint64_t count;
+    uint64_t sum_us;
+};
+
+struct metrics_desc_s {
+    const char *name;
+    const char *help;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static struct metrics_hist_s hist[METRICS_HIST_NB];
+static uint64_t counter[METRICS_COUNTER_NB];
+
+static const struct metrics_desc_s hist_desc[METRICS_HIST_NB] = {
+    {"lora_pkt_fwd_push_ack_rtt_seconds", "PUSH_DATA to PUSH_ACK round-trip time"},
+    {"lora_pkt_fwd_pull_ack_rtt_seconds", "PULL_DATA to PULL_ACK round-trip time"},
+    {"lora_pkt_fwd_fetch_to_send_seconds", "Delay between packet fetch and PUSH_DATA transmission"},
+    {"lora_pkt_fwd_jit_lead_seconds", "Time left before TX when a downlink is written to the MCU"},
+    {"lora_pkt_fwd_uart_write_seconds", "Duration of downlink writes to the MCU"},
+    {"lora_pkt_fwd_compress_cpu_seconds", "CPU time spent compressing a PUSH_DATA"}
+};
+
+static const struct metrics_desc_s counter_desc[METRICS_COUNTER_NB] = {
+    {"lora_pkt_fwd_rx_received_total", "Radio packets received"},
+    {"lora_pkt_fwd_rx_ok_total", "Radio packets received with CRC OK"},
+    {"lora_pkt_fwd_up_forwarded_total", "Radio packets forwarded to the server"},
+    {"lora_pkt_fwd_push_data_sent_total", "PUSH_DATA datagrams sent"},
+    {"lora_pkt_fwd_push_ack_received_total", "PUSH_ACK datagrams received"},
+    {"lora_pkt_fwd_pull_data_sent_total", "PULL_DATA datagrams sent"},
+    {"lora_pkt_fwd_pull_ack_received_total", "PULL_ACK datagrams received"},
+    {"lora_pkt_fwd_pull_resp_received_total", "PULL_RESP datagrams received"},
+    {"lora_pkt_fwd_tx_ok_total", "Downlinks written to the MCU"},
+    {"lora_pkt_fwd_tx_fail_total", "Downlinks that failed to be written to the MCU"}
+};
+
+static int sock_metrics = -1; /* listening socket of the endpoint */
+static void (*reload_handler)(void) = NULL; /* called on a RELOAD command */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int hist_bucket_index(uint32_t value_us) {
+    int exp;
+
+    if (value_us > HIST_MAX_VALUE) {
+        value_us = HIST_MAX_VALUE;
+    }
+    if (value_us < HIST_SUB_NB) {
+        return (int)value_us;
+    }
+    exp = 31 - __builtin_clz(value_us);
+    return ((exp - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int)((value_us >> (exp - HIST_SUB_BITS)) - HIST_SUB_NB);
+}
+
+/* highest value held by a bucket */
+static uint32_t hist_bucket_upper(int idx) {
+    int exp;
+    uint32_t sub;
+
+    if (idx < HIST_SUB_NB) {
+        return (uint32_t)idx;
+    }
+    exp = (idx >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    sub = (uint32_t)(idx & (HIST_SUB_NB - 1));
+    return ((HIST_SUB_NB + sub + 1) << (exp - HIST_SUB_BITS)) - 1;
+}
+
+static void metrics_write(FILE *out) {
+    uint64_t cumul;
+    int i, j;
+
+    for (i = 0; i < METRICS_HIST_NB; i++) {
+        fprintf(out, "# HELP %s %s\n", hist_desc[i].name, hist_desc[i].help);
+        fprintf(out, "# TYPE %s histogram\n", hist_desc[i].name);
+        cumul = 0;
+        for (j = 0; j < HIST_BUCKET_NB; j++) {
+            cumul += __atomic_load_n(&(hist[i].bucket[j]), __ATOMIC_RELAXED);
+            fprintf(out, "%s_bucket{le=\"%.6f\"} %llu\n", hist_desc[i].name, (double)hist_bucket_upper(j) / 1E6, (unsigned long long)cumul);
+        }
+        fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", hist_desc[i].name, (unsigned long long)cumul);
+        fprintf(out, "%s_sum %.6f\n", hist_desc[i].name, (double)__atomic_load_n(&(hist[i].sum_us), __ATOMIC_RELAXED) / 1E6);
+        fprintf(out, "%s_count %llu\n", hist_desc[i].name, (unsigned long long)cumul);
+    }
+
+    for (i = 0; i < METRICS_COUNTER_NB; i++) {
+        fprintf(out, "# HELP %s %s\n", counter_desc[i].name, counter_desc[i].help);
+        fprintf(out, "# TYPE %s counter\n", counter_desc[i].name);
+        fprintf(out, "%s %llu\n", counter_desc[i].name, (unsigned long long)__atomic_load_n(&counter[i], __ATOMIC_RELAXED));
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void metrics_hist_record(enum metrics_hist_e id, uint32_t value_us) {
+    __atomic_fetch_add(&(hist[id].bucket[hist_bucket_index(value_us)]), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist[id].count), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist[id].sum_us), value_us, __ATOMIC_RELAXED);
+}
+
+uint32_t metrics_hist_percentile(enum metrics_hist_e id, double q) {
+    uint64_t count = __atomic_load_n(&(hist[id].count), __ATOMIC_RELAXED);
+    uint64_t rank;
+    uint64_t cumul = 0;
+    int i;
+
+    if (count == 0) {
+        return 0;
+    }
+    rank = (uint64_t)(q * (double)count);
+    for (i = 0; i < HIST_BUCKET_NB; i++) {
+        cumul += __atomic_load_n(&(hist[id].bucket[i]), __ATOMIC_RELAXED);
+        if (cumul > rank) {
+            return hist_bucket_upper(i);
+        }
+    }
+    return HIST_MAX_VALUE;
+}
+
+void metrics_counter_add(enum metrics_counter_e id, uint32_t nb) {
+    __atomic_fetch_add(&counter[id], nb, __ATOMIC_RELAXED);
+}
+
+void metrics_set_reload(void (*handler)(void)) {
+    reload_handler = handler;
+}
+
+int metrics_init(const char * endpoint) {
+    struct sockaddr_un addr_un;
+    struct sockaddr_in addr_in;
+    struct stat st;
+    int opt = 1;
+
+    if ((endpoint == NULL) || (endpoint[0] == '\0')) {
+        return -1;
+    }
+
+    if (endpoint[0] == '/') {
+        if (strlen(endpoint) >= sizeof(addr_un.sun_path)) {
+            MSG(LOG_ERR, "ERROR: [metrics] socket path %s is too long\n", endpoint);
+            return -1;
+        }
+        /* remove a socket left by a previous instance, never a file of another kind */
+        if (lstat(endpoint, &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                MSG(LOG_ERR, "ERROR: [metrics] %s exists and is not a socket, not replacing it\n", endpoint);
+                return -1;
+            }
+            unlink(endpoint);
+        }
+        sock_metrics = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock_metrics == -1) {
+            MSG(LOG_ERR, "ERROR: [metrics] socket creation failed: %s\n", strerror(errno));
+            return -1;
+        }
+        memset(&addr_un, 0, sizeof addr_un);
+        addr_un.sun_family = AF_UNIX;
+        strncpy(addr_un.sun_path, endpoint, sizeof(addr_un.sun_path) - 1);
+        if (bind(sock_metrics, (struct sockaddr *)&addr_un, sizeof addr_un) == -1) {
+            MSG(LOG_ERR, "ERROR: [metrics] bind on %s failed: %s\n", endpoint, strerror(errno));
+            close(sock_metrics);
+            sock_metrics = -1;
+            return -1;
+        }
+    } else {
+        sock_metrics = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock_metrics == -1) {
+            MSG(LOG_ERR, "ERROR: [metrics] socket creation failed: %s\n", strerror(errno));
+            return -1;
+        }
+        setsockopt(sock_metrics, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof opt);
+        memset(&addr_in, 0, sizeof addr_in);
+        addr_in.sin_family = AF_INET;
+        addr_in.sin_port = htons((uint16_t)atoi(endpoint));
+        addr_in.sin_addr.s_addr = htonl(INADDR_LOOPBACK); /* never exposed outside the gateway */
+        if (bind(sock_metrics, (struct sockaddr *)&addr_in, sizeof addr_in) == -1) {
+            MSG(LOG_ERR, "ERROR: [metrics] bind on port %s failed: %s\n", endpoint, strerror(errno));
+            close(sock_metrics);
+            sock_metrics = -1;
+            return -1;
+        }
+    }
+
+    if (listen(sock_metrics, METRICS_BACKLOG) == -1) {
+        MSG(LOG_ERR, "ERROR: [metrics] listen failed: %s\n", strerror(errno));
+        close(sock_metrics);
+        sock_metrics = -1;
+        return -1;
+    }
+
+    MSG(LOG_INFO, "INFO: [metrics] serving metrics on %s\n", endpoint);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- THREAD: SERVE METRICS TO LOCAL CLIENTS ------------------------------- */
+
+void thread_metrics(void) {
+    struct timeval req_timeout = {0, METRICS_REQ_TIMEOUT};
+    char req[256];
+    FILE *out;
+    int sock_client;
+    ssize_t nb_byte;
+
+    while (sock_metrics != -1) {
+        sock_client = accept(sock_metrics, NULL, NULL);
+        if (sock_client == -1) {
+            if (errno != EINTR) {
+                MSG(LOG_WARNING, "WARNING: [metrics] accept failed: %s\n", strerror(errno));
+            }
+            continue;
+        }
+
+        /* an HTTP client sends its request first, a plain client just reads */
+        setsockopt(sock_client, SOL_SOCKET, SO_RCVTIMEO, (void *)&req_timeout, sizeof req_timeout);
+        nb_byte = recv(sock_client, req, sizeof req, 0);
+
+        out = fdopen(sock_client, "w");
+        if (out == NULL) {
+            close(sock_client);
+            continue;
+        }
+        if ((nb_byte >= 6) && (strncmp(req, "RELOAD", 6) == 0)) {
+            if (reload_handler != NULL) {
+                reload_handler();
+                fprintf(out, "OK\n");
+            } else {
+                fprintf(out, "ERROR: reload not supported\n");
+            }
+            fclose(out);
+            continue;
+        }
+        if ((nb_byte >= 4) && (strncmp(req, "GET ", 4) == 0)) {
+            fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+        }
+        metrics_write(out);
+        fclose(out); /* also closes the client socket */
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
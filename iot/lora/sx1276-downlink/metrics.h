@@ -0,0 +1,102 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Metrics
+        Latency histograms and cumulative counters, served in Prometheus text
+        format on a local endpoint
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_METRICS_H
+#define _LORA_PKTFWD_METRICS_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum metrics_hist_e {
+    METRICS_PUSH_ACK_RTT,   /* PUSH_DATA sent to PUSH_ACK received */
+    METRICS_PULL_ACK_RTT,   /* PULL_DATA sent to PULL_ACK received */
+    METRICS_FETCH_TO_SEND,  /* packets fetched from the concentrator to PUSH_DATA sent */
+    METRICS_JIT_LEAD,       /* time left before TX when a packet is dispatched to the MCU */
+    METRICS_UART_WRITE,     /* duration of the downlink write to the MCU */
+    METRICS_COMPRESS_CPU,   /* CPU time spent compressing a PUSH_DATA */
+    METRICS_HIST_NB
+};
+
+enum metrics_counter_e {
+    METRICS_RX_RCV,         /* radio packets received */
+    METRICS_RX_OK,          /* radio packets received with CRC OK */
+    METRICS_UP_PKT_FWD,     /* radio packets forwarded to the server */
+    METRICS_UP_DGRAM_SENT,  /* PUSH_DATA datagrams sent */
+    METRICS_UP_ACK_RCV,     /* PUSH_ACK received */
+    METRICS_DW_PULL_SENT,   /* PULL_DATA datagrams sent */
+    METRICS_DW_ACK_RCV,     /* PULL_ACK received */
+    METRICS_DW_DGRAM_RCV,   /* PULL_RESP datagrams received */
+    METRICS_TX_OK,          /* downlinks written to the MCU */
+    METRICS_TX_FAIL,        /* downlinks failed to be written to the MCU */
+    METRICS_COUNTER_NB
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Record a latency sample, can be called from any thread without locking
+@param id histogram to update
+@param value_us sample value in microseconds
+*/
+void metrics_hist_record(enum metrics_hist_e id, uint32_t value_us);
+
+/**
+@brief Get a percentile of a histogram since startup
+@param id histogram to read
+@param q percentile, between 0.0 and 1.0
+@return upper bound of the bucket holding the percentile, in microseconds (0 if empty)
+*/
+uint32_t metrics_hist_percentile(enum metrics_hist_e id, double q);
+
+/**
+@brief Add to a cumulative counter, can be called from any thread without locking
+@param id counter to update
+@param nb value to add
+*/
+void metrics_counter_add(enum metrics_counter_e id, uint32_t nb);
+
+/**
+@brief Set the function called when a client sends a RELOAD command
+@param handler function requesting the reload, it must return without waiting for it
+*/
+void metrics_set_reload(void (*handler)(void));
+
+/**
+@brief Open the metrics endpoint
+@param endpoint path of a Unix socket (starting with '/'), or a TCP port on loopback
+@return 0 if the endpoint is listening, -1 else
+*/
+int metrics_init(const char * endpoint);
+
+/**
+@brief Serve the metrics to every client connecting to the endpoint
+
+Plain clients (e.g. socat) get the Prometheus text, clients sending an HTTP
+request get it as an HTTP response. A client sending "RELOAD" gets "OK" once
+the reload is requested.
+*/
+void thread_metrics(void);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
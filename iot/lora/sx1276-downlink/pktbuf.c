@@ -0,0 +1,181 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : packet buffers
+        Reference counted packets sized to their payload, carved from slabs
+        so they can be kept and passed around by handle
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stddef.h>         /* offsetof */
+#include <stdlib.h>         /* malloc */
+#include <string.h>         /* memcpy */
+#include <pthread.h>
+
+#include "trace.h"
+#include "pktbuf.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* A buffer holds the packet structure truncated right after its payload, so
+ * a 20-byte uplink takes less than 100 bytes instead of the 300 of a full
+ * structure. Buffers of the same size class are carved from slabs and
+ * recycled through a free list, slabs are never given back. */
+
+#define PKTBUF_CLASS_NB     4
+#define PKTBUF_META_MAX     ((offsetof(struct lgw_pkt_rx_s, payload) > offsetof(struct lgw_pkt_tx_s, payload)) ? \
+                             offsetof(struct lgw_pkt_rx_s, payload) : offsetof(struct lgw_pkt_tx_s, payload))
+
+static const uint16_t class_payload[PKTBUF_CLASS_NB] = {32, 64, 128, 256};
+
+struct pktbuf_s {
+    struct pktbuf_s *next;  /* free list */
+    int32_t ref;
+    uint8_t cls;
+    uint32_t data[];        /* packet structure, aligned for its 32-bit fields */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_pktbuf = PTHREAD_MUTEX_INITIALIZER; /* control access to the free lists */
+
+static struct pktbuf_s *free_list[PKTBUF_CLASS_NB];
+static uint32_t nb_used[PKTBUF_CLASS_NB];
+static uint32_t nb_slab;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static size_t class_size(int cls) {
+    return (offsetof(struct pktbuf_s, data) + PKTBUF_META_MAX + class_payload[cls] + 7) & ~(size_t)7;
+}
+
+static int class_of(uint16_t size) {
+    int cls;
+
+    for (cls = 0; cls < PKTBUF_CLASS_NB - 1; cls++) {
+        if (size <= class_payload[cls]) {
+            break;
+        }
+    }
+    return cls;
+}
+
+static struct pktbuf_s *buf_alloc(int cls) {
+    struct pktbuf_s *buf;
+    uint8_t *slab;
+    size_t size = class_size(cls);
+    unsigned i;
+
+    pthread_mutex_lock(&mx_pktbuf);
+    if (free_list[cls] == NULL) {
+        slab = malloc(PKTBUF_SLAB_SIZE);
+        if (slab == NULL) {
+            pthread_mutex_unlock(&mx_pktbuf);
+            MSG(LOG_ERR, "ERROR: [pktbuf] out of memory\n");
+            return NULL;
+        }
+        for (i = 0; i + size <= PKTBUF_SLAB_SIZE; i += size) {
+            buf = (struct pktbuf_s *)(slab + i);
+            buf->cls = cls;
+            buf->next = free_list[cls];
+            free_list[cls] = buf;
+        }
+        nb_slab += 1;
+    }
+    buf = free_list[cls];
+    free_list[cls] = buf->next;
+    nb_used[cls] += 1;
+    pthread_mutex_unlock(&mx_pktbuf);
+
+    buf->next = NULL;
+    buf->ref = 1;
+    return buf;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+struct pktbuf_s *pktbuf_tx_new(const struct lgw_pkt_tx_s *pkt) {
+    uint16_t size = (pkt->size < sizeof pkt->payload) ? pkt->size : sizeof pkt->payload;
+    struct pktbuf_s *buf = buf_alloc(class_of(size));
+
+    if (buf != NULL) {
+        memcpy(buf->data, pkt, offsetof(struct lgw_pkt_tx_s, payload) + size);
+    }
+    return buf;
+}
+
+struct pktbuf_s *pktbuf_rx_new(const struct lgw_pkt_rx_s *pkt) {
+    uint16_t size = (pkt->size < sizeof pkt->payload) ? pkt->size : sizeof pkt->payload;
+    struct pktbuf_s *buf = buf_alloc(class_of(size));
+
+    if (buf != NULL) {
+        memcpy(buf->data, pkt, offsetof(struct lgw_pkt_rx_s, payload) + size);
+    }
+    return buf;
+}
+
+struct lgw_pkt_tx_s *pktbuf_tx(struct pktbuf_s *buf) {
+    return (struct lgw_pkt_tx_s *)buf->data;
+}
+
+struct lgw_pkt_rx_s *pktbuf_rx(struct pktbuf_s *buf) {
+    return (struct lgw_pkt_rx_s *)buf->data;
+}
+
+void pktbuf_tx_get(struct pktbuf_s *buf, struct lgw_pkt_tx_s *pkt) {
+    const struct lgw_pkt_tx_s *held = (const struct lgw_pkt_tx_s *)buf->data;
+    uint16_t size = (held->size < sizeof held->payload) ? held->size : sizeof held->payload;
+
+    memcpy(pkt, held, offsetof(struct lgw_pkt_tx_s, payload) + size);
+}
+
+struct pktbuf_s *pktbuf_ref(struct pktbuf_s *buf) {
+    __atomic_fetch_add(&(buf->ref), 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+void pktbuf_unref(struct pktbuf_s *buf) {
+    if (buf == NULL) {
+        return;
+    }
+    if (__atomic_sub_fetch(&(buf->ref), 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    pthread_mutex_lock(&mx_pktbuf);
+    buf->next = free_list[buf->cls];
+    free_list[buf->cls] = buf;
+    nb_used[buf->cls] -= 1;
+    pthread_mutex_unlock(&mx_pktbuf);
+}
+
+void pktbuf_stat(struct pktbuf_stat_s *st) {
+    int cls;
+
+    pthread_mutex_lock(&mx_pktbuf);
+    st->nb_used = 0;
+    st->byte_used = 0;
+    for (cls = 0; cls < PKTBUF_CLASS_NB; cls++) {
+        st->nb_used += nb_used[cls];
+        st->byte_used += nb_used[cls] * class_size(cls);
+    }
+    st->nb_slab = nb_slab;
+    pthread_mutex_unlock(&mx_pktbuf);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
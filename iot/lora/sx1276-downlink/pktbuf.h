@@ -0,0 +1,105 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : packet buffers
+        Reference counted packets sized to their payload, carved from slabs
+        so they can be kept and passed around by handle
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_PKTBUF_H
+#define _LORA_PKTFWD_PKTBUF_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define PKTBUF_SLAB_SIZE    4096    /* slabs are allocated when a size class runs out of buffers */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct pktbuf_s; /* opaque handle */
+
+struct pktbuf_stat_s {
+    uint32_t nb_used;       /* buffers in use */
+    uint32_t byte_used;     /* bytes held by them */
+    uint32_t nb_slab;       /* slabs allocated since startup */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Copy a TX packet into a buffer, only its payload bytes are kept
+@param pkt packet to copy
+@return buffer with a reference count of 1, NULL if out of memory
+*/
+struct pktbuf_s *pktbuf_tx_new(const struct lgw_pkt_tx_s *pkt);
+
+/**
+@brief Copy an RX packet into a buffer, only its payload bytes are kept
+@param pkt packet to copy
+@return buffer with a reference count of 1, NULL if out of memory
+*/
+struct pktbuf_s *pktbuf_rx_new(const struct lgw_pkt_rx_s *pkt);
+
+/**
+@brief Access the TX packet held by a buffer, without copying it
+@param buf buffer created by pktbuf_tx_new
+@return the packet, only the first size bytes of its payload exist
+
+The structure must not be copied as a whole, use pktbuf_tx_get for a full copy.
+*/
+struct lgw_pkt_tx_s *pktbuf_tx(struct pktbuf_s *buf);
+
+/**
+@brief Access the RX packet held by a buffer, without copying it
+@param buf buffer created by pktbuf_rx_new
+@return the packet, only the first size bytes of its payload exist
+*/
+struct lgw_pkt_rx_s *pktbuf_rx(struct pktbuf_s *buf);
+
+/**
+@brief Copy the TX packet held by a buffer into a full structure
+@param buf buffer created by pktbuf_tx_new
+@param pkt structure to be filled
+*/
+void pktbuf_tx_get(struct pktbuf_s *buf, struct lgw_pkt_tx_s *pkt);
+
+/**
+@brief Take a reference on a buffer
+@param buf buffer
+@return buf
+*/
+struct pktbuf_s *pktbuf_ref(struct pktbuf_s *buf);
+
+/**
+@brief Drop a reference, the buffer is recycled when the last one is dropped
+@param buf buffer, NULL is ignored
+*/
+void pktbuf_unref(struct pktbuf_s *buf);
+
+/**
+@brief Get the buffer usage
+@param st pointer to the structure to be filled
+*/
+void pktbuf_stat(struct pktbuf_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
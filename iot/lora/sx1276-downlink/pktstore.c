@@ -0,0 +1,519 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : store and forward of uplinks
+        Memory-mapped ring file keeping the packets received while the
+        server is unreachable, recovered after a crash or a power loss
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stddef.h>         /* offsetof */
+#include <stdio.h>          /* snprintf */
+#include <string.h>         /* memcpy, memset, strerror */
+#include <errno.h>          /* errno */
+#include <time.h>           /* time, clock_gettime */
+#include <fcntl.h>          /* open */
+#include <unistd.h>         /* close, ftruncate */
+#include <sys/mman.h>       /* mmap, msync */
+#include <sys/stat.h>       /* fstat */
+#include <pthread.h>
+
+#include "trace.h"
+#include "crc.h"
+#include "pktstore.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* File layout: two header slots in the first page, then the ring of records.
+ * A record is never split: when it does not fit before the end of the ring a
+ * wrap marker is written and the ring continues at offset 0. Records carry a
+ * sequence number, so the packets still stored are found back after a crash
+ * by following the chain from the read position saved in the header until
+ * the first record that is torn or left from a previous lap. */
+
+#define PKTSTORE_MAGIC          0x53544B50  /* "PKTS" */
+#define PKTSTORE_VERSION        1
+#define PKTSTORE_HEAD_AREA      4096        /* header page, the ring starts page aligned */
+#define PKTSTORE_HEAD_SLOT      512         /* slot stride, a torn write leaves the other slot valid */
+#define PKTSTORE_SIZE_MIN       65536
+
+#define PKTSTORE_REC_MAGIC      0xA55A
+#define PKTSTORE_REC_WRAP       0x0001      /* marker, the ring continues at offset 0 */
+#define PKTSTORE_META_SIZE      offsetof(struct lgw_pkt_rx_s, payload) /* metadata stored before the payload */
+#define PKTSTORE_REC_SIZE(len)  ((sizeof(struct pktstore_rec_s) + (len) + 3) & ~(uint32_t)3)
+
+#define PKTSTORE_SYNC_MS        10000       /* max delay before written records are flushed */
+#define PKTSTORE_SYNC_BYTES     16384       /* flush earlier when that much was written */
+
+struct pktstore_head_s {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t crc;           /* CRC16 of the slot, computed with crc = 0 */
+    uint32_t gen;           /* incremented on each write, the highest valid slot wins */
+    uint32_t capacity;      /* ring size in bytes */
+    uint32_t rd_off;        /* oldest record not acknowledged */
+    uint32_t rd_seq;        /* its sequence number */
+};
+
+struct pktstore_rec_s {
+    uint16_t crc;           /* CRC16 of the rest of the header and of the body */
+    uint16_t magic;
+    uint16_t flags;
+    uint16_t len;           /* body size: metadata and payload */
+    uint32_t seq;
+    uint32_t time;          /* unix time the packet was stored */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_pktstore = PTHREAD_MUTEX_INITIALIZER; /* control access to the store */
+
+static int store_fd = -1;
+static uint8_t *store_map = NULL;
+static size_t store_map_size;
+static uint8_t *ring;               /* first byte of the ring in the mapping */
+static uint32_t cap;                /* ring size */
+static uint32_t max_age;            /* 0 = no limit */
+static uint32_t head_gen;
+
+static uint32_t rd_off, rd_seq;     /* oldest packet */
+static uint32_t wr_off, wr_seq;     /* next record */
+static uint32_t nb_pkt;
+
+static uint32_t nb_evicted;
+static uint32_t nb_expired;
+
+static bool dirty = false;
+static uint32_t dirty_byte;
+static struct timespec last_sync;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static void head_write(void) {
+    struct pktstore_head_s head;
+
+    memset(&head, 0, sizeof head);
+    head.magic = PKTSTORE_MAGIC;
+    head.version = PKTSTORE_VERSION;
+    head.gen = ++head_gen;
+    head.capacity = cap;
+    head.rd_off = rd_off;
+    head.rd_seq = rd_seq;
+    head.crc = crc16_ccitt((const uint8_t *)&head, sizeof head);
+    memcpy(store_map + (head_gen & 1) * PKTSTORE_HEAD_SLOT, &head, sizeof head);
+    dirty = true;
+}
+
+static bool head_read(int slot, struct pktstore_head_s *head) {
+    uint16_t crc;
+
+    memcpy(head, store_map + slot * PKTSTORE_HEAD_SLOT, sizeof *head);
+    crc = head->crc;
+    head->crc = 0;
+    if ((head->magic != PKTSTORE_MAGIC) || (head->version != PKTSTORE_VERSION) ||
+        (crc != crc16_ccitt((const uint8_t *)head, sizeof *head))) {
+        return false;
+    }
+    return true;
+}
+
+/* 0: no valid record at off, 1: packet record, 2: wrap marker */
+static int rec_check(uint32_t off, uint32_t seq, struct pktstore_rec_s *rec) {
+    if ((cap - off) < sizeof *rec) {
+        return 0;
+    }
+    memcpy(rec, ring + off, sizeof *rec);
+    if ((rec->magic != PKTSTORE_REC_MAGIC) || (rec->seq != seq)) {
+        return 0;
+    }
+    if (rec->flags & PKTSTORE_REC_WRAP) {
+        if (rec->len != 0) {
+            return 0;
+        }
+    } else if ((rec->len < PKTSTORE_META_SIZE) || (rec->len > sizeof(struct lgw_pkt_rx_s)) ||
+               (PKTSTORE_REC_SIZE(rec->len) > (cap - off))) {
+        return 0;
+    }
+    if (rec->crc != crc16_ccitt(ring + off + 2, sizeof *rec - 2 + rec->len)) {
+        return 0;
+    }
+    return (rec->flags & PKTSTORE_REC_WRAP) ? 2 : 1;
+}
+
+static void rec_write(uint16_t flags, const struct lgw_pkt_rx_s *pkt, uint16_t len, uint32_t now) {
+    struct pktstore_rec_s rec;
+
+    rec.crc = 0;
+    rec.magic = PKTSTORE_REC_MAGIC;
+    rec.flags = flags;
+    rec.len = len;
+    rec.seq = wr_seq++;
+    rec.time = now;
+    memcpy(ring + wr_off, &rec, sizeof rec);
+    if (pkt != NULL) {
+        memcpy(ring + wr_off + sizeof rec, pkt, PKTSTORE_META_SIZE);
+        memcpy(ring + wr_off + sizeof rec + PKTSTORE_META_SIZE, pkt->payload, len - PKTSTORE_META_SIZE);
+    }
+    /* CRC written last, covers the whole record */
+    rec.crc = crc16_ccitt(ring + wr_off + 2, sizeof rec - 2 + len);
+    memcpy(ring + wr_off, &rec.crc, sizeof rec.crc);
+
+    wr_off += PKTSTORE_REC_SIZE(len);
+    dirty = true;
+    dirty_byte += PKTSTORE_REC_SIZE(len);
+}
+
+/* move the read position over wrap markers, it always rests on a packet or on the write position */
+static void rd_skip_wrap(void) {
+    struct pktstore_rec_s rec;
+
+    while ((nb_pkt > 0) || (rd_off != wr_off)) {
+        if ((cap - rd_off) < sizeof rec) {
+            rd_off = 0;
+        } else if (rec_check(rd_off, rd_seq, &rec) == 2) {
+            rd_off = 0;
+            rd_seq += 1;
+        } else {
+            break;
+        }
+    }
+}
+
+static void rd_advance(void) {
+    struct pktstore_rec_s rec;
+
+    memcpy(&rec, ring + rd_off, sizeof rec);
+    rd_off += PKTSTORE_REC_SIZE(rec.len);
+    rd_seq += 1;
+    nb_pkt -= 1;
+    rd_skip_wrap();
+}
+
+/* make need contiguous bytes available at the write position, evicting the oldest packets if needed */
+static void make_room(uint32_t need) {
+    for (;;) {
+        if ((wr_off > rd_off) || (nb_pkt == 0)) {
+            /* free space is [wr_off, cap) then [0, rd_off) */
+            if ((cap - wr_off) >= need) {
+                return;
+            }
+            if ((cap - wr_off) >= sizeof(struct pktstore_rec_s)) {
+                rec_write(PKTSTORE_REC_WRAP, NULL, 0, 0);
+            }
+            wr_off = 0;
+            if (nb_pkt == 0) {
+                rd_skip_wrap();
+            }
+        } else {
+            /* free space is [wr_off, rd_off) */
+            if ((rd_off - wr_off) >= need) {
+                return;
+            }
+            rd_advance();
+            nb_evicted += 1;
+        }
+    }
+}
+
+static void recover(void) {
+    struct pktstore_rec_s rec;
+    uint32_t off = rd_off;
+    uint32_t seq = rd_seq;
+    uint32_t scanned = 0;
+    int i;
+
+    nb_pkt = 0;
+    while (scanned <= cap) {
+        if ((cap - off) < sizeof rec) {
+            off = 0;
+            continue;
+        }
+        i = rec_check(off, seq, &rec);
+        if (i == 0) {
+            break;
+        } else if (i == 2) {
+            scanned += cap - off;
+            off = 0;
+        } else {
+            scanned += PKTSTORE_REC_SIZE(rec.len);
+            off += PKTSTORE_REC_SIZE(rec.len);
+            nb_pkt += 1;
+        }
+        seq += 1;
+    }
+    wr_off = off;
+    wr_seq = seq;
+    rd_skip_wrap();
+}
+
+static void store_sync(bool force) {
+    struct timespec now;
+    long elapsed_ms;
+
+    if (dirty == false) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ms = (now.tv_sec - last_sync.tv_sec) * 1000 + (now.tv_nsec - last_sync.tv_nsec) / 1000000;
+    if ((force == false) && (dirty_byte < PKTSTORE_SYNC_BYTES) && (elapsed_ms < PKTSTORE_SYNC_MS)) {
+        return;
+    }
+    /* only the dirty pages are written, batching keeps flash wear low */
+    if (msync(store_map, store_map_size, MS_SYNC) != 0) {
+        MSG(LOG_WARNING, "WARNING: [pktstore] msync failed: %s\n", strerror(errno));
+    }
+    dirty = false;
+    dirty_byte = 0;
+    last_sync = now;
+}
+
+static int store_map_file(size_t size) {
+    store_map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store_fd, 0);
+    if (store_map == MAP_FAILED) {
+        store_map = NULL;
+        return -1;
+    }
+    store_map_size = size;
+    ring = store_map + PKTSTORE_HEAD_AREA;
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int pktstore_init(const char *path, uint32_t size, uint32_t max_age_s) {
+    char file[256];
+    struct stat st;
+    struct pktstore_head_s head[2];
+    bool valid[2];
+    int slot;
+
+    /* store file */
+    if (path == NULL) {
+        snprintf(file, sizeof file, "%s", PKTSTORE_DEFAULT_FILE);
+    } else if ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) {
+        snprintf(file, sizeof file, "%s/%s", path, PKTSTORE_DEFAULT_FILE);
+    } else {
+        snprintf(file, sizeof file, "%s", path);
+    }
+    size &= ~(uint32_t)3;
+    if (size < PKTSTORE_SIZE_MIN) {
+        size = PKTSTORE_SIZE_MIN;
+    }
+
+    pthread_mutex_lock(&mx_pktstore);
+    max_age = max_age_s;
+    store_fd = open(file, O_RDWR | O_CREAT, 0644);
+    if ((store_fd < 0) || (fstat(store_fd, &st) != 0)) {
+        MSG(LOG_ERR, "ERROR: [pktstore] failed to open %s: %s\n", file, strerror(errno));
+        goto fail;
+    }
+
+    /* existing store: follow the chain of records from the last saved read position */
+    if ((st.st_size >= PKTSTORE_HEAD_AREA + PKTSTORE_SIZE_MIN) && (store_map_file(st.st_size) == 0)) {
+        cap = (uint32_t)(st.st_size - PKTSTORE_HEAD_AREA);
+        valid[0] = head_read(0, &head[0]) && (head[0].capacity == cap);
+        valid[1] = head_read(1, &head[1]) && (head[1].capacity == cap);
+        if (valid[0] || valid[1]) {
+            slot = (valid[0] && (!valid[1] || (int32_t)(head[0].gen - head[1].gen) > 0)) ? 0 : 1;
+            if (((head[slot].rd_off & 3) == 0) && (head[slot].rd_off < cap)) {
+                head_gen = head[slot].gen;
+                rd_off = head[slot].rd_off;
+                rd_seq = head[slot].rd_seq;
+                recover();
+                if (cap != size) {
+                    MSG(LOG_WARNING, "WARNING: [pktstore] keeping the %u bytes of the existing store\n", cap);
+                }
+                MSG(LOG_INFO, "INFO: [pktstore] %u packets recovered from %s\n", nb_pkt, file);
+                clock_gettime(CLOCK_MONOTONIC, &last_sync);
+                pthread_mutex_unlock(&mx_pktstore);
+                return 0;
+            }
+        }
+        MSG(LOG_WARNING, "WARNING: [pktstore] %s is not a valid store, resetting it\n", file);
+        munmap(store_map, store_map_size);
+        store_map = NULL;
+    }
+
+    /* new store */
+    if ((ftruncate(store_fd, 0) != 0) || (ftruncate(store_fd, PKTSTORE_HEAD_AREA + size) != 0) ||
+        (store_map_file(PKTSTORE_HEAD_AREA + size) != 0)) {
+        MSG(LOG_ERR, "ERROR: [pktstore] failed to create %s: %s\n", file, strerror(errno));
+        goto fail;
+    }
+    cap = size;
+    head_gen = 0;
+    rd_off = wr_off = 0;
+    rd_seq = wr_seq = 1;
+    nb_pkt = 0;
+    head_write();
+    store_sync(true);
+    MSG(LOG_INFO, "INFO: [pktstore] created %s (%u bytes)\n", file, cap);
+    pthread_mutex_unlock(&mx_pktstore);
+    return 0;
+
+fail:
+    if (store_fd >= 0) {
+        close(store_fd);
+        store_fd = -1;
+    }
+    pthread_mutex_unlock(&mx_pktstore);
+    return -1;
+}
+
+void pktstore_deinit(void) {
+    pthread_mutex_lock(&mx_pktstore);
+    if (store_map != NULL) {
+        store_sync(true);
+        munmap(store_map, store_map_size);
+        store_map = NULL;
+    }
+    if (store_fd >= 0) {
+        close(store_fd);
+        store_fd = -1;
+    }
+    pthread_mutex_unlock(&mx_pktstore);
+}
+
+int pktstore_enqueue(const struct lgw_pkt_rx_s *pkt, int nb) {
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t evicted;
+    uint16_t len;
+    int i;
+
+    pthread_mutex_lock(&mx_pktstore);
+    if (store_map == NULL) {
+        pthread_mutex_unlock(&mx_pktstore);
+        return 0;
+    }
+    evicted = nb_evicted;
+    for (i = 0; i < nb; i++) {
+        len = PKTSTORE_META_SIZE + ((pkt[i].size < sizeof pkt[i].payload) ? pkt[i].size : sizeof pkt[i].payload);
+        make_room(PKTSTORE_REC_SIZE(len));
+        rec_write(0, &pkt[i], len, now);
+        nb_pkt += 1;
+    }
+    if (nb_evicted != evicted) {
+        head_write(); /* read position moved */
+    }
+    store_sync(false);
+    pthread_mutex_unlock(&mx_pktstore);
+
+    return nb;
+}
+
+int pktstore_read(uint32_t *seq, struct lgw_pkt_rx_s *pkt, int max_nb) {
+    struct pktstore_rec_s rec;
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t off, last = 0;
+    uint32_t left;
+    int nb = 0;
+
+    pthread_mutex_lock(&mx_pktstore);
+    if (store_map == NULL) {
+        pthread_mutex_unlock(&mx_pktstore);
+        return 0;
+    }
+
+    /* packets beyond the age quota are not worth forwarding */
+    if (max_age > 0) {
+        off = rd_off;
+        while (nb_pkt > 0) {
+            memcpy(&rec, ring + rd_off, sizeof rec);
+            if ((int32_t)(now - rec.time) <= (int32_t)max_age) {
+                break;
+            }
+            rd_advance();
+            nb_expired += 1;
+        }
+        if (rd_off != off) {
+            head_write();
+        }
+    }
+
+    /* start over from the oldest packet if the wanted one is gone, or was never written */
+    if (((int32_t)(*seq - rd_seq) < 0) || ((int32_t)(*seq - wr_seq) > 0)) {
+        *seq = rd_seq;
+    }
+
+    /* records between rd_off and wr_off were validated when written or recovered */
+    off = rd_off;
+    left = nb_pkt;
+    while ((nb < max_nb) && (left > 0)) {
+        if ((cap - off) < sizeof rec) {
+            off = 0;
+            continue;
+        }
+        memcpy(&rec, ring + off, sizeof rec);
+        if (rec.flags & PKTSTORE_REC_WRAP) {
+            off = 0;
+            continue;
+        }
+        /* packets already read but not released yet are skipped */
+        if ((int32_t)(rec.seq - *seq) >= 0) {
+            memset(&pkt[nb], 0, sizeof pkt[nb]);
+            memcpy(&pkt[nb], ring + off + sizeof rec, PKTSTORE_META_SIZE);
+            memcpy(pkt[nb].payload, ring + off + sizeof rec + PKTSTORE_META_SIZE, rec.len - PKTSTORE_META_SIZE);
+            last = rec.seq;
+            nb += 1;
+        }
+        off += PKTSTORE_REC_SIZE(rec.len);
+        left -= 1;
+    }
+    if (nb > 0) {
+        *seq = last + 1;
+    }
+    store_sync(false);
+    pthread_mutex_unlock(&mx_pktstore);
+
+    return nb;
+}
+
+void pktstore_release(uint32_t seq) {
+    pthread_mutex_lock(&mx_pktstore);
+    if (store_map == NULL) {
+        pthread_mutex_unlock(&mx_pktstore);
+        return;
+    }
+    if ((nb_pkt > 0) && ((int32_t)(rd_seq - seq) < 0)) {
+        while ((nb_pkt > 0) && ((int32_t)(rd_seq - seq) < 0)) {
+            rd_advance();
+        }
+        head_write();
+        store_sync(false);
+    }
+    pthread_mutex_unlock(&mx_pktstore);
+}
+
+void pktstore_stat(struct pktstore_stat_s *st) {
+    pthread_mutex_lock(&mx_pktstore);
+    st->nb_pkt = nb_pkt;
+    if (wr_off > rd_off) {
+        st->nb_byte = wr_off - rd_off;
+    } else {
+        st->nb_byte = (nb_pkt == 0) ? 0 : (cap - rd_off + wr_off);
+    }
+    st->nb_evicted = nb_evicted;
+    st->nb_expired = nb_expired;
+    nb_evicted = 0;
+    nb_expired = 0;
+    pthread_mutex_unlock(&mx_pktstore);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,97 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : store and forward of uplinks
+        Memory-mapped ring file keeping the packets received while the
+        server is unreachable, recovered after a crash or a power loss
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_PKTSTORE_H
+#define _LORA_PKTFWD_PKTSTORE_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define PKTSTORE_DEFAULT_FILE       "lora_pkt_fwd.store"    /* file name used when the path is a directory or not set */
+#define PKTSTORE_DEFAULT_SIZE       (2 * 1024 * 1024)       /* ring size in bytes, the oldest packets are evicted beyond */
+#define PKTSTORE_DEFAULT_MAX_AGE    86400                   /* packets older than that (in s) are not forwarded, 0 = no limit */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct pktstore_stat_s {
+    uint32_t nb_pkt;        /* packets waiting in the store */
+    uint32_t nb_byte;       /* bytes used in the ring */
+    uint32_t nb_evicted;    /* packets overwritten because the ring was full, since the last call */
+    uint32_t nb_expired;    /* packets dropped because of their age, since the last call */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Open the store, creating it if needed, and recover the packets it holds
+@param path store file, or directory to create it in, NULL for the current directory
+@param size ring size in bytes, only used when the file is created
+@param max_age_s age beyond which stored packets are dropped, 0 for no limit
+@return 0 if the store is usable, -1 else
+*/
+int pktstore_init(const char *path, uint32_t size, uint32_t max_age_s);
+
+/**
+@brief Flush and close the store
+*/
+void pktstore_deinit(void);
+
+/**
+@brief Append packets to the store, evicting the oldest ones if it is full
+@param pkt array of packets
+@param nb_pkt number of packets
+@return number of packets stored
+*/
+int pktstore_enqueue(const struct lgw_pkt_rx_s *pkt, int nb_pkt);
+
+/**
+@brief Read stored packets, without removing them
+@param seq in: sequence number of the first packet wanted, out: sequence number following the last packet read
+@param pkt array to be filled
+@param max_nb size of the array
+@return number of packets read
+
+Reading starts from the oldest packet when *seq is no longer in the store.
+The packets stay in the store until pktstore_release is called, typically when
+the server acknowledged them, so several batches can be read ahead.
+*/
+int pktstore_read(uint32_t *seq, struct lgw_pkt_rx_s *pkt, int max_nb);
+
+/**
+@brief Remove the packets read before a given point
+@param seq sequence number returned by pktstore_read, the packets before it are removed
+*/
+void pktstore_release(uint32_t seq);
+
+/**
+@brief Get the store statistics, evicted and expired counts are reset
+@param st pointer to the structure to be filled
+*/
+void pktstore_stat(struct pktstore_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,67 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : protocol constants
+        Datagram types of the packet forwarder protocol, and the LoRaWAN
+        frame fields the forwarder looks into
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_PROTOCOL_H
+#define _LORA_PKTFWD_PROTOCOL_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* Datagrams start with the version, a 2-byte token and the type; PUSH_DATA,
+ * PULL_DATA and TX_ACK follow with the 8-byte gateway ID, then the JSON. */
+
+#define PROTOCOL_VERSION    2           /* v1.3 */
+
+#define PKT_PUSH_DATA   0
+#define PKT_PUSH_ACK    1
+#define PKT_PULL_DATA   2
+#define PKT_PULL_RESP   3
+#define PKT_PULL_ACK    4
+#define PKT_TX_ACK      5
+
+/* MType, the 3 top bits of the MHDR */
+#define MTYPE_JOIN_REQUEST          0
+#define MTYPE_JOIN_ACCEPT           1
+#define MTYPE_UNCONFIRM_DATA_UP     2
+#define MTYPE_UNCONFIRM_DATA_DOWN   3
+#define MTYPE_CONFIRM_DATA_UP       4
+#define MTYPE_CONFIRM_DATA_DOWN     5
+#define MTYPE_REJOIN_REQUEST        6   /* LoRaWAN 1.1, RFU before */
+#define MTYPE_PROPRIETARY           7
+
+#define LORAWAN_DATA_MIN_SIZE   12      /* MHDR, FHDR without FOpts, MIC */
+#define LORAWAN_JOIN_SIZE       23      /* MHDR, JoinEUI, DevEUI, DevNonce, MIC */
+
+/* MType of a frame of at least 1 byte */
+#define LORAWAN_MTYPE(payload)  ((uint8_t)((payload)[0] >> 5))
+
+/* a data uplink, long enough to hold its FHDR */
+#define LORAWAN_DATA_UP(payload, size) (((size) >= LORAWAN_DATA_MIN_SIZE) && \
+    ((LORAWAN_MTYPE(payload) == MTYPE_UNCONFIRM_DATA_UP) || (LORAWAN_MTYPE(payload) == MTYPE_CONFIRM_DATA_UP)))
+
+/* DevAddr of a data frame, little endian on air */
+#define LORAWAN_DEVADDR(payload) ((uint32_t)(payload)[1] | ((uint32_t)(payload)[2] << 8) | \
+    ((uint32_t)(payload)[3] << 16) | ((uint32_t)(payload)[4] << 24))
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,95 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : read-copy-update of shared tables
+        Quiescent state based reclamation, readers only announce when they
+        hold no reference to a shared table
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <time.h>           /* nanosleep */
+#include <pthread.h>
+
+#include "rcu.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* Each reader copies the grace period counter when it is quiescent. A grace
+ * period is over when every registered reader has copied a value at least
+ * equal to the one set at its start. */
+
+#define RCU_POLL_NS         1000000 /* 1 ms between two checks of the readers */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_rcu = PTHREAD_MUTEX_INITIALIZER; /* control access to the reader slots, one grace period at a time */
+
+static uint64_t gp_count = 1;
+static uint64_t reader_count[RCU_READER_MAX]; /* 0 for a free slot */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int rcu_register(void) {
+    int id;
+
+    pthread_mutex_lock(&mx_rcu);
+    for (id = 0; id < RCU_READER_MAX; id++) {
+        if (__atomic_load_n(&reader_count[id], __ATOMIC_SEQ_CST) == 0) {
+            __atomic_store_n(&reader_count[id], __atomic_load_n(&gp_count, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mx_rcu);
+
+    return (id < RCU_READER_MAX) ? id : -1;
+}
+
+void rcu_unregister(int id) {
+    if (id < 0) {
+        return;
+    }
+    __atomic_store_n(&reader_count[id], 0, __ATOMIC_SEQ_CST);
+}
+
+void rcu_quiescent(int id) {
+    if (id < 0) {
+        return;
+    }
+    __atomic_store_n(&reader_count[id], __atomic_load_n(&gp_count, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+void rcu_synchronize(void) {
+    const struct timespec poll = {0, RCU_POLL_NS};
+    uint64_t target, seen;
+    int id;
+
+    pthread_mutex_lock(&mx_rcu);
+    target = __atomic_add_fetch(&gp_count, 1, __ATOMIC_SEQ_CST);
+    for (id = 0; id < RCU_READER_MAX; id++) {
+        for (;;) {
+            seen = __atomic_load_n(&reader_count[id], __ATOMIC_SEQ_CST);
+            if ((seen == 0) || (seen >= target)) {
+                break;
+            }
+            nanosleep(&poll, NULL);
+        }
+    }
+    pthread_mutex_unlock(&mx_rcu);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,59 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : read-copy-update of shared tables
+        Quiescent state based reclamation, readers only announce when they
+        hold no reference to a shared table
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_RCU_H
+#define _LORA_PKTFWD_RCU_H
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* A table shared with the reader threads is never modified. It is replaced
+ * by publishing a new one with __atomic_store_n, calling rcu_synchronize,
+ * then freeing the old one. Readers load the pointer with __atomic_load_n
+ * and call rcu_quiescent between two uses, typically once per loop. */
+
+#define RCU_READER_MAX      8
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Register the calling thread as a reader
+@return reader identifier, -1 if there are too many readers
+*/
+int rcu_register(void);
+
+/**
+@brief Unregister a reader, it must not hold any reference anymore
+@param id reader identifier, -1 is ignored
+*/
+void rcu_unregister(int id);
+
+/**
+@brief Announce that the reader does not hold any reference to a shared table
+@param id reader identifier, -1 is ignored
+*/
+void rcu_quiescent(int id);
+
+/**
+@brief Wait until no reader can hold a reference to a table unpublished before the call
+*/
+void rcu_synchronize(void);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
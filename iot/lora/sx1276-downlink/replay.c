@@ -0,0 +1,398 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : replay of a capture
+        Feeds the captured uplinks to thread_up in place of the concentrators
+        and the captured PULL_RESP to thread_down from a local server
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* snprintf */
+#include <string.h>         /* memcpy, memset, strerror */
+#include <errno.h>          /* errno */
+#include <time.h>           /* clock_gettime */
+#include <fcntl.h>          /* open */
+#include <unistd.h>         /* close */
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>       /* mmap */
+#include <sys/stat.h>       /* fstat */
+#include <sys/socket.h>     /* socket specific definitions */
+#include <netinet/in.h>     /* INET constants and stuff */
+#include <arpa/inet.h>      /* IP address conversion stuff */
+
+#include "trace.h"
+#include "capture.h"
+#include "protocol.h"
+#include "replay.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* The capture is mapped read-only. thread_up keeps one cursor per board and
+ * the local server one for the PULL_RESP, each walks the records on its own;
+ * a truncated record at the end of the file (capture interrupted) ends the
+ * replay. */
+
+#define REPLAY_BOARD_MAX    8
+#define REPLAY_POLL_MS      10      /* max wait of the local server between two PULL_RESP checks */
+#define REPLAY_DGRAM_SIZE   65536
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_replay = PTHREAD_MUTEX_INITIALIZER; /* control access to the statistics */
+
+static const uint8_t *map = NULL;
+static size_t map_size;
+static double pace;                 /* speed, 0.0 for no pacing */
+static int board_nb;
+static uint64_t last_time_ns;       /* time of the last record */
+
+static size_t rx_cursor[REPLAY_BOARD_MAX]; /* 0 once a board has no more packet */
+static size_t down_cursor;
+static bool pull_known = false;     /* address of the PULL_DATA sender known */
+static struct sockaddr_in pull_addr;
+
+static struct timespec start_time;
+static int sock_up = -1;
+static int sock_down = -1;
+static pthread_t thrid_server;
+static bool server_running = false;
+
+static struct replay_stat_s stat_acc;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* record at offset off, NULL at the end of the capture */
+static const struct capture_rec_s *rec_at(size_t off) {
+    const struct capture_rec_s *rec;
+
+    if ((off == 0) || (off + sizeof *rec > map_size)) {
+        return NULL;
+    }
+    rec = (const struct capture_rec_s *)(map + off);
+    if (off + sizeof *rec + rec->size > map_size) {
+        return NULL; /* truncated */
+    }
+    return rec;
+}
+
+static size_t rec_next(size_t off) {
+    const struct capture_rec_s *rec = rec_at(off);
+
+    return (rec == NULL) ? 0 : (off + sizeof *rec + CAPTURE_PAD(rec->size));
+}
+
+/* first record of a kind from off, 0 if none */
+static size_t rec_find(size_t off, enum capture_type_e type, int src) {
+    const struct capture_rec_s *rec;
+
+    for (; (rec = rec_at(off)) != NULL; off = rec_next(off)) {
+        if ((rec->type == type) && ((src < 0) || (rec->src == src))) {
+            return off;
+        }
+    }
+    return 0;
+}
+
+static uint64_t replay_clock_ns(void) {
+    struct timespec now;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (double)(now.tv_sec - start_time.tv_sec) * 1E9 + (now.tv_nsec - start_time.tv_nsec);
+    return (uint64_t)(elapsed * pace);
+}
+
+static bool due(const struct capture_rec_s *rec) {
+    return (pace == REPLAY_SPEED_MAX) || (rec->time_ns <= replay_clock_ns());
+}
+
+static int open_local_socket(char *port, int size) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof addr;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0; /* any free port */
+    if ((bind(sock, (struct sockaddr *)&addr, sizeof addr) != 0) || (getsockname(sock, (struct sockaddr *)&addr, &len) != 0)) {
+        close(sock);
+        return -1;
+    }
+    snprintf(port, size, "%u", ntohs(addr.sin_port));
+    return sock;
+}
+
+static int count_rxpk(const uint8_t *data, int size) {
+    static const char key[] = "{\"tmst\":";
+    int i, nb = 0;
+
+    for (i = 0; i + (int)sizeof key - 1 <= size; i++) {
+        if (memcmp(data + i, key, sizeof key - 1) == 0) {
+            nb += 1;
+        }
+    }
+    return nb;
+}
+
+/* acknowledge a PUSH_DATA or PULL_DATA, count the TX_ACK */
+static void serve(int sock, uint8_t *buff) {
+    struct sockaddr_in from;
+    socklen_t len = sizeof from;
+    uint8_t ack[4];
+    int size;
+
+    size = recvfrom(sock, buff, REPLAY_DGRAM_SIZE, MSG_DONTWAIT, (struct sockaddr *)&from, &len);
+    if ((size < 12) || (buff[0] != PROTOCOL_VERSION)) {
+        return;
+    }
+    ack[0] = PROTOCOL_VERSION;
+    ack[1] = buff[1];
+    ack[2] = buff[2];
+    switch (buff[3]) {
+        case PKT_PUSH_DATA:
+            ack[3] = PKT_PUSH_ACK;
+            sendto(sock, ack, sizeof ack, 0, (struct sockaddr *)&from, len);
+            pthread_mutex_lock(&mx_replay);
+            stat_acc.nb_push_data += 1;
+            stat_acc.nb_rxpk += count_rxpk(buff + 12, size - 12);
+            pthread_mutex_unlock(&mx_replay);
+            break;
+        case PKT_PULL_DATA:
+            ack[3] = PKT_PULL_ACK;
+            sendto(sock, ack, sizeof ack, 0, (struct sockaddr *)&from, len);
+            pull_addr = from;
+            pull_known = true;
+            break;
+        case PKT_TX_ACK:
+            pthread_mutex_lock(&mx_replay);
+            stat_acc.nb_tx_ack += 1;
+            pthread_mutex_unlock(&mx_replay);
+            break;
+        default:
+            break;
+    }
+}
+
+/* send the PULL_RESP that are due */
+static void push_down(void) {
+    const struct capture_rec_s *rec;
+    const uint8_t *data;
+
+    while (pull_known && ((rec = rec_at(down_cursor)) != NULL) && due(rec)) {
+        data = (const uint8_t *)(rec + 1);
+        if ((rec->size >= 4) && (data[3] == PKT_PULL_RESP)) {
+            sendto(sock_down, data, rec->size, 0, (struct sockaddr *)&pull_addr, sizeof pull_addr);
+            pthread_mutex_lock(&mx_replay);
+            stat_acc.nb_pull_resp += 1;
+            pthread_mutex_unlock(&mx_replay);
+        }
+        __atomic_store_n(&down_cursor, rec_find(rec_next(down_cursor), CAPTURE_DOWN, -1), __ATOMIC_RELAXED);
+    }
+}
+
+static void *thread_server(void *arg) {
+    static uint8_t buff[REPLAY_DGRAM_SIZE];
+    struct pollfd pfd[2];
+
+    (void)arg;
+    pfd[0].fd = sock_up;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sock_down;
+    pfd[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(pfd, 2, REPLAY_POLL_MS) > 0) {
+            if (pfd[0].revents & POLLIN) {
+                serve(sock_up, buff);
+            }
+            if (pfd[1].revents & POLLIN) {
+                serve(sock_down, buff);
+            }
+        }
+        push_down();
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int replay_open(const char *path, double speed, int nb_board) {
+    const struct capture_head_s *head;
+    const struct capture_rec_s *rec;
+    struct stat st;
+    size_t off;
+    uint32_t nb_rec = 0;
+    void *m;
+    int fd, b;
+
+    fd = open(path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        MSG(LOG_ERR, "ERROR: [replay] failed to open %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof *head) {
+        MSG(LOG_ERR, "ERROR: [replay] %s is not a capture\n", path);
+        close(fd);
+        return -1;
+    }
+    m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        MSG(LOG_ERR, "ERROR: [replay] failed to map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    head = m;
+    if ((head->magic != CAPTURE_MAGIC) || (head->version != CAPTURE_VERSION) || (head->meta_size != CAPTURE_META_SIZE)) {
+        MSG(LOG_ERR, "ERROR: [replay] %s is not a capture of this version\n", path);
+        munmap(m, (size_t)st.st_size);
+        return -1;
+    }
+    map = m;
+    map_size = (size_t)st.st_size;
+    pace = (speed > 0.0) ? speed : REPLAY_SPEED_MAX;
+    board_nb = (nb_board < REPLAY_BOARD_MAX) ? nb_board : REPLAY_BOARD_MAX;
+
+    last_time_ns = 0;
+    for (off = sizeof *head; (rec = rec_at(off)) != NULL; off = rec_next(off)) {
+        last_time_ns = rec->time_ns;
+        nb_rec += 1;
+    }
+    for (b = 0; b < board_nb; b++) {
+        rx_cursor[b] = rec_find(sizeof *head, CAPTURE_RX, b);
+    }
+    down_cursor = rec_find(sizeof *head, CAPTURE_DOWN, -1);
+    memset(&stat_acc, 0, sizeof stat_acc);
+
+    MSG(LOG_INFO, "INFO: [replay] %s: %u records over %.1f s, replayed at %s\n", path, nb_rec, last_time_ns / 1E9, (pace == REPLAY_SPEED_MAX) ? "max speed" : "given speed");
+    return 0;
+}
+
+int replay_server_start(char *addr, int addr_size, char *port_up, char *port_down, int port_size) {
+    sock_up = open_local_socket(port_up, port_size);
+    sock_down = open_local_socket(port_down, port_size);
+    if ((sock_up < 0) || (sock_down < 0)) {
+        MSG(LOG_ERR, "ERROR: [replay] failed to open the local server sockets: %s\n", strerror(errno));
+        return -1;
+    }
+    snprintf(addr, addr_size, "127.0.0.1");
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    if (pthread_create(&thrid_server, NULL, thread_server, NULL) != 0) {
+        MSG(LOG_ERR, "ERROR: [replay] failed to create the local server thread\n");
+        return -1;
+    }
+    server_running = true;
+    MSG(LOG_INFO, "INFO: [replay] local server on %s, ports %s/%s\n", addr, port_up, port_down);
+    return 0;
+}
+
+void replay_close(void) {
+    if (server_running) {
+        pthread_cancel(thrid_server);
+        pthread_join(thrid_server, NULL);
+        server_running = false;
+    }
+    if (sock_up >= 0) {
+        close(sock_up);
+        sock_up = -1;
+    }
+    if (sock_down >= 0) {
+        close(sock_down);
+        sock_down = -1;
+    }
+    if (map != NULL) {
+        munmap((void *)map, map_size);
+        map = NULL;
+    }
+}
+
+int replay_receive(int board, int max_nb, struct lgw_pkt_rx_s *pkt) {
+    const struct capture_rec_s *rec;
+    const uint8_t *data;
+    size_t payload_size;
+    int nb = 0;
+
+    if ((map == NULL) || (board < 0) || (board >= board_nb)) {
+        return 0;
+    }
+    while ((nb < max_nb) && ((rec = rec_at(rx_cursor[board])) != NULL) && due(rec)) {
+        data = (const uint8_t *)(rec + 1);
+        payload_size = (rec->size > CAPTURE_META_SIZE) ? (rec->size - CAPTURE_META_SIZE) : 0;
+        if ((rec->size >= CAPTURE_META_SIZE) && (payload_size <= sizeof pkt[nb].payload)) {
+            memset(&pkt[nb], 0, sizeof pkt[nb]);
+            memcpy(&pkt[nb], data, CAPTURE_META_SIZE);
+            memcpy(pkt[nb].payload, data + CAPTURE_META_SIZE, payload_size);
+            pkt[nb].size = (uint16_t)payload_size;
+            nb += 1;
+        }
+        __atomic_store_n(&rx_cursor[board], rec_find(rec_next(rx_cursor[board]), CAPTURE_RX, board), __ATOMIC_RELAXED);
+    }
+
+    if (nb > 0) {
+        pthread_mutex_lock(&mx_replay);
+        stat_acc.nb_rx += nb;
+        pthread_mutex_unlock(&mx_replay);
+    }
+    return nb;
+}
+
+/* offset of the least advanced cursor, map_size once all are at the end */
+static size_t replay_position(void) {
+    size_t off, pos = map_size;
+    int b;
+
+    for (b = 0; b < board_nb; b++) {
+        off = __atomic_load_n(&rx_cursor[b], __ATOMIC_RELAXED);
+        if ((rec_at(off) != NULL) && (off < pos)) {
+            pos = off;
+        }
+    }
+    off = __atomic_load_n(&down_cursor, __ATOMIC_RELAXED);
+    if ((rec_at(off) != NULL) && (off < pos)) {
+        pos = off;
+    }
+    return pos;
+}
+
+bool replay_done(void) {
+    return (map == NULL) || (replay_position() == map_size);
+}
+
+void replay_stat(struct replay_stat_s *st) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&mx_replay);
+    *st = stat_acc;
+    pthread_mutex_unlock(&mx_replay);
+    st->elapsed_s = (double)(now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1E9;
+    st->progress = (map == NULL) ? 1.0 : ((double)replay_position() / map_size);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
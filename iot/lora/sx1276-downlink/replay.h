@@ -0,0 +1,103 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : replay of a capture
+        Feeds the captured uplinks to thread_up in place of the concentrators
+        and the captured PULL_RESP to thread_down from a local server
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_REPLAY_H
+#define _LORA_PKTFWD_REPLAY_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* The replay clock starts with the local server. A record is due once the
+ * replay clock, multiplied by the speed, passes its capture time; at speed 0
+ * every record is due at once. The local server stands in for the network
+ * server: it acknowledges PUSH_DATA and PULL_DATA, counts the TX_ACK, and
+ * sends the captured PULL_RESP to the last PULL_DATA sender. */
+
+#define REPLAY_SPEED_MAX        0.0     /* no pacing */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct replay_stat_s {
+    uint32_t nb_rx;             /* packets handed to thread_up */
+    uint32_t nb_pull_resp;      /* PULL_RESP sent by the local server */
+    uint32_t nb_push_data;      /* PUSH_DATA received by the local server */
+    uint32_t nb_rxpk;           /* rxpk in these PUSH_DATA */
+    uint32_t nb_tx_ack;         /* TX_ACK received by the local server */
+    double elapsed_s;           /* since the start of the replay */
+    double progress;            /* share of the capture replayed, 0.0 to 1.0 */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Load a capture
+@param path capture file
+@param speed 1.0 for the captured pace, N for N times faster, REPLAY_SPEED_MAX for no pacing
+@param nb_board concentrators polled by thread_up, packets of the others are ignored
+@return 0 if the capture can be replayed, -1 else
+*/
+int replay_open(const char *path, double speed, int nb_board);
+
+/**
+@brief Start the local server and the replay clock
+@param addr set to the address of the local server
+@param addr_size size of addr
+@param port_up set to its port for PUSH_DATA
+@param port_down set to its port for PULL_DATA
+@param port_size size of port_up and port_down
+@return 0 if the server is running, -1 else
+*/
+int replay_server_start(char *addr, int addr_size, char *port_up, char *port_down, int port_size);
+
+/**
+@brief Stop the local server and unload the capture
+*/
+void replay_close(void);
+
+/**
+@brief Captured packets due now, in place of lgw_receive
+@param board concentrator
+@param max_nb size of the array
+@param pkt array to be filled
+@return number of packets
+*/
+int replay_receive(int board, int max_nb, struct lgw_pkt_rx_s *pkt);
+
+/**
+@brief Tell whether every packet and PULL_RESP was replayed
+*/
+bool replay_done(void);
+
+/**
+@brief Get the replay statistics, counters since the start
+@param st pointer to the structure to be filled
+*/
+void replay_stat(struct replay_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
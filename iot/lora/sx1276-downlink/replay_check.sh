@@ -0,0 +1,143 @@
+#!/bin/sh
+#
+# LoRa concentrator : replay check
+#     Replays a capture at max speed, with the SX1276 MCUs simulated, and
+#     checks the replay counters the forwarder reports against the capture
+#
+# Usage:
+#     replay_check.sh [-f lora_pkt_fwd] [-g global_conf.json] [-t timeout_s] [capture]
+#
+#     The configuration is the one the capture was made with, without the
+#     replay_file, replay_speed, sim_mcu and capture_file keys: they are added
+#     to a copy of it. The forwarder exits two statistics reports after the
+#     replay is done, a short "stat_interval" makes the check faster.
+#         replay_check.sh -f ./lora_pkt_fwd -g global_conf.json uplink_corpus.cap
+#
+#     Checked: the whole capture was replayed, every captured packet was handed
+#     to thread_up and every PULL_RESP sent, the local server got as many rxpk
+#     as the capture holds, and a TX_ACK for each PULL_RESP. Captures are read
+#     as little-endian, the order of the hosts they are made on.
+#
+# License: Revised BSD License, see LICENSE.TXT file include in the project
+
+set -u
+
+FWD=./lora_pkt_fwd
+CONF=/etc/lora/global_conf.json
+TIMEOUT_S=600
+CAP=$(dirname "$0")/uplink_corpus.cap
+
+usage() {
+    echo "Usage: replay_check.sh [-f lora_pkt_fwd] [-g global_conf.json] [-t timeout_s] [capture]"
+    echo "  -f  forwarder to run, default $FWD"
+    echo "  -g  configuration the capture was made with, default $CONF"
+    echo "  -t  time given to the replay, default $TIMEOUT_S s"
+    echo "  capture to replay, default $CAP"
+}
+
+# counts of a capture, as shell assignments: RX records, PULL_RESP, rxpk and
+# TX_ACK sent by the captured forwarder
+capture_counts() {
+    od -An -v -tu1 "$1" | awk '
+    { for (i = 1; i <= NF; i++) b[n++] = $i }
+    function u32(o) { return b[o] + 256 * b[o + 1] + 65536 * b[o + 2] + 16777216 * b[o + 3] }
+    END {
+        if ((n < 16) || (u32(0) != 1129334348)) { print "capture_ok=0"; exit }
+        split("123 34 116 109 115 116 34 58", key, " ") # {"tmst":
+        rx = 0; pull_resp = 0; rxpk = 0; tx_ack = 0; push_data = 0
+        for (off = 16; off + 16 <= n; off = data + 8 * int((size + 7) / 8)) {
+            size = u32(off + 8); type = b[off + 12]; data = off + 16
+            if (data + size > n) break # capture interrupted
+            if (type == 1) {
+                rx++
+            } else if ((type == 2) && (size >= 12) && (b[data + 3] == 5)) {
+                tx_ack++
+            } else if ((type == 2) && (size >= 12) && (b[data + 3] == 0)) {
+                push_data++
+                for (i = data + 12; i + 8 <= data + size; i++) {
+                    for (k = 1; (k <= 8) && (b[i + k - 1] == key[k]); k++);
+                    if (k > 8) rxpk++
+                }
+            } else if ((type == 3) && (size >= 4) && (b[data + 3] == 3)) {
+                pull_resp++
+            }
+        }
+        printf "capture_ok=1 exp_rx=%d exp_pull_resp=%d exp_rxpk=%d exp_tx_ack=%d exp_push_data=%d\n", rx, pull_resp, rxpk, tx_ack, push_data
+    }'
+}
+
+nb_fail=0
+check() {
+    if [ "$2" = "$3" ]; then
+        printf "%-24s %10s %10s  ok\n" "$1" "$2" "$3"
+    else
+        printf "%-24s %10s %10s  FAIL\n" "$1" "$2" "$3"
+        nb_fail=$((nb_fail + 1))
+    fi
+}
+
+while getopts "f:g:t:h" opt; do
+    case $opt in
+        f) FWD=$OPTARG ;;
+        g) CONF=$OPTARG ;;
+        t) TIMEOUT_S=$OPTARG ;;
+        *) usage; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] && CAP=$1
+case $CAP in
+    /*) ;;
+    *) CAP=$PWD/$CAP ;;
+esac
+
+if [ ! -x "$FWD" ] || [ ! -r "$CONF" ] || [ ! -r "$CAP" ]; then
+    echo "ERROR: cannot run $FWD with $CONF on $CAP"
+    exit 1
+fi
+if grep -Eq '"(replay_file|replay_speed|sim_mcu|capture_file)"' "$CONF"; then
+    echo "ERROR: $CONF already sets the replay, sim_mcu or capture keys"
+    exit 1
+fi
+
+eval "$(capture_counts "$CAP")"
+if [ "$capture_ok" != 1 ]; then
+    echo "ERROR: $CAP is not a capture, or was made on a big-endian host"
+    exit 1
+fi
+
+TMP=$(mktemp -d /tmp/replay_check.XXXXXX) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+sed 's|"gateway_conf"[[:space:]]*:[[:space:]]*{|& "replay_file": "'"$CAP"'", "replay_speed": 0, "sim_mcu": true,|' "$CONF" > "$TMP/global_conf.json"
+if ! grep -q '"replay_file"' "$TMP/global_conf.json"; then
+    echo "ERROR: no \"gateway_conf\" object found in $CONF"
+    exit 1
+fi
+
+echo "replaying $CAP with $FWD, at most $TIMEOUT_S s"
+timeout "$TIMEOUT_S" "$FWD" -f -g "$TMP/global_conf.json" > "$TMP/log" 2>&1
+if ! grep -q "replay of .* done, exiting" "$TMP/log"; then
+    tail -n 20 "$TMP/log"
+    echo "ERROR: the replay did not complete, see the log above"
+    exit 1
+fi
+
+# last reports, "# Replayed: P% in S s, N packets, N PULL_RESP" and
+# "# Local server: PUSH_DATA N, N rxpk, TX_ACK N"
+set -- $(grep "# Replayed:" "$TMP/log" | tail -n 1 | sed 's/.*# Replayed: \([0-9.]*\)% in \([0-9.]*\) s, \([0-9]*\) packets, \([0-9]*\) PULL_RESP.*/\1 \2 \3 \4/') \
+       $(grep "# Local server:" "$TMP/log" | tail -n 1 | sed 's/.*# Local server: PUSH_DATA \([0-9]*\), \([0-9]*\) rxpk, TX_ACK \([0-9]*\).*/\1 \2 \3/')
+if [ $# -ne 7 ]; then
+    echo "ERROR: no replay statistics in the log"
+    exit 1
+fi
+
+printf "%-24s %10s %10s\n" "" "captured" "replayed"
+check "progress" "100.0" "$1"
+check "packets to thread_up" "$exp_rx" "$3"
+check "PULL_RESP sent" "$exp_pull_resp" "$4"
+check "rxpk received" "$exp_rxpk" "$6"
+check "TX_ACK received" "$exp_tx_ack" "$7"
+printf "%-24s %10s %10s\n" "PUSH_DATA received" "$exp_push_data" "$5"
+echo "replayed in $2 s, $nb_fail check(s) failed"
+
+[ "$nb_fail" -eq 0 ]
@@ -0,0 +1,213 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : shared memory ring of received packets
+        Writer side, called by thread_up for every accepted uplink
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stddef.h>         /* offsetof */
+#include <string.h>         /* memset, memcpy, strerror */
+#include <errno.h>          /* errno */
+#include <time.h>           /* clock_gettime */
+#include <signal.h>         /* kill */
+#include <fcntl.h>          /* O_CREAT */
+#include <unistd.h>         /* close, ftruncate */
+#include <sys/mman.h>       /* shm_open, mmap */
+#include <sys/stat.h>       /* fstat */
+
+#include "trace.h"
+#include "shmring.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+/* only thread_up publishes, the statistics come from main_loop */
+
+static struct shmring_head_s *head = NULL;
+static struct shmring_slot_s *slot;
+static size_t map_size;
+static uint64_t write_seq;          /* writer copy of head->write_seq */
+
+static uint64_t stat_seq;           /* write_seq at the last statistics */
+static uint64_t prev_lost[SHMRING_READER_MAX];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static bool ring_fits(const struct shmring_head_s *h, size_t size, uint32_t nb_slot) {
+    return (size == SHMRING_SIZE(nb_slot)) && (h->magic == SHMRING_MAGIC) && (h->version == SHMRING_VERSION)
+        && (h->slot_size == sizeof(struct shmring_slot_s)) && (h->nb_slot == nb_slot);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int shmring_init(const char *name, uint32_t nb_slot) {
+    struct stat st;
+    struct timespec now;
+    void *map;
+    int fd;
+
+    if (name == NULL) {
+        name = SHMRING_DEFAULT_NAME;
+    }
+    if ((nb_slot == 0) || (nb_slot > SHMRING_SLOTS_MAX)) {
+        MSG(LOG_ERR, "ERROR: [shm] invalid ring size %u, max %u\n", nb_slot, SHMRING_SLOTS_MAX);
+        return -1;
+    }
+    map_size = SHMRING_SIZE(nb_slot);
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        MSG(LOG_ERR, "ERROR: [shm] failed to open %s: %s\n", name, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    /* a ring left by a previous run is reused if it fits, its readers go on */
+    if ((size_t)st.st_size == map_size) {
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if ((map != MAP_FAILED) && ring_fits(map, (size_t)st.st_size, nb_slot)) {
+            close(fd);
+            head = map;
+            slot = (struct shmring_slot_s *)(head + 1);
+            write_seq = __atomic_load_n(&head->write_seq, __ATOMIC_ACQUIRE);
+            MSG(LOG_INFO, "INFO: [shm] reusing ring %s at packet %llu\n", name, (unsigned long long)write_seq);
+            goto ready;
+        }
+        if (map != MAP_FAILED) {
+            munmap(map, map_size);
+        }
+    }
+
+    /* otherwise close it for its readers and start a new one */
+    if (st.st_size >= (off_t)sizeof(uint32_t)) {
+        map = mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            __atomic_store_n((uint32_t *)map, 0, __ATOMIC_RELEASE);
+            munmap(map, sizeof(uint32_t));
+        }
+        close(fd);
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            MSG(LOG_ERR, "ERROR: [shm] failed to create %s: %s\n", name, strerror(errno));
+            return -1;
+        }
+    }
+    if (ftruncate(fd, (off_t)map_size) != 0) {
+        MSG(LOG_ERR, "ERROR: [shm] failed to size %s to %zu bytes: %s\n", name, map_size, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        MSG(LOG_ERR, "ERROR: [shm] failed to map %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    head = map;
+    slot = (struct shmring_slot_s *)(head + 1);
+    head->version = SHMRING_VERSION;
+    head->slot_size = sizeof(struct shmring_slot_s);
+    head->nb_slot = nb_slot;
+    write_seq = 0;
+    __atomic_store_n(&head->magic, SHMRING_MAGIC, __ATOMIC_RELEASE); /* readers may attach now */
+    MSG(LOG_INFO, "INFO: [shm] ring %s created, %u packets (%zu bytes)\n", name, nb_slot, map_size);
+
+ready:
+    clock_gettime(CLOCK_REALTIME, &now);
+    __atomic_store_n(&head->epoch, (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec, __ATOMIC_RELEASE);
+    stat_seq = write_seq;
+    memset(prev_lost, 0, sizeof prev_lost);
+    return 0;
+}
+
+void shmring_deinit(void) {
+    if (head != NULL) {
+        munmap(head, map_size);
+        head = NULL;
+    }
+}
+
+void shmring_publish(const struct lgw_pkt_rx_s *p, int board) {
+    struct shmring_slot_s *s;
+    struct timespec now;
+    uint16_t size = (p->size < sizeof p->payload) ? p->size : sizeof p->payload;
+
+    if (head == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    s = &slot[write_seq % head->nb_slot];
+    __atomic_store_n(&s->lock, 2 * write_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); /* readers see the odd lock before any new byte */
+    s->rec.seq = write_seq;
+    s->rec.rx_utc_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    s->rec.board = board;
+    s->rec.reserved = 0;
+    memcpy(&s->rec.pkt, p, offsetof(struct lgw_pkt_rx_s, payload) + size); /* p may be a packet buffer, cut after its payload */
+    __atomic_store_n(&s->lock, 2 * write_seq + 2, __ATOMIC_RELEASE);
+
+    write_seq += 1;
+    __atomic_store_n(&head->write_seq, write_seq, __ATOMIC_RELEASE);
+}
+
+void shmring_stat(struct shmring_stat_s *st) {
+    struct shmring_reader_s *r;
+    uint64_t next, lost;
+    int32_t pid;
+    int i;
+
+    memset(st, 0, sizeof *st);
+    if (head == NULL) {
+        return;
+    }
+    st->nb_pub = (uint32_t)(write_seq - stat_seq);
+    stat_seq = write_seq;
+
+    for (i = 0; i < SHMRING_READER_MAX; i++) {
+        r = &head->reader[i];
+        pid = __atomic_load_n(&r->pid, __ATOMIC_ACQUIRE);
+        if (pid == 0) {
+            prev_lost[i] = 0;
+            continue;
+        }
+        /* free the entries of readers that exited without closing */
+        if ((kill(pid, 0) != 0) && (errno == ESRCH)) {
+            __atomic_compare_exchange_n(&r->pid, &pid, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+            prev_lost[i] = 0;
+            continue;
+        }
+        st->nb_reader += 1;
+        next = __atomic_load_n(&r->next_seq, __ATOMIC_RELAXED);
+        lost = __atomic_load_n(&r->nb_lost, __ATOMIC_RELAXED);
+        if ((next < write_seq) && (write_seq - next > st->max_lag)) {
+            st->max_lag = write_seq - next;
+        }
+        if (lost > prev_lost[i]) {
+            st->nb_slow += 1;
+            MSG(LOG_INFO, "INFO: [shm] reader %d (pid %d) too slow, %llu packets lost\n", i, pid, (unsigned long long)(lost - prev_lost[i]));
+        }
+        prev_lost[i] = lost;
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,156 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : shared memory ring of received packets
+        Publishes the accepted uplinks in /dev/shm for local consumers, the
+        writer never waits for them
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_SHMRING_H
+#define _LORA_PKTFWD_SHMRING_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* The ring is a shared memory object: a header, then nb_slot slots. Packet n
+ * goes to slot n % nb_slot. The lock of a slot is 2n+1 while the writer fills
+ * it and 2n+2 once packet n is complete; a reader copies the slot and keeps
+ * the copy only if the lock did not change meanwhile. A reader left behind by
+ * more than nb_slot packets skips to the oldest one still in the ring and
+ * counts the others as lost. Readers announce their position in the header so
+ * the forwarder can report the slow ones, it never waits for them. A ring
+ * that no longer fits the configuration is marked closed and replaced, its
+ * readers have to open the new one. */
+
+#define SHMRING_MAGIC           0x474E5253  /* "SRNG" */
+#define SHMRING_VERSION         1
+#define SHMRING_DEFAULT_NAME    "/lora_pkt_fwd.up"
+#define SHMRING_DEFAULT_SLOTS   4096
+#define SHMRING_SLOTS_MAX       (1 << 20)
+#define SHMRING_READER_MAX      16
+#define SHMRING_CACHE_LINE      64
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/* packet as published */
+struct shmring_rec_s {
+    uint64_t seq;                   /* packet number since the ring was created */
+    uint64_t rx_utc_ns;             /* host time the packet was fetched, ns since the Epoch */
+    int32_t board;                  /* concentrator the packet comes from */
+    uint32_t reserved;
+    struct lgw_pkt_rx_s pkt;        /* count_us in the gateway time domain */
+};
+
+struct shmring_slot_s {
+    uint64_t lock;
+    struct shmring_rec_s rec;
+} __attribute__((aligned(SHMRING_CACHE_LINE)));
+
+struct shmring_reader_s {
+    int32_t pid;                    /* 0 for a free entry */
+    uint32_t reserved;
+    uint64_t next_seq;              /* next packet the reader wants */
+    uint64_t nb_lost;               /* packets skipped because it was too slow */
+} __attribute__((aligned(SHMRING_CACHE_LINE)));
+
+struct shmring_head_s {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slot_size;             /* sizeof(struct shmring_slot_s) of the writer */
+    uint32_t nb_slot;
+    uint32_t reserved;
+    uint64_t epoch;                 /* changes each time the forwarder starts */
+    uint64_t write_seq __attribute__((aligned(SHMRING_CACHE_LINE))); /* packets published */
+    struct shmring_reader_s reader[SHMRING_READER_MAX];
+};
+
+#define SHMRING_SIZE(nb)        (sizeof(struct shmring_head_s) + (size_t)(nb) * sizeof(struct shmring_slot_s))
+
+/* reader side, see shmring_reader.c, and shmring_bench.c for a consumer */
+struct shmring_cursor_s {
+    struct shmring_head_s *head;
+    struct shmring_slot_s *slot;
+    size_t map_size;
+    int id;                         /* entry in head->reader, -1 if the table was full */
+    uint64_t next_seq;
+    uint64_t nb_lost;
+};
+
+struct shmring_stat_s {
+    uint32_t nb_pub;                /* packets published since the last call */
+    int nb_reader;                  /* readers attached */
+    int nb_slow;                    /* readers that lost packets since the last call */
+    uint64_t max_lag;               /* packets the slowest reader is behind */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Create the ring, or reuse it if the forwarder restarts
+@param name shared memory object name, NULL for SHMRING_DEFAULT_NAME
+@param nb_slot number of packets kept in the ring
+@return 0 if the ring is usable, -1 else
+*/
+int shmring_init(const char *name, uint32_t nb_slot);
+
+/**
+@brief Unmap the ring, it stays in /dev/shm for the readers
+*/
+void shmring_deinit(void);
+
+/**
+@brief Publish a packet, wait-free
+@param p received packet
+@param board concentrator the packet comes from
+*/
+void shmring_publish(const struct lgw_pkt_rx_s *p, int board);
+
+/**
+@brief Get the writer statistics and check the readers
+@param st pointer to the structure to be filled
+*/
+void shmring_stat(struct shmring_stat_s *st);
+
+/**
+@brief Attach to the ring, reading starts with the next packet published
+@param cur cursor to initialize
+@param name shared memory object name, NULL for SHMRING_DEFAULT_NAME
+@return 0 if attached, -1 if the ring does not exist or is not compatible
+*/
+int shmring_open(struct shmring_cursor_s *cur, const char *name);
+
+/**
+@brief Detach from the ring
+@param cur cursor
+*/
+void shmring_close(struct shmring_cursor_s *cur);
+
+/**
+@brief Read the next packet, lock-free
+@param cur cursor
+@param rec filled with the packet
+@return 1 if a packet was read, 0 if there is none yet, -1 if the ring was closed
+*/
+int shmring_read(struct shmring_cursor_s *cur, struct shmring_rec_s *rec);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,332 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : shared memory ring of received packets
+        Multi-consumer bench, forks readers on the ring of a running forwarder,
+        or on a ring it publishes itself, and reports what each of them
+        received, lost, and how late
+
+    Build, next to the forwarder (libloragw headers installed in the staging
+    include directory):
+        cc -O2 -Wall -I$(STAGING_DIR)/usr/include -o shmring_bench \
+            shmring_bench.c shmring.c shmring_reader.c -lrt
+
+    Run against a forwarder with "shm_ring": true, on hardware or with the
+    simulated concentrators:
+        shmring_bench -r 4 -t 60            4 readers for 60 s
+        shmring_bench -r 2 -d 5000          readers spending 5 ms per packet
+
+    Run without forwarder, the bench publishing on a ring of its own:
+        shmring_bench -w 10000 -r 4 -t 10   10000 packets/s, 4096 slots
+        shmring_bench -w 10000 -s 256 -d 200  small ring, slow readers
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* printf, fprintf */
+#include <stdlib.h>         /* atoi, exit */
+#include <string.h>         /* memset */
+#include <stdarg.h>         /* va_list */
+#include <time.h>           /* clock_gettime, clock_nanosleep */
+#include <unistd.h>         /* fork, getopt, usleep */
+#include <syslog.h>         /* LOG_WARNING */
+#include <sys/mman.h>       /* shm_unlink */
+#include <sys/wait.h>       /* waitpid */
+
+#include "shmring.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* Each reader is a process of its own, as the local consumers are, so they
+ * take separate entries of the reader table and the forwarder reports them
+ * separately. Latency is the host time a packet is read minus the host time
+ * it was fetched from the concentrator, both on CLOCK_REALTIME.
+ * With -w the bench is the writer: it creates a ring of its own, waits for
+ * the readers to attach, then publishes rate * duration packets at a steady
+ * rate as thread_up would, through shmring_publish. Readers then also fail if
+ * they did not get all of them, and keep reading BENCH_DRAIN_S longer. */
+
+#define BENCH_READER_MAX        SHMRING_READER_MAX
+#define BENCH_DEFAULT_READERS   2
+#define BENCH_DEFAULT_TIME_S    30
+#define BENCH_POLL_US           1000    /* wait when the ring is empty */
+#define BENCH_REOPEN_MS         1000    /* wait before opening again a closed ring */
+#define BENCH_WRITER_NAME       "/lora_pkt_fwd.bench"
+#define BENCH_ATTACH_MS         2000    /* wait for the readers before publishing */
+#define BENCH_DRAIN_S           1
+#define BENCH_PAYLOAD_SIZE      23
+
+struct bench_result_s {
+    uint64_t nb_pkt;
+    uint64_t nb_lost;
+    uint64_t nb_reorder;    /* packets whose seq is not the next one expected */
+    uint32_t nb_reopen;
+    uint64_t lat_sum_us;
+    uint64_t lat_max_us;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* shmring.c logs through the forwarder */
+void _debug(int level, char *format, ...) {
+    va_list vlist;
+
+    if (level <= LOG_WARNING) {
+        va_start(vlist, format);
+        vfprintf(stderr, format, vlist);
+        va_end(vlist);
+    }
+}
+
+static uint64_t utc_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void usage(void) {
+    printf("Usage: shmring_bench [-r readers] [-t seconds] [-d delay_us] [-w rate [-s slots]] [name]\n");
+    printf("  -r  readers to fork, 1 to %d, default %d\n", BENCH_READER_MAX, BENCH_DEFAULT_READERS);
+    printf("  -t  duration in seconds, default %d\n", BENCH_DEFAULT_TIME_S);
+    printf("  -d  time spent on each packet, to make slow readers\n");
+    printf("  -w  publish on a ring of the bench at rate packets/s, instead of reading a forwarder\n");
+    printf("  -s  slots of that ring, default %d\n", SHMRING_DEFAULT_SLOTS);
+    printf("  name of the shared memory object, default %s, or %s with -w\n", SHMRING_DEFAULT_NAME, BENCH_WRITER_NAME);
+}
+
+/* publish nb_pkt packets at rate packets/s, returns the largest reader lag seen */
+static uint64_t run_writer(int rate, uint64_t nb_pkt) {
+    struct lgw_pkt_rx_s p;
+    struct shmring_stat_s st;
+    struct timespec next;
+    uint64_t period_ns = 1000000000ULL / (uint64_t)rate;
+    uint64_t max_lag = 0;
+    uint64_t i;
+
+    memset(&p, 0, sizeof p);
+    p.freq_hz = 470300000;
+    p.status = STAT_CRC_OK;
+    p.modulation = MOD_LORA;
+    p.bandwidth = BW_125KHZ;
+    p.datarate = DR_LORA_SF7;
+    p.coderate = CR_LORA_4_5;
+    p.size = BENCH_PAYLOAD_SIZE;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (i = 0; i < nb_pkt; i++) {
+        p.count_us = (uint32_t)(i * period_ns / 1000);
+        p.payload[0] = (uint8_t)i;
+        shmring_publish(&p, 0);
+
+        /* the readers are checked once per second, as main_loop does at each report */
+        if ((i + 1) % (uint64_t)rate == 0) {
+            shmring_stat(&st);
+            if (st.max_lag > max_lag) {
+                max_lag = st.max_lag;
+            }
+        }
+        next.tv_nsec += (long)period_ns;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec += 1;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL); /* returns at once when late */
+    }
+    return max_lag;
+}
+
+static int run_reader(int id, const char *name, int duration_s, int delay_us, uint64_t nb_expect) {
+    struct shmring_cursor_s cur;
+    struct shmring_rec_s rec;
+    struct bench_result_s res = {0};
+    uint64_t start_ns, end_ns, now_ns, lat_us;
+    uint64_t expect_seq = 0;
+    bool attached = false;
+    double elapsed_s;
+    int r;
+
+    start_ns = utc_ns();
+    end_ns = start_ns + (uint64_t)duration_s * 1000000000ULL;
+    while ((now_ns = utc_ns()) < end_ns) {
+        if (attached == false) {
+            if (shmring_open(&cur, name) != 0) {
+                usleep(1000 * BENCH_REOPEN_MS);
+                continue;
+            }
+            attached = true;
+            expect_seq = cur.next_seq;
+        }
+        r = shmring_read(&cur, &rec);
+        if (r < 0) {
+            shmring_close(&cur);
+            attached = false;
+            res.nb_reopen += 1;
+            continue;
+        }
+        if (r == 0) {
+            usleep(BENCH_POLL_US);
+            continue;
+        }
+        if (rec.seq < expect_seq) {
+            res.nb_reorder += 1;
+        }
+        expect_seq = rec.seq + 1;
+        res.nb_pkt += 1;
+        now_ns = utc_ns();
+        lat_us = (now_ns > rec.rx_utc_ns) ? (now_ns - rec.rx_utc_ns) / 1000 : 0;
+        res.lat_sum_us += lat_us;
+        if (lat_us > res.lat_max_us) {
+            res.lat_max_us = lat_us;
+        }
+        if (delay_us > 0) {
+            usleep((useconds_t)delay_us);
+        }
+    }
+    if (attached == true) {
+        res.nb_lost = cur.nb_lost;
+        shmring_close(&cur);
+    }
+
+    elapsed_s = (double)(utc_ns() - start_ns) / 1E9;
+    printf("reader %2d: %llu packets (%.1f/s), %llu lost, %llu out of order, %u reopen, latency mean %.0f us max %llu us\n",
+        id, (unsigned long long)res.nb_pkt, (double)res.nb_pkt / elapsed_s, (unsigned long long)res.nb_lost,
+        (unsigned long long)res.nb_reorder, res.nb_reopen,
+        (res.nb_pkt > 0) ? (double)res.lat_sum_us / (double)res.nb_pkt : 0.0, (unsigned long long)res.lat_max_us);
+    fflush(stdout);
+
+    if ((nb_expect > 0) && (res.nb_pkt != nb_expect)) {
+        printf("reader %2d: %llu packets expected\n", id, (unsigned long long)nb_expect);
+        return 1;
+    }
+    return ((res.nb_lost > 0) || (res.nb_reorder > 0)) ? 1 : 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    const char *name = NULL;
+    int nb_reader = BENCH_DEFAULT_READERS;
+    int duration_s = BENCH_DEFAULT_TIME_S;
+    int delay_us = 0;
+    int write_rate = 0;
+    int nb_slot = SHMRING_DEFAULT_SLOTS;
+    uint64_t nb_pkt = 0;
+    struct shmring_stat_s st;
+    uint64_t start_ns, max_lag;
+    double elapsed_s;
+    int nb_fail = 0;
+    int status;
+    pid_t pid;
+    int i;
+
+    while ((i = getopt(argc, argv, "hr:t:d:w:s:")) != -1) {
+        switch (i) {
+            case 'r':
+                nb_reader = atoi(optarg);
+                break;
+            case 't':
+                duration_s = atoi(optarg);
+                break;
+            case 'd':
+                delay_us = atoi(optarg);
+                break;
+            case 'w':
+                write_rate = atoi(optarg);
+                break;
+            case 's':
+                nb_slot = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) {
+        name = argv[optind];
+    }
+    if ((nb_reader < 1) || (nb_reader > BENCH_READER_MAX) || (duration_s < 1) || (delay_us < 0)
+        || (write_rate < 0) || (write_rate > 1000000) || (nb_slot < 1) || (nb_slot > SHMRING_SLOTS_MAX)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (write_rate > 0) {
+        if (name == NULL) {
+            name = BENCH_WRITER_NAME;
+        }
+        if (shmring_init(name, (uint32_t)nb_slot) != 0) {
+            fprintf(stderr, "ERROR: failed to create the ring %s\n", name);
+            return EXIT_FAILURE;
+        }
+        nb_pkt = (uint64_t)write_rate * (uint64_t)duration_s;
+        printf("publishing %llu packets at %d/s on %s, %d slots\n", (unsigned long long)nb_pkt, write_rate, name, nb_slot);
+    }
+
+    printf("%d readers on %s for %d s, %d us per packet\n", nb_reader, (name != NULL) ? name : SHMRING_DEFAULT_NAME, duration_s, delay_us);
+    fflush(stdout);
+    for (i = 0; i < nb_reader; i++) {
+        pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "ERROR: failed to fork reader %d\n", i);
+            nb_reader = i;
+            break;
+        }
+        if (pid == 0) {
+            if (write_rate > 0) {
+                exit(run_reader(i, name, duration_s + BENCH_ATTACH_MS / 1000 + BENCH_DRAIN_S, delay_us, nb_pkt));
+            }
+            exit(run_reader(i, name, duration_s, delay_us, 0));
+        }
+    }
+
+    if (write_rate > 0) {
+        for (i = 0; i < BENCH_ATTACH_MS; i += 10) {
+            shmring_stat(&st);
+            if (st.nb_reader == nb_reader) {
+                break;
+            }
+            usleep(10000);
+        }
+        if (st.nb_reader < nb_reader) {
+            fprintf(stderr, "ERROR: %d of %d readers attached\n", st.nb_reader, nb_reader);
+        }
+        start_ns = utc_ns();
+        max_lag = run_writer(write_rate, nb_pkt);
+        elapsed_s = (double)(utc_ns() - start_ns) / 1E9;
+        printf("writer: %llu packets in %.2f s (%.0f/s), largest reader lag %llu packets\n",
+            (unsigned long long)nb_pkt, elapsed_s, (double)nb_pkt / elapsed_s, (unsigned long long)max_lag);
+        fflush(stdout);
+    }
+
+    /* a reader exits with 1 if it lost packets or saw them out of order */
+    for (i = 0; i < nb_reader; i++) {
+        if ((wait(&status) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+            nb_fail += 1;
+        }
+    }
+    printf("%d of %d readers got every packet in order\n", nb_reader - nb_fail, nb_reader);
+    if (write_rate > 0) {
+        shmring_deinit();
+        shm_unlink(name);
+    }
+
+    return (nb_fail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,152 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : shared memory ring of received packets
+        Reader side, linked in the local consumers, it only depends on the
+        C library
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <string.h>         /* memcpy, memset */
+#include <fcntl.h>          /* O_RDWR */
+#include <unistd.h>         /* close, getpid */
+#include <sys/mman.h>       /* shm_open, mmap */
+#include <sys/stat.h>       /* fstat */
+
+#include "shmring.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* let the forwarder see how far behind the reader is */
+static void announce(struct shmring_cursor_s *cur) {
+    if (cur->id >= 0) {
+        __atomic_store_n(&cur->head->reader[cur->id].next_seq, cur->next_seq, __ATOMIC_RELAXED);
+        __atomic_store_n(&cur->head->reader[cur->id].nb_lost, cur->nb_lost, __ATOMIC_RELAXED);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int shmring_open(struct shmring_cursor_s *cur, const char *name) {
+    struct shmring_head_s *h;
+    struct stat st;
+    int32_t pid, free_pid;
+    void *map;
+    int fd, i;
+
+    memset(cur, 0, sizeof *cur);
+    cur->id = -1;
+    if (name == NULL) {
+        name = SHMRING_DEFAULT_NAME;
+    }
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(struct shmring_head_s))) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    h = map;
+    if ((__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC) || (h->version != SHMRING_VERSION)
+        || (h->slot_size != sizeof(struct shmring_slot_s)) || ((size_t)st.st_size != SHMRING_SIZE(h->nb_slot))) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    cur->head = h;
+    cur->slot = (struct shmring_slot_s *)(h + 1);
+    cur->map_size = (size_t)st.st_size;
+    cur->next_seq = __atomic_load_n(&h->write_seq, __ATOMIC_ACQUIRE);
+
+    /* take a reader entry, reading works without one but goes unreported */
+    pid = (int32_t)getpid();
+    for (i = 0; i < SHMRING_READER_MAX; i++) {
+        free_pid = 0;
+        if (__atomic_compare_exchange_n(&h->reader[i].pid, &free_pid, pid, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            cur->id = i;
+            break;
+        }
+    }
+    announce(cur);
+
+    return 0;
+}
+
+void shmring_close(struct shmring_cursor_s *cur) {
+    if (cur->head == NULL) {
+        return;
+    }
+    if (cur->id >= 0) {
+        __atomic_store_n(&cur->head->reader[cur->id].pid, 0, __ATOMIC_RELEASE);
+    }
+    munmap(cur->head, cur->map_size);
+    cur->head = NULL;
+}
+
+int shmring_read(struct shmring_cursor_s *cur, struct shmring_rec_s *rec) {
+    struct shmring_head_s *h = cur->head;
+    struct shmring_slot_s *s;
+    uint64_t wseq, lock;
+    uint32_t nb_slot;
+
+    if (h == NULL) {
+        return -1;
+    }
+    nb_slot = h->nb_slot;
+
+    for (;;) {
+        if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC) {
+            return -1; /* replaced by the forwarder, open it again */
+        }
+        wseq = __atomic_load_n(&h->write_seq, __ATOMIC_ACQUIRE);
+        if (cur->next_seq == wseq) {
+            return 0;
+        }
+        if (wseq - cur->next_seq > nb_slot) {
+            cur->nb_lost += wseq - nb_slot - cur->next_seq; /* lapped by the writer */
+            cur->next_seq = wseq - nb_slot;
+        }
+
+        s = &cur->slot[cur->next_seq % nb_slot];
+        lock = __atomic_load_n(&s->lock, __ATOMIC_ACQUIRE);
+        if (lock < 2 * cur->next_seq + 2) {
+            return 0; /* not complete yet */
+        }
+        if (lock == 2 * cur->next_seq + 2) {
+            memcpy(rec, &s->rec, sizeof *rec);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->lock, __ATOMIC_RELAXED) == lock) {
+                cur->next_seq += 1;
+                announce(cur);
+                return 1;
+            }
+        }
+        /* overwritten meanwhile, that packet is lost */
+        cur->nb_lost += 1;
+        cur->next_seq += 1;
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,304 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : simulated SX1301 concentrator
+        Generates LoRaWAN shaped uplinks in place of a concentrator selected
+        with "spi_type": "sim"
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdlib.h>         /* calloc, free */
+#include <string.h>         /* memset, memcpy */
+#include <math.h>           /* log */
+#include <time.h>           /* clock_gettime */
+#include <pthread.h>
+
+#include "trace.h"
+#include "protocol.h"
+#include "simgw.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* Arrivals are drawn one ahead: next_us is the end of reception of the next
+ * uplink on the host clock, it is generated once the clock passes it. The
+ * random generator is per board and only used under mx_simgw, thread_up is
+ * the only consumer of the uplinks but the counter is read from other
+ * threads. */
+
+#define SIMGW_DEVADDR_BASE      0x26000000  /* devices get consecutive addresses from there */
+#define SIMGW_DEVEUI_BASE       0x00800000A0000000ULL
+#define SIMGW_JOINEUI           0x70B3D57ED0000000ULL
+#define SIMGW_FREQ_DEFAULT      868100000   /* when no multi-SF channel is enabled */
+
+struct simgw_board_s {
+    bool enabled;
+    bool started;
+    struct simgw_conf_s conf;
+    double sf_cdf[SIMGW_SF_NB];     /* cumulated share of each SF */
+    uint16_t *fcnt;                 /* next frame counter or DevNonce of each device */
+    uint64_t rng;                   /* xorshift state */
+    uint32_t origin_us;             /* counter value at host time 0 */
+    uint64_t next_us;               /* host time of the next uplink */
+    struct simgw_stat_s stat;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_simgw = PTHREAD_MUTEX_INITIALIZER; /* control access to the simulated boards */
+
+static struct simgw_board_s sim[SUPPORT_SX1301_MAX];
+
+extern lgw_context * g_ctx_arr[];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t host_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t rand64(struct simgw_board_s *b) {
+    b->rng ^= b->rng >> 12;
+    b->rng ^= b->rng << 25;
+    b->rng ^= b->rng >> 27;
+    return b->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/* uniform in [0, 1) */
+static double rand_unit(struct simgw_board_s *b) {
+    return (double)(rand64(b) >> 11) / 9007199254740992.0;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int nb) {
+    int i;
+
+    for (i = 0; i < nb; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+/* time between two uplinks, exponential for a Poisson process */
+static uint64_t interval_us(struct simgw_board_s *b) {
+    return (uint64_t)(-log(1.0 - rand_unit(b)) * 1E6 / b->conf.rate) + 1;
+}
+
+static void fill_payload(struct simgw_board_s *b, struct lgw_pkt_rx_s *p) {
+    uint32_t dev = (uint32_t)(rand64(b) % b->conf.nb_device);
+    uint16_t fcnt = b->fcnt[dev]++;
+    unsigned i, size;
+
+    if (rand_unit(b) < b->conf.join) {
+        p->payload[0] = MTYPE_JOIN_REQUEST << 5;
+        put_le(&p->payload[1], SIMGW_JOINEUI, 8);
+        put_le(&p->payload[9], SIMGW_DEVEUI_BASE + dev, 8);
+        put_le(&p->payload[17], fcnt, 2); /* DevNonce */
+        put_le(&p->payload[19], rand64(b), 4); /* MIC */
+        p->size = 23;
+        b->stat.nb_join += 1;
+        return;
+    }
+
+    if (rand_unit(b) < b->conf.confirmed) {
+        p->payload[0] = MTYPE_CONFIRM_DATA_UP << 5;
+        b->stat.nb_confirmed += 1;
+    } else {
+        p->payload[0] = MTYPE_UNCONFIRM_DATA_UP << 5;
+    }
+    put_le(&p->payload[1], SIMGW_DEVADDR_BASE + dev, 4);
+    p->payload[5] = 0x80; /* FCtrl: ADR */
+    put_le(&p->payload[6], fcnt, 2);
+    p->payload[8] = 1; /* FPort */
+    size = b->conf.payload_size;
+    if (size > sizeof p->payload - 13) {
+        size = sizeof p->payload - 13;
+    }
+    for (i = 0; i < size; i++) {
+        p->payload[9 + i] = (uint8_t)rand64(b);
+    }
+    put_le(&p->payload[9 + size], rand64(b), 4); /* MIC */
+    p->size = (uint16_t)(13 + size);
+}
+
+static void fill_pkt(struct simgw_board_s *b, struct lgw_pkt_rx_s *p, uint64_t t_us) {
+    double snr_floor, u;
+    int sf, c;
+
+    memset(p, 0, sizeof *p);
+    u = rand_unit(b) * b->sf_cdf[SIMGW_SF_NB - 1];
+    for (sf = 0; (sf < SIMGW_SF_NB - 1) && (u >= b->sf_cdf[sf]); sf++);
+    fill_payload(b, p);
+
+    if (b->conf.nb_chan > 0) {
+        c = (int)(rand64(b) % (uint64_t)b->conf.nb_chan);
+        p->freq_hz = b->conf.freq_hz[c];
+        p->rf_chain = b->conf.rf_chain[c];
+        p->if_chain = b->conf.if_chain[c];
+    } else {
+        p->freq_hz = SIMGW_FREQ_DEFAULT;
+    }
+    p->count_us = b->origin_us + (uint32_t)t_us;
+    p->modulation = MOD_LORA;
+    p->bandwidth = BW_125KHZ;
+    p->datarate = DR_LORA_SF7 << sf;
+    p->coderate = CR_LORA_4_5;
+
+    /* weaker links use higher SF, down to their demodulation floor */
+    snr_floor = -7.5 - 2.5 * sf;
+    p->snr = (float)(snr_floor + rand_unit(b) * (10.0 - snr_floor));
+    p->snr_min = p->snr - 1.0f;
+    p->snr_max = p->snr + 1.0f;
+    p->rssi = (float)(-125.0 + 2.5 * (SIMGW_SF_NB - 1 - sf) + rand_unit(b) * 60.0);
+    p->crc = (uint16_t)rand64(b);
+
+    if (rand_unit(b) < b->conf.crc_error) {
+        p->status = STAT_CRC_BAD;
+        p->payload[rand64(b) % p->size] ^= 0x5A;
+        b->stat.nb_crc_bad += 1;
+    } else {
+        p->status = STAT_CRC_OK;
+    }
+    b->stat.nb_pkt += 1;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int simgw_setconf(int board, const struct simgw_conf_s *conf) {
+    struct simgw_board_s *b;
+    uint16_t *fcnt = NULL;
+    double sum = 0.0;
+    int i;
+
+    if ((board < 0) || (board >= SUPPORT_SX1301_MAX) || (conf->rate <= 0.0) || (conf->nb_device == 0)) {
+        return -1;
+    }
+    /* called at startup and on a reload only, never concurrently: fcnt is stable here */
+    if ((sim[board].fcnt == NULL) || (sim[board].conf.nb_device != conf->nb_device)) {
+        fcnt = calloc(conf->nb_device, sizeof *fcnt);
+        if (fcnt == NULL) {
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&mx_simgw);
+    b = &sim[board];
+    if (fcnt != NULL) { /* new population, devices restart from frame 0 */
+        free(b->fcnt);
+        b->fcnt = fcnt;
+    }
+    b->conf = *conf;
+    if (b->conf.nb_chan > SIMGW_CHAN_MAX) {
+        b->conf.nb_chan = SIMGW_CHAN_MAX;
+    }
+    for (i = 0; i < SIMGW_SF_NB; i++) {
+        sum += (conf->sf_mix[i] > 0.0) ? conf->sf_mix[i] : 0.0;
+        b->sf_cdf[i] = sum;
+    }
+    if (sum <= 0.0) { /* no mix given, SF7 only */
+        for (i = 0; i < SIMGW_SF_NB; i++) {
+            b->sf_cdf[i] = 1.0;
+        }
+    }
+    b->rng = (host_us() * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)(board + 1);
+    b->enabled = true;
+    pthread_mutex_unlock(&mx_simgw);
+
+    MSG(LOG_INFO, "INFO: [simgw] concentrator %d is simulated, %.1f uplinks/s from %u devices on %d channels\n", board, conf->rate, conf->nb_device, b->conf.nb_chan);
+    return 0;
+}
+
+bool simgw_enabled(int board) {
+    return (board >= 0) && (board < SUPPORT_SX1301_MAX) && sim[board].enabled;
+}
+
+int simgw_start(int board) {
+    struct simgw_board_s *b;
+
+    if (!simgw_enabled(board)) {
+        return LGW_HAL_ERROR;
+    }
+    pthread_mutex_lock(&mx_simgw);
+    b = &sim[board];
+    __atomic_store_n(&b->origin_us, (uint32_t)rand64(b), __ATOMIC_RELAXED);
+    b->next_us = host_us() + interval_us(b);
+    b->started = true;
+    pthread_mutex_unlock(&mx_simgw);
+    return LGW_HAL_SUCCESS;
+}
+
+void simgw_stop(int board) {
+    if (!simgw_enabled(board)) {
+        return;
+    }
+    pthread_mutex_lock(&mx_simgw);
+    sim[board].started = false;
+    pthread_mutex_unlock(&mx_simgw);
+}
+
+int simgw_receive(int board, int max_nb, struct lgw_pkt_rx_s *pkt) {
+    struct simgw_board_s *b;
+    uint64_t now;
+    int nb = 0;
+
+    if (!simgw_enabled(board)) {
+        return LGW_HAL_ERROR;
+    }
+    pthread_mutex_lock(&mx_simgw);
+    b = &sim[board];
+    if (!b->started) {
+        pthread_mutex_unlock(&mx_simgw);
+        return LGW_HAL_ERROR;
+    }
+    now = host_us();
+    while (b->next_us + SIMGW_FIFO_US < now) {
+        b->stat.nb_overflow += 1;
+        b->next_us += interval_us(b);
+    }
+    while ((nb < max_nb) && (b->next_us <= now)) {
+        fill_pkt(b, &pkt[nb], b->next_us);
+        nb += 1;
+        b->next_us += interval_us(b);
+    }
+    pthread_mutex_unlock(&mx_simgw);
+
+    return nb;
+}
+
+int simgw_get_trigcnt(int board, uint32_t *trig_cnt_us) {
+    if (!simgw_enabled(board)) {
+        return lgw_get_trigcnt(trig_cnt_us, &(g_ctx_arr[board]->spi));
+    }
+    *trig_cnt_us = __atomic_load_n(&sim[board].origin_us, __ATOMIC_RELAXED) + (uint32_t)host_us();
+    return LGW_HAL_SUCCESS;
+}
+
+void simgw_stat(int board, struct simgw_stat_s *st) {
+    if (!simgw_enabled(board)) {
+        memset(st, 0, sizeof *st);
+        return;
+    }
+    pthread_mutex_lock(&mx_simgw);
+    *st = sim[board].stat;
+    memset(&sim[board].stat, 0, sizeof sim[board].stat);
+    pthread_mutex_unlock(&mx_simgw);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,129 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : simulated SX1301 concentrator
+        Generates LoRaWAN shaped uplinks in place of a concentrator selected
+        with "spi_type": "sim"
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_SIMGW_H
+#define _LORA_PKTFWD_SIMGW_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* Uplinks arrive as a Poisson process. Each one comes from a device of a fixed
+ * population, with its own DevAddr and frame counter, on one of the enabled
+ * multi-SF channels, with a spreading factor drawn from the configured mix.
+ * The counter of a simulated board runs on the host monotonic clock from a
+ * random origin, count_us is the end of the reception as on a concentrator.
+ * Uplinks not fetched within SIMGW_FIFO_US are lost, as in a full FIFO. */
+
+#define SIMGW_SF_NB             6       /* SF7 to SF12 */
+#define SIMGW_CHAN_MAX          8       /* multi-SF channels */
+#define SIMGW_DEFAULT_RATE      10.0    /* uplinks per second */
+#define SIMGW_DEFAULT_DEVICES   1000
+#define SIMGW_DEFAULT_SIZE      20      /* FRMPayload bytes */
+#define SIMGW_FIFO_US           1000000 /* uplinks older than that are lost */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct simgw_conf_s {
+    double rate;                        /* uplinks per second */
+    double sf_mix[SIMGW_SF_NB];         /* relative weights of SF7 to SF12 */
+    double crc_error;                   /* share of uplinks with a bad CRC */
+    double confirmed;                   /* share of data uplinks that are confirmed */
+    double join;                        /* share of uplinks that are join requests */
+    uint32_t nb_device;
+    uint16_t payload_size;              /* FRMPayload bytes of the data uplinks */
+    uint32_t freq_hz[SIMGW_CHAN_MAX];   /* channel frequencies */
+    uint8_t rf_chain[SIMGW_CHAN_MAX];   /* radio of each channel */
+    uint8_t if_chain[SIMGW_CHAN_MAX];   /* multi-SF channel index of each channel */
+    int nb_chan;
+};
+
+struct simgw_stat_s {
+    uint32_t nb_pkt;        /* uplinks generated since the last call */
+    uint32_t nb_crc_bad;
+    uint32_t nb_join;
+    uint32_t nb_confirmed;
+    uint32_t nb_overflow;   /* uplinks lost because the board was not polled in time */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Make a board simulated
+@param board concentrator
+@param conf traffic to generate, copied
+@return 0 if the board is simulated, -1 else
+
+On a reload with the same number of devices, their frame counters go on.
+*/
+int simgw_setconf(int board, const struct simgw_conf_s *conf);
+
+/**
+@brief Tell whether a board is simulated
+@param board concentrator
+*/
+bool simgw_enabled(int board);
+
+/**
+@brief Start generating traffic, in place of lgw_start
+@param board concentrator
+@return LGW_HAL_SUCCESS or LGW_HAL_ERROR
+*/
+int simgw_start(int board);
+
+/**
+@brief Stop generating traffic, in place of lgw_stop
+@param board concentrator
+*/
+void simgw_stop(int board);
+
+/**
+@brief Uplinks received by a simulated board since the last call, in place of lgw_receive
+@param board concentrator
+@param max_nb size of the array
+@param pkt array to be filled
+@return number of packets, LGW_HAL_ERROR if the board is not started
+*/
+int simgw_receive(int board, int max_nb, struct lgw_pkt_rx_s *pkt);
+
+/**
+@brief Counter of a board, from lgw_get_trigcnt unless it is simulated
+@param board concentrator
+@param trig_cnt_us pointer to receive the counter value
+@return LGW_HAL_SUCCESS or LGW_HAL_ERROR
+*/
+int simgw_get_trigcnt(int board, uint32_t *trig_cnt_us);
+
+/**
+@brief Get the statistics of a simulated board, counters since the last call
+@param board concentrator
+@param st pointer to the structure to be filled
+*/
+void simgw_stat(int board, struct simgw_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
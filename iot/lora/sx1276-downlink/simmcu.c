@@ -0,0 +1,430 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : simulated SX1276 MCU
+        Answers the UART command set on a pseudo terminal, in place of the
+        MCU behind /dev/ttyUSBx
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#define _GNU_SOURCE         /* posix_openpt, ptsname_r */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* snprintf */
+#include <stdlib.h>         /* posix_openpt, grantpt, unlockpt */
+#include <string.h>         /* memset, memmove, strerror */
+#include <errno.h>          /* errno */
+#include <fcntl.h>          /* O_RDWR */
+#include <unistd.h>         /* read, write, close */
+#include <poll.h>           /* poll */
+#include <termios.h>        /* cfmakeraw */
+#include <time.h>           /* clock_gettime, clock_nanosleep */
+#include <pthread.h>
+
+#include "trace.h"
+#include "crc.h"
+#include "txconfirm.h"
+#include "simmcu.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* One thread per MCU reads its side of the pseudo terminal and handles the
+ * commands in order, like the MCU: a command is handled once its bytes went
+ * through the serial line and the MCU is done with the previous one, after the
+ * configured latency. The answer takes its own serial time. The slave side is
+ * kept open and raw, the forwarder opens it again as the UART.
+ *
+ * Downlinks are scheduled on the MCU counter: one is reported started at its
+ * count_us and done after its time on air; it fails if its count_us is already
+ * past or it would start before the previous one is done. Reports are held
+ * until the MCU counter reaches them, then returned by TX report polls. */
+
+#define SIMMCU_DOWNLINK_HEAD    28          /* UART_HEADER_LEN of lora_uart_write_downlink */
+#define SIMMCU_RX_SIZE          (SIMMCU_DOWNLINK_HEAD + 256)
+#define SIMMCU_REPORT_MAX       32
+#define SIMMCU_TX_AHEAD_MAX_US  30000000    /* downlinks scheduled further away are rejected */
+#define SIMMCU_POLL_MS          100         /* to notice the stop */
+#define SIMMCU_VERSION          "SIM1.0.0"  /* 8 bytes, as VERSION_VAILD_SIZE */
+
+struct simmcu_s {
+    bool enabled;
+    int running;
+    int master;
+    int slave;
+    pthread_t thrid;
+    struct simmcu_conf_s conf;
+    uint64_t rng;                   /* xorshift state, for the jitter */
+    uint32_t origin_us;             /* MCU counter at start_us */
+    uint64_t start_us;
+    uint64_t free_us;               /* host time the MCU is done with the last command */
+    uint8_t rx[SIMMCU_RX_SIZE];
+    int rx_len;
+    struct txconfirm_report_s report[SIMMCU_REPORT_MAX];
+    int nb_report;
+    bool busy;                      /* a downlink is on air or scheduled */
+    uint32_t busy_until;            /* MCU counter at its end */
+    struct simmcu_stat_s stat;      /* under mx_simmcu */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_simmcu = PTHREAD_MUTEX_INITIALIZER; /* control access to the statistics */
+
+static struct simmcu_s mcu[SUPPORT_SX1276_MAX];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t host_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t t_us) {
+    struct timespec t;
+
+    t.tv_sec = (time_t)(t_us / 1000000);
+    t.tv_nsec = (long)(t_us % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+}
+
+static uint32_t rand32(struct simmcu_s *m) {
+    m->rng ^= m->rng >> 12;
+    m->rng ^= m->rng << 25;
+    m->rng ^= m->rng >> 27;
+    return (uint32_t)((m->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* MCU counter at a host time, drifting from the host clock */
+static uint32_t mcu_counter(const struct simmcu_s *m, uint64_t t_us) {
+    double elapsed = (double)(t_us - m->start_us);
+
+    return m->origin_us + (uint32_t)(uint64_t)(elapsed * (1.0 + 1E-6 * m->conf.drift_ppm));
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/* size of the frame at the start of rx, 0 if incomplete, -1 if not a frame */
+static int frame_size(const uint8_t *rx, int len) {
+    int size;
+
+    if (len < 2) {
+        return 0;
+    }
+    if (rx[0] != 0x00) {
+        return -1;
+    }
+    switch (rx[1]) {
+        case SIMMCU_CMD_VERSION:
+        case SIMMCU_CMD_TIMER:
+        case SIMMCU_CMD_RTC:
+        case SIMMCU_CMD_TX_REPORT:
+            return (len < 3) ? 0 : 3;
+        case SIMMCU_CMD_DOWNLINK:
+            if (len < SIMMCU_DOWNLINK_HEAD) {
+                return 0;
+            }
+            size = (rx[26] << 8) | rx[27];
+            if (size > 256) {
+                return -1;
+            }
+            return (len < SIMMCU_DOWNLINK_HEAD + size) ? 0 : SIMMCU_DOWNLINK_HEAD + size;
+        default:
+            return -1;
+    }
+}
+
+static void add_report(struct simmcu_s *m, uint8_t event, uint32_t count_us, uint32_t timer_us) {
+    if (m->nb_report == SIMMCU_REPORT_MAX) { /* never polled, drop the oldest */
+        memmove(&m->report[0], &m->report[1], (SIMMCU_REPORT_MAX - 1) * sizeof m->report[0]);
+        m->nb_report -= 1;
+    }
+    m->report[m->nb_report].event = event;
+    m->report[m->nb_report].count_us = count_us;
+    m->report[m->nb_report].timer_us = timer_us;
+    m->nb_report += 1;
+}
+
+static void schedule_downlink(struct simmcu_s *m, const uint8_t *f, uint32_t now_c) {
+    struct lgw_pkt_tx_s tx;
+    uint32_t toa_us;
+    int32_t delay;
+    bool fail;
+
+    memset(&tx, 0, sizeof tx);
+    tx.freq_hz = get_be32(&f[2]);
+    tx.tx_mode = f[6];
+    tx.count_us = get_be32(&f[7]);
+    tx.rf_chain = f[11];
+    tx.rf_power = (int8_t)f[12];
+    tx.modulation = f[13];
+    tx.bandwidth = f[14];
+    tx.datarate = get_be32(&f[15]);
+    tx.coderate = f[19];
+    tx.invert_pol = f[20];
+    tx.f_dev = f[21];
+    tx.preamble = (uint16_t)((f[22] << 8) | f[23]);
+    tx.no_crc = f[24];
+    tx.no_header = f[25];
+    tx.size = (uint16_t)((f[26] << 8) | f[27]);
+    toa_us = 1000 * lgw_time_on_air(&tx, 3);
+
+    delay = (int32_t)(tx.count_us - now_c);
+    fail = (delay < 0) || (delay > SIMMCU_TX_AHEAD_MAX_US);
+    if (m->busy && ((int32_t)(m->busy_until - now_c) <= 0)) {
+        m->busy = false;
+    }
+    fail = fail || (m->busy && ((int32_t)(tx.count_us - m->busy_until) < 0));
+
+    pthread_mutex_lock(&mx_simmcu);
+    if (fail) {
+        m->stat.nb_tx_fail += 1;
+    } else {
+        m->stat.nb_tx += 1;
+    }
+    pthread_mutex_unlock(&mx_simmcu);
+
+    if (fail) {
+        add_report(m, TXCONFIRM_EVT_FAIL, tx.count_us, now_c);
+        return;
+    }
+    add_report(m, TXCONFIRM_EVT_START, tx.count_us, tx.count_us);
+    add_report(m, TXCONFIRM_EVT_DONE, tx.count_us, tx.count_us + toa_us);
+    m->busy = true;
+    m->busy_until = tx.count_us + toa_us;
+}
+
+/* reports reached by the MCU counter, in order, removed from the queue */
+static int take_reports(struct simmcu_s *m, uint8_t *data, uint32_t now_c) {
+    int i, j = 0, nb = 0;
+
+    for (i = 0; i < m->nb_report; i++) {
+        if ((nb < TXCONFIRM_REPORT_MAX) && ((int32_t)(now_c - m->report[i].timer_us) >= 0)) {
+            data[9 * nb] = m->report[i].event;
+            put_be32(&data[9 * nb + 1], m->report[i].count_us);
+            put_be32(&data[9 * nb + 5], m->report[i].timer_us);
+            nb += 1;
+        } else {
+            m->report[j++] = m->report[i];
+        }
+    }
+    m->nb_report = j;
+    return 9 * nb;
+}
+
+/* handle one complete frame, its last byte was read at t_read */
+static void handle_frame(struct simmcu_s *m, const uint8_t *f, int size, uint64_t t_read) {
+    uint8_t ans[3 + 9 * TXCONFIRM_REPORT_MAX + 1];
+    struct timespec utc;
+    uint64_t t_done;
+    uint32_t now_c;
+    int len = 0;
+
+    t_done = t_read + (uint64_t)size * SIMMCU_BYTE_US;
+    if (t_done < m->free_us) {
+        t_done = m->free_us;
+    }
+    t_done += m->conf.latency_us;
+    if (m->conf.jitter_us > 0) {
+        t_done += rand32(m) % (m->conf.jitter_us + 1);
+    }
+    sleep_until(t_done);
+    now_c = mcu_counter(m, t_done);
+
+    switch (f[1]) {
+        case SIMMCU_CMD_VERSION:
+            len = 8;
+            memcpy(&ans[3], SIMMCU_VERSION, len);
+            break;
+        case SIMMCU_CMD_TIMER:
+            len = 4;
+            put_be32(&ans[3], now_c);
+            break;
+        case SIMMCU_CMD_RTC:
+            clock_gettime(CLOCK_REALTIME, &utc);
+            len = 6;
+            put_be32(&ans[3], (uint32_t)utc.tv_sec);
+            ans[7] = (uint8_t)((utc.tv_nsec / 1000000) >> 8);
+            ans[8] = (uint8_t)(utc.tv_nsec / 1000000);
+            break;
+        case SIMMCU_CMD_TX_REPORT:
+            len = take_reports(m, &ans[3], now_c);
+            break;
+        case SIMMCU_CMD_DOWNLINK:
+            schedule_downlink(m, f, now_c);
+            m->free_us = t_done;
+            return; /* no answer */
+    }
+
+    ans[0] = 0x00;
+    ans[1] = f[1];
+    ans[2] = (uint8_t)len;
+    ans[3 + len] = crc8_smbus(&ans[3], len);
+    m->free_us = t_done + (uint64_t)(len + 4) * SIMMCU_BYTE_US;
+    sleep_until(m->free_us);
+    if (write(m->master, ans, len + 4) != len + 4) {
+        MSG(LOG_WARNING, "WARNING: [simmcu] failed to answer command 0x%02X: %s\n", f[1], strerror(errno));
+    }
+
+    pthread_mutex_lock(&mx_simmcu);
+    m->stat.nb_cmd += 1;
+    if (f[1] == SIMMCU_CMD_TIMER) {
+        m->stat.nb_timer += 1;
+    }
+    pthread_mutex_unlock(&mx_simmcu);
+}
+
+static void *simmcu_thread(void *arg) {
+    struct simmcu_s *m = arg;
+    struct pollfd pfd;
+    uint64_t t_read;
+    int n, size, dropped;
+
+    pfd.fd = m->master;
+    pfd.events = POLLIN;
+    while (__atomic_load_n(&m->running, __ATOMIC_RELAXED) != 0) {
+        if (poll(&pfd, 1, SIMMCU_POLL_MS) <= 0) {
+            continue;
+        }
+        n = read(m->master, &m->rx[m->rx_len], sizeof m->rx - m->rx_len);
+        if (n <= 0) {
+            continue;
+        }
+        t_read = host_us();
+        m->rx_len += n;
+
+        dropped = 0;
+        for (;;) {
+            size = frame_size(m->rx, m->rx_len);
+            if (size == 0) {
+                break;
+            }
+            if (size < 0) {
+                size = 1; /* resynchronize on the next byte */
+                dropped += 1;
+            } else {
+                handle_frame(m, m->rx, size, t_read);
+            }
+            m->rx_len -= size;
+            memmove(m->rx, &m->rx[size], m->rx_len);
+        }
+        if (dropped > 0) {
+            pthread_mutex_lock(&mx_simmcu);
+            m->stat.nb_bad_frame += dropped;
+            pthread_mutex_unlock(&mx_simmcu);
+        }
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int simmcu_open(int index, const struct simmcu_conf_s *conf, char *path, int path_size) {
+    struct simmcu_s *m;
+    struct termios opt;
+    char name[64];
+
+    if ((index < 0) || (index >= SUPPORT_SX1276_MAX) || mcu[index].enabled) {
+        return -1;
+    }
+    m = &mcu[index];
+    memset(m, 0, sizeof *m);
+    m->conf = *conf;
+    m->slave = -1;
+
+    m->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((m->master < 0) || (grantpt(m->master) != 0) || (unlockpt(m->master) != 0)
+        || (ptsname_r(m->master, name, sizeof name) != 0)) {
+        MSG(LOG_ERR, "ERROR: [simmcu] failed to create a pseudo terminal: %s\n", strerror(errno));
+        goto fail;
+    }
+    /* raw both ways, lora_uart_set_port only sets the local and control flags */
+    m->slave = open(name, O_RDWR | O_NOCTTY);
+    if ((m->slave < 0) || (tcgetattr(m->slave, &opt) != 0)) {
+        MSG(LOG_ERR, "ERROR: [simmcu] failed to open %s: %s\n", name, strerror(errno));
+        goto fail;
+    }
+    cfmakeraw(&opt);
+    tcsetattr(m->slave, TCSANOW, &opt);
+
+    m->start_us = host_us();
+    m->rng = (m->start_us * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)(index + 1);
+    m->origin_us = rand32(m);
+    m->running = 1;
+    if (pthread_create(&m->thrid, NULL, simmcu_thread, m) != 0) {
+        MSG(LOG_ERR, "ERROR: [simmcu] failed to start the MCU thread\n");
+        goto fail;
+    }
+    m->enabled = true;
+    snprintf(path, path_size, "%s", name);
+
+    MSG(LOG_INFO, "INFO: [simmcu] SX1276 %d is simulated on %s, latency %u us (+%u us), drift %.1f ppm\n", index, name, conf->latency_us, conf->jitter_us, conf->drift_ppm);
+    return 0;
+
+fail:
+    if (m->slave >= 0) {
+        close(m->slave);
+    }
+    if (m->master >= 0) {
+        close(m->master);
+    }
+    return -1;
+}
+
+void simmcu_close(void) {
+    int i;
+
+    for (i = 0; i < SUPPORT_SX1276_MAX; i++) {
+        if (!mcu[i].enabled) {
+            continue;
+        }
+        __atomic_store_n(&mcu[i].running, 0, __ATOMIC_RELAXED);
+        pthread_join(mcu[i].thrid, NULL);
+        close(mcu[i].slave);
+        close(mcu[i].master);
+        mcu[i].enabled = false;
+    }
+}
+
+bool simmcu_enabled(int index) {
+    return (index >= 0) && (index < SUPPORT_SX1276_MAX) && mcu[index].enabled;
+}
+
+void simmcu_stat(int index, struct simmcu_stat_s *st) {
+    if (!simmcu_enabled(index)) {
+        memset(st, 0, sizeof *st);
+        return;
+    }
+    pthread_mutex_lock(&mx_simmcu);
+    *st = mcu[index].stat;
+    memset(&mcu[index].stat, 0, sizeof mcu[index].stat);
+    pthread_mutex_unlock(&mx_simmcu);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
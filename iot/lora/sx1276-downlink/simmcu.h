@@ -0,0 +1,95 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : simulated SX1276 MCU
+        Answers the UART command set on a pseudo terminal, in place of the
+        MCU behind /dev/ttyUSBx
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_SIMMCU_H
+#define _LORA_PKTFWD_SIMMCU_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* Frames are [port, command, ...]. Requests are 3 bytes [0x00, command, 0x00]
+ * except downlinks, which carry the 28 bytes header of lora_uart_write_downlink
+ * and the payload and get no answer. Answers are [0x00, command, length, data,
+ * CRC8 of the data]. The timer command is the one lgw_uart_read_timer sends,
+ * answered with the 1 MHz MCU counter, big endian. */
+
+#define SIMMCU_CMD_VERSION      0x01
+#define SIMMCU_CMD_TIMER        0x02
+#define SIMMCU_CMD_RTC          0x03
+#define SIMMCU_CMD_DOWNLINK     0x04
+#define SIMMCU_CMD_TX_REPORT    0x05
+
+#define SIMMCU_BYTE_US          87      /* one byte at 115200 bauds, 8N1 */
+#define SIMMCU_DEFAULT_LATENCY_US 1000  /* MCU processing of a command */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct simmcu_conf_s {
+    uint32_t latency_us;    /* processing time of a command, after its last byte */
+    uint32_t jitter_us;     /* random extra processing time, up to that */
+    double drift_ppm;       /* MCU counter drift against the host clock */
+};
+
+struct simmcu_stat_s {
+    uint32_t nb_cmd;        /* commands answered since the last call */
+    uint32_t nb_timer;      /* timer reads among them */
+    uint32_t nb_tx;         /* downlinks sent on air */
+    uint32_t nb_tx_fail;    /* downlinks late or colliding with the previous one */
+    uint32_t nb_bad_frame;  /* bytes dropped to find the next frame */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Create the pseudo terminal of a simulated MCU and start answering on it
+@param index SX1276
+@param conf behaviour of the MCU, copied
+@param path set to the device to open in place of the UART
+@param path_size size of path
+@return 0 if the MCU is running, -1 else
+*/
+int simmcu_open(int index, const struct simmcu_conf_s *conf, char *path, int path_size);
+
+/**
+@brief Stop the simulated MCUs and close their pseudo terminals
+*/
+void simmcu_close(void);
+
+/**
+@brief Tell whether an SX1276 is simulated
+@param index SX1276
+*/
+bool simmcu_enabled(int index);
+
+/**
+@brief Get the statistics of a simulated MCU, counters since the last call
+@param index SX1276
+@param st pointer to the structure to be filled
+*/
+void simmcu_stat(int index, struct simmcu_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
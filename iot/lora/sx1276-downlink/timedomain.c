@@ -0,0 +1,284 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Time domain
+        Translates the counters of all SX1301 and SX1276 radios to and from
+        the gateway timestamp domain (counter of SX1301 0)
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <unistd.h>         /* usleep */
+#include <sys/time.h>       /* timeval */
+#include <pthread.h>
+
+#include "trace.h"
+#include "timedomain.h"
+#include "timersync.h"
+#include "simgw.h"
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define TIMEDOMAIN_PPS_POLL_US      200     /* delay between two reads of the PPS latched counter */
+#define TIMEDOMAIN_PPS_TIMEOUT_US   1500000 /* no PPS edge seen within this delay: GPS lost */
+#define TIMEDOMAIN_MAX_ERROR_US     1000    /* measurements less accurate than this are discarded */
+#define TIMEDOMAIN_DRIFT_ERROR_PPM  2.0     /* drift of the reference against the host plus error of the fitted drift */
+
+/* An SX1276 offset is extrapolated from its sample with the drift of the
+   SX1276 clock model, the reference being taken as running at the host rate.
+   Its error bound grows with the age of the sample by what that assumption
+   and the fitted drift may be wrong. SX1301 offsets are taken between
+   counters of the same kind and are not extrapolated (host_us is 0). */
+struct timedomain_radio_s {
+    uint32_t seq;       /* seqlock sequence, odd while the fields are being updated */
+    int32_t offset_us;  /* radio counter + offset = gateway timestamp, at host_us */
+    uint32_t error_us;  /* bound on the error of offset_us, at host_us */
+    int64_t host_us;    /* host time of the sample, 0 if not extrapolated */
+    double drift_ppm;   /* drift of the radio counter against the host */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_timedomain = PTHREAD_MUTEX_INITIALIZER; /* one writer at a time, thread_timersync or a reload */
+
+static struct timedomain_radio_s sx1301_domain[SUPPORT_SX1301_MAX] = {[0 ... SUPPORT_SX1301_MAX-1] = {0, 0, TIMEDOMAIN_ERROR_UNKNOWN, 0, 0.0}};
+static struct timedomain_radio_s sx1276_domain[SUPPORT_SX1276_MAX] = {[0 ... SUPPORT_SX1276_MAX-1] = {0, 0, TIMEDOMAIN_ERROR_UNKNOWN, 0, 0.0}};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE SHARED VARIABLES (GLOBAL) ------------------------------------ */
+
+extern bool gps_enabled;
+extern pthread_mutex_t mx_concent;
+extern lgw_context * g_ctx_arr[];
+extern lgw_context_sx1276 * g_ctx_sx1276_arr[];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int64_t timeval_to_us(const struct timeval *tv) {
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* Offsets are read by the upstream and downstream threads while they are
+   updated, they are published with a seqlock as the SX1276 clock models are.
+   Writers are serialized by mx_timedomain. */
+static void timedomain_publish(struct timedomain_radio_s *radio, int32_t offset_us, uint32_t error_us, int64_t host_us, double drift_ppm) {
+    uint32_t seq;
+
+    pthread_mutex_lock(&mx_timedomain);
+    seq = __atomic_load_n(&(radio->seq), __ATOMIC_RELAXED);
+    __atomic_store_n(&(radio->seq), seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    radio->offset_us = offset_us;
+    radio->error_us = error_us;
+    radio->host_us = host_us;
+    radio->drift_ppm = drift_ppm;
+    __atomic_store_n(&(radio->seq), seq + 2, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mx_timedomain);
+}
+
+/* offset of a radio now, and its error bound */
+static int32_t timedomain_read(struct timedomain_radio_s *radio, uint32_t *error_us) {
+    struct timeval now;
+    int32_t offset_us;
+    uint32_t err_us;
+    int64_t host_us;
+    int64_t age_us;
+    double drift_ppm;
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&(radio->seq), __ATOMIC_ACQUIRE);
+        offset_us = radio->offset_us;
+        err_us = radio->error_us;
+        host_us = radio->host_us;
+        drift_ppm = radio->drift_ppm;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&(radio->seq), __ATOMIC_RELAXED)));
+
+    if (host_us != 0) {
+        get_host_time(&now);
+        age_us = timeval_to_us(&now) - host_us;
+        offset_us -= (int32_t)(drift_ppm * (double)age_us / 1E6);
+        if ((err_us != TIMEDOMAIN_ERROR_UNKNOWN) && (age_us > 0)) {
+            err_us += (uint32_t)(TIMEDOMAIN_DRIFT_ERROR_PPM * (double)age_us / 1E6);
+        }
+    }
+    if (error_us != NULL) {
+        *error_us = err_us;
+    }
+    return offset_us;
+}
+
+/* Get the value of the reference counter at a known host time.
+   Without GPS the counter runs freely and a single SPI read is bracketed by host time.
+   With GPS it only changes on PPS: the edge is polled for and the new latched value is
+   the reference counter at the host time of the edge. */
+static int timedomain_sample_ref(int64_t *host_us, uint32_t *ref_us, uint32_t *error_us) {
+    struct timeval t_start;
+    struct timeval t_send;
+    struct timeval t_recv;
+    int64_t prev_send_us;
+    uint32_t initial_us;
+    uint32_t count_us;
+    int i;
+
+    if (gps_enabled == false) {
+        pthread_mutex_lock(&mx_concent);
+        get_host_time(&t_send);
+        i = simgw_get_trigcnt(0, &count_us);
+        get_host_time(&t_recv);
+        pthread_mutex_unlock(&mx_concent);
+        if (i != LGW_HAL_SUCCESS) {
+            return -1;
+        }
+        *host_us = (timeval_to_us(&t_send) + timeval_to_us(&t_recv)) / 2;
+        *ref_us = count_us;
+        *error_us = (uint32_t)((timeval_to_us(&t_recv) - timeval_to_us(&t_send)) / 2) + 1;
+        return 0;
+    }
+
+    pthread_mutex_lock(&mx_concent);
+    get_host_time(&t_send);
+    i = simgw_get_trigcnt(0, &initial_us);
+    pthread_mutex_unlock(&mx_concent);
+    if (i != LGW_HAL_SUCCESS) {
+        return -1;
+    }
+    t_start = t_send;
+    prev_send_us = timeval_to_us(&t_send);
+
+    do {
+        usleep(TIMEDOMAIN_PPS_POLL_US);
+        pthread_mutex_lock(&mx_concent);
+        get_host_time(&t_send);
+        i = simgw_get_trigcnt(0, &count_us);
+        get_host_time(&t_recv);
+        pthread_mutex_unlock(&mx_concent);
+        if (i != LGW_HAL_SUCCESS) {
+            return -1;
+        }
+        if (count_us != initial_us) {
+            /* the pulse came after the previous read started and before this one ended */
+            *host_us = (prev_send_us + timeval_to_us(&t_recv)) / 2;
+            *ref_us = count_us;
+            *error_us = (uint32_t)((timeval_to_us(&t_recv) - prev_send_us) / 2) + 1;
+            return 0;
+        }
+        prev_send_us = timeval_to_us(&t_send);
+    } while ((timeval_to_us(&t_recv) - timeval_to_us(&t_start)) < TIMEDOMAIN_PPS_TIMEOUT_US);
+
+    return -1;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void timedomain_update(void) {
+    struct timeval host_time;
+    struct timeval concent_time;
+    struct timeval later_time;
+    struct timeval concent_later;
+    double drift_ppm;
+    int64_t host_us;
+    uint32_t ref_a_us, ref_b_us;
+    uint32_t ref_us;
+    uint32_t count_us;
+    uint32_t ref_error_us;
+    uint32_t error_us;
+    int32_t offset_us;
+    int ret_a, ret_b, ret;
+    int i;
+
+    if (g_ctx_arr[0] == NULL) {
+        return;
+    }
+    timedomain_publish(&sx1301_domain[0], 0, 0, 0, 0.0);
+
+    /* SX1301 boards: read the board counter between two reads of the reference.
+       With PPS all values are latched on the same pulse and the offset is exact,
+       without PPS the error is bounded by the duration of the SPI reads. */
+    for (i = 1; i < SUPPORT_SX1301_MAX; i++) {
+        if (g_ctx_arr[i] == NULL) {
+            break;
+        }
+        pthread_mutex_lock(&mx_concent);
+        ret_a = simgw_get_trigcnt(0, &ref_a_us);
+        ret = simgw_get_trigcnt(i, &count_us);
+        ret_b = simgw_get_trigcnt(0, &ref_b_us);
+        pthread_mutex_unlock(&mx_concent);
+        if ((ret_a != LGW_HAL_SUCCESS) || (ret != LGW_HAL_SUCCESS) || (ret_b != LGW_HAL_SUCCESS)) {
+            MSG(LOG_WARNING, "WARNING: [timedomain] failed to read counter of sx1301 %d\n", i);
+            continue;
+        }
+        error_us = (ref_b_us - ref_a_us) / 2 + 1;
+        if (error_us > TIMEDOMAIN_MAX_ERROR_US) {
+            continue; /* PPS edge between the reads, try again next time */
+        }
+        offset_us = (int32_t)(ref_a_us + (ref_b_us - ref_a_us) / 2 - count_us);
+        timedomain_publish(&sx1301_domain[i], offset_us, error_us, 0, 0.0);
+        MSG_DEBUG(DEBUG_TIMERSYNC, "sx1301 %d: offset to gateway domain %d us (+/-%u us)\n", i, offset_us, error_us);
+    }
+
+    /* SX1276: no shared trigger with the SX1301, go through the host clock */
+    if (timedomain_sample_ref(&host_us, &ref_us, &ref_error_us) != 0) {
+        MSG(LOG_WARNING, "WARNING: [timedomain] could not sample the reference counter, keeping previous offsets\n");
+        return;
+    }
+    host_time.tv_sec = host_us / 1000000;
+    host_time.tv_usec = host_us % 1000000;
+    later_time.tv_sec = host_time.tv_sec + 1;
+    later_time.tv_usec = host_time.tv_usec;
+    for (i = 0; i < SUPPORT_SX1276_MAX; i++) {
+        if (g_ctx_sx1276_arr[i] == NULL) {
+            break;
+        }
+        if ((get_concentrator_time(&concent_time, host_time, g_ctx_sx1276_arr[i]) != 0)
+            || (get_concentrator_time(&concent_later, later_time, g_ctx_sx1276_arr[i]) != 0)) {
+            continue;
+        }
+        /* the model one second later gives its drift, consistent with the offset */
+        drift_ppm = (double)(timeval_to_us(&concent_later) - timeval_to_us(&concent_time) - 1000000);
+        count_us = (uint32_t)timeval_to_us(&concent_time);
+        offset_us = (int32_t)(ref_us - count_us);
+        error_us = ref_error_us + g_ctx_sx1276_arr[i]->sync_accuracy_us;
+        timedomain_publish(&sx1276_domain[i], offset_us, error_us, host_us, drift_ppm);
+        g_ctx_sx1276_arr[i]->offset_count_us = offset_us;
+        MSG_DEBUG(DEBUG_TIMERSYNC, "sx1276 %d: offset to gateway domain %d us (+/-%u us)\n", i, offset_us, error_us);
+    }
+}
+
+uint32_t timedomain_sx1301_to_ref(int idx, uint32_t count_us) {
+    return count_us + (uint32_t)timedomain_read(&sx1301_domain[idx], NULL);
+}
+
+uint64_t timedomain_ref_to_sx1276(int idx, uint32_t ref_us) {
+    int32_t offset_us = timedomain_read(&sx1276_domain[idx], NULL);
+
+    return extend_concentrator_count(g_ctx_sx1276_arr[idx], ref_us - (uint32_t)offset_us);
+}
+
+int32_t timedomain_sx1301_offset(int idx, uint32_t *error_us) {
+    return timedomain_read(&sx1301_domain[idx], error_us);
+}
+
+int32_t timedomain_sx1276_offset(int idx, uint32_t *error_us) {
+    return timedomain_read(&sx1276_domain[idx], error_us);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
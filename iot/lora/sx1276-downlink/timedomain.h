@@ -0,0 +1,81 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Time domain
+        Translates the counters of all SX1301 and SX1276 radios to and from
+        the gateway timestamp domain (counter of SX1301 0)
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_TIMEDOMAIN_H
+#define _LORA_PKTFWD_TIMEDOMAIN_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define TIMEDOMAIN_ERROR_UNKNOWN    0xFFFFFFFF  /* offset of the radio not measured yet */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Measure the offset of every radio against the gateway timestamp domain
+
+The reference is the counter of SX1301 0, latched on PPS when a GPS is enabled.
+SX1301 boards are compared with SPI reads bracketed by reads of the reference,
+SX1276 boards through their clock model evaluated at a host time where the
+reference is known. Called by thread_timersync after the models are updated.
+*/
+void timedomain_update(void);
+
+/**
+@brief Convert a counter value of an SX1301 board to the gateway domain
+@param idx index of the SX1301 board
+@param count_us counter value of that board (e.g. rx packet count_us)
+@return the matching gateway timestamp (uplink tmst)
+*/
+uint32_t timedomain_sx1301_to_ref(int idx, uint32_t count_us);
+
+/**
+@brief Convert a gateway timestamp to the 64-bit timeline of an SX1276
+@param idx index of the SX1276
+@param ref_us gateway timestamp (downlink tmst, beacon time)
+@return the counter value of that SX1276, truncate to 32 bits for the MCU
+*/
+uint64_t timedomain_ref_to_sx1276(int idx, uint32_t ref_us);
+
+/**
+@brief Get the offset of an SX1301 board and its error bound
+@param idx index of the SX1301 board
+@param error_us pointer to receive the error bound, TIMEDOMAIN_ERROR_UNKNOWN if never measured
+@return offset to add to the board counter to get a gateway timestamp
+*/
+int32_t timedomain_sx1301_offset(int idx, uint32_t *error_us);
+
+/**
+@brief Get the offset of an SX1276 and its error bound
+@param idx index of the SX1276
+@param error_us pointer to receive the error bound, TIMEDOMAIN_ERROR_UNKNOWN if never measured
+@return offset to add to the SX1276 counter to get a gateway timestamp
+
+The offset is extrapolated to the current host time with the drift of the
+SX1276 clock model, the error bound grows with the age of the measurement.
+*/
+int32_t timedomain_sx1276_offset(int idx, uint32_t *error_us);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -19,10 +19,14 @@ Maintainer: Michael Coracin
 
 #include <stdio.h>        /* printf, fprintf, snprintf, fopen, fputs */
 #include <stdint.h>        /* C99 types */
+#include <stdbool.h>       /* bool type */
+#include <time.h>          /* clock_gettime */
+#include <math.h>          /* fabs, sqrt */
 #include <pthread.h>
 
 #include "trace.h"
 #include "timersync.h"
+#include "timedomain.h"
 #include "libloragw/loragw_hal.h"
 #include "libloragw/loragw_reg.h"
 #include "libloragw/loragw_aux.h"
@@ -30,6 +34,27 @@ Maintainer: Michael Coracin
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
 
+#define TIMERSYNC_PROBE_NB          8       /* number of timer reads per synchronization, the one with the lowest RTT is kept */
+#define TIMERSYNC_HISTORY_NB        8       /* number of synchronization points the offset and drift are fitted on */
+#define TIMERSYNC_INTERVAL_MIN_S    10      /* delay between two synchronizations while the model converges */
+#define TIMERSYNC_INTERVAL_MAX_S    300     /* delay between two synchronizations once the model is stable */
+#define TIMERSYNC_TARGET_US         100     /* accuracy under which the synchronization interval is stretched */
+#define TIMERSYNC_RESET_US          50000   /* residual above which the history is discarded (counter reset/wrap) */
+#define TIMERSYNC_MAX_DRIFT_PPM     200.0   /* drift beyond this value is considered a measurement error */
+
+struct timersync_point_s {
+    int64_t host_us;    /* host time of the probe (RTT midpoint) */
+    int64_t offset_us;  /* measured host - extended concentrator offset */
+};
+
+struct timersync_hist_s {
+    struct timersync_point_s point[TIMERSYNC_HISTORY_NB];
+    int nb_point;
+    int wr_idx;
+    bool count_valid;
+    uint64_t last_count_us; /* last probe, extended to 64 bits */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
 
@@ -46,9 +71,10 @@ Maintainer: Michael Coracin
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
 
-static pthread_mutex_t mx_timersync = PTHREAD_MUTEX_INITIALIZER; /* control access to timer sync offsets */
 // static struct timeval offset_unix_concent = {0,0}; /* timer offset between unix host and concentrator */
 
+static struct timersync_hist_s sync_hist[SUPPORT_SX1276_MAX]; /* synchronization points of each SX1276 */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE SHARED VARIABLES (GLOBAL) ------------------------------------ */
 extern bool exit_sig;
@@ -56,104 +82,266 @@ extern bool quit_sig;
 extern pthread_mutex_t mx_concent;
 //extern lgw_context * ctx_tx;
 extern lgw_context * g_ctx_arr[];
+extern pthread_mutex_t mx_concent_sx1276;
+extern lgw_context_sx1276 * g_ctx_sx1276_arr[];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int64_t timeval_to_us(const struct timeval *tv) {
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void us_to_timeval(int64_t us, struct timeval *tv) {
+    tv->tv_sec = (time_t)(us / 1000000);
+    tv->tv_usec = (suseconds_t)(us % 1000000);
+    if (tv->tv_usec < 0) {
+        --tv->tv_sec;
+        tv->tv_usec += 1000000;
+    }
+}
+
+/* Extend a 32-bit counter value to 64 bits, taking the value nearest to ref_us.
+   This is only valid if count_us is less than ~35 minutes away from ref_us. */
+static uint64_t timersync_extend(uint64_t ref_us, uint32_t count_us) {
+    return ref_us + (int64_t)(int32_t)(count_us - (uint32_t)ref_us);
+}
+
+/* Read the SX1276 counter several times and keep the read with the lowest round-trip time.
+   The counter is assumed to be latched in the middle of the UART transaction.
+   Returns -1 if no read gave a usable round-trip time, the outputs are then zeroed. */
+static int timersync_probe(int uart, uint32_t *count_us, int64_t *host_us, uint32_t *rtt_us) {
+    struct timeval t_send;
+    struct timeval t_recv;
+    uint32_t read_us;
+    int64_t rtt;
+    int64_t best_rtt = INT64_MAX;
+    int i;
+
+    *count_us = 0;
+    *host_us = 0;
+    *rtt_us = 0;
+
+    for (i = 0; i < TIMERSYNC_PROBE_NB; i++) {
+        pthread_mutex_lock(&mx_concent_sx1276);
+        get_host_time(&t_send);
+        read_us = lgw_uart_read_timer(uart);
+        get_host_time(&t_recv);
+        pthread_mutex_unlock(&mx_concent_sx1276);
+
+        rtt = timeval_to_us(&t_recv) - timeval_to_us(&t_send);
+        if ((rtt >= 0) && (rtt < best_rtt)) {
+            best_rtt = rtt;
+            *count_us = read_us;
+            *host_us = timeval_to_us(&t_send) + rtt / 2;
+        }
+    }
+
+    if (best_rtt == INT64_MAX) {
+        return -1;
+    }
+    *rtt_us = (uint32_t)best_rtt;
+    return 0;
+}
+
+/* Least-squares fit of offset = offset_ref + drift * (t - t_ref), t_ref being the latest point.
+   Returns the RMS residual of the fit in µs. */
+static double timersync_fit(const struct timersync_hist_s *hist, const struct timersync_point_s *ref, double *offset_us, double *drift_ppm) {
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    double x, y, res, rss = 0.0;
+    double n = (double)hist->nb_point;
+    double a, b;
+    int i;
+
+    for (i = 0; i < hist->nb_point; i++) {
+        x = (double)(hist->point[i].host_us - ref->host_us) / 1E6; /* seconds before the reference point */
+        y = (double)(hist->point[i].offset_us - ref->offset_us);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    if ((hist->nb_point < 2) || ((n * sxx - sx * sx) <= 0.0)) {
+        *offset_us = (double)ref->offset_us;
+        *drift_ppm = 0.0;
+        return 0.0;
+    }
+
+    b = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    a = (sy - b * sx) / n;
+    if (fabs(b) > TIMERSYNC_MAX_DRIFT_PPM) {
+        *offset_us = (double)ref->offset_us;
+        *drift_ppm = 0.0;
+        return TIMERSYNC_RESET_US;
+    }
+
+    for (i = 0; i < hist->nb_point; i++) {
+        x = (double)(hist->point[i].host_us - ref->host_us) / 1E6;
+        y = (double)(hist->point[i].offset_us - ref->offset_us);
+        res = y - (a + b * x);
+        rss += res * res;
+    }
+
+    *offset_us = (double)ref->offset_us + a;
+    *drift_ppm = b;
+    return (hist->nb_point > 2) ? sqrt(rss / (n - 2.0)) : 0.0;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
-int get_concentrator_time(struct timeval *concent_time, struct timeval unix_time, lgw_context * ctx) {
+void get_host_time(struct timeval *host_time) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    host_time->tv_sec = ts.tv_sec;
+    host_time->tv_usec = ts.tv_nsec / 1000;
+}
+
+int get_concentrator_time(struct timeval *concent_time, struct timeval host_time, lgw_context_sx1276 * ctx) {
     struct timeval local_timeval;
+    struct timeval offset;
+    struct timeval sync_time;
+    double drift_ppm;
+    int64_t offset_us;
+    int64_t elapsed_us;
 
-    if (concent_time == NULL) {
+    if ((concent_time == NULL) || (ctx == NULL)) {
         MSG(LOG_INFO,"ERROR: %s invalid parameter\n", __FUNCTION__);
         return -1;
     }
 
-    pthread_mutex_lock(&mx_timersync); /* protect global variable access */
-    timersub(&unix_time, &(ctx->offset_unix_concent), &local_timeval);
-    pthread_mutex_unlock(&mx_timersync);
+    /* extrapolate the offset measured at last sync with the fitted drift */
+    timersync_model_read(ctx, &offset, &sync_time, &drift_ppm);
+    elapsed_us = timeval_to_us(&host_time) - timeval_to_us(&sync_time);
+    offset_us = timeval_to_us(&offset) + (int64_t)(drift_ppm * (double)elapsed_us / 1E6);
 
-    /* TODO: handle sx1301 coutner wrap-up !! */
+    us_to_timeval(timeval_to_us(&host_time) - offset_us, &local_timeval);
     concent_time->tv_sec = local_timeval.tv_sec;
     concent_time->tv_usec = local_timeval.tv_usec;
 
-    MSG_DEBUG(DEBUG_TIMERSYNC, " --> TIME: unix current time is   %ld,%ld\n", unix_time.tv_sec, unix_time.tv_usec);
-    MSG_DEBUG(DEBUG_TIMERSYNC, "           offset is              %ld,%ld\n", ctx->offset_unix_concent.tv_sec, ctx->offset_unix_concent.tv_usec);
-    MSG_DEBUG(DEBUG_TIMERSYNC, "           sx1301 current time is %ld,%ld\n", local_timeval.tv_sec, local_timeval.tv_usec);
+    MSG_DEBUG(DEBUG_TIMERSYNC, " --> TIME: host current time is   %ld,%ld\n", host_time.tv_sec, host_time.tv_usec);
+    MSG_DEBUG(DEBUG_TIMERSYNC, "           offset is              %lld µs\n", (long long)offset_us);
+    MSG_DEBUG(DEBUG_TIMERSYNC, "           sx1276 current time is %ld,%ld\n", local_timeval.tv_sec, local_timeval.tv_usec);
 
     return 0;
 }
 
+uint64_t extend_concentrator_count(lgw_context_sx1276 * ctx, uint32_t count_us) {
+    struct timeval host_time;
+    struct timeval concent_time;
+
+    get_host_time(&host_time);
+    if (get_concentrator_time(&concent_time, host_time, ctx) != 0) {
+        return count_us;
+    }
+    return timersync_extend((uint64_t)timeval_to_us(&concent_time), count_us);
+}
+
 /* ---------------------------------------------------------------------------------------------- */
 /* --- THREAD 6: REGULARLAY MONITOR THE OFFSET BETWEEN UNIX CLOCK AND CONCENTRATOR CLOCK -------- */
-extern lgw_context * g_ctx_arr[];
-extern pthread_mutex_t mx_concent_sx1276;
-extern lgw_context_sx1276 * g_ctx_sx1276_arr[];
 
 void thread_timersync(void) {
-    struct timeval unix_timeval;
-    struct timeval concentrator_timeval;
-    uint32_t sx1276_0_timecount = 0;
+    struct timersync_hist_s *hist;
+    struct timersync_point_s point;
+    struct timeval sync_time;
+    struct timeval offset_model;
     uint32_t sx1276_timecount = 0;
-    struct timeval offset_previous = {0,0};
-    struct timeval offset_drift = {0,0}; /* delta between current and previous offset */
+    uint32_t rtt_us;
+    uint32_t interval_s = TIMERSYNC_INTERVAL_MIN_S;
+    uint32_t accuracy_us;
+    int64_t host_us;
+    double offset_us;
+    double drift_ppm;
+    double residual_us;
+    double predicted_us;
     int i;
-    uint32_t uart;
-    
+    int uart;
+
     while (!exit_sig && !quit_sig) {
+        uint32_t worst_accuracy_us = 0;
+
         for( i = 0 ;i < SUPPORT_SX1276_MAX; i++ ){
             if( NULL == g_ctx_sx1276_arr[i] )
                 break;
 
-            uart = g_ctr_sx1276_arr[i]->uart;
-
-            /* Get current unix time */
-            gettimeofday(&unix_timeval, NULL);
+            uart = g_ctx_sx1276_arr[i]->uart;
+            hist = &sync_hist[i];
 
             /* Get current concentrator counter value (1MHz), tow 16bits timer make one 32bits timer */
-            pthread_mutex_lock(&mx_concent_sx1276);
-            if( i != 0 ){
-                sx1276_0_timecount = lgw_uart_read_timer(g_ctx_sx1276_arr[0]->uart);
+            if (timersync_probe(uart, &sx1276_timecount, &host_us, &rtt_us) != 0) {
+                MSG(LOG_WARNING,"WARNING: [timersync] no usable timer read from sx1276 %d, skipping this sync\n", i);
+                continue;
             }
-            sx1301_timecount = lgw_uart_read_timer(uart);
-            pthread_mutex_unlock(&mx_concent_sx1276);
 
-            if (0 != i) {
-                g_ctx_sx1276_arr[i]->offset_count_us = sx1276_0_timecount - sx1276_timecount;
+            /* Keep counting past the 32-bit wrap, probes are always less than 71 minutes apart */
+            if (hist->count_valid) {
+                hist->last_count_us += (uint32_t)(sx1276_timecount - (uint32_t)hist->last_count_us);
             } else {
-                g_ctx_sx1276_arr[i]->offset_count_us = 0;
+                hist->last_count_us = sx1276_timecount;
+                hist->count_valid = true;
+            }
+
+            /* Compute offset between host and concentrator timers, with microsecond precision */
+            point.host_us = host_us;
+            point.offset_us = host_us - (int64_t)hist->last_count_us;
+
+            /* discard the history if the new point does not fit the model (MCU reset) */
+            if (hist->nb_point > 0) {
+                /* this thread is the only writer of the model, no need to go through the seqlock */
+                predicted_us = (double)timeval_to_us(&(g_ctx_sx1276_arr[i]->offset_unix_concent)) +
+                               g_ctx_sx1276_arr[i]->drift_ppm * (double)(host_us - timeval_to_us(&(g_ctx_sx1276_arr[i]->sync_host_time))) / 1E6;
+                if (fabs((double)point.offset_us - predicted_us) > TIMERSYNC_RESET_US) {
+                    MSG(LOG_INFO,"INFO: host/sx1276 time offset jumped by %.0fµs, restarting drift estimation\n", (double)point.offset_us - predicted_us);
+                    hist->nb_point = 0;
+                    hist->wr_idx = 0;
+                }
+            }
+
+            hist->point[hist->wr_idx] = point;
+            hist->wr_idx = (hist->wr_idx + 1) % TIMERSYNC_HISTORY_NB;
+            if (hist->nb_point < TIMERSYNC_HISTORY_NB) {
+                hist->nb_point++;
             }
-            
-            concentrator_timeval.tv_sec = sx1276_timecount / 1000000UL;
-            concentrator_timeval.tv_usec = sx1276_timecount - (concentrator_timeval.tv_sec * 1000000UL);
-
-            /* Compute offset between unix and concentrator timers, with microsecond precision */
-            offset_previous.tv_sec = g_ctx_sx1276_arr[i]->offset_unix_concent.tv_sec;
-            offset_previous.tv_usec = g_ctx_sx1276_arr[i]->offset_unix_concent.tv_usec;
-
-            /* TODO: handle sx1276 coutner wrap-up */
-            pthread_mutex_lock(&mx_timersync); /* protect global variable access */
-            timersub(&unix_timeval, &concentrator_timeval, &(g_ctx_sx1276_arr[i]->offset_unix_concent));
-            pthread_mutex_unlock(&mx_timersync);
-
-            timersub(&(g_ctx_sx1276_arr[i]->offset_unix_concent), &offset_previous, &offset_drift);
-
-            MSG_DEBUG(DEBUG_TIMERSYNC, "  sx1276    = %u (µs) - timeval (%ld,%ld)\n",
-                sx1276_timecount,
-                concentrator_timeval.tv_sec,
-                concentrator_timeval.tv_usec);
-            MSG_DEBUG(DEBUG_TIMERSYNC, "  unix_timeval = %ld,%ld\n", unix_timeval.tv_sec, unix_timeval.tv_usec);
-
-            MSG(LOG_INFO,"INFO: host/sx1276 time offset=(%lds:%ldµs) - drift=%ldµs\n",
-                g_ctx_sx1276_arr[i]->offset_unix_concent.tv_sec,
-                g_ctx_sx1276_arr[i]->offset_unix_concent.tv_usec,
-                offset_drift.tv_sec * 1000000UL + offset_drift.tv_usec);
+
+            residual_us = timersync_fit(hist, &point, &offset_us, &drift_ppm);
+            accuracy_us = (rtt_us / 2) + (uint32_t)residual_us;
+            if (accuracy_us > worst_accuracy_us) {
+                worst_accuracy_us = accuracy_us;
+            }
+
+            us_to_timeval((int64_t)offset_us, &offset_model);
+            us_to_timeval(host_us, &sync_time);
+
+            timersync_model_write(g_ctx_sx1276_arr[i], &offset_model, &sync_time, drift_ppm);
+            g_ctx_sx1276_arr[i]->sync_accuracy_us = accuracy_us; /* display only */
+            g_ctx_sx1276_arr[i]->sync_interval_s = interval_s;
+
+            MSG_DEBUG(DEBUG_TIMERSYNC, "  sx1276    = %u (µs) - rtt %u µs\n", sx1276_timecount, rtt_us);
+            MSG_DEBUG(DEBUG_TIMERSYNC, "  host_us   = %lld\n", (long long)host_us);
+
+            MSG(LOG_INFO,"INFO: host/sx1276 time offset=(%lds:%ldµs) - drift=%.3fppm - accuracy=%uµs (%d points)\n",
+                offset_model.tv_sec,
+                offset_model.tv_usec,
+                drift_ppm,
+                accuracy_us,
+                hist->nb_point);
         }
 
+        /* translate all radio counters to the gateway domain with the updated models */
+        timedomain_update();
+
         /* delay next sync */
         /* If we consider a crystal oscillator precision of about 20ppm worst case, and a clock
             running at 1MHz, this would mean 1µs drift every 50000µs (10000000/20).
-            As here the time precision is not critical, we should be able to cope with at least 1ms drift,
-            which should occur after 50s (50000µs * 1000).
-            Let's set the thread sleep to 1 minute for now */
-        wait_ms(60000);
+            The drift is now fitted, so what is left is the error on that fit: resync often
+            while the model converges or is noisy, and back off once it is stable. */
+        if ((sync_hist[0].nb_point >= 3) && (worst_accuracy_us < TIMERSYNC_TARGET_US)) {
+            interval_s = (interval_s * 2 > TIMERSYNC_INTERVAL_MAX_S) ? TIMERSYNC_INTERVAL_MAX_S : interval_s * 2;
+        } else if (worst_accuracy_us > 4 * TIMERSYNC_TARGET_US) {
+            interval_s = (interval_s / 2 < TIMERSYNC_INTERVAL_MIN_S) ? TIMERSYNC_INTERVAL_MIN_S : interval_s / 2;
+        }
+        wait_ms(1000 * interval_s);
     }
 }
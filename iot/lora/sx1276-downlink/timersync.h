@@ -0,0 +1,89 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Timer synchronization
+        Provides synchronization between unix, concentrator and gps clocks
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_TIMERSYNC_H
+#define _LORA_PKTFWD_TIMERSYNC_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <sys/time.h>       /* timeval */
+
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Get the host time the SX1276 clock models are based on
+@param host_time pointer to receive the current host time
+
+CLOCK_MONOTONIC is used so that NTP or manual clock changes do not shift the
+concentrator time seen by the scheduler.
+*/
+void get_host_time(struct timeval *host_time);
+
+/**
+@brief Publish a new clock model of an SX1276
+@param ctx SX1276 context holding the clock model
+@param offset host time minus concentrator time, measured at sync_time
+@param sync_time host time of the measure, as returned by get_host_time
+@param drift_ppm offset drift, in µs per second of host time
+
+Only thread_timersync updates the model, writers must not run concurrently.
+*/
+void timersync_model_write(lgw_context_sx1276 * ctx, const struct timeval *offset, const struct timeval *sync_time, double drift_ppm);
+
+/**
+@brief Get a consistent copy of the clock model of an SX1276, without locking
+@param ctx SX1276 context holding the clock model
+@param offset pointer to receive the offset
+@param sync_time pointer to receive the host time of the measure
+@param drift_ppm pointer to receive the drift
+@return number of times the copy was retried because of a concurrent update
+*/
+unsigned timersync_model_read(lgw_context_sx1276 * ctx, struct timeval *offset, struct timeval *sync_time, double *drift_ppm);
+
+/**
+@brief Convert a host time to the concentrator time of an SX1276
+@param concent_time pointer to receive the concentrator time
+@param host_time host time to be converted, as returned by get_host_time
+@param ctx SX1276 context holding the clock model
+@return 0 if the conversion succeeded, -1 else
+
+The offset measured at the last synchronization is extrapolated to host_time
+using the drift fitted by thread_timersync. The returned time is on the 64-bit
+concentrator timeline and does not wrap with the 32-bit counter. The model is read without locking,
+so this function can be called from any thread at any rate.
+*/
+int get_concentrator_time(struct timeval *concent_time, struct timeval host_time, lgw_context_sx1276 * ctx);
+
+/**
+@brief Extend a 32-bit SX1276 counter value to the 64-bit concentrator timeline
+@param ctx SX1276 context holding the clock model
+@param count_us counter value, as exchanged with the MCU and the network server
+@return the 64-bit timestamp nearest to the current concentrator time
+
+The 32-bit counter wraps every ~71.6 minutes, the value returned here does not.
+Truncating it to 32 bits gives count_us back.
+*/
+uint64_t extend_concentrator_count(lgw_context_sx1276 * ctx, uint32_t count_us);
+
+void thread_timersync(void);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
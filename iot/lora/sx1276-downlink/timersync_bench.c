@@ -0,0 +1,238 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Timer synchronization
+        Seqlock bench, one thread publishes clock models while reader threads
+        copy them, and reports the read latency, the retries, and any torn copy
+
+    Build, next to the forwarder (libloragw headers installed in the staging
+    include directory):
+        cc -O2 -Wall -I$(STAGING_DIR)/usr/include -o timersync_bench \
+            timersync_bench.c timersync_model.c -lpthread
+
+    Run:
+        timersync_bench -r 4 -t 10          4 readers, writer back to back
+        timersync_bench -r 4 -w 1000        writer publishing every 1 ms
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdio.h>          /* printf, fprintf */
+#include <stdlib.h>         /* atoi, calloc */
+#include <time.h>           /* clock_gettime */
+#include <unistd.h>         /* getopt, usleep */
+#include <pthread.h>
+
+#include "timersync.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* thread_timersync publishes a model every few seconds, the writer here does
+ * it back to back by default, the worst case for the readers. Each model it
+ * writes has the same number in all its fields, so a reader sees a torn copy
+ * if they differ. The latency of a read includes the two clock_gettime around
+ * it, it is kept in BENCH_HIST_STEP_NS buckets for the percentiles. */
+
+#define BENCH_READER_MAX        16
+#define BENCH_DEFAULT_READERS   2
+#define BENCH_DEFAULT_TIME_S    5
+#define BENCH_HIST_STEP_NS      10
+#define BENCH_HIST_NB           10000   /* 100 us, longer reads go in the last bucket */
+
+struct bench_reader_s {
+    pthread_t thread;
+    int id;
+    uint64_t nb_read;
+    uint64_t nb_retry;      /* sum of the retries */
+    uint64_t nb_retried;    /* reads that needed at least one retry */
+    uint64_t nb_torn;
+    uint64_t lat_sum_ns;
+    uint64_t lat_max_ns;
+    uint32_t hist[BENCH_HIST_NB];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static lgw_context_sx1276 *ctx;
+static bool stop = false;
+static int write_period_us = 0;
+static uint64_t nb_write = 0;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t mono_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void *run_writer(void *arg) {
+    struct timeval offset;
+    struct timeval sync_time;
+    uint32_t k = 0;
+
+    (void)arg;
+    while (__atomic_load_n(&stop, __ATOMIC_RELAXED) == false) {
+        k += 1;
+        offset.tv_sec = k;
+        offset.tv_usec = k % 1000000;
+        sync_time.tv_sec = k;
+        sync_time.tv_usec = k % 1000000;
+        timersync_model_write(ctx, &offset, &sync_time, (double)k);
+        nb_write += 1;
+        if (write_period_us > 0) {
+            usleep((useconds_t)write_period_us);
+        }
+    }
+    return NULL;
+}
+
+static void *run_reader(void *arg) {
+    struct bench_reader_s *r = arg;
+    struct timeval offset;
+    struct timeval sync_time;
+    double drift_ppm;
+    uint64_t t0, lat_ns;
+    unsigned retry;
+
+    while (__atomic_load_n(&stop, __ATOMIC_RELAXED) == false) {
+        t0 = mono_ns();
+        retry = timersync_model_read(ctx, &offset, &sync_time, &drift_ppm);
+        lat_ns = mono_ns() - t0;
+
+        r->nb_read += 1;
+        r->nb_retry += retry;
+        r->nb_retried += (retry > 0) ? 1 : 0;
+        if ((offset.tv_sec != sync_time.tv_sec) || (offset.tv_usec != sync_time.tv_usec) || ((double)offset.tv_sec != drift_ppm)) {
+            r->nb_torn += 1;
+        }
+        r->lat_sum_ns += lat_ns;
+        if (lat_ns > r->lat_max_ns) {
+            r->lat_max_ns = lat_ns;
+        }
+        r->hist[(lat_ns / BENCH_HIST_STEP_NS < BENCH_HIST_NB) ? lat_ns / BENCH_HIST_STEP_NS : BENCH_HIST_NB - 1] += 1;
+    }
+    return NULL;
+}
+
+/* latency under which a fraction of the reads completed */
+static uint64_t percentile_ns(const struct bench_reader_s *r, double fraction) {
+    uint64_t target = (uint64_t)((double)r->nb_read * fraction);
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < BENCH_HIST_NB; i++) {
+        sum += r->hist[i];
+        if (sum >= target) {
+            break;
+        }
+    }
+    return (uint64_t)(i + 1) * BENCH_HIST_STEP_NS;
+}
+
+static void usage(void) {
+    printf("Usage: timersync_bench [-r readers] [-t seconds] [-w period_us]\n");
+    printf("  -r  reader threads, 1 to %d, default %d\n", BENCH_READER_MAX, BENCH_DEFAULT_READERS);
+    printf("  -t  duration in seconds, default %d\n", BENCH_DEFAULT_TIME_S);
+    printf("  -w  time between two models published, default 0 (back to back)\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    static struct bench_reader_s reader[BENCH_READER_MAX];
+    pthread_t writer;
+    int nb_reader = BENCH_DEFAULT_READERS;
+    int duration_s = BENCH_DEFAULT_TIME_S;
+    uint64_t nb_torn = 0;
+    double elapsed_s;
+    uint64_t start_ns;
+    int i;
+
+    while ((i = getopt(argc, argv, "hr:t:w:")) != -1) {
+        switch (i) {
+            case 'r':
+                nb_reader = atoi(optarg);
+                break;
+            case 't':
+                duration_s = atoi(optarg);
+                break;
+            case 'w':
+                write_period_us = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if ((nb_reader < 1) || (nb_reader > BENCH_READER_MAX) || (duration_s < 1) || (write_period_us < 0)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    ctx = calloc(1, sizeof *ctx);
+    if (ctx == NULL) {
+        fprintf(stderr, "ERROR: failed to allocate the SX1276 context\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%d readers for %d s, a model written every %d us\n", nb_reader, duration_s, write_period_us);
+    start_ns = mono_ns();
+    if (pthread_create(&writer, NULL, run_writer, NULL) != 0) {
+        fprintf(stderr, "ERROR: failed to start the writer\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < nb_reader; i++) {
+        reader[i].id = i;
+        if (pthread_create(&reader[i].thread, NULL, run_reader, &reader[i]) != 0) {
+            fprintf(stderr, "ERROR: failed to start reader %d\n", i);
+            nb_reader = i;
+            break;
+        }
+    }
+    sleep((unsigned)duration_s);
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    pthread_join(writer, NULL);
+    for (i = 0; i < nb_reader; i++) {
+        pthread_join(reader[i].thread, NULL);
+    }
+    elapsed_s = (double)(mono_ns() - start_ns) / 1E9;
+
+    printf("writer: %llu models (%.0f/s)\n", (unsigned long long)nb_write, (double)nb_write / elapsed_s);
+    for (i = 0; i < nb_reader; i++) {
+        struct bench_reader_s *r = &reader[i];
+
+        printf("reader %2d: %llu reads (%.0f/s), latency mean %.0f ns p50 %llu ns p99 %llu ns max %llu ns, "
+               "%llu retries on %.3f%% of the reads, %llu torn\n",
+            i, (unsigned long long)r->nb_read, (double)r->nb_read / elapsed_s,
+            (r->nb_read > 0) ? (double)r->lat_sum_ns / (double)r->nb_read : 0.0,
+            (unsigned long long)percentile_ns(r, 0.5), (unsigned long long)percentile_ns(r, 0.99),
+            (unsigned long long)r->lat_max_ns, (unsigned long long)r->nb_retry,
+            (r->nb_read > 0) ? 100.0 * (double)r->nb_retried / (double)r->nb_read : 0.0,
+            (unsigned long long)r->nb_torn);
+        nb_torn += r->nb_torn;
+    }
+    free(ctx);
+
+    return (nb_torn == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,72 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Timer synchronization
+        Publishes the clock model of each SX1276, it only depends on the C
+        library so that timersync_bench.c can link it alone
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <sched.h>          /* sched_yield */
+
+#include "timersync.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* The clock model of each SX1276 is published with a seqlock: thread_timersync is
+   the only writer, it makes the sequence odd while it updates the model and even
+   again once done. Readers retry if the sequence was odd or changed during the copy.
+   A writer preempted with an odd sequence would keep the readers spinning for the
+   rest of their time slice, so after TIMERSYNC_SPIN_MAX tries they give the CPU away. */
+
+#define TIMERSYNC_SPIN_MAX  16
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void timersync_model_write(lgw_context_sx1276 * ctx, const struct timeval *offset, const struct timeval *sync_time, double drift_ppm) {
+    uint32_t seq = __atomic_load_n(&(ctx->sync_seq), __ATOMIC_RELAXED);
+
+    __atomic_store_n(&(ctx->sync_seq), seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ctx->offset_unix_concent = *offset;
+    ctx->sync_host_time = *sync_time;
+    ctx->drift_ppm = drift_ppm;
+    __atomic_store_n(&(ctx->sync_seq), seq + 2, __ATOMIC_RELEASE);
+}
+
+unsigned timersync_model_read(lgw_context_sx1276 * ctx, struct timeval *offset, struct timeval *sync_time, double *drift_ppm) {
+    uint32_t seq;
+    unsigned retry = 0;
+
+    for (;;) {
+        seq = __atomic_load_n(&(ctx->sync_seq), __ATOMIC_ACQUIRE);
+        *offset = ctx->offset_unix_concent;
+        *sync_time = ctx->sync_host_time;
+        *drift_ppm = ctx->drift_ppm;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (((seq & 1) == 0) && (seq == __atomic_load_n(&(ctx->sync_seq), __ATOMIC_RELAXED))) {
+            break;
+        }
+        retry += 1;
+        if ((seq & 1) && (retry % TIMERSYNC_SPIN_MAX == 0)) {
+            sched_yield();
+        }
+    }
+    return retry;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,89 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : byte rate limit
+        Token bucket shared by the uplink lanes and the data_recovery drain
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <time.h>           /* clock_gettime */
+
+#include "tokenbucket.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* Only the time worth the whole bytes credited is consumed, the fraction of
+   a byte left is credited by a later call. Otherwise calls more frequent than
+   a few bytes of the rate would each lose up to a byte. */
+static void refill(struct tokenbucket_s *tb) {
+    struct timespec now;
+    int64_t dt_ns;
+    int64_t credit;
+    int64_t used_ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    dt_ns = (int64_t)(now.tv_sec - tb->last_refill.tv_sec) * 1000000000 + (now.tv_nsec - tb->last_refill.tv_nsec);
+    if (dt_ns <= 0) {
+        return;
+    }
+    credit = (int64_t)tb->rate * (dt_ns / 1000000000) + ((int64_t)tb->rate * (dt_ns % 1000000000)) / 1000000000;
+    if (credit == 0) {
+        return;
+    }
+    tb->allowance += credit;
+    if ((tb->allowance >= (int64_t)tb->rate) || (credit >= (int64_t)tb->rate)) {
+        if (tb->allowance > (int64_t)tb->rate) {
+            tb->allowance = tb->rate; /* 1 s burst at most */
+        }
+        tb->last_refill = now;
+        return;
+    }
+    used_ns = (credit * 1000000000) / tb->rate;
+    tb->last_refill.tv_sec += used_ns / 1000000000;
+    tb->last_refill.tv_nsec += used_ns % 1000000000;
+    if (tb->last_refill.tv_nsec >= 1000000000) {
+        tb->last_refill.tv_nsec -= 1000000000;
+        tb->last_refill.tv_sec += 1;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void tokenbucket_init(struct tokenbucket_s *tb, uint32_t rate) {
+    tb->rate = rate;
+    tb->allowance = rate;
+    clock_gettime(CLOCK_MONOTONIC, &tb->last_refill);
+}
+
+bool tokenbucket_ready(struct tokenbucket_s *tb) {
+    if (tb->rate == 0) {
+        return true;
+    }
+    refill(tb);
+    return (tb->allowance >= 0);
+}
+
+void tokenbucket_take(struct tokenbucket_s *tb, int nb_byte) {
+    if (tb->rate == 0) {
+        return;
+    }
+    refill(tb);
+    tb->allowance -= nb_byte;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,67 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : byte rate limit
+        Token bucket shared by the uplink lanes and the data_recovery drain
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_TOKENBUCKET_H
+#define _LORA_PKTFWD_TOKENBUCKET_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <time.h>           /* timespec */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/* The bucket fills at rate bytes per second up to one second of traffic. A
+ * datagram may be sent while the allowance is not negative, and takes its
+ * whole size from it, so a large datagram leaves it negative until refilled.
+ * A bucket is not locked, its owner calls it under its own lock. */
+
+struct tokenbucket_s {
+    uint32_t rate;                  /* bytes per second, 0 = not limited */
+    int64_t allowance;              /* bytes that can be sent now, negative after a large datagram */
+    struct timespec last_refill;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Set the rate and fill the bucket
+@param tb bucket
+@param rate max bytes per second, 0 for no limit
+*/
+void tokenbucket_init(struct tokenbucket_s *tb, uint32_t rate);
+
+/**
+@brief Tell whether a datagram can be sent now
+@param tb bucket
+@return true if the rate is not limited or the allowance is not exhausted
+*/
+bool tokenbucket_ready(struct tokenbucket_s *tb);
+
+/**
+@brief Take a datagram sent from the allowance
+@param tb bucket
+@param nb_byte datagram size
+*/
+void tokenbucket_take(struct tokenbucket_s *tb, int nb_byte);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,272 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : TX confirmation
+        Keeps the downlinks whose TX_ACK is deferred until the MCU reports
+        the end of the transmission
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <string.h>         /* memset */
+#include <time.h>           /* clock_gettime */
+#include <pthread.h>
+
+#include "trace.h"
+#include "txconfirm.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+enum txconfirm_state_e {
+    TXCONFIRM_STATE_FREE,
+    TXCONFIRM_STATE_QUEUED,     /* in the JIT queue */
+    TXCONFIRM_STATE_DISPATCHED, /* written to the MCU, waiting for TX start */
+    TXCONFIRM_STATE_STARTED,    /* TX started, waiting for TX end */
+    TXCONFIRM_STATE_DONE        /* outcome known, waiting for txconfirm_collect */
+};
+
+struct txconfirm_entry_s {
+    enum txconfirm_state_e state;
+    struct txconfirm_done_s info;
+    uint32_t start_timer_us;    /* MCU timer at TX start */
+    struct timespec expect;     /* expected time of the next TX report, START then DONE */
+    struct timespec deadline;   /* scheduled (QUEUED) or expected (DISPATCHED, STARTED) end of TX + TXCONFIRM_TIMEOUT_MS */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_txconfirm = PTHREAD_MUTEX_INITIALIZER; /* control access to the pending table */
+static struct txconfirm_entry_s pending[TXCONFIRM_PENDING_MAX];
+static bool no_report[SUPPORT_SX1276_MAX]; /* MCU firmware without TX reports */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static struct txconfirm_entry_s *find_entry(int radio, uint32_t count_us, enum txconfirm_state_e min_state, enum txconfirm_state_e max_state) {
+    int i;
+
+    for (i = 0; i < TXCONFIRM_PENDING_MAX; i++) {
+        if ((pending[i].state >= min_state) && (pending[i].state <= max_state) &&
+            (pending[i].info.radio == radio) && (pktbuf_tx(pending[i].info.pkt)->count_us == count_us)) {
+            return &pending[i];
+        }
+    }
+    return NULL;
+}
+
+static void timespec_add_us(struct timespec *t, uint32_t us) {
+    t->tv_sec += us / 1000000;
+    t->tv_nsec += (us % 1000000) * 1000L;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec += 1;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+static bool timespec_passed(const struct timespec *now, const struct timespec *t) {
+    return (now->tv_sec > t->tv_sec) || ((now->tv_sec == t->tv_sec) && (now->tv_nsec >= t->tv_nsec));
+}
+
+static void set_done(struct txconfirm_entry_s *entry, enum txconfirm_status_e status) {
+    entry->info.status = status;
+    entry->state = TXCONFIRM_STATE_DONE;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int txconfirm_add(int server, uint8_t token_h, uint8_t token_l, int radio, const struct lgw_pkt_tx_s *pkt, enum jit_pkt_type_e type, uint8_t retry_nb, uint32_t ahead_us) {
+    struct pktbuf_s *buf;
+    int i;
+
+    buf = pktbuf_tx_new(pkt);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&mx_txconfirm);
+    for (i = 0; i < TXCONFIRM_PENDING_MAX; i++) {
+        if (pending[i].state == TXCONFIRM_STATE_FREE) {
+            break;
+        }
+    }
+    if (i == TXCONFIRM_PENDING_MAX) {
+        pthread_mutex_unlock(&mx_txconfirm);
+        pktbuf_unref(buf);
+        MSG(LOG_WARNING, "WARNING: [txconfirm] too many pending downlinks, TX_ACK sent without confirmation\n");
+        return -1;
+    }
+    memset(&pending[i], 0, sizeof pending[i]);
+    pending[i].info.server = server;
+    pending[i].info.token_h = token_h;
+    pending[i].info.token_l = token_l;
+    pending[i].info.radio = radio;
+    pending[i].info.retry_nb = retry_nb;
+    pending[i].info.type = type;
+    pending[i].info.pkt = buf;
+    /* thread_jit dispatches it before its TX time, or it was dropped from the queue */
+    clock_gettime(CLOCK_MONOTONIC, &pending[i].deadline);
+    timespec_add_us(&pending[i].deadline, ahead_us);
+    timespec_add_us(&pending[i].deadline, TXCONFIRM_TIMEOUT_MS * 1000);
+    pending[i].state = TXCONFIRM_STATE_QUEUED;
+    pthread_mutex_unlock(&mx_txconfirm);
+
+    return 0;
+}
+
+void txconfirm_cancel(int radio, uint32_t count_us) {
+    struct txconfirm_entry_s *entry;
+
+    pthread_mutex_lock(&mx_txconfirm);
+    entry = find_entry(radio, count_us, TXCONFIRM_STATE_QUEUED, TXCONFIRM_STATE_QUEUED);
+    if (entry != NULL) {
+        pktbuf_unref(entry->info.pkt);
+        entry->state = TXCONFIRM_STATE_FREE;
+    }
+    pthread_mutex_unlock(&mx_txconfirm);
+}
+
+void txconfirm_dispatched(int radio, uint32_t count_us, int32_t lead_us, bool write_ok) {
+    struct txconfirm_entry_s *entry;
+    uint32_t lead_pos_us = (lead_us > 0) ? (uint32_t)lead_us : 0;
+    uint32_t wait_ms;
+
+    pthread_mutex_lock(&mx_txconfirm);
+    entry = find_entry(radio, count_us, TXCONFIRM_STATE_QUEUED, TXCONFIRM_STATE_QUEUED);
+    if (entry == NULL) {
+        /* beacon, or downlink acknowledged at enqueue time */
+        pthread_mutex_unlock(&mx_txconfirm);
+        return;
+    }
+
+    if (write_ok == false) {
+        set_done(entry, TXCONFIRM_FAILED);
+    } else if (no_report[radio] == true) {
+        set_done(entry, TXCONFIRM_UNCONFIRMED);
+    } else {
+        wait_ms = lead_pos_us / 1000 + lgw_time_on_air(pktbuf_tx(entry->info.pkt), 4) + TXCONFIRM_TIMEOUT_MS;
+        clock_gettime(CLOCK_MONOTONIC, &entry->expect);
+        entry->deadline = entry->expect;
+        timespec_add_us(&entry->expect, lead_pos_us);
+        timespec_add_us(&entry->deadline, wait_ms * 1000);
+        entry->state = TXCONFIRM_STATE_DISPATCHED;
+    }
+    pthread_mutex_unlock(&mx_txconfirm);
+}
+
+bool txconfirm_poll_due(int radio) {
+    struct timespec now;
+    int i;
+    bool due = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&mx_txconfirm);
+    for (i = 0; i < TXCONFIRM_PENDING_MAX; i++) {
+        if (((pending[i].state == TXCONFIRM_STATE_DISPATCHED) || (pending[i].state == TXCONFIRM_STATE_STARTED)) &&
+            (pending[i].info.radio == radio) && timespec_passed(&now, &pending[i].expect)) {
+            due = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mx_txconfirm);
+
+    return due;
+}
+
+void txconfirm_report(int radio, const struct txconfirm_report_s *report, int nb_report) {
+    struct txconfirm_entry_s *entry;
+    int i;
+
+    pthread_mutex_lock(&mx_txconfirm);
+    for (i = 0; i < nb_report; i++) {
+        entry = find_entry(radio, report[i].count_us, TXCONFIRM_STATE_DISPATCHED, TXCONFIRM_STATE_STARTED);
+        if (entry == NULL) {
+            MSG(LOG_DEBUG, "DEBUG: [txconfirm] TX report %u for unknown packet (count_us=%u)\n", report[i].event, report[i].count_us);
+            continue;
+        }
+        switch (report[i].event) {
+            case TXCONFIRM_EVT_START:
+                entry->start_timer_us = report[i].timer_us;
+                entry->state = TXCONFIRM_STATE_STARTED;
+                /* nothing more to read before the end of the airtime */
+                clock_gettime(CLOCK_MONOTONIC, &entry->expect);
+                timespec_add_us(&entry->expect, 1000 * lgw_time_on_air(pktbuf_tx(entry->info.pkt), 4));
+                break;
+            case TXCONFIRM_EVT_DONE:
+                if (entry->state == TXCONFIRM_STATE_STARTED) {
+                    entry->info.airtime_us = report[i].timer_us - entry->start_timer_us;
+                } else {
+                    /* start report lost, fall back to the computed airtime */
+                    entry->info.airtime_us = 1000 * lgw_time_on_air(pktbuf_tx(entry->info.pkt), 4);
+                }
+                set_done(entry, TXCONFIRM_OK);
+                break;
+            case TXCONFIRM_EVT_FAIL:
+                set_done(entry, TXCONFIRM_FAILED);
+                break;
+            default:
+                MSG(LOG_WARNING, "WARNING: [txconfirm] unknown TX report event %u\n", report[i].event);
+                break;
+        }
+    }
+    pthread_mutex_unlock(&mx_txconfirm);
+}
+
+void txconfirm_no_report(int radio) {
+    int i;
+
+    pthread_mutex_lock(&mx_txconfirm);
+    if (no_report[radio] == false) {
+        MSG(LOG_WARNING, "WARNING: [txconfirm] MCU of SX1276 %d does not report TX, TX_ACK sent on dispatch\n", radio);
+        no_report[radio] = true;
+    }
+    for (i = 0; i < TXCONFIRM_PENDING_MAX; i++) {
+        if (((pending[i].state == TXCONFIRM_STATE_DISPATCHED) || (pending[i].state == TXCONFIRM_STATE_STARTED)) &&
+            (pending[i].info.radio == radio)) {
+            set_done(&pending[i], TXCONFIRM_UNCONFIRMED);
+        }
+    }
+    pthread_mutex_unlock(&mx_txconfirm);
+}
+
+int txconfirm_collect(struct txconfirm_done_s *done, int max_nb) {
+    struct timespec now;
+    int i;
+    int nb = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&mx_txconfirm);
+    for (i = 0; (i < TXCONFIRM_PENDING_MAX) && (nb < max_nb); i++) {
+        if ((pending[i].state >= TXCONFIRM_STATE_QUEUED) && (pending[i].state <= TXCONFIRM_STATE_STARTED)) {
+            if (timespec_passed(&now, &pending[i].deadline)) {
+                if (pending[i].state == TXCONFIRM_STATE_QUEUED) {
+                    MSG(LOG_WARNING, "WARNING: [txconfirm] downlink on SX1276 %d never dispatched (count_us=%u)\n", pending[i].info.radio, pktbuf_tx(pending[i].info.pkt)->count_us);
+                }
+                set_done(&pending[i], TXCONFIRM_TIMEOUT);
+            }
+        }
+        if (pending[i].state == TXCONFIRM_STATE_DONE) {
+            done[nb++] = pending[i].info; /* the caller takes over the packet buffer */
+            pending[i].state = TXCONFIRM_STATE_FREE;
+        }
+    }
+    pthread_mutex_unlock(&mx_txconfirm);
+
+    return nb;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,146 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : TX confirmation
+        Keeps the downlinks whose TX_ACK is deferred until the MCU reports
+        the end of the transmission
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_TXCONFIRM_H
+#define _LORA_PKTFWD_TXCONFIRM_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+
+#include "jitqueue.h"
+#include "pktbuf.h"
+#include "libloragw/loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define TXCONFIRM_PENDING_MAX   32      /* downlinks waiting for their TX report */
+#define TXCONFIRM_REPORT_MAX    8       /* reports returned by the MCU in one reply */
+#define TXCONFIRM_TIMEOUT_MS    1000    /* added to the expected end of TX before giving up */
+
+/* Events of the MCU TX report */
+#define TXCONFIRM_EVT_START     1       /* TX started */
+#define TXCONFIRM_EVT_DONE      2       /* TX done */
+#define TXCONFIRM_EVT_FAIL      3       /* TX aborted or not started */
+
+enum txconfirm_status_e {
+    TXCONFIRM_OK,           /* TX done, airtime known */
+    TXCONFIRM_UNCONFIRMED,  /* written to an MCU that does not report TX */
+    TXCONFIRM_FAILED,       /* UART write failed or MCU reported a failure */
+    TXCONFIRM_TIMEOUT       /* no TX report in time */
+};
+
+/* TX report, as read from the MCU */
+struct txconfirm_report_s {
+    uint8_t event;          /* TXCONFIRM_EVT_xxx */
+    uint32_t count_us;      /* scheduled TX time, identifies the packet */
+    uint32_t timer_us;      /* MCU timer when the event occurred */
+};
+
+/* Downlink whose outcome is known, returned by txconfirm_collect */
+struct txconfirm_done_s {
+    int server;             /* server the PULL_RESP came from, 0 for the main one */
+    uint8_t token_h;
+    uint8_t token_l;
+    int radio;
+    uint8_t retry_nb;       /* number of retries already done */
+    enum txconfirm_status_e status;
+    uint32_t airtime_us;    /* TXCONFIRM_OK only */
+    enum jit_pkt_type_e type;
+    struct pktbuf_s *pkt;   /* packet as queued, kept for a retry on another SX1276 */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Register a downlink before it is queued, its TX_ACK is deferred
+@param server server the PULL_RESP came from, 0 for the main one
+@param token_h token_l PULL_RESP token to acknowledge
+@param radio index of the SX1276 it was queued on
+@param pkt packet as queued, count_us in the time domain of that SX1276
+@param type JIT packet type
+@param retry_nb number of retries already done
+@param ahead_us time left before the scheduled TX
+@return 0 if registered, -1 if the table is full (TX_ACK must be sent right away)
+
+A downlink still not dispatched TXCONFIRM_TIMEOUT_MS after its scheduled TX is
+returned by txconfirm_collect as TXCONFIRM_TIMEOUT.
+*/
+int txconfirm_add(int server, uint8_t token_h, uint8_t token_l, int radio, const struct lgw_pkt_tx_s *pkt, enum jit_pkt_type_e type, uint8_t retry_nb, uint32_t ahead_us);
+
+/**
+@brief Forget a downlink registered by txconfirm_add that the JIT queue rejected
+@param radio index of the SX1276
+@param count_us scheduled TX time of the packet
+*/
+void txconfirm_cancel(int radio, uint32_t count_us);
+
+/**
+@brief Mark a downlink as handed to the MCU
+@param radio index of the SX1276
+@param count_us scheduled TX time of the packet
+@param lead_us time left before TX when the packet was written
+@param write_ok false if the UART write failed
+*/
+void txconfirm_dispatched(int radio, uint32_t count_us, int32_t lead_us, bool write_ok);
+
+/**
+@brief Tell whether TX reports must be polled on an SX1276
+@param radio index of the SX1276
+@return true if a dispatched downlink is past the expected time of its next report
+
+A report is expected at the scheduled start of TX, then at the end of its airtime.
+Before that the MCU has nothing to report and is not polled.
+*/
+bool txconfirm_poll_due(int radio);
+
+/**
+@brief Apply the TX reports read from the MCU
+@param radio index of the SX1276
+@param report reports, in the order the MCU returned them
+@param nb_report number of reports
+*/
+void txconfirm_report(int radio, const struct txconfirm_report_s *report, int nb_report);
+
+/**
+@brief Record that the MCU of an SX1276 does not support TX reports
+@param radio index of the SX1276
+
+The downlinks dispatched on that SX1276 are then released as TXCONFIRM_UNCONFIRMED
+as soon as they are written to the UART.
+*/
+void txconfirm_no_report(int radio);
+
+/**
+@brief Get the downlinks whose outcome is known and release them
+@param done array to be filled
+@param max_nb size of the array
+@return number of downlinks returned
+
+Downlinks still waiting past their expected end of TX, or still queued past their
+scheduled TX, are returned as TXCONFIRM_TIMEOUT.
+The caller owns the pkt buffer of each downlink returned and releases it with pktbuf_unref.
+*/
+int txconfirm_collect(struct txconfirm_done_s *done, int max_nb);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,169 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Downlink deadline tracing
+        Follows each downlink from PULL_RESP receipt to the UART write and
+        keeps the last records in a bounded ring
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdlib.h>         /* qsort */
+#include <pthread.h>
+
+#include "trace.h"
+#include "txtrace.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define TXTRACE_RING_SIZE   256     /* number of downlinks kept */
+
+enum txtrace_stage_e {
+    TXTRACE_SLACK_RECV,     /* slack when the PULL_RESP was received */
+    TXTRACE_PARSE,          /* PULL_RESP received to packet queued */
+    TXTRACE_QUEUE,          /* packet queued to packet dequeued */
+    TXTRACE_WRITE,          /* UART write duration */
+    TXTRACE_SLACK_TX,       /* slack left when the UART write ended */
+    TXTRACE_STAGE_NB
+};
+
+static const char * stage_name[TXTRACE_STAGE_NB] = {
+    "slack at PULL_RESP",
+    "PULL_RESP to queued",
+    "wait in JIT queue",
+    "UART write",
+    "slack after write"
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_txtrace = PTHREAD_MUTEX_INITIALIZER; /* control access to the trace ring */
+static struct txtrace_rec_s ring[TXTRACE_RING_SIZE];
+static unsigned ring_wr_idx = 0;    /* next record to be written */
+static unsigned ring_nb = 0;        /* number of valid records */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int32_t diff_us(const struct timespec *end, const struct timespec *beginning) {
+    return (int32_t)((end->tv_sec - beginning->tv_sec) * 1000000 + (end->tv_nsec - beginning->tv_nsec) / 1000);
+}
+
+static int compare_int32(const void *a, const void *b) {
+    int32_t x = *(const int32_t *)a;
+    int32_t y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void txtrace_queued(const struct txtrace_rec_s *rec) {
+    pthread_mutex_lock(&mx_txtrace);
+    ring[ring_wr_idx] = *rec;
+    ring[ring_wr_idx].dispatched = false;
+    ring_wr_idx = (ring_wr_idx + 1) % TXTRACE_RING_SIZE;
+    if (ring_nb < TXTRACE_RING_SIZE) {
+        ring_nb++;
+    }
+    pthread_mutex_unlock(&mx_txtrace);
+}
+
+void txtrace_dispatched(int radio, uint32_t count_us, const struct timespec *dequeued_time, const struct timespec *write_start, const struct timespec *write_end, int32_t slack_dispatch_us, bool write_ok) {
+    struct txtrace_rec_s *rec;
+    unsigned i;
+
+    pthread_mutex_lock(&mx_txtrace);
+    /* count_us is unique in a JIT queue, search from the most recent record */
+    for (i = 1; i <= ring_nb; i++) {
+        rec = &ring[(ring_wr_idx + TXTRACE_RING_SIZE - i) % TXTRACE_RING_SIZE];
+        if ((rec->radio == radio) && (rec->count_us == count_us) && (rec->dispatched == false) && (rec->jit_result == 0)) {
+            rec->dispatched = true;
+            rec->write_ok = write_ok;
+            rec->dequeued_time = *dequeued_time;
+            rec->write_start = *write_start;
+            rec->write_end = *write_end;
+            rec->slack_dispatch_us = slack_dispatch_us;
+            rec->slack_tx_us = slack_dispatch_us - diff_us(write_end, dequeued_time);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mx_txtrace);
+}
+
+void txtrace_report(void) {
+    static int32_t value[TXTRACE_STAGE_NB][TXTRACE_RING_SIZE];
+    unsigned nb[TXTRACE_STAGE_NB] = {0};
+    struct txtrace_rec_s *rec;
+    unsigned i;
+    int s;
+
+    pthread_mutex_lock(&mx_txtrace);
+    for (i = 0; i < ring_nb; i++) {
+        rec = &ring[i];
+        value[TXTRACE_SLACK_RECV][nb[TXTRACE_SLACK_RECV]++] = rec->slack_recv_us;
+        value[TXTRACE_PARSE][nb[TXTRACE_PARSE]++] = diff_us(&(rec->queued_time), &(rec->recv_time));
+        if (rec->dispatched == true) {
+            value[TXTRACE_QUEUE][nb[TXTRACE_QUEUE]++] = diff_us(&(rec->dequeued_time), &(rec->queued_time));
+            value[TXTRACE_WRITE][nb[TXTRACE_WRITE]++] = diff_us(&(rec->write_end), &(rec->write_start));
+            value[TXTRACE_SLACK_TX][nb[TXTRACE_SLACK_TX]++] = rec->slack_tx_us;
+        }
+    }
+    pthread_mutex_unlock(&mx_txtrace);
+
+    for (s = 0; s < TXTRACE_STAGE_NB; s++) {
+        if (nb[s] == 0) {
+            continue;
+        }
+        qsort(value[s], nb[s], sizeof(int32_t), compare_int32);
+        MSG(LOG_NOTICE,"# %s (us): min %d, p50 %d, p90 %d, p99 %d, max %d (%u downlinks)\n", stage_name[s],
+            value[s][0], value[s][nb[s] / 2], value[s][(nb[s] * 9) / 10], value[s][(nb[s] * 99) / 100], value[s][nb[s] - 1], nb[s]);
+    }
+}
+
+void txtrace_dump(void) {
+    struct txtrace_rec_s rec;
+    unsigned i;
+    unsigned nb;
+    unsigned first;
+
+    pthread_mutex_lock(&mx_txtrace);
+    nb = ring_nb;
+    first = (ring_wr_idx + TXTRACE_RING_SIZE - ring_nb) % TXTRACE_RING_SIZE;
+    pthread_mutex_unlock(&mx_txtrace);
+
+    MSG(LOG_NOTICE,"INFO: [txtrace] %u downlinks traced (times in us from PULL_RESP receipt)\n", nb);
+    for (i = 0; i < nb; i++) {
+        pthread_mutex_lock(&mx_txtrace);
+        rec = ring[(first + i) % TXTRACE_RING_SIZE];
+        pthread_mutex_unlock(&mx_txtrace);
+        if (rec.dispatched == true) {
+            MSG(LOG_NOTICE,"INFO: [txtrace] sx1276 %d count_us %u: slack %d, queued +%d, dequeued +%d (slack %d), write +%d..+%d %s (slack %d)\n",
+                rec.radio, rec.count_us, rec.slack_recv_us,
+                diff_us(&rec.queued_time, &rec.recv_time),
+                diff_us(&rec.dequeued_time, &rec.recv_time), rec.slack_dispatch_us,
+                diff_us(&rec.write_start, &rec.recv_time), diff_us(&rec.write_end, &rec.recv_time),
+                (rec.write_ok == true) ? "ok" : "failed", rec.slack_tx_us);
+        } else {
+            MSG(LOG_NOTICE,"INFO: [txtrace] sx1276 %d count_us %u: slack %d, queued +%d, jit result %d, not dispatched\n",
+                rec.radio, rec.count_us, rec.slack_recv_us,
+                diff_us(&rec.queued_time, &rec.recv_time), rec.jit_result);
+        }
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,82 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Downlink deadline tracing
+        Follows each downlink from PULL_RESP receipt to the UART write and
+        keeps the last records in a bounded ring
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_TXTRACE_H
+#define _LORA_PKTFWD_TXTRACE_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <time.h>           /* timespec */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct txtrace_rec_s {
+    uint32_t count_us;              /* TX timestamp, on the counter of the selected SX1276 */
+    int radio;                      /* SX1276 the packet was queued on */
+    int jit_result;                 /* result of jit_enqueue */
+    bool dispatched;                /* packet has been written to the MCU */
+    bool write_ok;                  /* UART write succeeded */
+    int32_t slack_recv_us;          /* count_us - concentrator time when the PULL_RESP was received */
+    int32_t slack_dispatch_us;      /* count_us - concentrator time when the packet left the JIT queue */
+    int32_t slack_tx_us;            /* count_us - concentrator time when the UART write ended */
+    struct timespec recv_time;      /* PULL_RESP received */
+    struct timespec queued_time;    /* parsed and enqueued in the JIT queue */
+    struct timespec dequeued_time;  /* dequeued by thread_jit */
+    struct timespec write_start;    /* UART write started */
+    struct timespec write_end;      /* UART write ended */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Store the trace of a downlink once it went through jit_enqueue
+@param rec trace filled by thread_down up to queued_time
+*/
+void txtrace_queued(const struct txtrace_rec_s *rec);
+
+/**
+@brief Complete the trace of a downlink written to the MCU
+@param radio SX1276 the packet was dequeued from
+@param count_us TX timestamp of the packet
+@param dequeued_time time the packet left the JIT queue
+@param write_start time the UART write started
+@param write_end time the UART write ended
+@param slack_dispatch_us time left before TX when the packet left the JIT queue
+@param write_ok true if the UART write succeeded
+
+Packets that were not traced when queued (beacons) are ignored.
+*/
+void txtrace_dispatched(int radio, uint32_t count_us, const struct timespec *dequeued_time, const struct timespec *write_start, const struct timespec *write_end, int32_t slack_dispatch_us, bool write_ok);
+
+/**
+@brief Print percentiles of each downlink stage over the records in the ring
+*/
+void txtrace_report(void);
+
+/**
+@brief Print all the records in the ring
+*/
+void txtrace_dump(void);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
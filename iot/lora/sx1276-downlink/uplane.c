@@ -0,0 +1,342 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : uplink priority lanes
+        Queues the uplinks by class and sheds the lower classes first when
+        the backhaul is congested
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+#include <stdlib.h>         /* calloc, free */
+#include <string.h>         /* memset */
+#include <time.h>           /* clock_gettime */
+#include <pthread.h>
+
+#include "trace.h"
+#include "tokenbucket.h"
+#include "protocol.h"
+#include "uplane.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+/* The backhaul is taken as congested after a PUSH_ACK is missed, or when the
+ * smoothed round trip goes well above the lowest one seen. Full lanes are not
+ * a sign of it: a burst of uplinks fills them while the backhaul keeps up, and
+ * smaller datagrams would only drain them slower; the queue bound sheds what
+ * does not fit. Every congested datagram raises the level by one, a
+ * number of good ones in a row lowers it by one. The lowest round trip is the
+ * minimum over the last UPLANE_RTT_WINDOW_S, kept per bucket of
+ * UPLANE_RTT_BUCKET_S, so a lasting change of path becomes the new reference
+ * once the window has moved past the older path, whatever the PUSH_ACK rate. */
+
+#define UPLANE_RTT_FACTOR       2       /* congested beyond that many times the lowest round trip */
+#define UPLANE_RTT_MARGIN_US    50000   /* plus that, jitter on a fast link is not congestion */
+#define UPLANE_CLEAR_NB         8       /* good datagrams in a row to lower the level */
+#define UPLANE_RTT_WINDOW_S     120     /* lowest round trip over that time */
+#define UPLANE_RTT_BUCKET_S     10
+#define UPLANE_RTT_BUCKET_NB    (UPLANE_RTT_WINDOW_S / UPLANE_RTT_BUCKET_S)
+
+struct uplane_slot_s {
+    struct pktbuf_s *pkt;           /* reference held by the lane */
+    int board;
+};
+
+struct uplane_lane_s {
+    struct uplane_slot_s *slot;     /* ring of depth slots */
+    unsigned head;                  /* oldest packet */
+    unsigned nb;
+};
+
+struct uplane_rtt_bucket_s {
+    int64_t epoch;                  /* monotonic seconds / UPLANE_RTT_BUCKET_S, 0 if never used */
+    uint32_t min_us;                /* lowest round trip acknowledged in that bucket */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+static pthread_mutex_t mx_uplane = PTHREAD_MUTEX_INITIALIZER; /* control access to the lanes and statistics */
+
+static struct uplane_lane_s lane[UPLANE_NB];
+static struct uplane_slot_s *slot_pool;
+static unsigned depth;
+static unsigned nb_queued;          /* packets in all lanes */
+
+static unsigned level;
+static unsigned good_nb;            /* good datagrams since the last level change */
+static struct uplane_rtt_bucket_s rtt_bucket[UPLANE_RTT_BUCKET_NB];
+static uint32_t rtt_min_us;
+static uint32_t srtt_us;
+
+static struct tokenbucket_s bucket;
+
+static uint32_t nb_sent[UPLANE_NB];
+static uint32_t nb_shed[UPLANE_NB];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* add a round trip to the window and return the lowest one within it */
+static uint32_t rtt_window_min(uint32_t rtt_us) {
+    struct timespec now;
+    struct uplane_rtt_bucket_s *b;
+    int64_t epoch;
+    uint32_t min_us = rtt_us;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    epoch = (int64_t)now.tv_sec / UPLANE_RTT_BUCKET_S + 1; /* never 0 */
+    b = &rtt_bucket[epoch % UPLANE_RTT_BUCKET_NB];
+    if (b->epoch != epoch) {
+        b->epoch = epoch;
+        b->min_us = rtt_us;
+    } else if (rtt_us < b->min_us) {
+        b->min_us = rtt_us;
+    }
+    for (i = 0; i < UPLANE_RTT_BUCKET_NB; i++) {
+        if ((rtt_bucket[i].epoch > epoch - UPLANE_RTT_BUCKET_NB) && (rtt_bucket[i].min_us < min_us)) {
+            min_us = rtt_bucket[i].min_us;
+        }
+    }
+    return min_us;
+}
+
+/* drop the oldest packet of a lane, it must not be empty */
+static void shed_oldest(enum uplane_class_e cls) {
+    struct uplane_lane_s *l = &lane[cls];
+
+    pktbuf_unref(l->slot[l->head].pkt);
+    l->slot[l->head].pkt = NULL;
+    l->head = (l->head + 1) % depth;
+    l->nb -= 1;
+    nb_queued -= 1;
+    nb_shed[cls] += 1;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int uplane_init(unsigned d, uint32_t rate) {
+    int i;
+
+    if ((d == 0) || (d > UPLANE_DEPTH_MAX)) {
+        MSG(LOG_ERR, "ERROR: [lane] invalid depth %u, max %u\n", d, UPLANE_DEPTH_MAX);
+        return -1;
+    }
+    slot_pool = calloc((size_t)UPLANE_NB * d, sizeof *slot_pool);
+    if (slot_pool == NULL) {
+        MSG(LOG_ERR, "ERROR: [lane] failed to allocate %u slots\n", UPLANE_NB * d);
+        return -1;
+    }
+
+    pthread_mutex_lock(&mx_uplane);
+    depth = d;
+    for (i = 0; i < UPLANE_NB; i++) {
+        lane[i].slot = slot_pool + (size_t)i * d;
+        lane[i].head = 0;
+        lane[i].nb = 0;
+    }
+    nb_queued = 0;
+    level = 0;
+    good_nb = 0;
+    memset(rtt_bucket, 0, sizeof rtt_bucket);
+    rtt_min_us = 0;
+    srtt_us = 0;
+    tokenbucket_init(&bucket, rate);
+    memset(nb_sent, 0, sizeof nb_sent);
+    memset(nb_shed, 0, sizeof nb_shed);
+    pthread_mutex_unlock(&mx_uplane);
+
+    return 0;
+}
+
+void uplane_deinit(void) {
+    int c;
+
+    pthread_mutex_lock(&mx_uplane);
+    for (c = 0; c < UPLANE_NB; c++) {
+        while (lane[c].nb > 0) {
+            pktbuf_unref(lane[c].slot[lane[c].head].pkt);
+            lane[c].head = (lane[c].head + 1) % depth;
+            lane[c].nb -= 1;
+        }
+    }
+    memset(lane, 0, sizeof lane);
+    nb_queued = 0;
+    free(slot_pool);
+    slot_pool = NULL;
+    pthread_mutex_unlock(&mx_uplane);
+}
+
+enum uplane_class_e uplane_class(const struct lgw_pkt_rx_s *p, bool lorawan) {
+    if ((p->status != STAT_CRC_OK) || (p->size == 0)) {
+        return UPLANE_BAD;
+    }
+    if (lorawan == false) {
+        return UPLANE_UNCONFIRMED;
+    }
+    switch (LORAWAN_MTYPE(p->payload)) {
+        case MTYPE_JOIN_REQUEST:
+        case MTYPE_REJOIN_REQUEST:
+            return UPLANE_JOIN;
+        case MTYPE_CONFIRM_DATA_UP:
+            return UPLANE_CONFIRMED;
+        default:
+            return UPLANE_UNCONFIRMED;
+    }
+}
+
+int uplane_push(struct pktbuf_s *buf, int board, enum uplane_class_e cls) {
+    struct uplane_lane_s *l = &lane[cls];
+    struct uplane_slot_s *s;
+    int c;
+
+    pthread_mutex_lock(&mx_uplane);
+
+    /* classes shed by the congestion level */
+    if ((int)cls >= UPLANE_NB - (int)level) {
+        nb_shed[cls] += 1;
+        pthread_mutex_unlock(&mx_uplane);
+        return -1;
+    }
+
+    /* queue full, make room in a lower lane, or in the same one */
+    if (nb_queued >= depth) {
+        for (c = UPLANE_NB - 1; c >= (int)cls; c--) {
+            if (lane[c].nb > 0) {
+                shed_oldest(c);
+                break;
+            }
+        }
+        if (c < (int)cls) {
+            nb_shed[cls] += 1; /* only higher classes are queued */
+            pthread_mutex_unlock(&mx_uplane);
+            return -1;
+        }
+    }
+
+    s = &l->slot[(l->head + l->nb) % depth];
+    s->pkt = pktbuf_ref(buf);
+    s->board = board;
+    l->nb += 1;
+    nb_queued += 1;
+
+    pthread_mutex_unlock(&mx_uplane);
+    return 0;
+}
+
+struct pktbuf_s *uplane_pop(int *board) {
+    struct uplane_lane_s *l;
+    struct pktbuf_s *buf = NULL;
+    int c;
+
+    pthread_mutex_lock(&mx_uplane);
+    for (c = 0; c < UPLANE_NB; c++) {
+        l = &lane[c];
+        if (l->nb > 0) {
+            buf = l->slot[l->head].pkt;
+            *board = l->slot[l->head].board;
+            l->slot[l->head].pkt = NULL;
+            l->head = (l->head + 1) % depth;
+            l->nb -= 1;
+            nb_queued -= 1;
+            nb_sent[c] += 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mx_uplane);
+
+    return buf;
+}
+
+unsigned uplane_count(void) {
+    unsigned nb;
+
+    pthread_mutex_lock(&mx_uplane);
+    nb = nb_queued;
+    pthread_mutex_unlock(&mx_uplane);
+
+    return nb;
+}
+
+int uplane_budget(int max) {
+    int budget;
+
+    pthread_mutex_lock(&mx_uplane);
+    if (tokenbucket_ready(&bucket) == false) {
+        budget = 0;
+    } else {
+        budget = max >> level; /* smaller datagrams while congested */
+        if (budget < 1) {
+            budget = 1;
+        }
+    }
+    pthread_mutex_unlock(&mx_uplane);
+
+    return budget;
+}
+
+void uplane_sent(int nb_byte) {
+    pthread_mutex_lock(&mx_uplane);
+    tokenbucket_take(&bucket, nb_byte);
+    pthread_mutex_unlock(&mx_uplane);
+}
+
+void uplane_ack(bool acked, uint32_t rtt_us) {
+    bool congested;
+
+    pthread_mutex_lock(&mx_uplane);
+    if (acked == true) {
+        rtt_min_us = rtt_window_min(rtt_us);
+        srtt_us = (srtt_us == 0) ? rtt_us : (srtt_us - srtt_us / 8 + rtt_us / 8);
+    }
+    congested = (acked == false) || (srtt_us > UPLANE_RTT_FACTOR * rtt_min_us + UPLANE_RTT_MARGIN_US);
+
+    if (congested == true) {
+        good_nb = 0;
+        if (level < UPLANE_LEVEL_MAX) {
+            level += 1;
+            MSG(LOG_INFO, "INFO: [lane] backhaul congested (srtt %u us, %u queued), level %u\n", srtt_us, nb_queued, level);
+        }
+    } else if (level > 0) {
+        good_nb += 1;
+        if (good_nb >= UPLANE_CLEAR_NB) {
+            good_nb = 0;
+            level -= 1;
+            MSG(LOG_INFO, "INFO: [lane] backhaul congestion easing, level %u\n", level);
+        }
+    }
+    pthread_mutex_unlock(&mx_uplane);
+}
+
+void uplane_stat(struct uplane_stat_s *st) {
+    int c;
+
+    pthread_mutex_lock(&mx_uplane);
+    for (c = 0; c < UPLANE_NB; c++) {
+        st->nb_sent[c] = nb_sent[c];
+        st->nb_shed[c] = nb_shed[c];
+        st->nb_queued[c] = lane[c].nb;
+    }
+    st->level = level;
+    st->srtt_us = srtt_us;
+    memset(nb_sent, 0, sizeof nb_sent);
+    memset(nb_shed, 0, sizeof nb_shed);
+    pthread_mutex_unlock(&mx_uplane);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
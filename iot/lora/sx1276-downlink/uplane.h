@@ -0,0 +1,136 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : uplink priority lanes
+        Queues the uplinks by class and sheds the lower classes first when
+        the backhaul is congested
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+#ifndef _LORA_PKTFWD_UPLANE_H
+#define _LORA_PKTFWD_UPLANE_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>         /* C99 types */
+#include <stdbool.h>        /* bool type */
+
+#include "libloragw/loragw_hal.h"
+#include "pktbuf.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+/* Lanes are served in strict priority order. Queued packets share one bound:
+ * when it is reached the oldest packet of the lowest class below the new one
+ * is dropped. Each congestion level also drops on arrival one more class,
+ * starting from the lowest; joins and confirmed frames are never dropped that
+ * way. */
+
+#define UPLANE_DEFAULT_DEPTH    64      /* packets queued in all lanes */
+#define UPLANE_DEPTH_MAX        4096
+#define UPLANE_LEVEL_MAX        2       /* congestion levels */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum uplane_class_e {
+    UPLANE_JOIN,            /* join and rejoin requests */
+    UPLANE_CONFIRMED,       /* confirmed data */
+    UPLANE_UNCONFIRMED,     /* unconfirmed data, proprietary and non-LoRaWAN frames */
+    UPLANE_BAD,             /* CRC error or no CRC */
+    UPLANE_NB
+};
+
+struct uplane_stat_s {
+    uint32_t nb_sent[UPLANE_NB];    /* packets taken for a datagram */
+    uint32_t nb_shed[UPLANE_NB];    /* packets dropped */
+    uint32_t nb_queued[UPLANE_NB];  /* packets waiting now */
+    unsigned level;                 /* congestion level now */
+    uint32_t srtt_us;               /* smoothed PUSH_ACK round trip */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Allocate the lanes
+@param depth max packets queued in all lanes
+@param rate max bytes per second sent to the server, 0 for no limit
+@return 0 if the lanes are usable, -1 else
+*/
+int uplane_init(unsigned depth, uint32_t rate);
+
+/**
+@brief Free the lanes
+*/
+void uplane_deinit(void);
+
+/**
+@brief Class of an uplink
+@param p received packet
+@param lorawan true if the MType of the frame can be trusted
+*/
+enum uplane_class_e uplane_class(const struct lgw_pkt_rx_s *p, bool lorawan);
+
+/**
+@brief Queue an uplink in the lane of its class
+@param buf received packet, created by pktbuf_rx_new
+@param board concentrator the packet comes from
+@param cls class of the packet, see uplane_class
+@return 0 if it was queued, -1 if it was shed
+
+The lane takes a reference of its own, the caller keeps its reference.
+*/
+int uplane_push(struct pktbuf_s *buf, int board, enum uplane_class_e cls);
+
+/**
+@brief Take the next uplink to send, highest class first
+@param board set to the concentrator the packet comes from
+@return the packet, released by the caller with pktbuf_unref, NULL if the lanes are empty
+*/
+struct pktbuf_s *uplane_pop(int *board);
+
+/**
+@brief Number of packets queued in all lanes
+*/
+unsigned uplane_count(void);
+
+/**
+@brief Max number of packets to put in the next datagram
+@param max datagram capacity
+@return packets allowed now, 0 if the byte rate is exhausted
+*/
+int uplane_budget(int max);
+
+/**
+@brief Record a datagram sent to the server
+@param nb_byte datagram size
+*/
+void uplane_sent(int nb_byte);
+
+/**
+@brief Update the congestion level after waiting for a PUSH_ACK
+@param acked true if the PUSH_ACK was received
+@param rtt_us round trip of the datagram, ignored if not acked
+*/
+void uplane_ack(bool acked, uint32_t rtt_us);
+
+/**
+@brief Get the lane statistics, counters since the last call
+@param st pointer to the structure to be filled
+*/
+void uplane_stat(struct uplane_stat_s *st);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */